@@ -1,8 +1,15 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <string>
 
+/**
+ * Immutable, NUL-terminated UTF-8 encoded string.
+ *
+ * The bytes are owned by the string. chars() iterates over Unicode code
+ * points, bytes() over the raw encoding.
+ */
 class Utf8String {
 private:
 	size_t size_;
@@ -10,7 +17,6 @@ private:
 
 public:
 	class iterator;
-	class byte_iterator;
 
 	struct ByteView;
 	struct CharView;
@@ -18,7 +24,8 @@ public:
 	Utf8String();
 	Utf8String(const uint8_t* bytes, size_t size);
 	Utf8String(const char* cstring);
-	Utf8String(const Utf8String&& v);
+	Utf8String(const Utf8String& v);
+	Utf8String(Utf8String&& v);
 	~Utf8String();
 
 	Utf8String& operator=(const Utf8String& v);
@@ -27,107 +34,189 @@ public:
 	bool empty() const { return size_ == 0; }
 	size_t size() const { return size_; }
 	const uint8_t* data() const { return data_; }
-	operator const char* () const { return data_; }
 
-	const char* c_str() const { return data(); }
-	std::string to_s() const { return std::string(data_, size_); }
+	const char* c_str() const { return data_ ? (const char*) data_ : ""; }
+	std::string to_s() const { return std::string(c_str(), size_); }
 
-	CharView chars();
-	ByteView bytes();
+	//! Number of code points.
+	size_t length() const;
+
+	bool equals(const char* s, size_t n) const { return size_ == n && (n == 0 || memcmp(data_, s, n) == 0); }
+	bool operator==(const Utf8String& v) const { return equals(v.c_str(), v.size_); }
+	bool operator!=(const Utf8String& v) const { return !(*this == v); }
+
+	CharView chars() const;
+	ByteView bytes() const;
 
 private:
 	void release();
 	static uint8_t* dup(const uint8_t* bytes, size_t n);
 };
 
+//! Iterates over the code points of a UTF-8 string, yielding U+FFFD on malformed input.
+class Utf8String::iterator {
+private:
+	const uint8_t* current_;
+	const uint8_t* end_;
+
+public:
+	iterator(const uint8_t* current, const uint8_t* end) : current_(current), end_(end) {}
+
+	char32_t operator*() const;
+	iterator& operator++() { current_ += sequenceLength(); return *this; }
+
+	bool operator==(const iterator& v) const { return current_ == v.current_; }
+	bool operator!=(const iterator& v) const { return current_ != v.current_; }
+
+private:
+	size_t sequenceLength() const;
+};
+
 struct Utf8String::ByteView {
-	char* begin_;
-	char* end_;
+	const uint8_t* begin_;
+	const uint8_t* end_;
 
-	ByteView(Utf8String* s) :
-		begin_(s.data_),
-		end_(s.data_ + s.size_)
+	explicit ByteView(const Utf8String* s) :
+		begin_(s->data_),
+		end_(s->data_ + s->size_)
 	{}
 
-	char* begin() { return begin_; }
-	char* end() { return end_; }
+	const uint8_t* begin() const { return begin_; }
+	const uint8_t* end() const { return end_; }
 };
 
 struct Utf8String::CharView {
-	Utf8String* s;
+	const Utf8String* s;
 
-	class iterator {
-		uint8_t* current;
-		uint8_t* end;
+	explicit CharView(const Utf8String* _s) : s(_s) {}
 
-		iterator& operator++();
-	};
-
-	CharView(Utf8String* _s) : s(_s) {}
-
-	iterator begin() { return iterator({s.data(), s.data() + s.size()}); }
-	iterator end() { return iterator({s.data() + s.size(), s.data() + s.size()}); }
+	iterator begin() const { return iterator(s->data_, s->data_ + s->size_); }
+	iterator end() const { return iterator(s->data_ + s->size_, s->data_ + s->size_); }
 };
 
-inline auto Utf8String::CharView::iterator::operator++() -> iterator&
+// {{{ Utf8String::iterator
+inline size_t Utf8String::iterator::sequenceLength() const
 {
-	// TODO
+	uint8_t ch = *current_;
+	size_t n = ch < 0x80 ? 1 : ch < 0xC0 ? 1 : ch < 0xE0 ? 2 : ch < 0xF0 ? 3 : ch < 0xF8 ? 4 : 1;
 
-	if (current != end)
-		++current;
+	if (n > (size_t) (end_ - current_))
+		return end_ - current_;
 
-	return *this;
+	for (size_t i = 1; i < n; ++i)
+		if ((current_[i] & 0xC0) != 0x80)
+			return i;
+
+	return n;
+}
+
+inline char32_t Utf8String::iterator::operator*() const
+{
+	uint8_t ch = *current_;
+	size_t n = sequenceLength();
+
+	switch (n) {
+		case 1:
+			return ch < 0x80 ? ch : 0xFFFD;
+		case 2:
+			return ch >= 0xC0 && ch < 0xE0 ? ((ch & 0x1F) << 6) | (current_[1] & 0x3F) : 0xFFFD;
+		case 3:
+			return ch >= 0xE0 && ch < 0xF0
+				? ((ch & 0x0F) << 12) | ((current_[1] & 0x3F) << 6) | (current_[2] & 0x3F)
+				: 0xFFFD;
+		case 4:
+			return ((ch & 0x07) << 18) | ((current_[1] & 0x3F) << 12) | ((current_[2] & 0x3F) << 6) | (current_[3] & 0x3F);
+		default:
+			return 0xFFFD;
+	}
 }
+// }}}
 
-// {{{
-Utf8String::Utf8String() :
+// {{{ Utf8String
+inline Utf8String::Utf8String() :
 	size_(0),
 	data_(nullptr)
 {
 }
 
-Utf8String::Utf8String(const uint8_t* bytes, size_t size) :
+inline Utf8String::Utf8String(const uint8_t* bytes, size_t size) :
 	size_(size),
 	data_(dup(bytes, size))
 {
 }
 
-Utf8String::Utf8String(const char* cstring) :
+inline Utf8String::Utf8String(const char* cstring) :
 	size_(strlen(cstring)),
-	data_(dup(v.data_, size_))
+	data_(dup((const uint8_t*) cstring, size_))
 {
 }
 
-Utf8String::Utf8String(const Utf8String&& v) :
+inline Utf8String::Utf8String(const Utf8String& v) :
 	size_(v.size_),
-	data_(dup(v.data_, v.size_))
+	data_(v.data_ ? dup(v.data_, v.size_) : nullptr)
 {
 }
 
-Utf8String::~Utf8String()
+inline Utf8String::Utf8String(Utf8String&& v) :
+	size_(v.size_),
+	data_(v.data_)
 {
-	delete[] data_;
+	v.size_ = 0;
+	v.data_ = nullptr;
+}
+
+inline Utf8String::~Utf8String()
+{
+	release();
 }
 
-Utf8String& Utf8String::operator=(const Utf8String& v)
+inline Utf8String& Utf8String::operator=(const Utf8String& v)
 {
+	if (this != &v) {
+		uint8_t* data = v.data_ ? dup(v.data_, v.size_) : nullptr;
+		release();
+		data_ = data;
+		size_ = v.size_;
+	}
+
 	return *this;
 }
 
-Utf8String& Utf8String::operator=(Utf8String&& v)
+inline Utf8String& Utf8String::operator=(Utf8String&& v)
 {
-	release();
+	if (this != &v) {
+		release();
 
-	data_ = v.data_;
-	v.data_ = nullptr;
+		data_ = v.data_;
+		v.data_ = nullptr;
 
-	size_ = v.size_;
-	v.size_ = 0;
+		size_ = v.size_;
+		v.size_ = 0;
+	}
 
 	return *this;
 }
 
-uint8_t* Utf8String::dup(const uint8_t* bytes, size_t n)
+inline size_t Utf8String::length() const
+{
+	size_t n = 0;
+	for (auto i = chars().begin(), e = chars().end(); i != e; ++i)
+		++n;
+
+	return n;
+}
+
+inline Utf8String::CharView Utf8String::chars() const
+{
+	return CharView(this);
+}
+
+inline Utf8String::ByteView Utf8String::bytes() const
+{
+	return ByteView(this);
+}
+
+inline uint8_t* Utf8String::dup(const uint8_t* bytes, size_t n)
 {
 	uint8_t* v = new uint8_t[n + 1];
 	memcpy(v, bytes, n);
@@ -135,8 +224,10 @@ uint8_t* Utf8String::dup(const uint8_t* bytes, size_t n)
 	return v;
 }
 
-void Utf8String::release()
+inline void Utf8String::release()
 {
 	delete[] data_;
+	data_ = nullptr;
+	size_ = 0;
 }
 // }}}
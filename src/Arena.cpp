@@ -0,0 +1,69 @@
+#include "Arena.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+static const size_t MIN_CHUNK_SIZE = 4096;
+static const size_t MAX_CHUNK_SIZE = 256 * 1024;
+
+Arena::Arena() :
+	chunks_(nullptr),
+	current_(nullptr),
+	end_(nullptr),
+	cleanups_(nullptr),
+	bytesAllocated_(0),
+	bytesReserved_(0)
+{
+}
+
+Arena::~Arena()
+{
+	release();
+}
+
+void* Arena::allocateSlow(size_t size, size_t alignment)
+{
+	// chunks grow with the arena, so large classes need few of them
+	size_t chunkSize = std::min(std::max(MIN_CHUNK_SIZE, bytesReserved_), MAX_CHUNK_SIZE);
+	chunkSize = std::max(chunkSize, sizeof(Chunk) + size + alignment);
+
+	Chunk* chunk = (Chunk*) malloc(chunkSize);
+	if (!chunk)
+		throw std::bad_alloc();
+
+	chunk->next = chunks_;
+	chunk->size = chunkSize;
+	chunks_ = chunk;
+	bytesReserved_ += chunkSize;
+
+	current_ = (uint8_t*) (chunk + 1);
+	end_ = (uint8_t*) chunk + chunkSize;
+
+	return allocate(size, alignment);
+}
+
+void Arena::addCleanup(void (*destroy)(void*), void* object)
+{
+	Cleanup* cleanup = (Cleanup*) allocate(sizeof(Cleanup), alignof(Cleanup));
+	cleanup->next = cleanups_;
+	cleanup->destroy = destroy;
+	cleanup->object = object;
+	cleanups_ = cleanup;
+}
+
+void Arena::release()
+{
+	for (Cleanup* cleanup = cleanups_; cleanup; cleanup = cleanup->next)
+		cleanup->destroy(cleanup->object);
+
+	while (Chunk* chunk = chunks_) {
+		chunks_ = chunk->next;
+		free(chunk);
+	}
+
+	current_ = nullptr;
+	end_ = nullptr;
+	cleanups_ = nullptr;
+	bytesAllocated_ = 0;
+	bytesReserved_ = 0;
+}
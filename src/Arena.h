@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+/**
+ * Bump-pointer allocator for metadata sharing a common lifetime.
+ *
+ * Memory is carved out of chunks of growing size and only ever released
+ * in bulk, when the arena gets destroyed or release()d. Objects that are
+ * not trivially destructible get their destructors run at that point.
+ *
+ * An arena is not thread-safe.
+ */
+class Arena {
+private:
+	struct Chunk {
+		Chunk* next;
+		size_t size;
+	};
+
+	struct Cleanup {
+		Cleanup* next;
+		void (*destroy)(void*);
+		void* object;
+	};
+
+	Chunk* chunks_;
+	uint8_t* current_;
+	uint8_t* end_;
+	Cleanup* cleanups_;
+
+	size_t bytesAllocated_;
+	size_t bytesReserved_;
+
+public:
+	Arena();
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	void* allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+		uint8_t* p = (uint8_t*) (((uintptr_t) current_ + alignment - 1) & ~(uintptr_t) (alignment - 1));
+		if (p + size > end_ || !current_)
+			return allocateSlow(size, alignment);
+
+		current_ = p + size;
+		bytesAllocated_ += size;
+		return p;
+	}
+
+	template<typename T, typename... Args>
+	T* construct(Args&&... args) {
+		T* object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		if (!std::is_trivially_destructible<T>::value)
+			addCleanup(&Arena::destroy<T>, object);
+		return object;
+	}
+
+	//! Allocates an uninitialized array of trivially destructible objects.
+	template<typename T>
+	T* allocateArray(size_t n) {
+		static_assert(std::is_trivially_destructible<T>::value, "arena arrays must be trivially destructible");
+		return n ? (T*) allocate(sizeof(T) * n, alignof(T)) : nullptr;
+	}
+
+	//! Frees all memory at once, running pending destructors.
+	void release();
+
+	//! number of bytes handed out to callers
+	size_t bytesAllocated() const { return bytesAllocated_; }
+
+	//! number of bytes reserved from the system, including slack
+	size_t bytesReserved() const { return bytesReserved_; }
+
+private:
+	void* allocateSlow(size_t size, size_t alignment);
+	void addCleanup(void (*destroy)(void*), void* object);
+
+	template<typename T>
+	static void destroy(void* object) { ((T*) object)->~T(); }
+};
@@ -0,0 +1,572 @@
+#include "BaselineCompiler.h"
+#include "Class.h"
+#include "CodeCache.h"
+#include "CompiledMethod.h"
+#include "ClassHierarchy.h"
+#include "ConstantPool.h"
+#include "Interpreter.h"
+#include "JObject.h"
+#include "MethodProfile.h"
+#include "QuickCode.h"
+#include "Symbol.h"
+#include "VMClassLoader.h"
+#include "X86Assembler.h"
+#include "X86Templates.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+
+static const uint16_t UnknownDepth = UINT16_MAX;
+
+// {{{ stack effects
+//! Argument and return slots of method \p descriptor, without the receiver.
+static void descriptorSlots(const char* s, int& arguments, int& returns)
+{
+	arguments = 0;
+	if (*s == '(')
+		++s;
+
+	while (*s && *s != ')') {
+		char type = *s;
+		while (*s == '[')
+			++s;
+		if (*s == 'L')
+			while (*s && *s != ';')
+				++s;
+		arguments += type == 'J' || type == 'D' ? 2 : 1;
+		if (*s)
+			++s;
+	}
+
+	char type = *s ? s[1] : 'V';
+	returns = type == 'V' ? 0 : type == 'J' || type == 'D' ? 2 : 1;
+}
+
+//! Net stack effect of \p insn, executing as \p op, in slots, or INT_MIN if unknown.
+static int stackEffect(const Instruction& insn, Opcode op, const QuickCode* quick, const ConstantPool& pool)
+{
+	switch (op) {
+		case Opcode::nop: case Opcode::iinc: case Opcode::goto_: case Opcode::swap:
+		case Opcode::laload: case Opcode::daload:
+		case Opcode::ineg: case Opcode::lneg: case Opcode::fneg: case Opcode::dneg:
+		case Opcode::i2f: case Opcode::l2d: case Opcode::f2i: case Opcode::d2l:
+		case Opcode::i2b: case Opcode::i2c: case Opcode::i2s:
+		case Opcode::arraylength: case Opcode::newarray: case Opcode::anewarray:
+		case Opcode::checkcast: case Opcode::instanceof:
+		case Opcode::checkcast_quick: case Opcode::instanceof_quick:
+		case Opcode::getfield_z: case Opcode::getfield_b: case Opcode::getfield_c: case Opcode::getfield_s:
+		case Opcode::getfield_i: case Opcode::getfield_a:
+		case Opcode::return_:
+			return 0;
+
+		case Opcode::aconst_null: case Opcode::iconst_m1: case Opcode::iconst_0: case Opcode::iconst_1:
+		case Opcode::iconst_2: case Opcode::iconst_3: case Opcode::iconst_4: case Opcode::iconst_5:
+		case Opcode::fconst_0: case Opcode::fconst_1: case Opcode::fconst_2:
+		case Opcode::bipush: case Opcode::sipush: case Opcode::ldc: case Opcode::ldc_w:
+		case Opcode::ldc_int: case Opcode::ldc_quick:
+		case Opcode::iload: case Opcode::fload: case Opcode::aload:
+		case Opcode::iload_0: case Opcode::iload_1: case Opcode::iload_2: case Opcode::iload_3:
+		case Opcode::fload_0: case Opcode::fload_1: case Opcode::fload_2: case Opcode::fload_3:
+		case Opcode::aload_0: case Opcode::aload_1: case Opcode::aload_2: case Opcode::aload_3:
+		case Opcode::dup: case Opcode::dup_x1: case Opcode::dup_x2:
+		case Opcode::new_: case Opcode::new_quick:
+		case Opcode::i2l: case Opcode::i2d: case Opcode::f2l: case Opcode::f2d:
+		case Opcode::getfield_j:
+		case Opcode::getstatic_z: case Opcode::getstatic_b: case Opcode::getstatic_c: case Opcode::getstatic_s:
+		case Opcode::getstatic_i: case Opcode::getstatic_a:
+			return 1;
+
+		case Opcode::lconst_0: case Opcode::lconst_1: case Opcode::dconst_0: case Opcode::dconst_1:
+		case Opcode::ldc2_w: case Opcode::lload: case Opcode::dload:
+		case Opcode::lload_0: case Opcode::lload_1: case Opcode::lload_2: case Opcode::lload_3:
+		case Opcode::dload_0: case Opcode::dload_1: case Opcode::dload_2: case Opcode::dload_3:
+		case Opcode::dup2: case Opcode::dup2_x1: case Opcode::dup2_x2:
+		case Opcode::getstatic_j:
+			return 2;
+
+		case Opcode::istore: case Opcode::fstore: case Opcode::astore:
+		case Opcode::istore_0: case Opcode::istore_1: case Opcode::istore_2: case Opcode::istore_3:
+		case Opcode::fstore_0: case Opcode::fstore_1: case Opcode::fstore_2: case Opcode::fstore_3:
+		case Opcode::astore_0: case Opcode::astore_1: case Opcode::astore_2: case Opcode::astore_3:
+		case Opcode::pop:
+		case Opcode::iaload: case Opcode::faload: case Opcode::aaload:
+		case Opcode::baload: case Opcode::caload: case Opcode::saload:
+		case Opcode::iadd: case Opcode::isub: case Opcode::imul: case Opcode::idiv: case Opcode::irem:
+		case Opcode::ishl: case Opcode::ishr: case Opcode::iushr: case Opcode::iand: case Opcode::ior: case Opcode::ixor:
+		case Opcode::fadd: case Opcode::fsub: case Opcode::fmul: case Opcode::fdiv: case Opcode::frem:
+		case Opcode::lshl: case Opcode::lshr: case Opcode::lushr:
+		case Opcode::l2i: case Opcode::l2f: case Opcode::d2i: case Opcode::d2f:
+		case Opcode::fcmpl: case Opcode::fcmpg:
+		case Opcode::ifeq: case Opcode::ifne: case Opcode::iflt: case Opcode::ifge: case Opcode::ifgt: case Opcode::ifle:
+		case Opcode::ifnull: case Opcode::ifnonnull:
+		case Opcode::tableswitch: case Opcode::lookupswitch:
+		case Opcode::ireturn: case Opcode::freturn: case Opcode::areturn: case Opcode::athrow:
+		case Opcode::monitorenter: case Opcode::monitorexit:
+		case Opcode::putstatic_z: case Opcode::putstatic_b: case Opcode::putstatic_s:
+		case Opcode::putstatic_i: case Opcode::putstatic_a:
+			return -1;
+
+		case Opcode::lstore: case Opcode::dstore:
+		case Opcode::lstore_0: case Opcode::lstore_1: case Opcode::lstore_2: case Opcode::lstore_3:
+		case Opcode::dstore_0: case Opcode::dstore_1: case Opcode::dstore_2: case Opcode::dstore_3:
+		case Opcode::pop2:
+		case Opcode::ladd: case Opcode::lsub: case Opcode::lmul: case Opcode::ldiv: case Opcode::lrem:
+		case Opcode::land: case Opcode::lor: case Opcode::lxor:
+		case Opcode::dadd: case Opcode::dsub: case Opcode::dmul: case Opcode::ddiv: case Opcode::drem:
+		case Opcode::if_icmpeq: case Opcode::if_icmpne: case Opcode::if_icmplt: case Opcode::if_icmpge:
+		case Opcode::if_icmpgt: case Opcode::if_icmple: case Opcode::if_acmpeq: case Opcode::if_acmpne:
+		case Opcode::lreturn: case Opcode::dreturn:
+		case Opcode::putfield_z: case Opcode::putfield_b: case Opcode::putfield_s:
+		case Opcode::putfield_i: case Opcode::putfield_a:
+		case Opcode::putstatic_j:
+			return -2;
+
+		case Opcode::iastore: case Opcode::fastore: case Opcode::aastore:
+		case Opcode::bastore: case Opcode::castore: case Opcode::sastore:
+		case Opcode::lcmp: case Opcode::dcmpl: case Opcode::dcmpg:
+		case Opcode::putfield_j:
+			return -3;
+
+		case Opcode::lastore: case Opcode::dastore:
+			return -4;
+
+		case Opcode::getstatic: case Opcode::putstatic: case Opcode::getfield: case Opcode::putfield: {
+			const ConstantUtf8* descriptor = pool.memberDescriptor(insn.index);
+			if (!descriptor)
+				return INT_MIN;
+			char type = descriptor->c_str()[0];
+			int slots = type == 'J' || type == 'D' ? 2 : 1;
+			switch (op) {
+				case Opcode::getstatic: return slots;
+				case Opcode::putstatic: return -slots;
+				case Opcode::getfield: return slots - 1;
+				default: return -slots - 1;
+			}
+		}
+
+		case Opcode::invokevirtual: case Opcode::invokespecial: case Opcode::invokestatic: case Opcode::invokeinterface: {
+			const ConstantUtf8* descriptor = pool.memberDescriptor(insn.index);
+			if (!descriptor)
+				return INT_MIN;
+			int arguments, returns;
+			descriptorSlots(descriptor->c_str(), arguments, returns);
+			return returns - arguments - (op == Opcode::invokestatic ? 0 : 1);
+		}
+		case Opcode::invokevirtual_mono: case Opcode::invokevirtual_poly: case Opcode::invokevirtual_mega:
+		case Opcode::invokeinterface_mono: case Opcode::invokeinterface_poly: case Opcode::invokeinterface_mega: {
+			const CallSite* site = quick->callSite(insn.operand);
+			return site->method->returnSlots() - site->argumentSlots;
+		}
+		case Opcode::invokespecial_quick: case Opcode::invokestatic_quick:
+			return insn.resolved.method->returnSlots() - insn.resolved.method->argumentSlots();
+
+		case Opcode::multianewarray:
+			return 1 - insn.operand;
+
+		default:
+			// jsr, ret, invokedynamic
+			return INT_MIN;
+	}
+}
+
+//! Stack depths by abstract interpretation, with UnknownDepth for unreachable instructions.
+static bool analyze(Method* method, QuickCode* quick, std::vector<uint16_t>& depths)
+{
+	const ConstantPool& pool = method->thisClass()->constantPool;
+	uint32_t size = quick->size();
+	int maxStack = method->maxStack();
+	std::vector<uint32_t> work;
+
+	depths.assign(size, UnknownDepth);
+
+	auto reach = [&](int64_t index, int depth) -> bool {
+		if (index < 0 || index >= size || depth < 0 || depth > maxStack)
+			return false;
+		if (depths[index] == UnknownDepth) {
+			depths[index] = depth;
+			work.push_back(index);
+			return true;
+		}
+		return depths[index] == depth;
+	};
+
+	if (!reach(0, 0))
+		return false;
+
+	for (const Method::ExceptionHandler& handler: method->exceptionTable()) {
+		Instruction* insn = quick->at(handler.handler);
+		if (!insn || !reach(insn - quick->instructions(), 1))
+			return false;
+	}
+
+	while (!work.empty()) {
+		uint32_t i = work.back();
+		work.pop_back();
+
+		// quickening does not change an instruction's stack effect, so a race with it is harmless
+		const Instruction& insn = quick->instructions()[i];
+		Opcode op = (Opcode) __atomic_load_n(&insn.opcode, __ATOMIC_ACQUIRE);
+		int effect = stackEffect(insn, op, quick, pool);
+		if (effect == INT_MIN)
+			return false;
+
+		int depth = depths[i] + effect;
+		switch (op) {
+			case Opcode::goto_:
+				if (!reach(insn.operand, depth))
+					return false;
+				break;
+			case Opcode::tableswitch: {
+				const int32_t* table = quick->switchTable(insn.operand);
+				if (!reach(table[0], depth))
+					return false;
+				for (int64_t k = 0; k <= (int64_t) table[2] - table[1]; ++k)
+					if (!reach(table[3 + k], depth))
+						return false;
+				break;
+			}
+			case Opcode::lookupswitch: {
+				const int32_t* table = quick->switchTable(insn.operand);
+				if (!reach(table[0], depth))
+					return false;
+				for (int32_t k = 0; k < table[1]; ++k)
+					if (!reach(table[3 + 2 * k], depth))
+						return false;
+				break;
+			}
+			case Opcode::ireturn: case Opcode::lreturn: case Opcode::freturn: case Opcode::dreturn:
+			case Opcode::areturn: case Opcode::return_: case Opcode::athrow:
+				break;
+			default:
+				if (X86Templates::isConditionalBranch(op) && !reach(insn.operand, depth))
+					return false;
+				if (!reach(i + 1, depth))
+					return false;
+				break;
+		}
+	}
+
+	return true;
+}
+
+bool BaselineCompiler::computeStackDepths(Method* method, QuickCode* quick, std::vector<uint16_t>& depths)
+{
+	if (!analyze(method, quick, depths))
+		return false;
+
+	for (uint16_t& depth: depths)
+		if (depth == UnknownDepth)
+			depth = 0;
+
+	return true;
+}
+// }}}
+
+// {{{ code generation
+namespace {
+
+class Codegen {
+private:
+	X86Assembler as_;
+	X86Templates templates_;
+	Method* method_;
+	QuickCode* quick_;
+	const ClassHierarchy& hierarchy_;
+	const std::vector<uint16_t>& depths_;
+	std::vector<size_t> labels_;  //!< per instruction
+	std::vector<size_t> exits_;   //!< per instruction, or SIZE_MAX
+	std::vector<size_t> stepExits_; //!< per instruction, or SIZE_MAX
+	std::vector<size_t> osr_;     //!< entry per loop
+	std::vector<size_t> traps_;   //!< per safepoint
+	DebugInfo debugInfo_;
+	std::vector<Dependency> dependencies_;  //!< of devirtualized calls
+	size_t epilogue_;
+	size_t dispatch_;
+	size_t resume_;
+	size_t table_;
+
+public:
+	Codegen(const X86Templates::Runtime& runtime, Method* method, QuickCode* quick, const ClassHierarchy& hierarchy,
+	        const std::vector<uint16_t>& depths) :
+		as_(), templates_(as_, runtime), method_(method), quick_(quick), hierarchy_(hierarchy), depths_(depths),
+		labels_(), exits_(quick->size(), SIZE_MAX), stepExits_(quick->size(), SIZE_MAX), osr_(), traps_(), debugInfo_(),
+		dependencies_(), epilogue_(as_.label()), dispatch_(as_.label()), resume_(as_.label()), table_(as_.label())
+	{
+		for (uint32_t i = 0; i < quick->size(); ++i)
+			labels_.push_back(as_.label());
+		for (uint32_t i = 0; i < quick->loopCount(); ++i)
+			osr_.push_back(as_.label());
+	}
+
+	const std::vector<uint8_t>& generate();
+
+	//! Code offsets of the loop entries, once generated.
+	std::vector<uint32_t> osrEntries() const {
+		std::vector<uint32_t> offsets;
+		for (size_t label: osr_)
+			offsets.push_back(as_.offset(label));
+		return offsets;
+	}
+
+	//! Safepoints of the uncommon traps, once generated.
+	DebugInfo& debugInfo() { return debugInfo_; }
+
+	//! Assumptions about the class hierarchy the code relies on.
+	const std::vector<Dependency>& dependencies() const { return dependencies_; }
+
+private:
+	void prologue();
+	void instruction(uint32_t i);
+	void loopEntries();
+	void epilogue();
+
+	//! Exit to the interpreter at instruction \p i.
+	size_t exit(uint32_t i) {
+		if (exits_[i] == SIZE_MAX)
+			exits_[i] = as_.label();
+		return exits_[i];
+	}
+
+	//! Exit after Interpreter::jitStep() at instruction \p i failed, or deoptimized.
+	size_t stepExit(uint32_t i) {
+		exit(i);
+		if (stepExits_[i] == SIZE_MAX)
+			stepExits_[i] = as_.label();
+		return stepExits_[i];
+	}
+
+	/**
+	 * Uncommon trap of conditional branch \p i, continuing in the
+	 * interpreter at its target.
+	 */
+	size_t trap(uint32_t i, Opcode op, int32_t target);
+
+	//! Runs the instruction via Interpreter::jitStep().
+	void step(uint32_t i, const Instruction& insn, bool branches);
+
+	//! Runs invoke \p insn with a call site, calling its only possible target directly if there is one.
+	void invoke(uint32_t i, const Instruction& insn);
+};
+
+const std::vector<uint8_t>& Codegen::generate()
+{
+	prologue();
+
+	for (uint32_t i = 0; i < quick_->size(); ++i) {
+		as_.bind(labels_[i]);
+		if (depths_[i] == UnknownDepth)
+			as_.jmp(exit(i));
+		else
+			instruction(i);
+	}
+
+	loopEntries();
+	epilogue();
+	return as_.finish();
+}
+
+void Codegen::prologue()
+{
+	templates_.prologue();
+
+	// resume at the frame's pc, unless at the method's start
+	as_.mov(true, Reg::rax, mem(X86Templates::FrameRecord, templates_.runtime().pcOffset));
+	as_.sub(true, Reg::rax, mem(X86Templates::FrameRecord, templates_.runtime().codeOffset));
+	as_.jcc(Cond::ne, resume_);
+}
+
+void Codegen::loopEntries()
+{
+	// a prologue of their own, going straight to the header rather than through the dispatch
+	for (uint32_t i = 0; i < osr_.size(); ++i) {
+		as_.bind(osr_[i]);
+		templates_.prologue();
+		as_.jmp(labels_[quick_->loop(i)->header]);
+	}
+}
+
+size_t Codegen::trap(uint32_t i, Opcode op, int32_t target)
+{
+	// the frame's slots as they are, past the branch's operands
+	DebugScope scope = {method_, (uint32_t) target, {}, {}};
+	size_t localCount = std::max<size_t>(method_->maxLocals(), method_->argumentSlots());
+	for (size_t k = 0; k < localCount; ++k)
+		scope.locals.push_back(ValueLocation::local(k));
+	for (int k = 0; k < depths_[i] - X86Templates::branchOperands(op); ++k)
+		scope.stack.push_back(ValueLocation::stack(k));
+
+	Safepoint safepoint = {0, i, {}};
+	safepoint.scopes.push_back(std::move(scope));
+	debugInfo_.add(std::move(safepoint));
+
+	traps_.push_back(as_.label());
+	return traps_.back();
+}
+
+void Codegen::epilogue()
+{
+	as_.bind(epilogue_);
+	templates_.epilogue();
+
+	for (uint32_t i = 0; i < exits_.size(); ++i) {
+		if (exits_[i] == SIZE_MAX)
+			continue;
+		if (stepExits_[i] != SIZE_MAX) {
+			// deoptimization already set up the frame
+			as_.bind(stepExits_[i]);
+			as_.cmp(false, Reg::rax, CompiledMethod::Deoptimized);
+			as_.jcc(Cond::e, epilogue_);
+		}
+		as_.bind(exits_[i]);
+		as_.mov(Reg::rax, (int64_t) i);
+		as_.jmp(epilogue_);
+	}
+
+	for (uint32_t id = 0; id < traps_.size(); ++id) {
+		as_.bind(traps_[id]);
+		templates_.trap(id);
+		debugInfo_.at(id).codeOffset = as_.size();
+		as_.jmp(epilogue_);
+	}
+
+	// from a byte offset into the instructions
+	static_assert(sizeof(Instruction) == 16, "resuming assumes 16-byte instructions");
+	as_.bind(resume_);
+	as_.shr(true, Reg::rax, 4);
+
+	// to the instruction indexed by eax
+	as_.bind(dispatch_);
+	as_.mov(false, Reg::rax, Reg::rax);
+	as_.lea(Reg::rcx, table_);
+	as_.movsxd(Reg::rax, mem(Reg::rcx, Reg::rax, 4));
+	as_.add(true, Reg::rax, Reg::rcx);
+	as_.jmp(Reg::rax);
+
+	while (as_.size() % 4)
+		as_.int3();
+	as_.bind(table_);
+	for (size_t label: labels_)
+		as_.offset32(label, table_);
+}
+
+void Codegen::step(uint32_t i, const Instruction& insn, bool branches)
+{
+	templates_.step(insn, depths_[i]);
+	as_.test(false, Reg::rax, Reg::rax);
+	as_.jcc(Cond::s, stepExit(i));
+	if (branches)
+		as_.jmp(dispatch_);
+}
+
+void Codegen::invoke(uint32_t i, const Instruction& insn)
+{
+	Dependency dependency;
+	Method* callee = hierarchy_.uniqueTarget(quick_->callSite(insn.operand)->method, dependency);
+	if (!callee) {
+		step(i, insn, false);
+		return;
+	}
+
+	dependencies_.push_back(dependency);
+	templates_.invoke(insn, depths_[i], callee);
+	as_.test(false, Reg::rax, Reg::rax);
+	as_.jcc(Cond::s, stepExit(i));
+}
+
+void Codegen::instruction(uint32_t i)
+{
+	const Instruction& insn = quick_->instructions()[i];
+	Opcode op = (Opcode) __atomic_load_n(&insn.opcode, __ATOMIC_ACQUIRE);
+	int d = depths_[i];
+
+	if (X86Templates::isConditionalBranch(op)) {
+		// leaves out branches that have never been taken, as far as profiled
+		const BranchProfile& profile = insn.resolved.branch;
+		bool cold = __atomic_load_n(&profile.taken, __ATOMIC_RELAXED) == 0 &&
+			__atomic_load_n(&profile.notTaken, __ATOMIC_RELAXED) >= BaselineCompiler::ColdBranchSamples;
+		as_.jcc(templates_.compare(op, d), cold ? trap(i, op, insn.operand) : labels_[insn.operand]);
+		return;
+	}
+
+	switch (op) {
+		case Opcode::goto_:
+			as_.jmp(labels_[insn.operand]);
+			break;
+		case Opcode::tableswitch: case Opcode::lookupswitch:
+			step(i, insn, true);
+			break;
+
+		// returns, with the value moved to the bottom of the stack
+		case Opcode::ireturn: case Opcode::freturn: case Opcode::areturn:
+		case Opcode::lreturn: case Opcode::dreturn: case Opcode::return_: {
+			int slots = op == Opcode::return_ ? 0 : op == Opcode::lreturn || op == Opcode::dreturn ? 2 : 1;
+			if (slots && d != slots) {
+				as_.mov(true, Reg::rax, X86Templates::slot(d - slots));
+				as_.mov(true, X86Templates::slot(0), Reg::rax);
+			}
+			as_.mov(Reg::rax, (int64_t) CompiledMethod::Returned);
+			as_.jmp(epilogue_);
+			break;
+		}
+
+		case Opcode::athrow:
+			step(i, insn, false);
+			as_.jmp(exit(i));
+			break;
+
+		case Opcode::invokevirtual_mono: case Opcode::invokevirtual_poly: case Opcode::invokevirtual_mega:
+		case Opcode::invokeinterface_mono: case Opcode::invokeinterface_poly: case Opcode::invokeinterface_mega:
+			invoke(i, insn);
+			break;
+
+		default:
+			if (!templates_.emit(insn, op, d, [this, i]() { return exit(i); }))
+				step(i, insn, false);
+			break;
+	}
+}
+
+} // namespace
+// }}}
+
+CompiledMethod* BaselineCompiler::compile(Method* method, QuickCode* quick, VMClassLoader& loader)
+{
+	std::vector<uint16_t> depths;
+	if (!analyze(method, quick, depths))
+		return nullptr;
+
+	X86Templates::Runtime runtime = {
+		offsetof(Interpreter::Frame, pc),
+		offsetof(Interpreter::Frame, code),
+		(uintptr_t) &Interpreter::jitStep,
+		(uintptr_t) &Interpreter::jitTrap,
+		(uintptr_t) &Interpreter::jitInvoke,
+	};
+
+	Codegen codegen(runtime, method, quick, loader.hierarchy(), depths);
+	const std::vector<uint8_t>& code = codegen.generate();
+
+	CodeCache& cache = loader.codeCache();
+	const uint8_t* entry = cache.install(code.data(), code.size());
+	if (!entry)
+		return nullptr;
+
+	for (uint16_t& depth: depths)
+		if (depth == UnknownDepth)
+			depth = 0;
+
+	CompiledMethod* compiled = cache.add(new CompiledMethod(method, CompiledMethod::Tier::Baseline, entry, code.size(),
+		std::move(depths), codegen.osrEntries(), std::move(codegen.debugInfo())));
+
+	// a class loaded since compilation may already have broken an assumption
+	for (const Dependency& dependency: codegen.dependencies()) {
+		if (!loader.addDependency(dependency, compiled)) {
+			compiled->invalidate();
+			break;
+		}
+	}
+
+	return compiled;
+}
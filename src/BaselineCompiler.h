@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+class Method;
+class QuickCode;
+class VMClassLoader;
+class CompiledMethod;
+
+/**
+ * Baseline JIT compiler, translating quickened code into x86-64 machine
+ * code with a fixed template per instruction.
+ *
+ * The code keeps all state in the interpreter frame (see CompiledMethod),
+ * with the frame's locals, operand stack, interpreter and frame record in
+ * callee-saved registers, and only saves the dispatch: control flow is
+ * native, and so are constants, locals, int and long arithmetic, stack
+ * shuffling, field and array accesses of primitives, and branches.
+ * Instructions whose operands were not resolved at compile time, calls,
+ * allocations, type checks, floating-point arithmetic and switches call
+ * back into the interpreter (see Interpreter::jitStep()). Anything else,
+ * and every failing null, bounds or division check, exits to the
+ * interpreter to run the instruction, so that the interpreter remains the
+ * only one throwing exceptions.
+ *
+ * Conditional branches profiled as never taken lead to uncommon traps
+ * instead of their target, which deoptimize the compiled method (see
+ * Interpreter::jitTrap()).
+ *
+ * Virtual and interface calls that the class hierarchy proves monomorphic
+ * call their target directly (see ClassHierarchy), with the compiled
+ * method depending on it to stay so.
+ */
+class BaselineCompiler {
+public:
+	//! Executions of a conditional branch, none taken, for it to become an uncommon trap.
+	static const uint32_t ColdBranchSamples = 1000;
+
+	/**
+	 * Compiles \p method into the code cache of \p loader, recording the
+	 * dependencies of the code with it.
+	 *
+	 * @return the compiled method, owned by the code cache, invalidated
+	 *         already if a class loaded meanwhile broke its dependencies,
+	 *         or \p nullptr if it uses jsr/ret or invokedynamic, or the
+	 *         cache is full.
+	 */
+	static CompiledMethod* compile(Method* method, QuickCode* quick, VMClassLoader& loader);
+
+	/**
+	 * Operand stack depth before each instruction, by abstract
+	 * interpretation of the stack effects.
+	 *
+	 * Exception handlers start with the exception on the stack.
+	 * Unreachable instructions get depth 0.
+	 *
+	 * @return false if the stack effect of some instruction is unknown.
+	 */
+	static bool computeStackDepths(Method* method, QuickCode* quick, std::vector<uint16_t>& depths);
+};
@@ -1,6 +1,9 @@
 #include "Class.h"
 #include "ConstantPool.h"
+#include "ClassfileReader.h"
 #include "JvmEnv.h"
+#include "QuickCode.h"
+#include "MethodProfile.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -106,23 +109,139 @@ std::string tos(FieldFlags flags)
 // }}}
 
 Class::Class() :
+	arena_(),
+	classfile_(),
 	sourceFile_(),
 	major_(0),
 	minor_(0),
-	flags_()
+	flags_(),
+	name_(nullptr),
+	thisClassId_(0),
+	superClassName_(nullptr),
+	superClass_(nullptr),
+	fieldTable_(),
+	methodTable_(),
+	vtable_(),
+	itables_(),
+	instanceSize_(0),
+	staticSize_(0),
+	staticData_(nullptr),
+	initState_(InitState::Uninitialized),
+	linkLock_(),
+	laidOut_(false),
+	linked_(false)
 {
 }
 
 Class::~Class()
 {
+	// all metadata is released in bulk by arena_
 }
 
-Method* Class::findMethod(const std::string& name)
+Method* Class::findDeclaredMethod(const Symbol* name, const Symbol* descriptor) const
 {
+	if (isLaidOut())
+		return methodTable_.find(name, descriptor);
+
 	for (Method* method: methods_)
-		if (method->name() == name)
+		if (method->name_ == name && method->signature_ == descriptor)
+			return method;
+
+	return nullptr;
+}
+
+Method* Class::findMethod(const Symbol* name, const Symbol* descriptor) const
+{
+	for (const Class* c = this; c; c = c->superClass_)
+		if (Method* method = c->findDeclaredMethod(name, descriptor))
 			return method;
 
+	// default and abstract interface methods
+	for (const Class* c = this; c; c = c->superClass_)
+		for (Class* interface: c->interfaces_)
+			if (interface)
+				if (Method* method = interface->findMethod(name, descriptor))
+					return method;
+
+	return nullptr;
+}
+
+Method* Class::findMethod(const Symbol* name) const
+{
+	for (const Class* c = this; c; c = c->superClass_)
+		for (Method* method: c->methods_)
+			if (method->name_ == name)
+				return method;
+
+	return nullptr;
+}
+
+Method* Class::findMethod(const char* name) const
+{
+	// a name that was never interned cannot name any method
+	const Symbol* symbol = SymbolTable::global().lookup(name);
+	return symbol ? findMethod(symbol) : nullptr;
+}
+
+Field* Class::findDeclaredField(const Symbol* name, const Symbol* descriptor) const
+{
+	if (isLaidOut())
+		return fieldTable_.find(name, descriptor);
+
+	for (Field* field: fields_)
+		if (field->name() == name && field->descriptor() == descriptor)
+			return field;
+
+	return nullptr;
+}
+
+Field* Class::findField(const Symbol* name, const Symbol* descriptor) const
+{
+	// JVMS 5.4.3.2: own fields, then superinterfaces, then the superclass
+	if (Field* field = findDeclaredField(name, descriptor))
+		return field;
+
+	for (Class* interface: interfaces_)
+		if (interface)
+			if (Field* field = interface->findField(name, descriptor))
+				return field;
+
+	return superClass_ ? superClass_->findField(name, descriptor) : nullptr;
+}
+
+Field* Class::findField(const Symbol* name) const
+{
+	for (const Class* c = this; c; c = c->superClass_)
+		for (Field* field: c->fields_)
+			if (field->name() == name)
+				return field;
+
+	return nullptr;
+}
+
+bool Class::isSubclassOf(const Class* other) const
+{
+	for (const Class* c = this; c; c = c->superClass_) {
+		if (c == other)
+			return true;
+
+		if (other->isInterface())
+			for (const Class* interface: c->interfaces_)
+				if (interface && interface->isSubclassOf(other))
+					return true;
+	}
+
+	return false;
+}
+
+Method* Class::itableLookup(const Method* method) const
+{
+	const Class* interface = method->thisClass();
+
+	for (const Itable& itable: itables_)
+		if (itable.interface == interface)
+			return itable.methods[method->itableIndex()];
+
 	return nullptr;
 }
 
@@ -134,58 +253,229 @@ void Class::dump()
 {
 	printf("-----------------------------------------------\n");
 	printf("Version: %d.%d\n", major_, minor_);
-	printf("This class: %s\n", thisClassName_.c_str());
-	printf("Super class: %s\n", superClassName_.c_str());
+	printf("This class: %s\n", name_->c_str());
+	printf("Super class: %s\n", superClassName_ ? superClassName_->c_str() : "");
 	printf("Flags: %s\n", tos(flags_).c_str());
 	printf("Interface count: %zu\n", interfaces_.size());
 
 	printf("CONSTANT_POOL:\n");
-	for (int k = 1; k < constantPool.size(); ++k) {
-		printf("\t[%d] %s\n", k, constantPool[k] ? constantPool[k]->to_s().c_str() : "null");
+	for (size_t k = 1; k < constantPool.size(); ++k) {
+		printf("\t[%zu] %s\n", k, constantPool.to_s(k).c_str());
 	}
 
 	printf("FIELDS: #%zu\n", fields_.size());
-	for (int k = 0; k < fields_.size(); ++k) {
+	for (size_t k = 0; k < fields_.size(); ++k) {
 		Field* field = fields_[k];
-		printf("\t[%d] ", k);
+		printf("\t[%zu] ", k);
 		field->dump();
 	}
 
 	printf("METHODS: #%zu\n", methods_.size());
-	for (int k = 0; k < methods_.size(); ++k) {
+	for (size_t k = 0; k < methods_.size(); ++k) {
 		Method* method = methods_[k];
-		printf("\t[%d] ", k);
+		printf("\t[%zu] ", k);
 		method->dump();
 	}
 }
 
+void Class::dumpProfiles() const
+{
+	for (Method* method: methods_)
+		if (MethodProfile* profile = method->profile())
+			profile->dump();
+}
+
+size_t Field::size() const
+{
+	switch (descriptor_->c_str()[0]) {
+		case 'J': case 'D': return 8;
+		case 'I': case 'F': return 4;
+		case 'S': case 'C': return 2;
+		case 'B': case 'Z': return 1;
+		default: return sizeof(void*); // references and arrays
+	}
+}
+
 void Field::dump() const
 {
 	printf("%s %s.%s: %s\n",
 		tos(flags_).c_str(),
-		thisClass_->name().c_str(),
+		thisClass_->name()->c_str(),
 		name_->c_str(),
 		descriptor_->c_str()
 	);
 }
 
+MethodProfile* Method::profile() const
+{
+	QuickCode* quick = quickCode();
+	return quick ? quick->profile() : nullptr;
+}
+
 void Method::dump() const
 {
 	printf("%s %s: %s (code size: %zu)\n",
 		tos(flags_).c_str(),
-		name_.c_str(),
-		signature_.c_str(),
-		code_.size()
+		name_->c_str(),
+		signature_->c_str(),
+		code().size()
 	);
 }
 
+void Method::computeSlots()
+{
+	const char* s = signature_->c_str();
+	uint16_t slots = isStatic() ? 0 : 1;
+
+	if (*s == '(')
+		++s;
+
+	while (*s && *s != ')') {
+		char type = *s;
+		while (*s == '[')
+			++s;
+
+		if (*s == 'L')
+			while (*s && *s != ';')
+				++s;
+
+		slots += type == 'J' || type == 'D' ? 2 : 1;
+		if (*s)
+			++s;
+	}
+
+	argumentSlots_ = slots;
+
+	char returnType = *s ? s[1] : 'V';
+	returnSlots_ = returnType == 'V' ? 0 : returnType == 'J' || returnType == 'D' ? 2 : 1;
+}
+
+void Method::setCodeAttribute(const uint8_t* data, uint32_t length)
+{
+	codeAttribute_ = data;
+	codeAttributeLength_ = length;
+	materialized_.store(false, std::memory_order_relaxed);
+}
+
+void Method::materializeSlow() const
+{
+	// the class arena is not thread-safe, so share the class' link lock
+	std::lock_guard<std::mutex> _l(thisClass_->linkLock_);
+
+	if (materialized_.load(std::memory_order_relaxed))
+		return;
+
+	// a malformed body fails the class when decoded eagerly, or the first invocation otherwise
+	Method* self = const_cast<Method*>(this);
+	self->codeError_ = self->decodeCode();
+	if (self->codeError_ != ClassfileError::None) {
+		self->maxStack_ = 0;
+		self->maxLocals_ = 0;
+		self->code_ = ByteView();
+		self->exceptionTable_ = ArrayView<ExceptionHandler>();
+		self->lineNumberTable_ = ArrayView<LineNumber>();
+	}
+
+	materialized_.store(true, std::memory_order_release);
+}
+
+int Method::lineNumber(uint32_t offset) const
+{
+	// entries are not necessarily sorted, so take the closest one starting at or before offset
+	const LineNumber* best = nullptr;
+	for (const LineNumber& entry: lineNumberTable())
+		if (entry.start <= offset && (!best || entry.start >= best->start))
+			best = &entry;
+
+	return best ? best->line : -1;
+}
+
+ClassfileError Method::decodeCode()
+{
+	ClassfileReader r(codeAttribute_, codeAttributeLength_);
+	Arena& arena = thisClass_->arena_;
+	ConstantPool& pool = thisClass_->constantPool;
+
+	if (!r.require(8))
+		return r.error();
+
+	maxStack_ = r.u2();
+	maxLocals_ = r.u2();
+
+	uint32_t codeLength = r.u4();
+	const uint8_t* code = r.view(codeLength);
+	if (!code)
+		return r.error();
+	code_ = ByteView(code, codeLength);
+
+	uint16_t exceptionTableLength = r.readU2();
+	if (!r.require(exceptionTableLength * 8))
+		return r.error();
+	ExceptionHandler* handlers = arena.allocateArray<ExceptionHandler>(exceptionTableLength);
+	for (uint16_t i = 0; i < exceptionTableLength; ++i) {
+		uint16_t start = r.u2();
+		uint16_t end = r.u2();
+		uint16_t handler = r.u2();
+		uint16_t type = r.u2();
+		handlers[i] = {start, end, handler, type};
+	}
+	exceptionTable_ = ArrayView<ExceptionHandler>(handlers, exceptionTableLength);
+
+	uint16_t attributeCount = r.readU2();
+	for (int i = 0; i < attributeCount; ++i) {
+		if (!r.require(6))
+			return r.error();
+
+		uint16_t nameId = r.u2();
+		uint32_t length = r.u4();
+		const uint8_t* payload = r.view(length);
+		if (!payload)
+			return r.error();
+
+		ConstantUtf8* utf8 = pool.utf8(nameId);
+		const Symbol* name = utf8 ? utf8->symbol() : nullptr;
+
+		if (name == Symbols::LineNumberTable) {
+			ClassfileReader a(payload, length);
+			uint16_t count = a.readU2();
+			if (!a.require(count * 4))
+				return ClassfileError::BadAttribute;
+			LineNumber* lines = arena.allocateArray<LineNumber>(count);
+			for (uint16_t i = 0; i < count; ++i) {
+				uint16_t start = a.u2();
+				uint16_t line = a.u2();
+				lines[i] = {start, line};
+			}
+			lineNumberTable_ = ArrayView<LineNumber>(lines, count);
+		} else if (name == Symbols::LocalVariableTable) {
+			// TODO implement when we add debugging support
+		} else if (name == Symbols::LocalVariableTypeTable) {
+			// TODO implement when we add debugging support
+		} else if (name == Symbols::StackMapTable) {
+			// TODO needed for operand-stack type-checking (optional feature since classfile version 51.0)
+		} else {
+			printf("WARNING: Unhandled method-code attribute %s for method %s\n", name ? name->c_str() : "?", to_s().c_str());
+		}
+	}
+
+	return r.error();
+}
+
+bool Method::isVirtual() const
+{
+	return !(flags_ & MethodFlags::Static)
+		&& !(flags_ & MethodFlags::Private)
+		&& name_ != Symbols::init
+		&& !thisClass_->isInterface();
+}
+
 std::string Method::to_s() const
 {
 	std::string s;
 
-	s += name_;
+	s += name_->c_str();
 	s += ": ";
-	s += signature_;
+	s += signature_->c_str();
 
 	return s;
 }
@@ -1,37 +1,61 @@
 #pragma once
 
 #include "ConstantPool.h"
+#include "Symbol.h"
+#include "MemberTable.h"
 #include "Classfile.h"
+#include "ClassfileBuffer.h"
+#include "ClassfileReader.h"
+#include "Arena.h"
 #include <stdint.h>
 #include <string>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
 
 class Class;
 class JObject;
+class QuickCode;
+class MethodProfile;
 
 class Field {
 private:
+	friend class VMClassLoader;
+	friend class ClassArchive;
+
 	Class* thisClass_;
-	ConstantUtf8* name_;
-	ConstantUtf8* descriptor_;
+	const Symbol* name_;
+	const Symbol* descriptor_;
 	FieldFlags flags_;
-	std::vector<Attribute*> attributes_;
+	uint32_t offset_; //!< assigned at link time
+	ArrayView<const Attribute*> attributes_; //!< views into the classfile
 
 public:
-	Field(Class* thisClass, ConstantUtf8* name, ConstantUtf8* descriptor, FieldFlags flags) :
+	Field(Class* thisClass, const Symbol* name, const Symbol* descriptor, FieldFlags flags) :
 		thisClass_(thisClass),
 		name_(name),
 		descriptor_(descriptor),
 		flags_(flags),
+		offset_(0),
 		attributes_()
 	{}
 
 	Class* thisClass() const { return thisClass_; }
-	const char* name() const { return name_->c_str(); }
-	const char* descriptor() const { return descriptor_->c_str(); }
+	const Symbol* name() const { return name_; }
+	const Symbol* descriptor() const { return descriptor_; }
 	FieldFlags flags() const { return flags_; }
-	const std::vector<Attribute*>& attributes() const { return attributes_; }
-	std::vector<Attribute*>& attributes() { return attributes_; }
+	bool isStatic() const { return flags_ & FieldFlags::Static; }
+
+	//! Size in bytes of a value of this field's type.
+	size_t size() const;
+
+	/**
+	 * Byte offset of this field within the instance data of an object, or
+	 * within the static data of its class for static fields.
+	 */
+	uint32_t offset() const { return offset_; }
+	const ArrayView<const Attribute*>& attributes() const { return attributes_; }
 
 	void dump() const;
 };
@@ -40,6 +64,8 @@ class Method {
 public:
 	friend class Class;
 	friend class VMClassLoader;
+	friend class ClassArchive;
+	friend class QuickCode;
 
 	struct ExceptionHandler {
 		uint16_t start;
@@ -93,58 +119,153 @@ public:
 		uint16_t line; // source code line number
 	};
 
+	//! vtable index of methods that are not virtual
+	static const uint16_t NoVtableIndex = 0xFFFF;
+
+	//! itable index of methods that are not interface methods
+	static const uint16_t NoItableIndex = 0xFFFF;
+
 private:
-	std::string name_;
-	std::string signature_;
+	Class* thisClass_;
+	const Symbol* name_;
+	const Symbol* signature_;
 	MethodFlags flags_;
+	uint16_t vtableIndex_; //!< assigned at link time
+	uint16_t itableIndex_; //!< of interface methods, assigned at link time
+	uint16_t argumentSlots_; //!< operand stack slots taken by the arguments, including this
+	uint8_t returnSlots_;
 	uint16_t maxStack_;
 	uint16_t maxLocals_;
 	bool isDeprecated_;
-	std::vector<uint8_t> code_;
-	std::vector<ExceptionHandler> exceptionTable_;
-	std::vector<StackMapFrame> stackMapTable_;
-	std::vector<LineNumber> lineNumberTable_;
+
+	// the raw Code attribute (view into the classfile), decoded on first use
+	const uint8_t* codeAttribute_;
+	uint32_t codeAttributeLength_;
+	mutable std::atomic<bool> materialized_;
+	ClassfileError codeError_; //!< of decoding the Code attribute, once materialized
+
+	ByteView code_; //!< view into the classfile
+	ArrayView<ExceptionHandler> exceptionTable_;
+	ArrayView<StackMapFrame> stackMapTable_;
+	ArrayView<LineNumber> lineNumberTable_;
+
+	mutable std::atomic<QuickCode*> quickCode_; //!< translated on first invocation
 
 public:
-	Method(ConstantUtf8* name, ConstantUtf8* signature, MethodFlags flags) :
-		name_(name->c_str()),
-		signature_(signature->c_str()),
+	Method(Class* thisClass, const Symbol* name, const Symbol* signature, MethodFlags flags) :
+		thisClass_(thisClass),
+		name_(name),
+		signature_(signature),
 		flags_(flags),
+		vtableIndex_(NoVtableIndex),
+		itableIndex_(NoItableIndex),
+		argumentSlots_(0),
+		returnSlots_(0),
 		maxStack_(0),
 		maxLocals_(0),
 		isDeprecated_(false),
+		codeAttribute_(nullptr),
+		codeAttributeLength_(0),
+		materialized_(true),
+		codeError_(ClassfileError::None),
 		code_(),
-		exceptionTable_()
+		exceptionTable_(),
+		stackMapTable_(),
+		lineNumberTable_(),
+		quickCode_(nullptr)
 	{
+		computeSlots();
 	}
 
-	const std::string& name() const { return name_; }
-	const std::string& signature() const { return signature_; }
+	Class* thisClass() const { return thisClass_; }
+	const Symbol* name() const { return name_; }
+	const Symbol* signature() const { return signature_; }
+	const Symbol* descriptor() const { return signature_; }
 	MethodFlags flags() const { return flags_; }
+	bool isStatic() const { return flags_ & MethodFlags::Static; }
+	bool isNative() const { return flags_ & MethodFlags::Native; }
+	bool isAbstract() const { return flags_ & MethodFlags::Abstract; }
+
+	/**
+	 * Number of slots the arguments take, including the receiver of
+	 * non-static methods. long and double take two slots each.
+	 */
+	uint16_t argumentSlots() const { return argumentSlots_; }
+
+	//! Number of slots the return value takes (0 for void).
+	uint8_t returnSlots() const { return returnSlots_; }
+
+	//! Whether this method is dispatched through the vtable.
+	bool isVirtual() const;
+	uint16_t vtableIndex() const { return vtableIndex_; }
+
+	//! Index into the itables of implementors, for interface methods dispatched by invokeinterface.
+	uint16_t itableIndex() const { return itableIndex_; }
 
-	uint16_t maxStack() const { return maxStack_; }
-	uint16_t maxLocals() const { return maxLocals_; }
 	bool isDeprecated() const { return isDeprecated_; }
-	const std::vector<uint8_t>& code() const { return code_; }
-	const std::vector<ExceptionHandler>& exceptionTable() const { return exceptionTable_; }
-	const std::vector<StackMapFrame>& stackMapTable() const { return stackMapTable_; }
-	const std::vector<LineNumber>& lineNumberTable() const { return lineNumberTable_; }
+
+	// {{{ method body, materialized from the Code attribute on first access
+	uint16_t maxStack() const { materialize(); return maxStack_; }
+	uint16_t maxLocals() const { materialize(); return maxLocals_; }
+	const ByteView& code() const { materialize(); return code_; }
+	const ArrayView<ExceptionHandler>& exceptionTable() const { materialize(); return exceptionTable_; }
+	const ArrayView<StackMapFrame>& stackMapTable() const { materialize(); return stackMapTable_; }
+	const ArrayView<LineNumber>& lineNumberTable() const { materialize(); return lineNumberTable_; }
+
+	//! Why the Code attribute is malformed, leaving the method without code, or ClassfileError::None.
+	ClassfileError codeError() const { materialize(); return codeError_; }
+
+	//! Source line of the instruction at given bytecode offset, or -1 if unknown.
+	int lineNumber(uint32_t offset) const;
+
+	//! Whether the method body has been decoded (always true for methods without code).
+	bool isMaterialized() const { return materialized_.load(std::memory_order_acquire); }
+
+	//! Decodes the method body unless already done; safe to call concurrently.
+	void materialize() const {
+		if (!isMaterialized())
+			materializeSlow();
+	}
+	// }}}
+
+	//! Quickened body for the interpreter, or \p nullptr until first invoked.
+	QuickCode* quickCode() const { return quickCode_.load(std::memory_order_acquire); }
+
+	//! Execution profile, or \p nullptr until first invoked.
+	MethodProfile* profile() const;
 
 	std::string to_s() const;
 	void dump() const;
+
+private:
+	void computeSlots();
+	void setCodeAttribute(const uint8_t* data, uint32_t length);
+	void materializeSlow() const;
+	ClassfileError decodeCode();
 };
 
 class Class {
+public:
+	enum class InitState : uint8_t {
+		Uninitialized,
+		Initializing,
+		Initialized,
+		Erroneous,
+	};
+
 private:
+	Arena arena_; //!< owns all constants, fields and methods of this class
+	std::shared_ptr<ClassfileBuffer> classfile_;
+
 	std::string sourceFile_;
 	int major_;
 	int minor_;
 
 	ClassFlags flags_;
-	std::string thisClassName_;
-	ConstantClass* thisClass_;
+	const Symbol* name_;
+	uint16_t thisClassId_;
 
-	std::string superClassName_;
+	const Symbol* superClassName_; //!< nullptr for java/lang/Object
 	Class* superClass_;
 
 	std::vector<uint16_t> interfaceIds_;
@@ -153,31 +274,114 @@ private:
 	std::vector<Field*> fields_;
 	std::vector<Method*> methods_;
 
+public:
+	//! Implementations of the methods of an interface, by their itableIndex().
+	struct Itable {
+		Class* interface;
+		Method** methods;
+	};
+
+private:
+	// built at link time
+	MemberTable<Field> fieldTable_;
+	MemberTable<Method> methodTable_;
+	ArrayView<Method*> vtable_;
+	ArrayView<Itable> itables_; //!< of all implemented interfaces, for non-interface classes
+	uint32_t instanceSize_;
+	uint32_t staticSize_;
+	uint8_t* staticData_; //!< storage of the static fields, zeroed at link time
+
+	std::atomic<InitState> initState_;
+
+	std::mutex linkLock_; //!< guards linking and any arena allocation past defineClass
+	std::atomic<bool> laidOut_;
+	std::atomic<bool> linked_;
+
 private:
 	Class();
 	~Class();
 
 	friend class VMClassLoader;
+	friend class ClassArchive;
+	friend class Method;
+	friend class Interpreter;
+	friend class QuickCode;
 
 public:
 	ConstantPool constantPool;
 
 public:
-	const std::string& name() const { return thisClassName_; }
+	const Symbol* name() const { return name_; }
 	bool isLoaded() const { return major_ != 0; }
 	const std::string& sourceFileName() const { return sourceFile_; }
 	int versionMajor() const { return major_; }
 	int versionMinor() const { return minor_; }
+	const ClassfileBuffer* classfile() const { return classfile_.get(); }
+
+	const Arena& arena() const { return arena_; }
+	size_t metadataBytes() const { return arena_.bytesAllocated(); }
 
+	bool isLinked() const { return linked_.load(std::memory_order_acquire); }
+	const Symbol* superClassName() const { return superClassName_; }
 	Class* superClass() const { return superClass_; }
 	ClassFlags flags() const { return flags_; }
+	bool isInterface() const { return flags_ & ClassFlags::Interactive; }
+	bool isAbstract() const { return flags_ & ClassFlags::Abstract; }
 
-	Method* findMethod(const std::string& name);
+	//! Whether member tables, vtable and field offsets have been built.
+	bool isLaidOut() const { return laidOut_.load(std::memory_order_acquire); }
+
+	const std::vector<Field*>& fields() const { return fields_; }
+	const std::vector<Method*>& methods() const { return methods_; }
+
+	//! Finds a method declared by this class.
+	Method* findDeclaredMethod(const Symbol* name, const Symbol* descriptor) const;
+
+	//! Finds a method declared by this class or inherited from its superclasses or interfaces.
+	Method* findMethod(const Symbol* name, const Symbol* descriptor) const;
+
+	//! Finds the first method of given name, regardless of its descriptor.
+	Method* findMethod(const Symbol* name) const;
+	Method* findMethod(const char* name) const;
+
+	Field* findDeclaredField(const Symbol* name, const Symbol* descriptor) const;
+	Field* findField(const Symbol* name, const Symbol* descriptor) const;
+	Field* findField(const Symbol* name) const;
+
+	//! Virtual methods by vtable index, overriding methods sharing their parent's slot.
+	const ArrayView<Method*>& vtable() const { return vtable_; }
+	Method* vtableAt(size_t index) const { return vtable_[index]; }
+
+	const ArrayView<Itable>& itables() const { return itables_; }
+
+	/**
+	 * Implementation of interface method \p method in this class, looked up
+	 * in the itables.
+	 *
+	 * Returns the interface method itself if not implemented (so that its
+	 * invocation fails as abstract), and \p nullptr if this class does not
+	 * implement the method's interface.
+	 */
+	Method* itableLookup(const Method* method) const;
+
+	//! Size of the instance data, including all inherited instance fields.
+	uint32_t instanceSize() const { return instanceSize_; }
+	uint32_t staticSize() const { return staticSize_; }
+	uint8_t* staticData() const { return staticData_; }
+
+	InitState initState() const { return initState_.load(std::memory_order_acquire); }
+	bool isInitialized() const { return initState() == InitState::Initialized; }
+
+	//! Whether this class is \p other, or a subclass or implementor of it.
+	bool isSubclassOf(const Class* other) const;
 
 	void resolve();
 
 	void dump();
 
+	//! Dumps the profiles of all methods that have run.
+	void dumpProfiles() const;
+
 	JObject* newInstance();
 };
 
@@ -0,0 +1,583 @@
+#include "ClassArchive.h"
+#include "ClassfileBuffer.h"
+#include "ConstantPool.h"
+#include "Class.h"
+#include "Symbol.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// {{{ archive layout
+// All structures are stored in host byte order and 8-byte aligned.
+// Offsets are relative to the start of the archive.
+
+static const char ARCHIVE_MAGIC[8] = { 'J', 'V', 'M', 'T', 'O', 'Y', 'C', 'D' };
+static const uint32_t ARCHIVE_VERSION = 2;
+
+struct ArchiveRef {
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct ClassArchive::Header {
+	char magic[8];
+	uint32_t version;
+	uint32_t classCount;
+	uint32_t bucketCount;       // power of two
+	uint32_t bucketsOffset;     // uint32_t[bucketCount]: class index + 1, or 0
+	uint32_t classesOffset;     // ClassRecord[classCount]
+	uint32_t checksum;          // CRC-32 over header (with checksum = 0), buckets and class records
+	uint64_t size;
+};
+
+struct ClassArchive::ClassRecord {
+	ArchiveRef name;            // binary class name bytes
+	uint32_t nameHash;
+	uint32_t dataChecksum;      // CRC-32 over the data range
+	ArchiveRef data;            // byte range of all data below
+
+	uint64_t sourceMtime;
+	uint64_t sourceSize;
+	uint32_t sourceCrc;
+
+	uint16_t major;
+	uint16_t minor;
+	uint16_t flags;
+	uint16_t thisClassId;
+	uint16_t constantCount;
+	uint16_t reserved;
+	uint32_t superIndex;        // archive index of the superclass or NoIndex
+
+	ArchiveRef superName;
+	ArchiveRef sourceFile;
+	ArchiveRef interfaces;      // ArchiveInterface[]
+	ArchiveRef constantTags;    // uint8_t[constantCount], without resolved bits
+	ArchiveRef constantRefs;    // ConstantPool::Ref[constantCount]
+	ArchiveRef constantValues;  // uint64_t[constantCount]; Utf8: offset of its bytes, unresolved otherwise
+	ArchiveRef fields;          // ArchiveField[]
+	ArchiveRef methods;         // ArchiveMethod[]
+};
+
+struct ArchiveInterface {
+	uint16_t id;
+	uint16_t reserved;
+	uint32_t archiveIndex;
+};
+
+struct ArchiveField {
+	uint16_t flags;
+	uint16_t nameId;
+	uint16_t descriptorId;
+	uint16_t reserved;
+	ArchiveRef attributes;      // uint32_t[]: offsets of raw attribute_info structures
+};
+
+struct ArchiveMethod {
+	uint16_t flags;
+	uint16_t nameId;
+	uint16_t descriptorId;
+	uint16_t maxStack;
+	uint16_t maxLocals;
+	uint8_t deprecated;
+	uint8_t reserved[5];
+	ArchiveRef code;
+	ArchiveRef exceptionTable;  // Method::ExceptionHandler[]
+	ArchiveRef lineNumberTable; // Method::LineNumber[]
+};
+
+static uint32_t hashName(const char* name, size_t length)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < length; ++i) {
+		h ^= (uint8_t) name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+// }}}
+
+uint32_t ClassArchive::crc32(const uint8_t* data, size_t size)
+{
+	// slicing-by-8: entries[k][i] is the CRC of byte i followed by k zero bytes
+	static const struct Table {
+		uint32_t entries[8][256];
+
+		Table() {
+			for (uint32_t i = 0; i < 256; ++i) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k)
+					c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				entries[0][i] = c;
+			}
+			for (uint32_t i = 0; i < 256; ++i)
+				for (int k = 1; k < 8; ++k)
+					entries[k][i] = entries[0][entries[k - 1][i] & 0xFF] ^ (entries[k - 1][i] >> 8);
+		}
+	} table;
+
+	uint32_t crc = 0xFFFFFFFFu;
+	for (; size >= 8; data += 8, size -= 8) {
+		uint32_t lo = crc ^ ((uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24);
+		uint32_t hi = (uint32_t) data[4] | (uint32_t) data[5] << 8 | (uint32_t) data[6] << 16 | (uint32_t) data[7] << 24;
+		crc = table.entries[7][lo & 0xFF] ^ table.entries[6][(lo >> 8) & 0xFF]
+			^ table.entries[5][(lo >> 16) & 0xFF] ^ table.entries[4][lo >> 24]
+			^ table.entries[3][hi & 0xFF] ^ table.entries[2][(hi >> 8) & 0xFF]
+			^ table.entries[1][(hi >> 16) & 0xFF] ^ table.entries[0][hi >> 24];
+	}
+	for (; size; ++data, --size)
+		crc = table.entries[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFFu;
+}
+
+// {{{ writer
+class ArchiveWriter {
+private:
+	std::vector<uint8_t> image_;
+
+public:
+	size_t size() const { return image_.size(); }
+	uint8_t* data() { return image_.data(); }
+
+	void align() {
+		image_.resize((image_.size() + 7) & ~(size_t) 7);
+	}
+
+	uint32_t reserve(size_t n) {
+		align();
+		size_t offset = image_.size();
+		image_.resize(offset + n);
+		return offset;
+	}
+
+	ArchiveRef append(const void* data, size_t size, uint32_t count) {
+		uint32_t offset = reserve(size);
+		if (size)
+			memcpy(&image_[offset], data, size);
+		return ArchiveRef{offset, count};
+	}
+
+	ArchiveRef append(const std::string& s) {
+		return append(s.data(), s.size(), s.size());
+	}
+
+	template<typename T> T* at(uint32_t offset) {
+		return (T*) &image_[offset];
+	}
+};
+
+bool ClassArchive::write(const std::string& path,
+                         const std::vector<Class*>& classes,
+                         const std::vector<Source>& sources)
+{
+	ArchiveWriter w;
+
+	uint32_t bucketCount = 16;
+	while (bucketCount < classes.size() * 2)
+		bucketCount *= 2;
+
+	uint32_t headerOffset = w.reserve(sizeof(Header));
+	uint32_t bucketsOffset = w.reserve(bucketCount * sizeof(uint32_t));
+	uint32_t classesOffset = w.reserve(classes.size() * sizeof(ClassRecord));
+
+	std::unordered_map<std::string, uint32_t> indexOf;
+	for (size_t i = 0; i < classes.size(); ++i)
+		indexOf[classes[i]->name()->c_str()] = i;
+
+	for (size_t ci = 0; ci < classes.size(); ++ci) {
+		Class* c = classes[ci];
+		ConstantPool& pool = c->constantPool;
+
+		ClassRecord rec;
+		memset(&rec, 0, sizeof(rec));
+
+		w.align();
+		uint32_t dataBegin = w.size();
+
+		rec.name = w.append(c->name()->value().to_s());
+		rec.nameHash = hashName(c->name()->c_str(), c->name()->size());
+		rec.sourceMtime = sources[ci].mtime;
+		rec.sourceSize = sources[ci].size;
+		rec.sourceCrc = sources[ci].crc;
+		rec.major = c->major_;
+		rec.minor = c->minor_;
+		rec.flags = (uint16_t) c->flags_;
+		rec.constantCount = pool.size();
+		rec.superName = w.append(c->superClassName_ ? c->superClassName_->value().to_s() : std::string());
+		rec.sourceFile = w.append(c->sourceFile_);
+
+		auto i = c->superClassName_ ? indexOf.find(c->superClassName_->c_str()) : indexOf.end();
+		rec.superIndex = i != indexOf.end() ? i->second : NoIndex;
+
+		// constant pool, stored as the pool's own arrays
+		std::unordered_map<const Symbol*, uint16_t> slotOf;
+		std::vector<uint8_t> tags(pool.tags(), pool.tags() + pool.size());
+		std::vector<uint64_t> values(pool.values(), pool.values() + pool.size());
+
+		for (size_t k = 1; k < pool.size(); ++k) {
+			tags[k] &= ~ConstantPool::Resolved;
+			switch (pool.tag(k)) {
+				case ConstantTag::Utf8: {
+					const ConstantUtf8* utf8 = pool.utf8At(k);
+					slotOf.emplace(utf8->symbol(), k);
+					values[k] = w.append(utf8->data, utf8->length, utf8->length).offset;
+					break;
+				}
+				case ConstantTag::Integer:
+				case ConstantTag::Float:
+				case ConstantTag::Long:
+				case ConstantTag::Double:
+					break;
+				default:
+					values[k] = 0; // resolved values are process-local
+					break;
+			}
+		}
+
+		rec.thisClassId = c->thisClassId_;
+		rec.constantTags = w.append(tags.data(), tags.size(), tags.size());
+		rec.constantRefs = w.append(pool.refs(), pool.size() * sizeof(ConstantPool::Ref), pool.size());
+		rec.constantValues = w.append(values.data(), values.size() * sizeof(uint64_t), values.size());
+
+		// interfaces
+		std::vector<ArchiveInterface> interfaces(c->interfaceIds_.size());
+		for (size_t k = 0; k < interfaces.size(); ++k) {
+			interfaces[k].id = c->interfaceIds_[k];
+			interfaces[k].reserved = 0;
+			interfaces[k].archiveIndex = NoIndex;
+			if (ConstantUtf8* interface = pool.className(interfaces[k].id)) {
+				auto i = indexOf.find(interface->c_str());
+				if (i != indexOf.end())
+					interfaces[k].archiveIndex = i->second;
+			}
+		}
+		rec.interfaces = w.append(interfaces.data(), interfaces.size() * sizeof(ArchiveInterface), interfaces.size());
+
+		// fields
+		std::vector<ArchiveField> fields(c->fields_.size());
+		for (size_t k = 0; k < fields.size(); ++k) {
+			Field* field = c->fields_[k];
+			ArchiveField& af = fields[k];
+			memset(&af, 0, sizeof(af));
+			af.flags = (uint16_t) field->flags();
+			af.nameId = slotOf[field->name_];
+			af.descriptorId = slotOf[field->descriptor_];
+
+			std::vector<uint32_t> attributes;
+			for (const Attribute* attribute: field->attributes()) {
+				const uint8_t* raw = (const uint8_t*) attribute;
+				uint32_t length = (raw[2] << 24) | (raw[3] << 16) | (raw[4] << 8) | raw[5];
+				attributes.push_back(w.append(raw, 6 + length, 1).offset);
+			}
+			af.attributes = w.append(attributes.data(), attributes.size() * sizeof(uint32_t), attributes.size());
+		}
+		rec.fields = w.append(fields.data(), fields.size() * sizeof(ArchiveField), fields.size());
+
+		// methods
+		std::vector<ArchiveMethod> methods(c->methods_.size());
+		for (size_t k = 0; k < methods.size(); ++k) {
+			Method* method = c->methods_[k];
+			ArchiveMethod& am = methods[k];
+			memset(&am, 0, sizeof(am));
+			am.flags = (uint16_t) method->flags_;
+			am.nameId = slotOf[method->name_];
+			am.descriptorId = slotOf[method->signature_];
+			method->materialize();
+			am.maxStack = method->maxStack_;
+			am.maxLocals = method->maxLocals_;
+			am.deprecated = method->isDeprecated_;
+			am.code = w.append(method->code_.data(), method->code_.size(), method->code_.size());
+			am.exceptionTable = w.append(method->exceptionTable_.data(),
+				method->exceptionTable_.size() * sizeof(Method::ExceptionHandler),
+				method->exceptionTable_.size());
+			am.lineNumberTable = w.append(method->lineNumberTable_.data(),
+				method->lineNumberTable_.size() * sizeof(Method::LineNumber),
+				method->lineNumberTable_.size());
+		}
+		rec.methods = w.append(methods.data(), methods.size() * sizeof(ArchiveMethod), methods.size());
+
+		w.align();
+		rec.data = ArchiveRef{dataBegin, (uint32_t) (w.size() - dataBegin)};
+		rec.dataChecksum = crc32(w.data() + dataBegin, rec.data.count);
+
+		*w.at<ClassRecord>(classesOffset + ci * sizeof(ClassRecord)) = rec;
+
+		uint32_t* buckets = w.at<uint32_t>(bucketsOffset);
+		uint32_t b = rec.nameHash & (bucketCount - 1);
+		while (buckets[b])
+			b = (b + 1) & (bucketCount - 1);
+		buckets[b] = ci + 1;
+	}
+
+	Header* header = w.at<Header>(headerOffset);
+	memcpy(header->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+	header->version = ARCHIVE_VERSION;
+	header->classCount = classes.size();
+	header->bucketCount = bucketCount;
+	header->bucketsOffset = bucketsOffset;
+	header->classesOffset = classesOffset;
+	header->checksum = 0;
+	header->size = w.size();
+	header->checksum = crc32(w.data(), classesOffset + classes.size() * sizeof(ClassRecord));
+
+	// write to a temporary file first, so concurrent readers never see a partial archive
+	std::string tmp = path + ".tmp";
+	int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		perror("open");
+		return false;
+	}
+
+	for (size_t n = 0; n < w.size(); ) {
+		ssize_t rv = ::write(fd, w.data() + n, w.size() - n);
+		if (rv <= 0) {
+			perror("write");
+			close(fd);
+			unlink(tmp.c_str());
+			return false;
+		}
+		n += rv;
+	}
+	close(fd);
+
+	if (rename(tmp.c_str(), path.c_str()) < 0) {
+		perror("rename");
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	return true;
+}
+// }}}
+
+// {{{ reader
+ClassArchive::ClassArchive(std::shared_ptr<ClassfileBuffer> buffer) :
+	buffer_(buffer),
+	header_((const Header*) buffer->data()),
+	classes_((const ClassRecord*) (buffer->data() + header_->classesOffset)),
+	buckets_((const uint32_t*) (buffer->data() + header_->bucketsOffset)),
+	instances_(new std::atomic<Class*>[header_->classCount]),
+	loaded_(0),
+	stale_(0)
+{
+	for (size_t i = 0; i < header_->classCount; ++i)
+		instances_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ClassArchive::~ClassArchive()
+{
+	delete[] instances_;
+}
+
+ClassArchive* ClassArchive::open(const std::string& path)
+{
+	std::shared_ptr<ClassfileBuffer> buffer = ClassfileBuffer::map(path.c_str());
+	if (!buffer)
+		return nullptr;
+
+	if (buffer->size() < sizeof(Header)) {
+		printf("WARNING: %s: not a class archive\n", path.c_str());
+		return nullptr;
+	}
+
+	Header header = *(const Header*) buffer->data();
+	if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || header.version != ARCHIVE_VERSION) {
+		printf("WARNING: %s: not a class archive or of a different version\n", path.c_str());
+		return nullptr;
+	}
+
+	uint64_t indexEnd = (uint64_t) header.classesOffset + (uint64_t) header.classCount * sizeof(ClassRecord);
+	if (header.size != buffer->size() || indexEnd > buffer->size()
+			|| (uint64_t) header.bucketsOffset + header.bucketCount * sizeof(uint32_t) > buffer->size()) {
+		printf("WARNING: %s: truncated class archive\n", path.c_str());
+		return nullptr;
+	}
+
+	// only the index is verified up front, class records are verified when instantiated
+	std::vector<uint8_t> index(buffer->data(), buffer->data() + indexEnd);
+	((Header*) index.data())->checksum = 0;
+	if (crc32(index.data(), index.size()) != header.checksum) {
+		printf("WARNING: %s: class archive checksum mismatch\n", path.c_str());
+		return nullptr;
+	}
+
+	return new ClassArchive(buffer);
+}
+
+size_t ClassArchive::size() const
+{
+	return header_->classCount;
+}
+
+uint32_t ClassArchive::find(const char* name, size_t length) const
+{
+	uint32_t mask = header_->bucketCount - 1;
+	for (uint32_t b = hashName(name, length) & mask; buckets_[b]; b = (b + 1) & mask) {
+		uint32_t index = buckets_[b] - 1;
+		if (index >= header_->classCount)
+			return NoIndex;
+
+		const ClassRecord& rec = classes_[index];
+		if (rec.name.count == length && memcmp(buffer_->data() + rec.name.offset, name, length) == 0)
+			return index;
+	}
+
+	return NoIndex;
+}
+
+const char* ClassArchive::name(uint32_t index, size_t* length) const
+{
+	const ClassRecord& rec = classes_[index];
+	*length = rec.name.count;
+	return (const char*) buffer_->data() + rec.name.offset;
+}
+
+ClassArchive::Source ClassArchive::source(uint32_t index) const
+{
+	const ClassRecord& rec = classes_[index];
+	return Source{rec.sourceMtime, rec.sourceSize, rec.sourceCrc};
+}
+
+uint32_t ClassArchive::superIndex(uint32_t index) const
+{
+	return classes_[index].superIndex;
+}
+
+Class* ClassArchive::instantiate(uint32_t index)
+{
+	const uint8_t* base = buffer_->data();
+	const ClassRecord& rec = classes_[index];
+
+	if ((uint64_t) rec.data.offset + rec.data.count > buffer_->size()
+			|| crc32(base + rec.data.offset, rec.data.count) != rec.dataChecksum) {
+		printf("WARNING: class archive record #%u is corrupt\n", index);
+		return nullptr;
+	}
+
+	Class* c = new Class();
+	c->classfile_ = buffer_;
+	c->major_ = rec.major;
+	c->minor_ = rec.minor;
+	c->flags_ = (ClassFlags) rec.flags;
+	if (rec.superName.count)
+		c->superClassName_ = SymbolTable::global().intern((const char*) base + rec.superName.offset, rec.superName.count);
+	c->sourceFile_.assign((const char*) base + rec.sourceFile.offset, rec.sourceFile.count);
+
+	// constant pool, copied as is, with Utf8 constants viewing into the archive
+	ConstantPool& pool = c->constantPool;
+	pool.allocate(c->arena_, rec.constantCount);
+	if (rec.constantCount) {
+		memcpy(pool.tags_, base + rec.constantTags.offset, rec.constantCount);
+		memcpy(pool.refs_, base + rec.constantRefs.offset, rec.constantCount * sizeof(ConstantPool::Ref));
+		memcpy(pool.values_, base + rec.constantValues.offset, rec.constantCount * sizeof(uint64_t));
+	}
+
+	for (size_t k = 1; k < rec.constantCount; ++k) {
+		if (pool.tag(k) == ConstantTag::Utf8) {
+			const uint8_t* data = base + pool.values_[k];
+			pool.values_[k] = (uintptr_t) new (c->arena_.allocate(sizeof(ConstantUtf8), alignof(ConstantUtf8)))
+				ConstantUtf8(pool.refs_[k].a, data, pool.refs_[k].b != 0);
+		}
+	}
+
+	if (!pool.verify()) {
+		printf("WARNING: class archive record #%u has a malformed constant pool\n", index);
+		delete c;
+		return nullptr;
+	}
+
+	c->thisClassId_ = rec.thisClassId;
+	c->name_ = SymbolTable::global().intern((const char*) base + rec.name.offset, rec.name.count);
+
+	auto symbolAt = [&](uint16_t id) -> const Symbol* {
+		ConstantUtf8* utf8 = pool.utf8(id);
+		return utf8 ? utf8->symbol() : nullptr;
+	};
+
+	// interfaces
+	const ArchiveInterface* interfaces = (const ArchiveInterface*) (base + rec.interfaces.offset);
+	c->interfaceIds_.resize(rec.interfaces.count);
+	c->interfaces_.resize(rec.interfaces.count);
+	for (size_t k = 0; k < rec.interfaces.count; ++k) {
+		c->interfaceIds_[k] = interfaces[k].id;
+		c->interfaces_[k] = instanceAt(interfaces[k].archiveIndex);
+	}
+
+	// link supertypes that already got instantiated from this archive right
+	// away, so resolveClass() only has to lay out the class.
+	c->superClass_ = instanceAt(rec.superIndex);
+
+	// fields
+	const ArchiveField* fields = (const ArchiveField*) (base + rec.fields.offset);
+	c->fields_.resize(rec.fields.count);
+	for (size_t k = 0; k < rec.fields.count; ++k) {
+		const ArchiveField& af = fields[k];
+		const Symbol* name = symbolAt(af.nameId);
+		const Symbol* descriptor = symbolAt(af.descriptorId);
+		if (!name || !descriptor) {
+			printf("WARNING: class archive record #%u has an invalid field\n", index);
+			delete c;
+			return nullptr;
+		}
+
+		Field* field = c->arena_.construct<Field>(c, name, descriptor,
+			(FieldFlags) af.flags);
+
+		const uint32_t* offsets = (const uint32_t*) (base + af.attributes.offset);
+		const Attribute** attributes = c->arena_.allocateArray<const Attribute*>(af.attributes.count);
+		for (size_t a = 0; a < af.attributes.count; ++a)
+			attributes[a] = (const Attribute*) (base + offsets[a]);
+		field->attributes_ = ArrayView<const Attribute*>(attributes, af.attributes.count);
+
+		c->fields_[k] = field;
+	}
+
+	// methods
+	const ArchiveMethod* methods = (const ArchiveMethod*) (base + rec.methods.offset);
+	c->methods_.reserve(rec.methods.count);
+	for (size_t k = 0; k < rec.methods.count; ++k) {
+		const ArchiveMethod& am = methods[k];
+		const Symbol* name = symbolAt(am.nameId);
+		const Symbol* descriptor = symbolAt(am.descriptorId);
+		if (!name || !descriptor) {
+			printf("WARNING: class archive record #%u has an invalid method\n", index);
+			delete c;
+			return nullptr;
+		}
+
+		Method* method = c->arena_.construct<Method>(c, name, descriptor,
+			(MethodFlags) am.flags);
+
+		method->maxStack_ = am.maxStack;
+		method->maxLocals_ = am.maxLocals;
+		method->isDeprecated_ = am.deprecated;
+		method->code_ = ByteView(base + am.code.offset, am.code.count);
+
+		method->exceptionTable_ = ArrayView<Method::ExceptionHandler>(
+			(const Method::ExceptionHandler*) (base + am.exceptionTable.offset), am.exceptionTable.count);
+		method->lineNumberTable_ = ArrayView<Method::LineNumber>(
+			(const Method::LineNumber*) (base + am.lineNumberTable.offset), am.lineNumberTable.count);
+
+		c->methods_.push_back(method);
+	}
+
+	++loaded_;
+	return c;
+}
+
+void ClassArchive::registerInstance(uint32_t index, Class* c)
+{
+	instances_[index].store(c, std::memory_order_release);
+}
+
+Class* ClassArchive::instanceAt(uint32_t index) const
+{
+	return index < header_->classCount ? instances_[index].load(std::memory_order_acquire) : nullptr;
+}
+// }}}
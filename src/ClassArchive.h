@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+class Class;
+class ClassfileBuffer;
+
+/**
+ * Class-data-sharing archive.
+ *
+ * An archive holds the parsed and linked metadata of a set of classes in a
+ * position-independent layout (all references are offsets relative to the
+ * archive start), so that a process can mmap it and instantiate its classes
+ * without parsing any classfile. Utf8 constants and method bytecode of such
+ * classes are views into the archive mapping.
+ *
+ * Every archived class records the modification time, size and CRC-32 of
+ * the classfile it was created from, so callers can detect changed classes
+ * and fall back to regular loading.
+ */
+class ClassArchive {
+public:
+	static const uint32_t NoIndex = 0xFFFFFFFF;
+
+	//! describes the classfile an archived class was created from
+	struct Source {
+		uint64_t mtime;
+		uint64_t size;
+		uint32_t crc;
+	};
+
+	struct Header;
+	struct ClassRecord;
+
+private:
+	std::shared_ptr<ClassfileBuffer> buffer_;
+	const Header* header_;
+	const ClassRecord* classes_;
+	const uint32_t* buckets_;
+	std::atomic<Class*>* instances_;
+
+	std::atomic<uint64_t> loaded_;
+	std::atomic<uint64_t> stale_;
+
+	explicit ClassArchive(std::shared_ptr<ClassfileBuffer> buffer);
+
+public:
+	~ClassArchive();
+
+	/**
+	 * Maps an archive file and validates its header.
+	 *
+	 * @return the archive or \p nullptr if missing, corrupt or of a different version.
+	 */
+	static ClassArchive* open(const std::string& path);
+
+	/**
+	 * Writes an archive of given (parsed and ideally resolved) classes.
+	 *
+	 * @param path archive file to create.
+	 * @param classes classes to archive.
+	 * @param sources classfile change-detection data, one per class.
+	 */
+	static bool write(const std::string& path,
+	                  const std::vector<Class*>& classes,
+	                  const std::vector<Source>& sources);
+
+	//! CRC-32 (IEEE 802.3, as used by zip) of given bytes.
+	static uint32_t crc32(const uint8_t* data, size_t size);
+
+	size_t size() const;
+
+	//! Finds an archived class by binary name, i.e. "java/lang/Object".
+	uint32_t find(const char* name, size_t length) const;
+
+	const char* name(uint32_t index, size_t* length) const;
+	Source source(uint32_t index) const;
+	uint32_t superIndex(uint32_t index) const;
+
+	/**
+	 * Instantiates an archived class.
+	 *
+	 * Supertypes that are archived as well and already registered are linked
+	 * right away, without resolving them by name.
+	 *
+	 * @return the new class or \p nullptr if its archive record is corrupt.
+	 */
+	Class* instantiate(uint32_t index);
+
+	//! Registers the (published) class instantiated from given archive index.
+	void registerInstance(uint32_t index, Class* c);
+	Class* instanceAt(uint32_t index) const;
+
+	//! Marks an archived class as out of date, i.e. its classfile changed.
+	void markStale() { ++stale_; }
+
+	uint64_t loadedCount() const { return loaded_; }
+	uint64_t staleCount() const { return stale_; }
+};
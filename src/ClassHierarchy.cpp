@@ -0,0 +1,126 @@
+#include "ClassHierarchy.h"
+#include "Class.h"
+
+#include <algorithm>
+
+void ClassHierarchy::add(Class* c)
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	++classCount_;
+
+	// the vtable starts with the superclass' one, overriding methods taking over their slots
+	Class* super = c->superClass();
+	if (super && super->isLaidOut()) {
+		subclasses_[super].push_back(c);
+
+		size_t inherited = std::min(super->vtable().size(), c->vtable().size());
+		for (size_t i = 0; i < inherited; ++i)
+			if (c->vtableAt(i) != super->vtableAt(i))
+				overridden_.insert(super->vtableAt(i));
+	}
+
+	if (!c->isInterface())
+		for (const Class::Itable& itable: c->itables())
+			implementors_[itable.interface].push_back(c);
+}
+
+std::vector<Class*> ClassHierarchy::subclasses(const Class* c) const
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	auto i = subclasses_.find(c);
+	return i != subclasses_.end() ? i->second : std::vector<Class*>();
+}
+
+std::vector<Class*> ClassHierarchy::implementors(const Class* interface) const
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	auto i = implementors_.find(interface);
+	return i != implementors_.end() ? i->second : std::vector<Class*>();
+}
+
+bool ClassHierarchy::hasSubclasses(const Class* c) const
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	return subclasses_.count(c) != 0;
+}
+
+bool ClassHierarchy::isOverridden(const Method* method) const
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	return overridden_.count(method) != 0;
+}
+
+size_t ClassHierarchy::classCount() const
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	return classCount_;
+}
+
+void ClassHierarchy::collectSubclasses(const Class* c, std::vector<Class*>& result) const
+{
+	auto i = subclasses_.find(c);
+	if (i == subclasses_.end())
+		return;
+
+	for (Class* subclass: i->second) {
+		result.push_back(subclass);
+		collectSubclasses(subclass, result);
+	}
+}
+
+Method* ClassHierarchy::uniqueTarget(Method* method, Dependency& dependency) const
+{
+	Class* type = method->thisClass();
+	std::lock_guard<std::mutex> _l(lock_);
+
+	if (!type->isInterface()) {
+		if (!method->isVirtual() || method->isAbstract() || overridden_.count(method))
+			return nullptr;
+		dependency = Dependency::notOverridden(method);
+		return method;
+	}
+
+	if (method->itableIndex() == Method::NoItableIndex)
+		return nullptr;
+
+	auto i = implementors_.find(type);
+	if (i == implementors_.end())
+		return nullptr;
+
+	Method* target = nullptr;
+	for (Class* c: i->second) {
+		if (c->isAbstract())
+			continue;
+		Method* selected = c->itableLookup(method);
+		if (!selected || selected->isAbstract() || (target && selected != target))
+			return nullptr;
+		target = selected;
+	}
+	if (!target)
+		return nullptr;
+
+	dependency = Dependency::uniqueTarget(type, method, target);
+	return target;
+}
+
+bool ClassHierarchy::holds(const Dependency& dependency) const
+{
+	std::lock_guard<std::mutex> _l(lock_);
+
+	if (dependency.kind == Dependency::Kind::NotOverridden && !dependency.type->isInterface())
+		return !overridden_.count(dependency.method);
+
+	std::vector<Class*> candidates;
+	if (dependency.type->isInterface()) {
+		auto i = implementors_.find(dependency.type);
+		if (i != implementors_.end())
+			candidates = i->second;
+	} else {
+		collectSubclasses(dependency.type, candidates);
+	}
+
+	for (Class* c: candidates)
+		if (dependency.isBrokenBy(c))
+			return false;
+	return true;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Dependencies.h"
+#include <stddef.h>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+class Class;
+class Method;
+
+/**
+ * Class hierarchy analysis: the subclasses, interface implementors and
+ * overridden methods among the classes laid out so far, maintained
+ * incrementally as each one gets laid out (see VMClassLoader).
+ *
+ * It lets the JIT prove a virtual or interface call monomorphic, which only
+ * holds until another class gets loaded: code relying on it records the
+ * Dependency that uniqueTarget() returns along, and gets invalidated by
+ * the class breaking it (see DependencyTable).
+ */
+class ClassHierarchy {
+private:
+	mutable std::mutex lock_;
+	std::unordered_map<const Class*, std::vector<Class*>> subclasses_;    //!< direct ones, by superclass
+	std::unordered_map<const Class*, std::vector<Class*>> implementors_;  //!< classes, by interface implemented
+	std::unordered_set<const Method*> overridden_;                         //!< by a method of some subclass
+	size_t classCount_;
+
+public:
+	ClassHierarchy() : lock_(), subclasses_(), implementors_(), overridden_(), classCount_(0) {}
+
+	ClassHierarchy(const ClassHierarchy&) = delete;
+	ClassHierarchy& operator=(const ClassHierarchy&) = delete;
+
+	//! Adds \p c, once laid out, along with the methods it overrides.
+	void add(Class* c);
+
+	//! Direct subclasses of \p c.
+	std::vector<Class*> subclasses(const Class* c) const;
+
+	//! Classes implementing \p interface, directly or inherited, but no interfaces.
+	std::vector<Class*> implementors(const Class* interface) const;
+
+	bool hasSubclasses(const Class* c) const;
+
+	//! Whether a subclass of its class overrides the virtual \p method.
+	bool isOverridden(const Method* method) const;
+
+	/**
+	 * The only method that a call of the virtual or interface \p method
+	 * can select with the classes loaded so far.
+	 *
+	 * @param dependency receives the assumption this relies on.
+	 * @return \p nullptr if there is more than one, or none.
+	 */
+	Method* uniqueTarget(Method* method, Dependency& dependency) const;
+
+	//! Whether no class loaded so far breaks \p dependency.
+	bool holds(const Dependency& dependency) const;
+
+	size_t classCount() const;
+
+private:
+	void collectSubclasses(const Class* c, std::vector<Class*>& result) const;
+};
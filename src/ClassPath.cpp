@@ -0,0 +1,302 @@
+#include "ClassPath.h"
+#include "ClassfileBuffer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+ClassPathEntry* ClassPathEntry::create(const std::string& path)
+{
+	struct stat st;
+	if (::stat(path.c_str(), &st) < 0)
+		return nullptr;
+
+	if (S_ISDIR(st.st_mode))
+		return new DirectoryClassPath(path);
+
+	JarClassPath* jar = new JarClassPath(path);
+	if (!jar->open()) {
+		delete jar;
+		return nullptr;
+	}
+
+	return jar;
+}
+
+// {{{ DirectoryClassPath
+DirectoryClassPath::DirectoryClassPath(const std::string& path) :
+	ClassPathEntry(path)
+{
+}
+
+std::shared_ptr<ClassfileBuffer> DirectoryClassPath::open(const std::string& fileName, bool mapped)
+{
+	std::string path = path_;
+	path += "/";
+	path += fileName;
+
+	return mapped
+		? ClassfileBuffer::map(path.c_str())
+		: ClassfileBuffer::read(path.c_str());
+}
+
+bool DirectoryClassPath::stat(const std::string& fileName, FileInfo& info)
+{
+	std::string path = path_;
+	path += "/";
+	path += fileName;
+
+	struct stat st;
+	if (::stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	info.mtime = (uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	info.size = st.st_size;
+	info.crc = 0;
+	info.hasCrc = false;
+	return true;
+}
+
+static bool endsWith(const char* s, size_t n, const char* suffix, size_t m)
+{
+	return n >= m && memcmp(s + n - m, suffix, m) == 0;
+}
+
+void DirectoryClassPath::list(std::vector<std::string>& classNames) const
+{
+	list(std::string(), classNames);
+}
+
+void DirectoryClassPath::list(const std::string& dir, std::vector<std::string>& classNames) const
+{
+	std::string path = dir.empty() ? path_ : path_ + "/" + dir;
+
+	DIR* d = opendir(path.c_str());
+	if (!d)
+		return;
+
+	while (struct dirent* de = readdir(d)) {
+		const char* name = de->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+
+		std::string rel = dir.empty() ? name : dir + "/" + name;
+
+		bool isDir = de->d_type == DT_DIR;
+		bool isFile = de->d_type == DT_REG;
+		if (de->d_type == DT_UNKNOWN || de->d_type == DT_LNK) {
+			struct stat st;
+			if (::stat((path + "/" + name).c_str(), &st) < 0)
+				continue;
+			isDir = S_ISDIR(st.st_mode);
+			isFile = S_ISREG(st.st_mode);
+		}
+
+		if (isDir)
+			list(rel, classNames);
+		else if (isFile && endsWith(rel.data(), rel.size(), ".class", 6))
+			classNames.push_back(rel.substr(0, rel.size() - 6));
+	}
+
+	closedir(d);
+}
+// }}}
+
+// {{{ JarClassPath
+// zip fields are little endian and not necessarily aligned
+static inline uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static inline uint32_t le32(const uint8_t* p) { return le16(p) | ((uint32_t) le16(p + 2) << 16); }
+
+enum {
+	ZIP_LOCAL_HEADER_SIG = 0x04034b50,
+	ZIP_LOCAL_HEADER_SIZE = 30,
+	ZIP_CENTRAL_HEADER_SIG = 0x02014b50,
+	ZIP_CENTRAL_HEADER_SIZE = 46,
+	ZIP_END_OF_CENTRAL_DIR_SIG = 0x06054b50,
+	ZIP_END_OF_CENTRAL_DIR_SIZE = 22,
+};
+
+JarClassPath::JarClassPath(const std::string& path) :
+	ClassPathEntry(path),
+	archive_(),
+	entries_(),
+	inflater_(nullptr),
+	inflaterLock_()
+{
+}
+
+JarClassPath::~JarClassPath()
+{
+#if defined(HAVE_ZLIB)
+	if (z_stream* z = (z_stream*) inflater_) {
+		inflateEnd(z);
+		delete z;
+	}
+#endif
+}
+
+bool JarClassPath::open()
+{
+	archive_ = ClassfileBuffer::map(path_.c_str());
+	if (!archive_)
+		return false;
+
+	const uint8_t* data = archive_->data();
+	size_t size = archive_->size();
+
+	if (size < ZIP_END_OF_CENTRAL_DIR_SIZE)
+		return false;
+
+	// the end-of-central-directory record is followed by an up to 64k comment
+	size_t eocd = size - ZIP_END_OF_CENTRAL_DIR_SIZE;
+	size_t lowest = size > ZIP_END_OF_CENTRAL_DIR_SIZE + 0xFFFF ? size - ZIP_END_OF_CENTRAL_DIR_SIZE - 0xFFFF : 0;
+	while (le32(data + eocd) != ZIP_END_OF_CENTRAL_DIR_SIG) {
+		if (eocd == lowest) {
+			printf("WARNING: %s: not a zip archive\n", path_.c_str());
+			return false;
+		}
+		--eocd;
+	}
+
+	uint16_t count = le16(data + eocd + 10);
+	uint32_t cdSize = le32(data + eocd + 12);
+	uint32_t cdOffset = le32(data + eocd + 16);
+
+	if ((size_t) cdOffset + cdSize > size) {
+		printf("WARNING: %s: corrupt central directory (possibly zip64, which is unsupported)\n", path_.c_str());
+		return false;
+	}
+
+	entries_.reserve(count);
+
+	const uint8_t* p = data + cdOffset;
+	const uint8_t* end = p + cdSize;
+	for (uint16_t i = 0; i < count; ++i) {
+		if (p + ZIP_CENTRAL_HEADER_SIZE > end || le32(p) != ZIP_CENTRAL_HEADER_SIG) {
+			printf("WARNING: %s: corrupt central directory entry #%u\n", path_.c_str(), i);
+			return false;
+		}
+
+		Entry entry;
+		entry.method = le16(p + 10);
+		entry.modified = (le16(p + 14) << 16) | le16(p + 12);
+		entry.crc = le32(p + 16);
+		entry.compressedSize = le32(p + 20);
+		entry.uncompressedSize = le32(p + 24);
+		uint16_t nameLength = le16(p + 28);
+		uint16_t extraLength = le16(p + 30);
+		uint16_t commentLength = le16(p + 32);
+		entry.localHeaderOffset = le32(p + 42);
+
+		const uint8_t* name = p + ZIP_CENTRAL_HEADER_SIZE;
+		p = name + nameLength + extraLength + commentLength;
+		if (p > end) {
+			printf("WARNING: %s: corrupt central directory entry #%u\n", path_.c_str(), i);
+			return false;
+		}
+
+		if (nameLength && name[nameLength - 1] != '/')
+			entries_[std::string((const char*) name, nameLength)] = entry;
+	}
+
+	return true;
+}
+
+std::shared_ptr<ClassfileBuffer> JarClassPath::open(const std::string& fileName, bool /*mapped*/)
+{
+	auto i = entries_.find(fileName);
+	if (i == entries_.end())
+		return nullptr;
+
+	const Entry& entry = i->second;
+	const uint8_t* archive = archive_->data();
+	size_t size = archive_->size();
+
+	// the local header's extra field may differ from the central directory's
+	size_t offset = entry.localHeaderOffset;
+	if (offset + ZIP_LOCAL_HEADER_SIZE > size || le32(archive + offset) != ZIP_LOCAL_HEADER_SIG)
+		return nullptr;
+
+	offset += ZIP_LOCAL_HEADER_SIZE + le16(archive + offset + 26) + le16(archive + offset + 28);
+	if (offset + entry.compressedSize > size)
+		return nullptr;
+
+	switch (entry.method) {
+		case 0: // stored
+			return ClassfileBuffer::subrange(archive_, offset, entry.compressedSize);
+		case 8: // deflated
+			return inflate(archive + offset, entry);
+		default:
+			printf("WARNING: %s: %s uses unsupported compression method %u\n",
+				path_.c_str(), fileName.c_str(), entry.method);
+			return nullptr;
+	}
+}
+
+void JarClassPath::list(std::vector<std::string>& classNames) const
+{
+	for (const auto& i: entries_) {
+		const std::string& name = i.first;
+		if (endsWith(name.data(), name.size(), ".class", 6))
+			classNames.push_back(name.substr(0, name.size() - 6));
+	}
+}
+
+bool JarClassPath::stat(const std::string& fileName, FileInfo& info)
+{
+	auto i = entries_.find(fileName);
+	if (i == entries_.end())
+		return false;
+
+	info.mtime = i->second.modified;
+	info.size = i->second.uncompressedSize;
+	info.crc = i->second.crc;
+	info.hasCrc = true;
+	return true;
+}
+
+std::shared_ptr<ClassfileBuffer> JarClassPath::inflate(const uint8_t* data, const Entry& entry)
+{
+#if defined(HAVE_ZLIB)
+	std::lock_guard<std::mutex> _l(inflaterLock_);
+
+	z_stream* z = (z_stream*) inflater_;
+	if (!z) {
+		z = new z_stream();
+		if (inflateInit2(z, -MAX_WBITS) != Z_OK) { // raw deflate stream, no zlib header
+			delete z;
+			return nullptr;
+		}
+		inflater_ = z;
+	} else {
+		inflateReset(z);
+	}
+
+	// the uncompressed size is known up front, so inflate straight into the
+	// buffer the class will keep viewing into.
+	uint8_t* out = new uint8_t[entry.uncompressedSize];
+
+	z->next_in = (Bytef*) data;
+	z->avail_in = entry.compressedSize;
+	z->next_out = out;
+	z->avail_out = entry.uncompressedSize;
+
+	if (::inflate(z, Z_FINISH) != Z_STREAM_END || z->total_out != entry.uncompressedSize) {
+		delete[] out;
+		return nullptr;
+	}
+
+	return ClassfileBuffer::adopt(out, entry.uncompressedSize);
+#else
+	printf("WARNING: %s: deflated entries are unsupported (built without zlib)\n", path_.c_str());
+	return nullptr;
+#endif
+}
+// }}}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+class ClassfileBuffer;
+
+/**
+ * A single classpath element, such as a directory or a .jar archive.
+ */
+class ClassPathEntry {
+public:
+	//! change-detection data of a classfile
+	struct FileInfo {
+		uint64_t mtime;     //!< modification time (entry specific encoding)
+		uint64_t size;      //!< uncompressed size in bytes
+		uint32_t crc;       //!< CRC-32 of the contents, if \p hasCrc
+		bool hasCrc;
+	};
+
+protected:
+	std::string path_;
+
+	explicit ClassPathEntry(const std::string& path) : path_(path) {}
+
+public:
+	virtual ~ClassPathEntry() {}
+
+	const std::string& path() const { return path_; }
+
+	/**
+	 * Opens a classfile within this classpath element.
+	 *
+	 * @param fileName relative file name, i.e. "java/lang/Object.class".
+	 * @param mapped whether to mmap the file instead of reading it into memory.
+	 * @return the classfile contents or \p nullptr if not found.
+	 */
+	virtual std::shared_ptr<ClassfileBuffer> open(const std::string& fileName, bool mapped) = 0;
+
+	/**
+	 * Appends the binary names of all classes within this element,
+	 * i.e. "java/lang/Object", to \p classNames.
+	 */
+	virtual void list(std::vector<std::string>& classNames) const = 0;
+
+	/**
+	 * Retrieves change-detection data of given classfile without opening it.
+	 *
+	 * @return whether this element provides \p fileName.
+	 */
+	virtual bool stat(const std::string& fileName, FileInfo& info) = 0;
+
+	/**
+	 * Creates the classpath element for given path, a directory or .jar/.zip file.
+	 *
+	 * @return the new entry or \p nullptr if \p path could not be opened.
+	 */
+	static ClassPathEntry* create(const std::string& path);
+};
+
+class DirectoryClassPath : public ClassPathEntry {
+public:
+	explicit DirectoryClassPath(const std::string& path);
+
+	virtual std::shared_ptr<ClassfileBuffer> open(const std::string& fileName, bool mapped);
+	virtual void list(std::vector<std::string>& classNames) const;
+	virtual bool stat(const std::string& fileName, FileInfo& info);
+
+	//! Appends the classes below the relative subdirectory \p dir (empty for the root).
+	void list(const std::string& dir, std::vector<std::string>& classNames) const;
+};
+
+/**
+ * A .jar (zip) archive, mapped once and indexed by its central directory.
+ *
+ * Stored entries are served as views into the archive mapping, deflated
+ * entries are inflated on demand.
+ */
+class JarClassPath : public ClassPathEntry {
+public:
+	struct Entry {
+		uint16_t method;            //!< compression method (0 = stored, 8 = deflated)
+		uint32_t modified;          //!< MS-DOS date (high word) and time (low word)
+		uint32_t crc;
+		uint32_t compressedSize;
+		uint32_t uncompressedSize;
+		uint32_t localHeaderOffset;
+	};
+
+private:
+	std::shared_ptr<ClassfileBuffer> archive_;
+	std::unordered_map<std::string, Entry> entries_;
+	void* inflater_; //!< z_stream, reused across inflations
+	std::mutex inflaterLock_;
+
+public:
+	explicit JarClassPath(const std::string& path);
+	~JarClassPath();
+
+	//! Maps the archive and reads its central directory.
+	bool open();
+
+	size_t size() const { return entries_.size(); }
+	const std::unordered_map<std::string, Entry>& entries() const { return entries_; }
+
+	virtual std::shared_ptr<ClassfileBuffer> open(const std::string& fileName, bool mapped);
+	virtual void list(std::vector<std::string>& classNames) const;
+	virtual bool stat(const std::string& fileName, FileInfo& info);
+
+private:
+	std::shared_ptr<ClassfileBuffer> inflate(const uint8_t* data, const Entry& entry);
+};
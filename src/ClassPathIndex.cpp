@@ -0,0 +1,222 @@
+#include "ClassPathIndex.h"
+#include "ClassPath.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <algorithm>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
+
+ClassPathIndex::ClassPathIndex() :
+	classes_(),
+	positions_(),
+	lock_(),
+	inotify_(-1),
+	watches_(),
+	hits_(0),
+	misses_(0)
+{
+}
+
+ClassPathIndex::~ClassPathIndex()
+{
+	if (inotify_ >= 0)
+		close(inotify_);
+}
+
+void ClassPathIndex::build(const std::vector<ClassPathEntry*>& classpath)
+{
+	std::vector<std::vector<std::string>> results(classpath.size());
+	std::atomic<size_t> next(0);
+
+	auto scan = [&]() {
+		for (size_t i = next++; i < classpath.size(); i = next++)
+			classpath[i]->list(results[i]);
+	};
+
+	size_t workerCount = std::min<size_t>(classpath.size(), std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < workerCount; ++i)
+		workers.push_back(std::thread(scan));
+
+	scan();
+
+	for (std::thread& worker: workers)
+		worker.join();
+
+	std::lock_guard<std::mutex> _l(lock_);
+	classes_.clear();
+	positions_.clear();
+	for (size_t i = 0; i < classpath.size(); ++i) {
+		positions_.emplace(classpath[i], i);
+		insert(results[i], classpath[i]);
+	}
+}
+
+void ClassPathIndex::add(ClassPathEntry* entry)
+{
+	std::vector<std::string> classNames;
+	entry->list(classNames);
+
+	std::lock_guard<std::mutex> _l(lock_);
+	positions_.emplace(entry, positions_.size());
+	insert(classNames, entry);
+
+	if (isWatching())
+		if (DirectoryClassPath* dir = dynamic_cast<DirectoryClassPath*>(entry))
+			addWatch(dir, std::string());
+}
+
+void ClassPathIndex::insert(const std::vector<std::string>& classNames, ClassPathEntry* entry)
+{
+	classes_.reserve(classes_.size() + classNames.size());
+
+	// emplace() keeps existing mappings, so earlier elements take precedence
+	for (const std::string& className: classNames)
+		classes_.emplace(className, entry);
+}
+
+void ClassPathIndex::update(const std::vector<std::string>& classNames, ClassPathEntry* entry)
+{
+	size_t position = positions_[entry];
+	for (const std::string& className: classNames) {
+		auto i = classes_.emplace(className, entry);
+		if (!i.second && positions_[i.first->second] > position)
+			i.first->second = entry;
+	}
+}
+
+ClassPathEntry* ClassPathIndex::find(const std::string& className)
+{
+	// only polling changes the index while classes are being loaded
+	std::unique_lock<std::mutex> l(lock_, std::defer_lock);
+	if (isWatching())
+		l.lock();
+
+	auto i = classes_.find(className);
+	if (i == classes_.end() && isWatching() && poll())
+		i = classes_.find(className);
+
+	if (i == classes_.end()) {
+		++misses_;
+		return nullptr;
+	}
+
+	++hits_;
+	return i->second;
+}
+
+// {{{ inotify
+#if defined(__linux__)
+bool ClassPathIndex::watch(const std::vector<ClassPathEntry*>& classpath)
+{
+	if (inotify_ < 0) {
+		inotify_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify_ < 0) {
+			perror("inotify_init1");
+			return false;
+		}
+	}
+
+	std::lock_guard<std::mutex> _l(lock_);
+
+	for (ClassPathEntry* entry: classpath)
+		if (DirectoryClassPath* dir = dynamic_cast<DirectoryClassPath*>(entry))
+			addWatch(dir, std::string());
+
+	return true;
+}
+
+void ClassPathIndex::addWatch(DirectoryClassPath* entry, const std::string& dir)
+{
+	std::string path = dir.empty() ? entry->path() : entry->path() + "/" + dir;
+
+	int wd = inotify_add_watch(inotify_, path.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+	if (wd < 0)
+		return;
+
+	watches_[wd] = std::make_pair(entry, dir);
+
+	DIR* d = opendir(path.c_str());
+	if (!d)
+		return;
+
+	while (struct dirent* de = readdir(d)) {
+		const char* name = de->d_name;
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+
+		struct stat st;
+		if (de->d_type == DT_DIR || ((de->d_type == DT_UNKNOWN || de->d_type == DT_LNK)
+				&& stat((path + "/" + name).c_str(), &st) == 0 && S_ISDIR(st.st_mode)))
+			addWatch(entry, dir.empty() ? name : dir + "/" + name);
+	}
+
+	closedir(d);
+}
+
+bool ClassPathIndex::poll()
+{
+	bool added = false;
+	alignas(struct inotify_event) char buf[4096];
+
+	for (;;) {
+		ssize_t n = read(inotify_, buf, sizeof(buf));
+		if (n <= 0)
+			break;
+
+		for (char* p = buf; p < buf + n; ) {
+			struct inotify_event* ev = (struct inotify_event*) p;
+			p += sizeof(struct inotify_event) + ev->len;
+
+			auto w = watches_.find(ev->wd);
+			if (w == watches_.end() || !ev->len)
+				continue;
+
+			DirectoryClassPath* entry = w->second.first;
+			std::string rel = w->second.second.empty()
+				? std::string(ev->name)
+				: w->second.second + "/" + ev->name;
+
+			std::vector<std::string> classNames;
+			if (ev->mask & IN_ISDIR) {
+				// files may have been created before the watch got installed
+				addWatch(entry, rel);
+				entry->list(rel, classNames);
+			} else if (rel.size() > 6 && rel.compare(rel.size() - 6, 6, ".class") == 0) {
+				classNames.push_back(rel.substr(0, rel.size() - 6));
+			}
+
+			if (!classNames.empty()) {
+				update(classNames, entry);
+				added = true;
+			}
+		}
+	}
+
+	return added;
+}
+#else
+bool ClassPathIndex::watch(const std::vector<ClassPathEntry*>& classpath)
+{
+	return false;
+}
+
+void ClassPathIndex::addWatch(DirectoryClassPath* entry, const std::string& dir)
+{
+}
+
+bool ClassPathIndex::poll()
+{
+	return false;
+}
+#endif
+// }}}
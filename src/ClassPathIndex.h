@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+class ClassPathEntry;
+class DirectoryClassPath;
+
+/**
+ * Maps binary class names to the classpath element providing them.
+ *
+ * Every classpath element is scanned once (in parallel), so that resolving
+ * a class costs a single hash probe instead of probing every element.
+ * Earlier classpath elements take precedence over later ones.
+ *
+ * Optionally, directories are watched via inotify and newly created
+ * classfiles are picked up whenever a lookup misses. Only then lookups
+ * lock the index, otherwise it only changes along with the classpath,
+ * which it must not while classes are being loaded.
+ */
+class ClassPathIndex {
+private:
+	std::unordered_map<std::string, ClassPathEntry*> classes_;
+	std::unordered_map<const ClassPathEntry*, size_t> positions_; //!< in the classpath
+	std::mutex lock_;
+
+	int inotify_;
+	std::unordered_map<int, std::pair<DirectoryClassPath*, std::string>> watches_;
+
+	std::atomic<uint64_t> hits_;
+	std::atomic<uint64_t> misses_;
+
+public:
+	ClassPathIndex();
+	~ClassPathIndex();
+
+	//! Rebuilds the index from scratch, scanning all elements in parallel.
+	void build(const std::vector<ClassPathEntry*>& classpath);
+
+	//! Adds the classes of an element appended to the classpath.
+	void add(ClassPathEntry* entry);
+
+	/**
+	 * Watches all directory elements for newly created classfiles (Linux only).
+	 *
+	 * @return whether watching could be enabled.
+	 */
+	bool watch(const std::vector<ClassPathEntry*>& classpath);
+	bool isWatching() const { return inotify_ >= 0; }
+
+	/**
+	 * Finds the classpath element providing given class.
+	 *
+	 * @param className binary class name, i.e. "java/lang/Object".
+	 * @return the element or \p nullptr if no element provides this class.
+	 */
+	ClassPathEntry* find(const std::string& className);
+
+	size_t size() const { return classes_.size(); }
+	uint64_t hits() const { return hits_; }
+	uint64_t misses() const { return misses_; }
+
+private:
+	void insert(const std::vector<std::string>& classNames, ClassPathEntry* entry);
+	//! Maps the classes to \p entry unless an earlier element provides them.
+	void update(const std::vector<std::string>& classNames, ClassPathEntry* entry);
+	void addWatch(DirectoryClassPath* entry, const std::string& dir);
+	bool poll();
+};
@@ -0,0 +1,86 @@
+#include "ClassTable.h"
+#include "Symbol.h"
+
+ClassTable::Table::Table(size_t capacity) :
+	mask(capacity - 1),
+	slots(new std::atomic<Entry*>[capacity])
+{
+	for (size_t i = 0; i < capacity; ++i)
+		slots[i].store(nullptr, std::memory_order_relaxed);
+}
+
+ClassTable::Table::~Table()
+{
+	delete[] slots;
+}
+
+ClassTable::ClassTable() :
+	table_(new Table(64)),
+	writeLock_(),
+	count_(0),
+	retired_()
+{
+}
+
+ClassTable::~ClassTable()
+{
+	Table* table = table_.load();
+	for (size_t i = 0; i <= table->mask; ++i)
+		delete table->slots[i].load();
+
+	delete table;
+
+	for (Table* t: retired_)
+		delete t;
+}
+
+Class* ClassTable::find(const Symbol* name) const
+{
+	Table* table = table_.load(std::memory_order_acquire);
+	for (size_t i = name->hash() & table->mask; ; i = (i + 1) & table->mask) {
+		Entry* entry = table->slots[i].load(std::memory_order_acquire);
+		if (!entry)
+			return nullptr;
+
+		if (entry->name == name)
+			return entry->value;
+	}
+}
+
+void ClassTable::put(Table* table, Entry* entry)
+{
+	size_t i = entry->name->hash() & table->mask;
+	while (table->slots[i].load(std::memory_order_relaxed))
+		i = (i + 1) & table->mask;
+
+	table->slots[i].store(entry, std::memory_order_release);
+}
+
+Class* ClassTable::insert(const Symbol* name, Class* value)
+{
+	std::lock_guard<std::mutex> _l(writeLock_);
+
+	if (Class* existing = find(name))
+		return existing;
+
+	Table* table = table_.load(std::memory_order_relaxed);
+
+	// keep the load factor below 1/2, so probe sequences stay short
+	if ((count_ + 1) * 2 > table->mask + 1) {
+		Table* grown = new Table((table->mask + 1) * 2);
+		for (size_t i = 0; i <= table->mask; ++i)
+			if (Entry* entry = table->slots[i].load(std::memory_order_relaxed))
+				put(grown, entry);
+
+		table_.store(grown, std::memory_order_release);
+
+		// readers may still be probing the old table
+		retired_.push_back(table);
+		table = grown;
+	}
+
+	put(table, new Entry{name, value});
+	++count_;
+
+	return value;
+}
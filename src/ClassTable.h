@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+class Class;
+class Symbol;
+
+/**
+ * Hash table of defined classes, keyed by interned class name.
+ *
+ * Probes compare symbols by pointer, using their precomputed hash.
+ *
+ * Lookups are lock-free: entries are immutable once published and a grown
+ * table replaces the old one atomically, keeping the old one around for
+ * concurrent readers until the table is destroyed. Inserts are serialized.
+ */
+class ClassTable {
+private:
+	struct Entry {
+		const Symbol* name;
+		Class* value;
+	};
+
+	struct Table {
+		size_t mask;
+		std::atomic<Entry*>* slots;
+
+		explicit Table(size_t capacity);
+		~Table();
+	};
+
+	std::atomic<Table*> table_;
+	std::mutex writeLock_;
+	size_t count_;
+	std::vector<Table*> retired_;
+
+public:
+	ClassTable();
+	~ClassTable();
+
+	ClassTable(const ClassTable&) = delete;
+	ClassTable& operator=(const ClassTable&) = delete;
+
+	//! Finds a class by name without taking any lock.
+	Class* find(const Symbol* name) const;
+
+	/**
+	 * Publishes a class under given name unless there is one already.
+	 *
+	 * @return the class registered under \p name after this call.
+	 */
+	Class* insert(const Symbol* name, Class* value);
+
+	size_t size() const { return count_; }
+
+	//! Invokes \p f for every class; must not run concurrently to inserts.
+	template<typename F> void forEach(F f) const;
+
+private:
+	static void put(Table* table, Entry* entry);
+};
+
+template<typename F>
+inline void ClassTable::forEach(F f) const
+{
+	Table* table = table_.load(std::memory_order_acquire);
+	for (size_t i = 0; i <= table->mask; ++i)
+		if (Entry* entry = table->slots[i].load(std::memory_order_relaxed))
+			f(entry->value);
+}
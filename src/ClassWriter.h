@@ -0,0 +1,261 @@
+#pragma once
+
+#include "Opcodes.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Minimal classfile writer for synthesizing benchmark input.
+ *
+ * Only emits what the loader consumes silently: fields without attributes
+ * and methods with a Code attribute, unless abstract.
+ */
+class ClassWriter {
+private:
+	std::vector<uint8_t> pool_;
+	uint16_t poolCount_;
+	std::unordered_map<std::string, uint16_t> utf8s_;
+	std::unordered_map<std::string, uint16_t> classes_;
+
+	std::vector<uint8_t> fields_;
+	uint16_t fieldCount_;
+	std::vector<uint8_t> methods_;
+	uint16_t methodCount_;
+
+	uint16_t flags_;
+	uint16_t thisClass_;
+	uint16_t superClass_;
+	std::vector<uint16_t> interfaces_;
+	uint16_t codeName_;
+	uint16_t lineNumbersName_;
+
+public:
+	ClassWriter(const std::string& name, const std::string& superName) :
+		pool_(), poolCount_(1), utf8s_(), classes_(),
+		fields_(), fieldCount_(0), methods_(), methodCount_(0),
+		flags_(0x0021), interfaces_()
+	{
+		thisClass_ = classRef(name);
+		superClass_ = superName.empty() ? 0 : classRef(superName);
+		codeName_ = utf8("Code");
+		lineNumbersName_ = utf8("LineNumberTable");
+	}
+
+	uint16_t constantCount() const { return poolCount_; }
+	uint16_t thisClass() const { return thisClass_; }
+
+	//! Class access flags, public super by default.
+	void setFlags(uint16_t flags) { flags_ = flags; }
+
+	void addInterface(const std::string& name) { interfaces_.push_back(classRef(name)); }
+
+	uint16_t utf8(const std::string& s) {
+		auto i = utf8s_.find(s);
+		if (i != utf8s_.end())
+			return i->second;
+
+		pool_.push_back(1);
+		put16(pool_, s.size());
+		pool_.insert(pool_.end(), s.begin(), s.end());
+		return utf8s_[s] = poolCount_++;
+	}
+
+	uint16_t classRef(const std::string& name) {
+		auto i = classes_.find(name);
+		if (i != classes_.end())
+			return i->second;
+
+		uint16_t nameId = utf8(name);
+		pool_.push_back(7);
+		put16(pool_, nameId);
+		return classes_[name] = poolCount_++;
+	}
+
+	uint16_t string(const std::string& s) {
+		uint16_t id = utf8(s);
+		pool_.push_back(8);
+		put16(pool_, id);
+		return poolCount_++;
+	}
+
+	uint16_t integer(int32_t value) {
+		pool_.push_back(3);
+		put32(pool_, value);
+		return poolCount_++;
+	}
+
+	uint16_t longConstant(int64_t value) {
+		pool_.push_back(5);
+		put32(pool_, (uint64_t) value >> 32);
+		put32(pool_, value);
+		uint16_t id = poolCount_;
+		poolCount_ += 2;
+		return id;
+	}
+
+	uint16_t nameAndType(const std::string& name, const std::string& descriptor) {
+		uint16_t nameId = utf8(name);
+		uint16_t descriptorId = utf8(descriptor);
+		pool_.push_back(12);
+		put16(pool_, nameId);
+		put16(pool_, descriptorId);
+		return poolCount_++;
+	}
+
+	uint16_t fieldRef(uint16_t classId, const std::string& name, const std::string& descriptor) {
+		return memberRef(9, classId, name, descriptor);
+	}
+
+	uint16_t methodRef(uint16_t classId, const std::string& name, const std::string& descriptor) {
+		return memberRef(10, classId, name, descriptor);
+	}
+
+	uint16_t interfaceMethodRef(uint16_t classId, const std::string& name, const std::string& descriptor) {
+		return memberRef(11, classId, name, descriptor);
+	}
+
+	void addField(uint16_t flags, const std::string& name, const std::string& descriptor) {
+		uint16_t nameId = utf8(name);
+		uint16_t descriptorId = utf8(descriptor);
+		put16(fields_, flags);
+		put16(fields_, nameId);
+		put16(fields_, descriptorId);
+		put16(fields_, 0);
+		++fieldCount_;
+	}
+
+	void addMethod(uint16_t flags, const std::string& name, const std::string& descriptor,
+	               uint16_t maxStack, uint16_t maxLocals, const std::vector<uint8_t>& code) {
+		uint16_t nameId = utf8(name);
+		uint16_t descriptorId = utf8(descriptor);
+		put16(methods_, flags);
+		put16(methods_, nameId);
+		put16(methods_, descriptorId);
+		put16(methods_, 1);
+
+		// Code, with a single-entry LineNumberTable
+		put16(methods_, codeName_);
+		put32(methods_, 8 + code.size() + 2 + 2 + 6 + 2 + 4);
+		put16(methods_, maxStack);
+		put16(methods_, maxLocals);
+		put32(methods_, code.size());
+		methods_.insert(methods_.end(), code.begin(), code.end());
+		put16(methods_, 0); // exception_table_length
+		put16(methods_, 1); // attributes_count
+		put16(methods_, lineNumbersName_);
+		put32(methods_, 2 + 4);
+		put16(methods_, 1);
+		put16(methods_, 0);
+		put16(methods_, methodCount_ + 1);
+		++methodCount_;
+	}
+
+	void addAbstractMethod(uint16_t flags, const std::string& name, const std::string& descriptor) {
+		uint16_t nameId = utf8(name);
+		uint16_t descriptorId = utf8(descriptor);
+		put16(methods_, flags);
+		put16(methods_, nameId);
+		put16(methods_, descriptorId);
+		put16(methods_, 0);
+		++methodCount_;
+	}
+
+	std::vector<uint8_t> finish() const {
+		std::vector<uint8_t> out;
+		put32(out, 0xcafebabe);
+		put16(out, 0);
+		put16(out, 51);
+		put16(out, poolCount_);
+		out.insert(out.end(), pool_.begin(), pool_.end());
+		put16(out, flags_);
+		put16(out, thisClass_);
+		put16(out, superClass_);
+		put16(out, interfaces_.size());
+		for (uint16_t id: interfaces_)
+			put16(out, id);
+		put16(out, fieldCount_);
+		out.insert(out.end(), fields_.begin(), fields_.end());
+		put16(out, methodCount_);
+		out.insert(out.end(), methods_.begin(), methods_.end());
+		put16(out, 0);
+		return out;
+	}
+
+	static void put16(std::vector<uint8_t>& out, uint16_t v) {
+		out.push_back(v >> 8);
+		out.push_back(v);
+	}
+
+	static void put32(std::vector<uint8_t>& out, uint32_t v) {
+		put16(out, v >> 16);
+		put16(out, v);
+	}
+
+private:
+	uint16_t memberRef(uint8_t tag, uint16_t classId, const std::string& name, const std::string& descriptor) {
+		uint16_t nat = nameAndType(name, descriptor);
+		pool_.push_back(tag);
+		put16(pool_, classId);
+		put16(pool_, nat);
+		return poolCount_++;
+	}
+};
+
+/**
+ * Bytecode assembler with forward branches to labels.
+ *
+ * \code
+ *   CodeBuilder b;
+ *   auto loop = b.label();
+ *   b.bind(loop).op(Opcode::iinc).u1(0).u1(1).branch(Opcode::goto_, loop);
+ * \endcode
+ */
+class CodeBuilder {
+private:
+	struct Fixup {
+		size_t insn;   //!< offset of the branch instruction
+		size_t label;
+	};
+
+	std::vector<uint8_t> code_;
+	std::vector<size_t> labels_;
+	std::vector<Fixup> fixups_;
+
+public:
+	CodeBuilder() : code_(), labels_(), fixups_() {}
+
+	size_t size() const { return code_.size(); }
+
+	CodeBuilder& op(Opcode opcode) { code_.push_back((uint8_t) opcode); return *this; }
+	CodeBuilder& u1(uint8_t v) { code_.push_back(v); return *this; }
+	CodeBuilder& u2(uint16_t v) { ClassWriter::put16(code_, v); return *this; }
+
+	CodeBuilder& op(Opcode opcode, uint8_t operand) { return op(opcode).u1(operand); }
+	CodeBuilder& op2(Opcode opcode, uint16_t operand) { return op(opcode).u2(operand); }
+
+	//! Creates an unbound label.
+	size_t label() { labels_.push_back(SIZE_MAX); return labels_.size() - 1; }
+
+	//! Binds \p label to the current offset.
+	CodeBuilder& bind(size_t label) { labels_[label] = code_.size(); return *this; }
+
+	//! Appends a branch instruction with a 16-bit offset to \p label.
+	CodeBuilder& branch(Opcode opcode, size_t label) {
+		fixups_.push_back({code_.size(), label});
+		return op(opcode).u2(0);
+	}
+
+	//! Resolves all branches; every label must have been bound.
+	std::vector<uint8_t> finish() const {
+		std::vector<uint8_t> code = code_;
+		for (const Fixup& fixup: fixups_) {
+			uint16_t offset = (uint16_t) (labels_[fixup.label] - fixup.insn);
+			code[fixup.insn + 1] = offset >> 8;
+			code[fixup.insn + 2] = offset;
+		}
+		return code;
+	}
+};
@@ -0,0 +1,106 @@
+#include "ClassfileBuffer.h"
+
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+class MappedClassfileBuffer : public ClassfileBuffer {
+public:
+	MappedClassfileBuffer(const uint8_t* data, size_t size) : ClassfileBuffer(data, size) {}
+
+	~MappedClassfileBuffer() {
+		munmap((void*) data_, size_);
+	}
+};
+
+class HeapClassfileBuffer : public ClassfileBuffer {
+public:
+	HeapClassfileBuffer(uint8_t* data, size_t size) : ClassfileBuffer(data, size) {}
+
+	~HeapClassfileBuffer() {
+		delete[] data_;
+	}
+};
+
+class SubrangeClassfileBuffer : public ClassfileBuffer {
+private:
+	std::shared_ptr<ClassfileBuffer> parent_;
+
+public:
+	SubrangeClassfileBuffer(std::shared_ptr<ClassfileBuffer> parent, size_t offset, size_t length) :
+		ClassfileBuffer(parent->data() + offset, length),
+		parent_(parent)
+	{}
+};
+
+std::shared_ptr<ClassfileBuffer> ClassfileBuffer::map(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	return std::make_shared<MappedClassfileBuffer>((const uint8_t*) data, st.st_size);
+}
+
+std::shared_ptr<ClassfileBuffer> ClassfileBuffer::read(const char* path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	uint8_t* data = new uint8_t[st.st_size];
+	size_t nread = 0;
+	while (nread < (size_t) st.st_size) {
+		ssize_t rv = ::read(fd, data + nread, st.st_size - nread);
+		if (rv <= 0) {
+			delete[] data;
+			close(fd);
+			return nullptr;
+		}
+		nread += rv;
+	}
+	close(fd);
+
+	return std::make_shared<HeapClassfileBuffer>(data, nread);
+}
+
+std::shared_ptr<ClassfileBuffer> ClassfileBuffer::copy(const uint8_t* data, size_t size)
+{
+	uint8_t* buf = new uint8_t[size];
+	memcpy(buf, data, size);
+
+	return std::make_shared<HeapClassfileBuffer>(buf, size);
+}
+
+std::shared_ptr<ClassfileBuffer> ClassfileBuffer::adopt(uint8_t* data, size_t size)
+{
+	return std::make_shared<HeapClassfileBuffer>(data, size);
+}
+
+std::shared_ptr<ClassfileBuffer> ClassfileBuffer::subrange(std::shared_ptr<ClassfileBuffer> parent,
+                                                           size_t offset, size_t length)
+{
+	return std::make_shared<SubrangeClassfileBuffer>(parent, offset, length);
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+
+/**
+ * Read-only view onto a contiguous array, not owning the underlying storage.
+ */
+template<typename T>
+class ArrayView {
+private:
+	const T* data_;
+	size_t size_;
+
+public:
+	ArrayView() : data_(nullptr), size_(0) {}
+	ArrayView(const T* data, size_t size) : data_(data), size_(size) {}
+
+	bool empty() const { return size_ == 0; }
+	size_t size() const { return size_; }
+	const T* data() const { return data_; }
+
+	const T* begin() const { return data_; }
+	const T* end() const { return data_ + size_; }
+
+	const T& operator[](size_t i) const { return data_[i]; }
+};
+
+typedef ArrayView<uint8_t> ByteView;
+
+/**
+ * Backing storage of a loaded classfile.
+ *
+ * Constant pool strings, method bytecode and attribute payloads of a Class
+ * are views into this buffer, so the Class keeps it alive for its lifetime.
+ */
+class ClassfileBuffer {
+protected:
+	const uint8_t* data_;
+	size_t size_;
+
+	ClassfileBuffer(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+public:
+	ClassfileBuffer(const ClassfileBuffer&) = delete;
+	ClassfileBuffer& operator=(const ClassfileBuffer&) = delete;
+	virtual ~ClassfileBuffer() {}
+
+	const uint8_t* data() const { return data_; }
+	size_t size() const { return size_; }
+
+	ByteView slice(size_t offset, size_t length) const { return ByteView(data_ + offset, length); }
+
+	//! Maps given file read-only into memory, or returns \p nullptr on failure.
+	static std::shared_ptr<ClassfileBuffer> map(const char* path);
+
+	//! Reads given file into a heap buffer, or returns \p nullptr on failure.
+	static std::shared_ptr<ClassfileBuffer> read(const char* path);
+
+	//! Creates a heap-allocated copy of the given bytes.
+	static std::shared_ptr<ClassfileBuffer> copy(const uint8_t* data, size_t size);
+
+	//! Takes ownership of given \p new[]'d bytes.
+	static std::shared_ptr<ClassfileBuffer> adopt(uint8_t* data, size_t size);
+
+	//! Creates a view onto a subrange of \p parent, keeping \p parent alive.
+	static std::shared_ptr<ClassfileBuffer> subrange(std::shared_ptr<ClassfileBuffer> parent,
+	                                                 size_t offset, size_t length);
+};
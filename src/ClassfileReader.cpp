@@ -0,0 +1,152 @@
+#include "ClassfileReader.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JVM_X86 1
+#endif
+
+std::string tos(ClassfileError error)
+{
+	switch (error) {
+		case ClassfileError::None: return "no error";
+		case ClassfileError::Truncated: return "truncated classfile";
+		case ClassfileError::BadMagic: return "bad magic";
+		case ClassfileError::BadConstantTag: return "invalid constant pool tag";
+		case ClassfileError::BadUtf8: return "malformed modified UTF-8";
+		case ClassfileError::BadConstantPool: return "malformed constant pool";
+		case ClassfileError::BadIndex: return "invalid constant pool index";
+		case ClassfileError::BadAttribute: return "malformed attribute";
+		default: return "unknown error";
+	}
+}
+
+// {{{ modified UTF-8 validation
+/**
+ * Validates the sequences starting in [i, until), returning the offset
+ * past the last one or 0 on malformed input (valid input never ends at 0
+ * here, as at least one sequence gets consumed).
+ *
+ * Modified UTF-8 has no NUL bytes (NUL is encoded as C0 80, the only
+ * overlong form allowed), no 4-byte sequences (supplementary characters
+ * are encoded as surrogate pairs), and thus no lead bytes from F0 up.
+ */
+static inline size_t validateScalar(const uint8_t* data, size_t i, size_t until, size_t n, bool* standard)
+{
+	do {
+		uint8_t ch = data[i];
+		if (ch >= 0x01 && ch < 0x80) {
+			i += 1;
+		} else if ((ch & 0xE0) == 0xC0) {
+			if (i + 1 >= n || (data[i + 1] & 0xC0) != 0x80)
+				return 0;
+			// C0 and C1 encode ASCII, overlong
+			if (ch == 0xC1 || (ch == 0xC0 && data[i + 1] != 0x80))
+				return 0;
+			if (ch == 0xC0)
+				*standard = false;
+			i += 2;
+		} else if ((ch & 0xF0) == 0xE0) {
+			if (i + 2 >= n || (data[i + 1] & 0xC0) != 0x80 || (data[i + 2] & 0xC0) != 0x80)
+				return 0;
+			if (ch == 0xED && data[i + 1] >= 0xA0)
+				*standard = false; // surrogate
+			i += 3;
+		} else {
+			return 0;
+		}
+	} while (i < until);
+
+	return i;
+}
+
+static bool validateUtf8Scalar(const uint8_t* data, size_t n, bool* standard)
+{
+	*standard = true;
+	return n == 0 || validateScalar(data, 0, n, n, standard) != 0;
+}
+
+#if defined(JVM_X86)
+static bool validateUtf8Sse2(const uint8_t* data, size_t n, bool* standard)
+{
+	*standard = true;
+	const __m128i zero = _mm_setzero_si128();
+	size_t i = 0;
+
+	while (i < n) {
+		if (i + 16 <= n) {
+			// ASCII without NULs is valid as is
+			__m128i chunk = _mm_loadu_si128((const __m128i*) (data + i));
+			int mask = _mm_movemask_epi8(chunk) | _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+			if (mask == 0) {
+				i += 16;
+				continue;
+			}
+		}
+
+		i = validateScalar(data, i, i + 16 < n ? i + 16 : n, n, standard);
+		if (!i)
+			return false;
+	}
+
+	return true;
+}
+
+__attribute__((target("avx2")))
+static bool validateUtf8Avx2(const uint8_t* data, size_t n, bool* standard)
+{
+	*standard = true;
+	const __m256i zero = _mm256_setzero_si256();
+	size_t i = 0;
+
+	while (i < n) {
+		if (i + 32 <= n) {
+			__m256i chunk = _mm256_loadu_si256((const __m256i*) (data + i));
+			int mask = _mm256_movemask_epi8(chunk) | _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, zero));
+			if (mask == 0) {
+				i += 32;
+				continue;
+			}
+		}
+
+		i = validateScalar(data, i, i + 32 < n ? i + 32 : n, n, standard);
+		if (!i)
+			return false;
+	}
+
+	return true;
+}
+#endif
+
+typedef bool (*Utf8Validator)(const uint8_t* data, size_t n, bool* standard);
+
+static Utf8Validator selectValidator()
+{
+#if defined(JVM_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &validateUtf8Avx2;
+
+	return &validateUtf8Sse2;
+#else
+	return &validateUtf8Scalar;
+#endif
+}
+
+bool ClassfileReader::validateUtf8(const uint8_t* data, size_t n, bool* standard)
+{
+	static const Utf8Validator validator = selectValidator();
+
+	// most names are short, where setting up vector registers does not pay off
+	if (n < 16)
+		return validateUtf8Scalar(data, n, standard);
+
+	return validator(data, n, standard);
+}
+
+bool ClassfileReader::isStandardUtf8(const uint8_t* data, size_t n)
+{
+	bool standard = true;
+	validateUtf8(data, n, &standard);
+	return standard;
+}
+// }}}
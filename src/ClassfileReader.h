@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+enum class ClassfileError {
+	None,
+	Truncated,          //!< unexpected end of the classfile
+	BadMagic,
+	BadConstantTag,
+	BadUtf8,            //!< Utf8 constant that is no valid modified UTF-8
+	BadConstantPool,    //!< constant referring to a slot of the wrong kind
+	BadIndex,           //!< constant pool index out of range or of the wrong kind
+	BadAttribute,       //!< attribute contents disagreeing with its length
+};
+
+std::string tos(ClassfileError error);
+
+/**
+ * Big-endian reader over an in-memory classfile.
+ *
+ * Callers check bounds once per structure via require(), followed by
+ * unchecked reads of its fields. Integers are read with unaligned loads
+ * and byte swaps. The first error (with its offset) is sticky, so parsing
+ * can bail out at structure boundaries rather than after every read.
+ */
+class ClassfileReader {
+private:
+	const uint8_t* begin_;
+	const uint8_t* cur_;
+	const uint8_t* end_;
+	ClassfileError error_;
+	size_t errorOffset_;
+
+public:
+	ClassfileReader(const uint8_t* data, size_t size) :
+		begin_(data),
+		cur_(data),
+		end_(data + size),
+		error_(ClassfileError::None),
+		errorOffset_(0)
+	{}
+
+	bool ok() const { return error_ == ClassfileError::None; }
+	ClassfileError error() const { return error_; }
+	size_t errorOffset() const { return errorOffset_; }
+
+	size_t offset() const { return cur_ - begin_; }
+	size_t remaining() const { return end_ - cur_; }
+	const uint8_t* position() const { return cur_; }
+
+	//! Records given error at the current offset, unless one is recorded already.
+	bool fail(ClassfileError error) {
+		if (ok()) {
+			error_ = error;
+			errorOffset_ = offset();
+		}
+		return false;
+	}
+
+	//! Ensures that \p n more bytes can be read, failing otherwise.
+	bool require(size_t n) {
+		return (ok() && n <= remaining()) || fail(ClassfileError::Truncated);
+	}
+
+	// {{{ unchecked reads, within the bounds of a preceding require()
+	uint8_t u1() { return *cur_++; }
+	uint16_t u2() { uint16_t v; memcpy(&v, cur_, 2); cur_ += 2; return __builtin_bswap16(v); }
+	uint32_t u4() { uint32_t v; memcpy(&v, cur_, 4); cur_ += 4; return __builtin_bswap32(v); }
+	uint64_t u8() { uint64_t v; memcpy(&v, cur_, 8); cur_ += 8; return __builtin_bswap64(v); }
+	// }}}
+
+	// {{{ checked reads, yielding 0 past the end
+	uint16_t readU2() { return require(2) ? u2() : 0; }
+	uint32_t readU4() { return require(4) ? u4() : 0; }
+	// }}}
+
+	//! Returns a view onto the next \p n bytes and skips them, or \p nullptr.
+	const uint8_t* view(size_t n) {
+		if (!require(n))
+			return nullptr;
+
+		const uint8_t* p = cur_;
+		cur_ += n;
+		return p;
+	}
+
+	bool skip(size_t n) { return view(n) != nullptr; }
+
+	/**
+	 * Reads a Utf8 constant's payload of given length, validating it as
+	 * modified UTF-8.
+	 *
+	 * @param standard receives whether the bytes are standard UTF-8 as is,
+	 *                 i.e. contain neither encoded NULs nor surrogates.
+	 * @return a view onto the payload or \p nullptr on error.
+	 */
+	const uint8_t* utf8(size_t n, bool* standard) {
+		const uint8_t* p = view(n);
+		if (p && !validateUtf8(p, n, standard)) {
+			cur_ = p;
+			fail(ClassfileError::BadUtf8);
+			return nullptr;
+		}
+		return p;
+	}
+
+	/**
+	 * Validates modified UTF-8 (JVMS 4.4.7), using SSE2 or AVX2 to skip
+	 * over runs of ASCII.
+	 */
+	static bool validateUtf8(const uint8_t* data, size_t n, bool* standard);
+
+	//! Tests whether valid modified UTF-8 is standard UTF-8 as is.
+	static bool isStandardUtf8(const uint8_t* data, size_t n);
+};
@@ -0,0 +1,80 @@
+#include "CodeCache.h"
+#include "CompiledMethod.h"
+#include "Trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+CodeCache::CodeCache(size_t capacity) :
+	lock_(),
+	base_(nullptr),
+	capacity_(capacity),
+	used_(0),
+	codeBytes_(0),
+	methods_(),
+	traces_()
+{
+}
+
+CodeCache::~CodeCache()
+{
+	if (base_)
+		munmap(base_, capacity_);
+}
+
+const uint8_t* CodeCache::install(const uint8_t* code, size_t size)
+{
+	std::lock_guard<std::mutex> _l(lock_);
+
+	if (!base_) {
+		void* p = mmap(nullptr, capacity_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		if (p == MAP_FAILED) {
+			printf("WARNING: could not reserve %zu bytes of code cache: %s\n", capacity_, strerror(errno));
+			capacity_ = 0;
+			return nullptr;
+		}
+		base_ = (uint8_t*) p;
+	}
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t chunkSize = (size + page - 1) & ~(page - 1);
+	if (used_ + chunkSize > capacity_)
+		return nullptr;
+
+	uint8_t* chunk = base_ + used_;
+	if (mprotect(chunk, chunkSize, PROT_READ | PROT_WRITE) != 0) {
+		printf("WARNING: could not map code cache writable: %s\n", strerror(errno));
+		return nullptr;
+	}
+
+	memcpy(chunk, code, size);
+
+	if (mprotect(chunk, chunkSize, PROT_READ | PROT_EXEC) != 0) {
+		printf("WARNING: could not map code cache executable: %s\n", strerror(errno));
+		mprotect(chunk, chunkSize, PROT_NONE);
+		return nullptr;
+	}
+
+	__builtin___clear_cache((char*) chunk, (char*) chunk + size);
+
+	used_ += chunkSize;
+	codeBytes_ += size;
+	return chunk;
+}
+
+CompiledMethod* CodeCache::add(CompiledMethod* method)
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	methods_.emplace_back(method);
+	return method;
+}
+
+Trace* CodeCache::add(Trace* trace)
+{
+	std::lock_guard<std::mutex> _l(lock_);
+	traces_.emplace_back(trace);
+	return trace;
+}
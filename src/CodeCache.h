@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class CompiledMethod;
+class Trace;
+
+/**
+ * Executable memory for compiled methods.
+ *
+ * Reserves one contiguous region of address space on first use, so that
+ * all code is within rel32 reach of itself, and hands out page-granular
+ * chunks of it. Pages are never writable and executable at the same time:
+ * a chunk is mapped read-write while the code is copied in, then flipped
+ * to read-execute for good. As no two methods share a page, flipping one
+ * never faults code that runs on another thread.
+ *
+ * Also owns the metadata of compiled methods and traces. Both live as
+ * long as the cache, i.e. the class loader that owns it.
+ */
+class CodeCache {
+private:
+	std::mutex lock_;
+	uint8_t* base_;          //!< of the reservation, or nullptr until first used
+	size_t capacity_;
+	size_t used_;
+	size_t codeBytes_;       //!< without the padding to page boundaries
+	std::vector<std::unique_ptr<CompiledMethod>> methods_;
+	std::vector<std::unique_ptr<Trace>> traces_;
+
+public:
+	explicit CodeCache(size_t capacity = 64 << 20);
+	~CodeCache();
+
+	CodeCache(const CodeCache&) = delete;
+	CodeCache& operator=(const CodeCache&) = delete;
+
+	/**
+	 * Copies \p size bytes of position-independent \p code into the cache.
+	 *
+	 * @return the executable copy, or \p nullptr if the cache is full or
+	 *         its pages could not be remapped.
+	 */
+	const uint8_t* install(const uint8_t* code, size_t size);
+
+	//! Takes ownership of \p method's metadata.
+	CompiledMethod* add(CompiledMethod* method);
+	Trace* add(Trace* trace);
+
+	size_t capacity() const { return capacity_; }
+	size_t bytesUsed() const { return used_; }
+	size_t codeBytes() const { return codeBytes_; }
+	size_t methodCount() const { return methods_.size(); }
+	size_t traceCount() const { return traces_.size(); }
+};
@@ -0,0 +1,17 @@
+#include "CompiledMethod.h"
+#include "Class.h"
+#include "MethodProfile.h"
+#include "QuickCode.h"
+
+bool CompiledMethod::invalidate()
+{
+	if (__atomic_exchange_n(&invalid_, true, __ATOMIC_ACQ_REL))
+		return false;
+
+	// counting anew, as what got it compiled may no longer be worth it
+	QuickCode* quick = method_->quickCode();
+	if (quick->replaceCompiled(this, nullptr))
+		quick->profile()->reset();
+
+	return true;
+}
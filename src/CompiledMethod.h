@@ -0,0 +1,124 @@
+#pragma once
+
+#include "DebugInfo.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+class Method;
+class Interpreter;
+union Slot;
+
+/**
+ * Native code of a method, compiled from its quickened instructions.
+ *
+ * Compiled code works on the same frame as the interpreter: locals and
+ * operand stack stay in the interpreter stack's slots, with every operand
+ * stack depth known at compile time. So control passes between compiled
+ * code and the interpreter at any instruction boundary without translating
+ * any state.
+ *
+ * All tiers share one calling convention, that of Entry:
+ *
+ * \code
+ *   int32_t entry(Slot* locals, Slot* stack, Interpreter* interpreter, void* frame);
+ * \endcode
+ *
+ * with \p stack the bottom of the frame's operand stack and \p frame its
+ * interpreter Frame record. It returns Returned when the method returned,
+ * with its return value (if any) in stack[0]. Otherwise it exited at the
+ * instruction of the returned index, which the interpreter continues at
+ * with stackDepth() operand slots in use. The instruction either raised
+ * the pending exception, or has yet to run in the interpreter as compiled
+ * code did not handle it. Or it returns Deoptimized, with the interpreter
+ * frames to continue in rebuilt already (see below).
+ *
+ * Besides the method entry, which starts at the frame's pc, loop headers
+ * have entries of their own (see osrEntry()), for frames that have
+ * been running interpreted since before the method got compiled to move
+ * over at a back edge, i.e. on-stack replacement. Their frame is already
+ * laid out the way the compiled code expects it, so the interpreter only
+ * needs to stop dispatching and call the entry.
+ *
+ * Code may speculate, e.g. on a branch never having been taken so far,
+ * or on assumptions about the loaded classes (see Dependency). Where a
+ * speculation fails, the code takes an uncommon trap: it calls
+ * Interpreter::jitTrap() with the id of the trap's Safepoint in its
+ * DebugInfo, which rebuilds the interpreter frames that the safepoint
+ * describes, including ones of inlined methods, from the machine state.
+ * The code then returns Deoptimized for the interpreter to continue in
+ * the innermost of them.
+ *
+ * Code whose assumptions no longer hold gets invalidated: it is not
+ * entered anymore, and its activations deoptimize as soon as they call
+ * into the runtime (see Interpreter::jitStep()).
+ */
+class CompiledMethod {
+public:
+	typedef int32_t (*Entry)(Slot* locals, Slot* stack, Interpreter* interpreter, void* frame);
+
+	static const int32_t Returned = -1;
+	static const int32_t Deoptimized = -2;
+
+	//! Code offset of a loop without an entry.
+	static const uint32_t NoEntry = UINT32_MAX;
+
+	enum class Tier : uint8_t {
+		Baseline,   //!< a fixed template per instruction
+		Optimized,  //!< from the optimized IR, values in registers (see OptimizingCompiler)
+	};
+
+private:
+	Method* method_;
+	Tier tier_;
+	Entry entry_;
+	size_t codeSize_;
+	std::vector<uint16_t> stackDepths_; //!< by instruction index
+	std::vector<uint32_t> osrEntries_;  //!< code offsets by loop index
+	DebugInfo debugInfo_;
+	bool invalid_;
+
+public:
+	CompiledMethod(Method* method, Tier tier, const uint8_t* code, size_t codeSize,
+	               std::vector<uint16_t>&& stackDepths, std::vector<uint32_t>&& osrEntries, DebugInfo&& debugInfo) :
+		method_(method),
+		tier_(tier),
+		entry_((Entry) code),
+		codeSize_(codeSize),
+		stackDepths_(std::move(stackDepths)),
+		osrEntries_(std::move(osrEntries)),
+		debugInfo_(std::move(debugInfo)),
+		invalid_(false)
+	{}
+
+	Method* method() const { return method_; }
+	Tier tier() const { return tier_; }
+	Entry entry() const { return entry_; }
+	const uint8_t* code() const { return (const uint8_t*) entry_; }
+	size_t codeSize() const { return codeSize_; }
+
+	//! Operand stack slots in use before the instruction of given index.
+	uint16_t stackDepth(uint32_t index) const { return stackDepths_[index]; }
+
+	/**
+	 * Entry at the header of loop \p loop (see QuickCode::loop()), for a
+	 * frame interpreted up to a back edge there, with stackDepth() of the
+	 * header operand slots in use.
+	 */
+	Entry osrEntry(uint16_t loop) const { return (Entry) (code() + osrEntries_[loop]); }
+
+	//! Whether loop \p loop has an entry: optimized code lacks some.
+	bool hasOsrEntry(uint16_t loop) const { return osrEntries_[loop] != NoEntry; }
+
+	const DebugInfo& debugInfo() const { return debugInfo_; }
+
+	bool isInvalid() const { return __atomic_load_n(&invalid_, __ATOMIC_ACQUIRE); }
+
+	/**
+	 * Marks the code invalid and uninstalls it from its method, which runs
+	 * interpreted until it turns hot and gets compiled again.
+	 *
+	 * @return false if it was invalid already.
+	 */
+	bool invalidate();
+};
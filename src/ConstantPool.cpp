@@ -1,11 +1,208 @@
 #include "ConstantPool.h"
+#include "Arena.h"
 #include "JvmEnv.h"
+#include "Symbol.h"
+#include <cstdio>
 
-bool ConstantClass::resolve(JvmEnv* env)
+bool ConstantUtf8::equals(const char* s, size_t n) const
 {
-	if (resolvedClass)
-		return true;
+	if (!standard)
+		return strLength() == n && std::memcmp(c_str(), s, n) == 0;
+
+	return length == n && std::memcmp(data, s, n) == 0;
+}
+
+const Symbol* ConstantUtf8::intern() const
+{
+	// symbols hold standard UTF-8, which most names already are byte for byte
+	const Symbol* s = !standard
+		? SymbolTable::global().intern(c_str(), strLength())
+		: SymbolTable::global().intern((const char*) data, length);
+
+	symbol_.store(s, std::memory_order_release);
+	return s;
+}
+
+const char* ConstantUtf8::materialize() const
+{
+	// decoding never grows the string: 0xC0 0x80 becomes 1 byte, and
+	// a 6-byte surrogate pair becomes a 4-byte UTF-8 sequence.
+	char* out = new char[length + 1];
+	size_t n = 0;
+
+	for (size_t i = 0; i < length; ) {
+		uint8_t ch = data[i];
+		if (ch == 0xC0 && i + 1 < length && data[i + 1] == 0x80) {
+			out[n++] = '\0';
+			i += 2;
+		} else if (ch == 0xED && i + 5 < length
+				&& (data[i + 1] & 0xF0) == 0xA0 && data[i + 3] == 0xED && (data[i + 4] & 0xF0) == 0xB0) {
+			uint32_t hi = ((data[i + 1] & 0x0F) << 6) | (data[i + 2] & 0x3F);
+			uint32_t lo = ((data[i + 4] & 0x0F) << 6) | (data[i + 5] & 0x3F);
+			uint32_t cp = 0x10000 + (hi << 10) + lo;
+			out[n++] = 0xF0 | (cp >> 18);
+			out[n++] = 0x80 | ((cp >> 12) & 0x3F);
+			out[n++] = 0x80 | ((cp >> 6) & 0x3F);
+			out[n++] = 0x80 | (cp & 0x3F);
+			i += 6;
+		} else {
+			out[n++] = ch;
+			++i;
+		}
+	}
+	out[n] = '\0';
+	strLength_.store(n, std::memory_order_relaxed);
+
+	// racing threads may materialize concurrently, the first one wins
+	char* expected = nullptr;
+	if (!str_.compare_exchange_strong(expected, out, std::memory_order_acq_rel)) {
+		delete[] out;
+		return expected;
+	}
+
+	return out;
+}
+
+// {{{ ConstantPool
+ConstantPool::ConstantPool() :
+	size_(0),
+	tags_(nullptr),
+	refs_(nullptr),
+	values_(nullptr)
+{
+}
+
+ConstantPool::~ConstantPool()
+{
+	// the slots themselves are owned by the class' arena, Utf8 constants
+	// are the only ones with a destructor to run.
+	for (size_t k = 1; k < size_; ++k)
+		if (is(ConstantTag::Utf8, k))
+			utf8At(k)->~ConstantUtf8();
+}
+
+void ConstantPool::allocate(Arena& arena, uint16_t size)
+{
+	size_ = size;
+	tags_ = arena.allocateArray<uint8_t>(size);
+	refs_ = arena.allocateArray<Ref>(size);
+	values_ = arena.allocateArray<uint64_t>(size);
+
+	if (size) {
+		memset(tags_, 0, size * sizeof(*tags_));
+		memset(refs_, 0, size * sizeof(*refs_));
+		memset(values_, 0, size * sizeof(*values_));
+	}
+}
+
+bool ConstantPool::verify() const
+{
+	auto isNameAndType = [&](uint16_t id) -> bool {
+		return is(ConstantTag::NameAndType, id)
+			&& is(ConstantTag::Utf8, refs_[id].a)
+			&& is(ConstantTag::Utf8, refs_[id].b);
+	};
+
+	for (size_t k = 1; k < size_; ++k) {
+		const Ref& ref = refs_[k];
+		switch (tag(k)) {
+			case ConstantTag::Class:
+			case ConstantTag::String:
+			case ConstantTag::MethodType:
+				if (!is(ConstantTag::Utf8, ref.a))
+					return false;
+				break;
+			case ConstantTag::NameAndType:
+				if (!isNameAndType(k))
+					return false;
+				break;
+			case ConstantTag::Fieldref:
+			case ConstantTag::Methodref:
+			case ConstantTag::InterfaceMethodref:
+				if (!is(ConstantTag::Class, ref.a) || !is(ConstantTag::Utf8, refs_[ref.a].a) || !isNameAndType(ref.b))
+					return false;
+				break;
+			case ConstantTag::MethodHandle:
+				if (ref.a < 1 || ref.a > 9 || !isMember(ref.b))
+					return false;
+				break;
+			case ConstantTag::InvokeDynamic:
+				if (!isNameAndType(ref.b))
+					return false;
+				break;
+			default:
+				break;
+		}
+	}
 
-	resolvedClass = env->getClass(name->c_str());
 	return true;
 }
+
+Class* ConstantPool::resolveClass(size_t id, JvmEnv* env)
+{
+	if (!is(ConstantTag::Class, id))
+		return nullptr;
+
+	if (Class* c = resolvedClassAt(id))
+		return c;
+
+	Class* c = env->getClass(className(id)->c_str());
+	if (c)
+		setResolved(id, (uintptr_t) c);
+
+	return c;
+}
+
+std::string ConstantPool::to_s(size_t id) const
+{
+	char buf[256];
+	ConstantTag t = tag(id);
+
+	switch (t) {
+		case ConstantTag::Utf8:
+			snprintf(buf, sizeof(buf), "%s: %s", tos(t).c_str(), utf8At(id)->c_str());
+			break;
+		case ConstantTag::Integer:
+			snprintf(buf, sizeof(buf), "%s: %i", tos(t).c_str(), integerAt(id));
+			break;
+		case ConstantTag::Float:
+			snprintf(buf, sizeof(buf), "%s: %g", tos(t).c_str(), floatAt(id));
+			break;
+		case ConstantTag::Long:
+			snprintf(buf, sizeof(buf), "%s: 0x%08llX (%li)", tos(t).c_str(),
+				(unsigned long long) (longAt(id) & 0xFFFFFFFFllu), (long) longAt(id));
+			break;
+		case ConstantTag::Double:
+			snprintf(buf, sizeof(buf), "%s: %g", tos(t).c_str(), doubleAt(id));
+			break;
+		case ConstantTag::Class:
+		case ConstantTag::String:
+			snprintf(buf, sizeof(buf), "%s: #%d: %s", tos(t).c_str(), refs_[id].a, utf8At(refs_[id].a)->c_str());
+			break;
+		case ConstantTag::NameAndType:
+			snprintf(buf, sizeof(buf), "%s: name=%s sig=%s", tos(t).c_str(),
+				utf8At(refs_[id].a)->c_str(), utf8At(refs_[id].b)->c_str());
+			break;
+		case ConstantTag::Fieldref:
+		case ConstantTag::Methodref:
+		case ConstantTag::InterfaceMethodref:
+			snprintf(buf, sizeof(buf), "%s: %s.%s:%s", tos(t).c_str(),
+				memberClassName(id)->c_str(), memberName(id)->c_str(), memberDescriptor(id)->c_str());
+			break;
+		case ConstantTag::MethodHandle:
+			snprintf(buf, sizeof(buf), "%s: kind=%d #%d", tos(t).c_str(), refs_[id].a, refs_[id].b);
+			break;
+		case ConstantTag::MethodType:
+			snprintf(buf, sizeof(buf), "%s: #%d: %s", tos(t).c_str(), refs_[id].a, utf8At(refs_[id].a)->c_str());
+			break;
+		case ConstantTag::InvokeDynamic:
+			snprintf(buf, sizeof(buf), "%s: bootstrap=#%d name=%s sig=%s", tos(t).c_str(), refs_[id].a,
+				utf8At(refs_[refs_[id].b].a)->c_str(), utf8At(refs_[refs_[id].b].b)->c_str());
+			break;
+		default:
+			return "null";
+	}
+
+	return buf;
+}
+// }}}
@@ -3,12 +3,16 @@
 #include <string>
 #include <cstring>
 #include <vector>
+#include <atomic>
 #include <stdint.h>
 
 class JvmEnv;
+class Symbol;
 class Class;
+class Arena;
 
 enum class ConstantTag {
+	Unused = 0, // slot #0 and the upper halves of Long and Double constants
 	Class = 7,
 	Fieldref = 9,
 	Methodref = 10,
@@ -27,6 +31,7 @@ enum class ConstantTag {
 
 inline std::string tos(ConstantTag value) {
 	switch (value) {
+		case ConstantTag::Unused: return "Unused";
 		case ConstantTag::Class: return "Class";
 		case ConstantTag::Fieldref: return "Fieldref";
 		case ConstantTag::Methodref: return "Methodref";
@@ -45,203 +50,154 @@ inline std::string tos(ConstantTag value) {
 	}
 }
 
-struct Constant {
-	ConstantTag tag;
-
-	Constant(ConstantTag t) : tag(t) {}
-
-	//! Returns a debug-friendly string representation of given constant.
-	virtual std::string to_s() const = 0;
-
-	virtual bool resolve(JvmEnv* env) = 0;
-};
-
-struct ConstantInteger : public Constant {
-	int16_t value;
-
-	ConstantInteger(int16_t val) : Constant(ConstantTag::Integer), value(val) {}
-
-	virtual std::string to_s() const {
-		char buf[64];
-		snprintf(buf, sizeof(buf), "%s: %i", tos(tag).c_str(), value);
-		return buf;
-	}
-
-	virtual bool resolve(JvmEnv* env) {
-		return true;
-	}
-};
-
-struct ConstantLong : public Constant {
-	int64_t value;
-
-	ConstantLong(int64_t val) : Constant(ConstantTag::Long), value(val) {}
-
-	virtual std::string to_s() const {
-		char buf[64];
-		snprintf(buf, sizeof(buf), "%s: 0x%08llX (%li)", tos(tag).c_str(), (value & 0xFFFFFFFFllu), value);
-		return buf;
-	}
-
-	virtual bool resolve(JvmEnv* env) {
-		return true;
-	}
-};
-
-struct ConstantUtf8 : public Constant {
+struct ConstantUtf8 {
 	uint16_t length;
-	uint8_t* data;
-
-	ConstantUtf8(uint16_t len, uint8_t* d) : Constant(ConstantTag::Utf8), length(len), data(d) {}
-	~ConstantUtf8() { delete[] data; }
-
-	const char* c_str() const { return (const char*) data; }
-	size_t size() const { return length; }
-
-	virtual std::string to_s() const {
-		char buf[256];
-		snprintf(buf, sizeof(buf), "%s: %s", tos(tag).c_str(), data);
-		return buf;
-	}
-
-	virtual bool resolve(JvmEnv* env) {
-		return true;
-	}
-};
-
-inline bool equals(const ConstantUtf8* a, const char* b) {
-	return (!a && !b) || (a && b && std::strcmp(a->c_str(), b) == 0);
-}
-
-inline bool equals(const ConstantUtf8& a, const char* b) {
-	return (!&a && !b) || (&a && b && std::strcmp(a.c_str(), b) == 0);
-}
-
-struct ConstantString : public Constant {
-	uint16_t id;
-	ConstantUtf8* value;
-
-	const char* c_str() const { return value->c_str(); }
+	bool standard; //!< whether the raw bytes are standard UTF-8 as is
+	const uint8_t* data; //!< raw modified UTF-8 bytes, viewing into the classfile
 
-	ConstantString(uint16_t nameId, ConstantUtf8* v) :
-		Constant(ConstantTag::String),
-		id(nameId),
-		value(v)
-	{}
+	ConstantUtf8(uint16_t len, const uint8_t* d, bool std) :
+		length(len), standard(std), data(d), str_(nullptr), strLength_(std ? len : 0), symbol_(nullptr) {}
+	~ConstantUtf8() { delete[] str_.load(); }
 
-	virtual std::string to_s() const {
-		char buf[256];
-		snprintf(buf, sizeof(buf), "%s: #%d: %s", tos(tag).c_str(), id, value->c_str());
-		return buf;
+	//! Returns the NUL-terminated (standard UTF-8) string, materialized on first use.
+	const char* c_str() const {
+		const char* s = str_.load(std::memory_order_acquire);
+		return s ? s : materialize();
 	}
+	size_t size() const { return length; }
 
-	virtual bool resolve(JvmEnv* env) {
-		// because we are already resolved at construction time.
-		return true;
-	}
-};
-
-struct ConstantNameAndType  : public Constant {
-	ConstantUtf8* name;
-	ConstantUtf8* signature;
-
-	ConstantNameAndType(ConstantUtf8* _name, ConstantUtf8* _sig) :
-		Constant(ConstantTag::NameAndType),
-		name(_name),
-		signature(_sig)
-	{}
-
-	virtual std::string to_s() const {
-		char buf[256];
-		snprintf(buf, sizeof(buf), "%s: name=%s sig=%s", tos(tag).c_str(), name->c_str(), signature->c_str());
-		return buf;
+	//! Length of c_str(), which contains NULs if the string does.
+	size_t strLength() const {
+		c_str();
+		return strLength_.load(std::memory_order_relaxed);
 	}
 
-	virtual bool resolve(JvmEnv* env) {
-		// TODO we may want to load classes for signature element types
-		return true;
-	}
-};
+	//! Compares against given standard UTF-8 string without materializing if possible.
+	bool equals(const char* s, size_t n) const;
 
-struct ConstantClass : public Constant {
-	uint16_t id;
-	ConstantUtf8* name;
-	Class* resolvedClass;
-
-	ConstantClass(uint16_t nameId, ConstantUtf8* value) :
-		Constant(ConstantTag::Class),
-		id(nameId),
-		name(value),
-		resolvedClass(nullptr)
-	{}
-
-	virtual std::string to_s() const {
-		char buf[256];
-		snprintf(buf, sizeof(buf), "%s: #%d: %s", tos(tag).c_str(), id, name->c_str());
-		return buf;
+	//! Returns the interned symbol of this string, interning it on first use.
+	const Symbol* symbol() const {
+		const Symbol* s = symbol_.load(std::memory_order_acquire);
+		return s ? s : intern();
 	}
 
-	virtual bool resolve(JvmEnv* env);
-};
+private:
+	mutable std::atomic<char*> str_;
+	mutable std::atomic<uint16_t> strLength_; //!< stored before str_ gets published
+	mutable std::atomic<const Symbol*> symbol_;
 
-struct ConstantMember : public Constant {
-	ConstantClass* classDef;
-	ConstantNameAndType* memberDef;
-
-	ConstantMember(ConstantTag _tag, ConstantClass* _classDef, ConstantNameAndType* _memberDef) :
-		Constant(_tag),
-		classDef(_classDef),
-		memberDef(_memberDef)
-	{}
-
-	virtual std::string to_s() const {
-		char buf[255];
-		snprintf(buf, sizeof(buf), "%s: %s.%s:%s",
-			tos(tag).c_str(),
-			classDef->name->c_str(),
-			memberDef->name->c_str(),
-			memberDef->signature->c_str()
-		);
-		return buf;
-	}
+	const Symbol* intern() const;
 
-	virtual bool resolve(JvmEnv* env) {
-		return classDef->resolve(env) && memberDef->resolve(env);
-	}
+	const char* materialize() const;
 };
 
+/**
+ * Constant pool of a class, as flat struct-of-arrays.
+ *
+ * Every slot has a tag byte, a symbolic reference pair (the indices a
+ * Class, String, NameAndType, member, MethodHandle, MethodType or
+ * InvokeDynamic constant refers to, or the length of a Utf8 constant),
+ * and an 8-byte value:
+ *
+ * <ul>
+ *   <li>Integer, Float, Long, Double: the value itself</li>
+ *   <li>Utf8: pointer to its ConstantUtf8</li>
+ *   <li>anything else: the resolved value (i.e. the Class*), or 0 while unresolved</li>
+ * </ul>
+ *
+ * So resolved constants are read with a single load, without any dispatch.
+ */
 class ConstantPool {
-	typedef std::vector<Constant*> vector_type;
+public:
+	//! tag bit marking resolved slots
+	static const uint8_t Resolved = 0x80;
 
-	vector_type pool;
+	//! symbolic references of a slot
+	struct Ref {
+		uint16_t a; //!< Utf8: length; Class, String, MethodType: Utf8 index; NameAndType: name; members: Class; MethodHandle: kind
+		uint16_t b; //!< Utf8: standard flag; NameAndType: descriptor; members, InvokeDynamic: NameAndType; MethodHandle: member
+	};
 
-public:
-	ConstantPool() { }
-	~ConstantPool() { }
+private:
+	friend class ClassArchive;
 
-	void resize(size_t size) { pool.resize(size); }
-	size_t size() const { return pool.size(); }
-	vector_type::iterator begin() { return pool.begin(); }
-	vector_type::iterator end() { return pool.end(); }
-	const Constant* operator[](size_t id) const { return pool[id]; }
-	Constant*& operator[](size_t id) { return pool[id]; }
+	uint16_t size_;
+	uint8_t* tags_;
+	Ref* refs_;
+	uint64_t* values_;
 
-	Constant* get(ConstantTag tag, size_t id) {
-		if (id < 1 || id >= pool.size() || pool[id]->tag != tag)
-			return nullptr;
+public:
+	ConstantPool();
+	~ConstantPool();
+
+	ConstantPool(const ConstantPool&) = delete;
+	ConstantPool& operator=(const ConstantPool&) = delete;
+
+	//! Allocates \p size (unused) slots from given arena.
+	void allocate(Arena& arena, uint16_t size);
+
+	size_t size() const { return size_; }
+
+	ConstantTag tag(size_t id) const { return (ConstantTag) (tags_[id] & ~Resolved); }
+	bool is(ConstantTag t, size_t id) const { return id < size_ && (tags_[id] & ~Resolved) == (uint8_t) t; }
+	bool isResolved(size_t id) const { return __atomic_load_n(&tags_[id], __ATOMIC_ACQUIRE) & Resolved; }
+
+	// {{{ unchecked accessors, the caller guarantees the slot's tag
+	int32_t integerAt(size_t id) const { return (int32_t) values_[id]; }
+	int64_t longAt(size_t id) const { return (int64_t) values_[id]; }
+	float floatAt(size_t id) const { float f; std::memcpy(&f, &values_[id], sizeof(f)); return f; }
+	double doubleAt(size_t id) const { double d; std::memcpy(&d, &values_[id], sizeof(d)); return d; }
+	ConstantUtf8* utf8At(size_t id) const { return (ConstantUtf8*) values_[id]; }
+	const Ref& refAt(size_t id) const { return refs_[id]; }
+
+	//! resolved value of a slot, or 0 if not resolved yet
+	uint64_t resolvedAt(size_t id) const { return __atomic_load_n(&values_[id], __ATOMIC_ACQUIRE); }
+	Class* resolvedClassAt(size_t id) const { return (Class*) resolvedAt(id); }
+	// }}}
+
+	// {{{ checked accessors, returning nullptr on invalid index or tag mismatch
+	ConstantUtf8* utf8(size_t id) const { return is(ConstantTag::Utf8, id) ? utf8At(id) : nullptr; }
+	ConstantUtf8* className(size_t id) const { return is(ConstantTag::Class, id) ? utf8At(refs_[id].a) : nullptr; }
+	ConstantUtf8* string(size_t id) const { return is(ConstantTag::String, id) ? utf8At(refs_[id].a) : nullptr; }
+	ConstantUtf8* memberClassName(size_t id) const { return isMember(id) ? utf8At(refs_[refs_[id].a].a) : nullptr; }
+	ConstantUtf8* memberName(size_t id) const { return isMember(id) ? utf8At(refs_[refs_[id].b].a) : nullptr; }
+	ConstantUtf8* memberDescriptor(size_t id) const { return isMember(id) ? utf8At(refs_[refs_[id].b].b) : nullptr; }
+	// }}}
+
+	bool isMember(size_t id) const {
+		return is(ConstantTag::Fieldref, id) || is(ConstantTag::Methodref, id) || is(ConstantTag::InterfaceMethodref, id);
+	}
 
-		return pool[id];
+	// {{{ construction
+	void setUtf8(size_t id, ConstantUtf8* utf8) { tags_[id] = (uint8_t) ConstantTag::Utf8; refs_[id] = {utf8->length, utf8->standard}; values_[id] = (uintptr_t) utf8; }
+	void setInteger(size_t id, int32_t value) { tags_[id] = (uint8_t) ConstantTag::Integer; values_[id] = (uint32_t) value; }
+	void setFloat(size_t id, uint32_t bits) { tags_[id] = (uint8_t) ConstantTag::Float; values_[id] = bits; }
+	void setLong(size_t id, int64_t value) { tags_[id] = (uint8_t) ConstantTag::Long; values_[id] = value; }
+	void setDouble(size_t id, uint64_t bits) { tags_[id] = (uint8_t) ConstantTag::Double; values_[id] = bits; }
+	void setRef(size_t id, ConstantTag t, uint16_t a, uint16_t b) { tags_[id] = (uint8_t) t; refs_[id] = {a, b}; values_[id] = 0; }
+
+	/**
+	 * Checks all symbolic references for pointing to slots of the right kind.
+	 *
+	 * Once verified, the unchecked accessors are safe to use on the
+	 * references of a slot with a known tag.
+	 */
+	bool verify() const;
+	// }}}
+
+	//! Publishes the resolved value of a slot.
+	void setResolved(size_t id, uint64_t value) {
+		__atomic_store_n(&values_[id], value, __ATOMIC_RELEASE);
+		__atomic_or_fetch(&tags_[id], Resolved, __ATOMIC_RELEASE);
 	}
 
-	template<typename T> T* get(size_t id);
-};
+	//! Resolves a Class constant, returning \p nullptr if the class cannot be loaded.
+	Class* resolveClass(size_t id, JvmEnv* env);
 
-template<>
-inline ConstantUtf8* ConstantPool::get<ConstantUtf8>(size_t id) {
-	return dynamic_cast<ConstantUtf8*>(get(ConstantTag::Utf8, id));
-}
+	//! Returns a debug-friendly string representation of given slot.
+	std::string to_s(size_t id) const;
 
-template<>
-inline ConstantClass* ConstantPool::get<ConstantClass>(size_t id) {
-	return dynamic_cast<ConstantClass*>(get(ConstantTag::Class, id));
-}
+	const uint8_t* tags() const { return tags_; }
+	const Ref* refs() const { return refs_; }
+	const uint64_t* values() const { return values_; }
+};
@@ -0,0 +1,105 @@
+#include "DebugInfo.h"
+#include "Class.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+
+const Safepoint* DebugInfo::find(uint32_t codeOffset) const
+{
+	for (const Safepoint& safepoint: safepoints_)
+		if (safepoint.codeOffset == codeOffset)
+			return &safepoint;
+
+	return nullptr;
+}
+
+static std::string locationString(const ValueLocation& location)
+{
+	char buf[64];
+	switch (location.kind) {
+		case ValueLocation::Kind::Dead:
+			return "-";
+		case ValueLocation::Kind::Local:
+			snprintf(buf, sizeof(buf), "l%d", location.index);
+			break;
+		case ValueLocation::Kind::Stack:
+			snprintf(buf, sizeof(buf), "s%d", location.index);
+			break;
+		case ValueLocation::Kind::Register:
+			snprintf(buf, sizeof(buf), "r%d", location.index);
+			break;
+		case ValueLocation::Kind::Spill:
+			snprintf(buf, sizeof(buf), "[%d]", location.index);
+			break;
+		case ValueLocation::Kind::Constant:
+			snprintf(buf, sizeof(buf), "#%" PRId64, location.bits);
+			break;
+	}
+
+	std::string s = buf;
+	if (location.type != IrType::Void) {
+		s += ':';
+		s += irTypeName(location.type);
+	}
+	return s;
+}
+
+static std::string locationsString(const std::vector<ValueLocation>& locations)
+{
+	std::string s = "[";
+	for (size_t i = 0; i < locations.size(); ++i) {
+		if (i)
+			s += ' ';
+		s += locationString(locations[i]);
+	}
+	return s + "]";
+}
+
+std::string DebugInfo::to_s() const
+{
+	std::string s;
+	char buf[64];
+
+	for (size_t i = 0; i < safepoints_.size(); ++i) {
+		const Safepoint& safepoint = safepoints_[i];
+		snprintf(buf, sizeof(buf), "#%zu +0x%x trap @%u", i, safepoint.codeOffset, safepoint.trap);
+		s += buf;
+
+		for (size_t k = 0; k < safepoint.scopes.size(); ++k) {
+			const DebugScope& scope = safepoint.scopes[k];
+			s += k ? " | " : ": ";
+			s += scope.method->thisClass()->name()->c_str();
+			s += '.';
+			s += scope.method->name()->c_str();
+			s += scope.method->descriptor()->c_str();
+			snprintf(buf, sizeof(buf), " @%u locals ", scope.index);
+			s += buf;
+			s += locationsString(scope.locals);
+			s += " stack ";
+			s += locationsString(scope.stack);
+		}
+		if (safepoint.check)
+			s += " check";
+		if (!safepoint.stackMap.empty()) {
+			s += " refs";
+			for (int r = 0; r < 16; ++r) {
+				if (safepoint.stackMap.registers & (1 << r)) {
+					snprintf(buf, sizeof(buf), " r%d", r);
+					s += buf;
+				}
+			}
+			for (int32_t spill: safepoint.stackMap.spills) {
+				snprintf(buf, sizeof(buf), " [%d]", spill);
+				s += buf;
+			}
+		}
+		s += '\n';
+	}
+
+	return s;
+}
+
+void DebugInfo::dump() const
+{
+	printf("%s", to_s().c_str());
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Ir.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class Method;
+
+/**
+ * Where compiled code keeps the value of a local or operand stack slot at
+ * a safepoint.
+ */
+struct ValueLocation {
+	enum class Kind : uint8_t {
+		Dead,      //!< not live there, restored as zero
+		Local,     //!< index: slot of the interpreter frame's locals
+		Stack,     //!< index: slot of the interpreter frame's operand stack
+		Register,  //!< index: number of the general-purpose register, as saved by the trap
+		Spill,     //!< index: 8-byte slot of the compiled frame's spill area
+		Constant,  //!< bits: the value
+	};
+
+	Kind kind;
+	IrType type;    //!< Void where the compiler does not track types, like the baseline compiler
+	int32_t index;
+	int64_t bits;
+
+	static ValueLocation dead() { return {Kind::Dead, IrType::Void, 0, 0}; }
+	static ValueLocation local(int32_t index, IrType type = IrType::Void) { return {Kind::Local, type, index, 0}; }
+	static ValueLocation stack(int32_t index, IrType type = IrType::Void) { return {Kind::Stack, type, index, 0}; }
+	static ValueLocation reg(int32_t number, IrType type) { return {Kind::Register, type, number, 0}; }
+	static ValueLocation spill(int32_t index, IrType type) { return {Kind::Spill, type, index, 0}; }
+	static ValueLocation constant(int64_t bits, IrType type) { return {Kind::Constant, type, 0, bits}; }
+};
+
+/**
+ * State of one interpreter frame at a safepoint: of the compiled method
+ * itself, or of a method inlined into it.
+ *
+ * Callers of inlined methods are at their invoke, with the arguments
+ * popped: they become the first locals of the callee's frame.
+ */
+struct DebugScope {
+	Method* method;
+	uint32_t index;                      //!< instruction to continue at, in the method's QuickCode
+	std::vector<ValueLocation> locals;   //!< all of the frame's locals
+	std::vector<ValueLocation> stack;    //!< operand stack slots in use, bottom first
+};
+
+/**
+ * Where compiled code keeps the references that are live at a safepoint,
+ * besides the ones in interpreter frames: what a garbage collector would
+ * scan, and update if it moved objects.
+ */
+struct StackMap {
+	uint16_t registers;            //!< bit per general-purpose register number
+	std::vector<int32_t> spills;   //!< 8-byte slots of the compiled frame's spill area
+
+	bool empty() const { return !registers && spills.empty(); }
+};
+
+/**
+ * A point in compiled code where the interpreter state can be recovered
+ * from the machine state, i.e. where the code may deoptimize.
+ */
+struct Safepoint {
+	uint32_t codeOffset;              //!< of the trap or call, from the start of the code
+	uint32_t trap;                    //!< instruction of the innermost scope whose speculation failed
+	std::vector<DebugScope> scopes;   //!< the compiled method first, then the methods inlined into it
+
+	/**
+	 * Whether it is a check rather than a speculation: of an instruction
+	 * that throws, or that the interpreter is to run, which deoptimizes the
+	 * frame but leaves the code valid.
+	 */
+	bool check;
+
+	StackMap stackMap;
+};
+
+/**
+ * Metadata of compiled code that maps the machine state at its
+ * safepoints back to the interpreter frames it stands for, which is what
+ * deoptimization rebuilds.
+ */
+class DebugInfo {
+private:
+	std::vector<Safepoint> safepoints_;
+
+public:
+	DebugInfo() : safepoints_() {}
+
+	//! Adds \p safepoint, returning its id.
+	uint32_t add(Safepoint&& safepoint) {
+		safepoints_.push_back(std::move(safepoint));
+		return safepoints_.size() - 1;
+	}
+
+	const Safepoint& at(uint32_t id) const { return safepoints_[id]; }
+	Safepoint& at(uint32_t id) { return safepoints_[id]; }
+	size_t size() const { return safepoints_.size(); }
+	bool empty() const { return safepoints_.empty(); }
+
+	//! Safepoint at \p codeOffset, or \p nullptr.
+	const Safepoint* find(uint32_t codeOffset) const;
+
+	//! Textual form, one safepoint per line.
+	std::string to_s() const;
+	void dump() const;
+};
@@ -0,0 +1,63 @@
+#include "Dependencies.h"
+#include "Class.h"
+#include "CompiledMethod.h"
+
+#include <vector>
+
+Dependency Dependency::notOverridden(Method* method)
+{
+	return {Kind::NotOverridden, method->thisClass(), method, nullptr};
+}
+
+bool Dependency::isBrokenBy(const Class* c) const
+{
+	if (c == type || !c->isSubclassOf(type))
+		return false;
+
+	switch (kind) {
+		case Kind::NoSubclasses:
+			return true;
+		case Kind::NotOverridden:
+			if (type->isInterface()) {
+				Method* implementation = c->itableLookup(method);
+				return implementation && implementation != method;
+			}
+			return method->vtableIndex() >= c->vtable().size() || c->vtableAt(method->vtableIndex()) != method;
+		case Kind::UniqueTarget:
+			// abstract classes have no instances to select anything
+			if (c->isAbstract())
+				return false;
+			if (type->isInterface())
+				return c->itableLookup(method) != target;
+			return method->vtableIndex() >= c->vtable().size() || c->vtableAt(method->vtableIndex()) != target;
+	}
+
+	return true;
+}
+
+size_t DependencyTable::classLoaded(const Class* c)
+{
+	// the assumptions that c can break are about its supertypes
+	std::vector<const Class*> supertypes;
+	for (const Class* super = c->superClass(); super; super = super->superClass())
+		supertypes.push_back(super);
+	for (const Class::Itable& itable: c->itables())
+		supertypes.push_back(itable.interface);
+
+	std::lock_guard<std::mutex> _l(lock_);
+	size_t invalidated = 0;
+
+	for (const Class* super: supertypes) {
+		auto range = dependencies_.equal_range(super);
+		for (auto i = range.first; i != range.second; ) {
+			if (i->second.first.isBrokenBy(c)) {
+				invalidated += i->second.second->invalidate();
+				i = dependencies_.erase(i);
+			} else {
+				++i;
+			}
+		}
+	}
+
+	return invalidated;
+}
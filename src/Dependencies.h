@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+class Class;
+class Method;
+class CompiledMethod;
+
+/**
+ * An assumption about the loaded classes that compiled code relies on,
+ * and that loading another class may break.
+ */
+struct Dependency {
+	enum class Kind : uint8_t {
+		NoSubclasses,   //!< type has no subclasses, so its instances are exactly of it
+		NotOverridden,  //!< no subclass of type overrides method
+		UniqueTarget,   //!< calls of method select target on every instance of type
+	};
+
+	Kind kind;
+	Class* type;
+	Method* method;
+	Method* target;
+
+	static Dependency noSubclasses(Class* type) { return {Kind::NoSubclasses, type, nullptr, nullptr}; }
+	static Dependency notOverridden(Method* method);
+	static Dependency uniqueTarget(Class* type, Method* method, Method* target) {
+		return {Kind::UniqueTarget, type, method, target};
+	}
+
+	//! Whether \p c, a class just laid out, breaks this assumption.
+	bool isBrokenBy(const Class* c) const;
+};
+
+/**
+ * The dependencies of compiled methods, by the class they are about.
+ *
+ * Once a new class has been laid out, the compiled methods relying on an
+ * assumption it breaks get invalidated (see CompiledMethod::invalidate()),
+ * before any instance of it can exist.
+ */
+class DependencyTable {
+private:
+	std::mutex lock_;
+	std::unordered_multimap<const Class*, std::pair<Dependency, CompiledMethod*>> dependencies_;
+
+public:
+	DependencyTable() : lock_(), dependencies_() {}
+
+	DependencyTable(const DependencyTable&) = delete;
+	DependencyTable& operator=(const DependencyTable&) = delete;
+
+	/**
+	 * Records that \p compiled relies on \p dependency.
+	 *
+	 * @param holds checks the assumption against the classes laid out so
+	 *              far, under the table's lock so that no class slips in
+	 *              between.
+	 * @return false, recording nothing, if it does not hold.
+	 */
+	template<typename F>
+	bool add(const Dependency& dependency, CompiledMethod* compiled, F holds) {
+		std::lock_guard<std::mutex> _l(lock_);
+		if (!holds(dependency))
+			return false;
+		dependencies_.emplace(dependency.type, std::make_pair(dependency, compiled));
+		return true;
+	}
+
+	/**
+	 * Invalidates the compiled methods relying on assumptions that \p c
+	 * breaks, to be called once \p c has been laid out.
+	 *
+	 * @return the number of compiled methods invalidated.
+	 */
+	size_t classLoaded(const Class* c);
+
+	size_t size() const { return dependencies_.size(); }
+};
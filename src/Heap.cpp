@@ -0,0 +1,57 @@
+#include "Heap.h"
+#include "JObject.h"
+#include "Class.h"
+#include "Symbol.h"
+
+#include <string.h>
+
+Heap::Heap() :
+	arena_(),
+	objectCount_(0)
+{
+}
+
+Heap::~Heap()
+{
+}
+
+JObject* Heap::newObject(Class* c)
+{
+	size_t size = sizeof(JObject) + c->instanceSize();
+	void* p = arena_.allocate(size, alignof(uint64_t));
+	memset(p, 0, size);
+	++objectCount_;
+
+	return new (p) JObject(c);
+}
+
+JArray* Heap::newArray(const Symbol* descriptor, Class* elementClass, int32_t length)
+{
+	uint32_t elementSize = Heap::elementSize(descriptor);
+	size_t size = sizeof(JArray) + (size_t) length * elementSize;
+	void* p = arena_.allocate(size, alignof(uint64_t));
+	memset(p, 0, size);
+	++objectCount_;
+
+	return new (p) JArray(descriptor, elementClass, length, elementSize);
+}
+
+uint32_t Heap::elementSize(const Symbol* descriptor)
+{
+	switch (descriptor->size() > 1 ? descriptor->c_str()[1] : 0) {
+		case 'Z':
+		case 'B':
+			return 1;
+		case 'C':
+		case 'S':
+			return 2;
+		case 'I':
+		case 'F':
+			return 4;
+		case 'J':
+		case 'D':
+			return 8;
+		default:
+			return sizeof(JObject*);
+	}
+}
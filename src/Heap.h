@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Arena.h"
+#include <stdint.h>
+#include <stddef.h>
+
+class Class;
+class Symbol;
+class JObject;
+class JArray;
+
+/**
+ * Java object heap.
+ *
+ * Objects are zero-initialized and bump-allocated. There is no garbage
+ * collector yet, all objects live as long as the heap.
+ */
+class Heap {
+private:
+	Arena arena_;
+	size_t objectCount_;
+
+public:
+	Heap();
+	~Heap();
+
+	Heap(const Heap&) = delete;
+	Heap& operator=(const Heap&) = delete;
+
+	//! Allocates an instance of given (laid out) class.
+	JObject* newObject(Class* c);
+
+	/**
+	 * Allocates an array.
+	 *
+	 * @param descriptor array type, i.e. "[I".
+	 * @param elementClass class of the elements of object arrays, if loaded.
+	 * @param length number of elements, must not be negative.
+	 */
+	JArray* newArray(const Symbol* descriptor, Class* elementClass, int32_t length);
+
+	//! Size in bytes of an element of arrays of given descriptor.
+	static uint32_t elementSize(const Symbol* descriptor);
+
+	size_t objectCount() const { return objectCount_; }
+	size_t bytesAllocated() const { return arena_.bytesAllocated(); }
+};
@@ -0,0 +1,1624 @@
+#include "Interpreter.h"
+#include "BaselineCompiler.h"
+#include "Class.h"
+#include "CompiledMethod.h"
+#include "ConstantPool.h"
+#include "DebugInfo.h"
+#include "JObject.h"
+#include "Opcodes.h"
+#include "OptimizingCompiler.h"
+#include "QuickCode.h"
+#include "Symbol.h"
+#include "Trace.h"
+#include "TraceCompiler.h"
+#include "VMClassLoader.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <algorithm>
+#include <type_traits>
+#include <vector>
+
+// {{{ helpers with Java semantics
+static inline int32_t be32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (int32_t) __builtin_bswap32(v);
+}
+
+template<typename T>
+static inline T javaDiv(T a, T b)
+{
+	return b == -1 ? (T) (0 - (typename std::make_unsigned<T>::type) a) : a / b;
+}
+
+template<typename T>
+static inline T javaRem(T a, T b)
+{
+	return b == -1 ? 0 : a % b;
+}
+
+//! Floating-point to integer conversion, saturating and mapping NaN to 0.
+template<typename Int, typename Float>
+static inline Int javaF2I(Float v)
+{
+	if (v != v)
+		return 0;
+	if (v >= (Float) std::numeric_limits<Int>::max())
+		return std::numeric_limits<Int>::max();
+	if (v <= (Float) std::numeric_limits<Int>::min())
+		return std::numeric_limits<Int>::min();
+	return (Int) v;
+}
+
+//! fcmp<op> and dcmp<op>, yielding \p nan if either value is NaN.
+template<typename T>
+static inline int32_t javaCmp(T a, T b, int32_t nan)
+{
+	return a > b ? 1 : a == b ? 0 : a < b ? -1 : nan;
+}
+
+//! Number of slots a value of given field descriptor takes.
+static inline int slotsOf(const Symbol* descriptor)
+{
+	char type = descriptor->c_str()[0];
+	return type == 'J' || type == 'D' ? 2 : 1;
+}
+
+//! Pushes the value at \p p onto the stack, returning the number of slots.
+static inline int loadValue(const Symbol* descriptor, const uint8_t* p, Slot* sp)
+{
+	switch (descriptor->c_str()[0]) {
+		case 'Z': sp->i = *(const uint8_t*) p; return 1;
+		case 'B': sp->i = *(const int8_t*) p; return 1;
+		case 'C': sp->i = *(const uint16_t*) p; return 1;
+		case 'S': sp->i = *(const int16_t*) p; return 1;
+		case 'I': sp->i = *(const int32_t*) p; return 1;
+		case 'F': sp->f = *(const float*) p; return 1;
+		case 'J': sp->j = *(const int64_t*) p; return 2;
+		case 'D': sp->d = *(const double*) p; return 2;
+		default: sp->a = *(JObject* const*) p; return 1;
+	}
+}
+
+static inline void storeValue(const Symbol* descriptor, uint8_t* p, const Slot* value)
+{
+	switch (descriptor->c_str()[0]) {
+		case 'Z': *(uint8_t*) p = value->i & 1; break;
+		case 'B': *(int8_t*) p = value->i; break;
+		case 'C': *(uint16_t*) p = value->i; break;
+		case 'S': *(int16_t*) p = value->i; break;
+		case 'I': *(int32_t*) p = value->i; break;
+		case 'F': *(float*) p = value->f; break;
+		case 'J': *(int64_t*) p = value->j; break;
+		case 'D': *(double*) p = value->d; break;
+		default: *(JObject**) p = value->a; break;
+	}
+}
+
+//! Quick getfield/getstatic variant for \p field, following \p base (the z variant).
+static inline Opcode getVariant(Opcode base, const Field* field)
+{
+	int variant;
+	switch (field->descriptor()->c_str()[0]) {
+		case 'Z': variant = 0; break;
+		case 'B': variant = 1; break;
+		case 'C': variant = 2; break;
+		case 'S': variant = 3; break;
+		case 'I':
+		case 'F': variant = 4; break;
+		case 'J':
+		case 'D': variant = 5; break;
+		default: variant = 6; break;
+	}
+	return (Opcode) ((uint8_t) base + variant);
+}
+
+//! Quick putfield/putstatic variant for \p field, following \p base (the z variant).
+static inline Opcode putVariant(Opcode base, const Field* field)
+{
+	int variant;
+	switch (field->descriptor()->c_str()[0]) {
+		case 'Z': variant = 0; break;
+		case 'B': variant = 1; break;
+		case 'C':
+		case 'S': variant = 2; break;
+		case 'I':
+		case 'F': variant = 3; break;
+		case 'J':
+		case 'D': variant = 4; break;
+		default: variant = 5; break;
+	}
+	return (Opcode) ((uint8_t) base + variant);
+}
+
+//! Whether arrays of type \p from can be assigned to type \p to (JVMS 6.5 checkcast).
+static bool isArrayAssignable(Interpreter& interpreter, const char* from, const char* to)
+{
+	if (strcmp(from, to) == 0)
+		return true;
+
+	while (*from == '[' && *to == '[') {
+		++from;
+		++to;
+	}
+
+	if (*from == '[' || *from == 'L') {
+		if (strcmp(to, "Ljava/lang/Object;") == 0)
+			return true;
+
+		if (*from == '[')
+			return strcmp(to, "Ljava/lang/Cloneable;") == 0 || strcmp(to, "Ljava/io/Serializable;") == 0;
+	}
+
+	if (*from != 'L' || *to != 'L')
+		return false;
+
+	std::string fromName(from + 1, strlen(from) - 2);
+	std::string toName(to + 1, strlen(to) - 2);
+	Class* fromClass = interpreter.loader()->loadClass(fromName.c_str(), true);
+	Class* toClass = interpreter.loader()->loadClass(toName.c_str(), true);
+
+	return fromClass && toClass && fromClass->isSubclassOf(toClass);
+}
+// }}}
+
+// {{{ dispatch loops
+#define JVM_INTERPRETER_NAME executeSwitch
+#define JVM_THREADED 0
+#define JVM_TOS_CACHE 0
+#define JVM_RECORDING 0
+#include "Interpreter.inc"
+#undef JVM_INTERPRETER_NAME
+#undef JVM_THREADED
+#undef JVM_TOS_CACHE
+#undef JVM_RECORDING
+
+#if defined(JVM_COMPUTED_GOTO)
+#define JVM_INTERPRETER_NAME executeThreaded
+#define JVM_THREADED 1
+#define JVM_TOS_CACHE 0
+#define JVM_RECORDING 0
+#include "Interpreter.inc"
+#undef JVM_INTERPRETER_NAME
+#undef JVM_THREADED
+#undef JVM_TOS_CACHE
+#undef JVM_RECORDING
+
+#define JVM_INTERPRETER_NAME executeCached
+#define JVM_THREADED 1
+#define JVM_TOS_CACHE 1
+#define JVM_RECORDING 0
+#include "Interpreter.inc"
+#undef JVM_INTERPRETER_NAME
+#undef JVM_THREADED
+#undef JVM_TOS_CACHE
+#undef JVM_RECORDING
+#endif
+
+#if defined(JVM_JIT)
+#define JVM_INTERPRETER_NAME executeRecording
+#define JVM_THREADED 0
+#define JVM_TOS_CACHE 0
+#define JVM_RECORDING 1
+#include "Interpreter.inc"
+#undef JVM_INTERPRETER_NAME
+#undef JVM_THREADED
+#undef JVM_TOS_CACHE
+#undef JVM_RECORDING
+#endif
+// }}}
+
+// {{{ builtin natives
+static bool Object_hashCode(Interpreter&, Slot* args, Slot* result)
+{
+	result->i = (int32_t) ((uintptr_t) args[0].a >> 3);
+	return true;
+}
+
+static bool Object_clone(Interpreter& interpreter, Slot* args, Slot* result)
+{
+	JObject* object = args[0].a;
+
+	if (object->isArray()) {
+		JArray* array = (JArray*) object;
+		JArray* copy = interpreter.heap().newArray(array->descriptor(), array->elementClass(), array->length());
+		memcpy(copy->elements<uint8_t>(), array->elements<uint8_t>(), (size_t) array->length() * array->elementSize());
+		result->a = copy;
+	} else {
+		JObject* copy = interpreter.heap().newObject(object->type());
+		memcpy(copy->data(), object->data(), object->type()->instanceSize());
+		result->a = copy;
+	}
+
+	return true;
+}
+
+static bool System_arraycopy(Interpreter& interpreter, Slot* args, Slot*)
+{
+	JArray* src = (JArray*) args[0].a;
+	int32_t srcPos = args[1].i;
+	JArray* dst = (JArray*) args[2].a;
+	int32_t dstPos = args[3].i;
+	int32_t length = args[4].i;
+
+	if (!src || !dst) {
+		interpreter.throwNew("java/lang/NullPointerException");
+		return false;
+	}
+
+	if (!src->isArray() || !dst->isArray() || src->elementSize() != dst->elementSize()
+			|| (src->descriptor()->c_str()[1] != dst->descriptor()->c_str()[1]
+				&& (src->elementSize() != sizeof(JObject*) || dst->elementSize() != sizeof(JObject*)))) {
+		interpreter.throwNew("java/lang/ArrayStoreException");
+		return false;
+	}
+
+	if (srcPos < 0 || dstPos < 0 || length < 0
+			|| (int64_t) srcPos + length > src->length()
+			|| (int64_t) dstPos + length > dst->length()) {
+		interpreter.throwNew("java/lang/ArrayIndexOutOfBoundsException");
+		return false;
+	}
+
+	size_t size = src->elementSize();
+	memmove(dst->elements<uint8_t>() + dstPos * size, src->elements<uint8_t>() + srcPos * size, length * size);
+	return true;
+}
+
+static bool nop(Interpreter&, Slot*, Slot*)
+{
+	return true;
+}
+// }}}
+
+Interpreter::Interpreter(VMClassLoader* loader, size_t stackSlots) :
+	loader_(loader),
+	heap_(),
+#if defined(JVM_COMPUTED_GOTO)
+	dispatch_(Dispatch::Threaded),
+#else
+	dispatch_(Dispatch::Switch),
+#endif
+	mapping_(nullptr),
+	mappingSize_(0),
+	stack_(nullptr),
+	stackEnd_(nullptr),
+	top_(nullptr),
+	hotThreshold_(DefaultHotThreshold),
+	hotMethodHandler_(),
+	jitEnabled_(hasJit()),
+	optimizingEnabled_(true),
+	osrEnabled_(true),
+	jitDepth_(0),
+	traceEnabled_(false),
+	traceThreshold_(DefaultTraceThreshold),
+	recording_(nullptr),
+	exception_(nullptr),
+	error_(),
+	natives_(),
+	boundNatives_(),
+	strings_(),
+	stringClass_(nullptr),
+	stringClassLoaded_(false)
+{
+	// the guard pages catch what bounds checks on frame entry cannot,
+	// i.e. operand stack overflow of unverified bytecode
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (stackSlots * sizeof(Slot) + page - 1) & ~(page - 1);
+
+	mappingSize_ = size + 2 * page;
+	mapping_ = mmap(nullptr, mappingSize_, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (mapping_ == MAP_FAILED || mprotect((uint8_t*) mapping_ + page, size, PROT_READ | PROT_WRITE) < 0) {
+		printf("WARNING: could not map interpreter stack of %zu bytes: %s\n", size, strerror(errno));
+		abort();
+	}
+
+	stack_ = (Slot*) ((uint8_t*) mapping_ + page);
+	stackEnd_ = stack_ + size / sizeof(Slot);
+
+#if defined(JVM_COMPUTED_GOTO)
+	static std::once_flag cachedTables;
+	std::call_once(cachedTables, [this]() { executeCached(nullptr, nullptr); });
+#endif
+
+	static const char* const arrays[] = {
+		nullptr, nullptr, nullptr, nullptr, "[Z", "[C", "[F", "[D", "[B", "[S", "[I", "[J"
+	};
+	for (size_t i = 0; i < sizeof(arrays) / sizeof(*arrays); ++i)
+		primitiveArrays_[i] = arrays[i] ? intern(arrays[i]) : nullptr;
+
+	registerNative("java/lang/Object", "hashCode", "()I", &Object_hashCode);
+	registerNative("java/lang/Object", "clone", "()Ljava/lang/Object;", &Object_clone);
+	registerNative("java/lang/Object", "registerNatives", "()V", &nop);
+	registerNative("java/lang/System", "registerNatives", "()V", &nop);
+	registerNative("java/lang/System", "arraycopy", "(Ljava/lang/Object;ILjava/lang/Object;II)V", &System_arraycopy);
+}
+
+Interpreter::~Interpreter()
+{
+	munmap(mapping_, mappingSize_);
+}
+
+bool Interpreter::hasThreadedDispatch()
+{
+#if defined(JVM_COMPUTED_GOTO)
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool Interpreter::hasJit()
+{
+#if defined(JVM_JIT)
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Interpreter::setDispatch(Dispatch dispatch)
+{
+	dispatch_ = hasThreadedDispatch() ? dispatch : Dispatch::Switch;
+}
+
+bool Interpreter::execute(Frame* entry, Slot* result)
+{
+#if defined(JVM_COMPUTED_GOTO)
+	if (dispatch_ == Dispatch::Threaded)
+		return executeThreaded(entry, result);
+	if (dispatch_ == Dispatch::Cached)
+		return executeCached(entry, result);
+#endif
+
+	return executeSwitch(entry, result);
+}
+
+bool Interpreter::invoke(Method* method, const Slot* args, Slot* result)
+{
+	if (method->isStatic() && !initialize(method->thisClass()))
+		return false;
+
+	if (method->isNative())
+		return callNative(method, const_cast<Slot*>(args), result);
+
+	// calls from outside the dispatch loop are the only ones copying arguments
+	Slot* locals = stackTop();
+	if (locals + method->argumentSlots() > stackEnd_) {
+		throwNew("java/lang/StackOverflowError");
+		return false;
+	}
+
+	if (method->argumentSlots())
+		memcpy(locals, args, method->argumentSlots() * sizeof(Slot));
+
+	Frame* frame = enter(method, locals);
+	if (!frame)
+		return false;
+
+	Slot value;
+	if (!run(frame, &value))
+		return false;
+
+	if (result)
+		*result = value;
+
+	return true;
+}
+
+std::string Interpreter::describeException() const
+{
+	if (!exception_)
+		return error_;
+
+	std::string s = exception_->type()->name()->c_str();
+	if (Field* field = exception_->type()->findField(intern("detailMessage"), intern("Ljava/lang/String;"))) {
+		if (JObject* message = exception_->at<JObject*>(field->offset())) {
+			s += ": ";
+			s += toUtf8(message);
+		}
+	}
+
+	return s;
+}
+
+void Interpreter::registerNative(const char* className, const char* name, const char* descriptor, NativeMethod native)
+{
+	natives_[std::string(className) + "." + name + descriptor] = native;
+}
+
+bool Interpreter::callNative(Method* method, Slot* args, Slot* result)
+{
+	NativeMethod native;
+
+	auto i = boundNatives_.find(method);
+	if (i != boundNatives_.end()) {
+		native = i->second;
+	} else {
+		std::string key = std::string(method->thisClass()->name()->c_str()) + "." +
+			method->name()->c_str() + method->descriptor()->c_str();
+
+		auto k = natives_.find(key);
+		if (k == natives_.end()) {
+			throwNew("java/lang/UnsatisfiedLinkError", key.c_str());
+			return false;
+		}
+
+		native = boundNatives_[method] = k->second;
+	}
+
+	return native(*this, args, result);
+}
+
+// {{{ frames
+Interpreter::Frame* Interpreter::enter(Method* method, Slot* locals)
+{
+	if (method->isAbstract()) {
+		throwNew("java/lang/AbstractMethodError", method->name()->c_str());
+		return nullptr;
+	}
+
+	if (method->codeError() != ClassfileError::None) {
+		throwNew("java/lang/ClassFormatError", ("malformed Code attribute: " + tos(method->codeError())).c_str());
+		return nullptr;
+	}
+
+	if (method->code().empty()) {
+		throwNew("java/lang/ClassFormatError", "method without code");
+		return nullptr;
+	}
+
+	QuickCode* quick = QuickCode::of(method);
+	if (!quick) {
+		throwNew("java/lang/VerifyError", method->name()->c_str());
+		return nullptr;
+	}
+
+	Frame* frame = pushFrame(method, quick, locals);
+	if (!frame) {
+		throwNew("java/lang/StackOverflowError");
+		return nullptr;
+	}
+
+	heat(quick->profile(), quick->profile()->invoked());
+
+	return frame;
+}
+
+Interpreter::Frame* Interpreter::pushFrame(Method* method, QuickCode* quick, Slot* locals)
+{
+	static const size_t frameSlots = (sizeof(Frame) + sizeof(Slot) - 1) / sizeof(Slot);
+
+	size_t localCount = std::max<size_t>(method->maxLocals(), method->argumentSlots());
+	Slot* stack = locals + localCount + frameSlots;
+	if (stack + method->maxStack() > stackEnd_)
+		return nullptr;
+
+	Frame* frame = new (locals + localCount) Frame;
+	frame->caller = top_;
+	frame->method = method;
+	frame->pool = &method->thisClass()->constantPool;
+	frame->quick = quick;
+	frame->code = quick->instructions();
+	frame->pc = frame->code;
+	frame->locals = locals;
+	frame->stack = stack;
+	frame->sp = stack;
+	frame->compiled = nullptr;
+
+	top_ = frame;
+	return frame;
+}
+
+void Interpreter::turnedHot(MethodProfile* profile)
+{
+	if (!profile->markHot())
+		return;
+
+	if (jitEnabled_)
+		compile(profile->method());
+
+	if (hotMethodHandler_)
+		hotMethodHandler_(*this, profile->method());
+}
+
+Slot* Interpreter::stackTop() const
+{
+	return top_ ? top_->stack + top_->method->maxStack() : stack_;
+}
+
+bool Interpreter::run(Frame* frame, Slot* result)
+{
+	if (jitEnabled_ && jitDepth_ < MaxJitDepth && frame->quick->compiled()) {
+		if (runCompiled(frame) == CompiledMethod::Returned) {
+			if (result)
+				*result = frame->stack[0];
+			popFrame();
+			return true;
+		}
+
+		// the dispatch loop takes over at the instruction compiled code exited
+		// at, or the innermost frame rebuilt by deoptimization
+		if (exception_) {
+			Instruction* handler = findHandler(frame, frame->pc);
+			if (!handler) {
+				popFrame();
+				return false;
+			}
+			frame->pc = handler;
+			frame->stack[0].a = exception_;
+			frame->sp = frame->stack + 1;
+			exception_ = nullptr;
+		} else if (!error_.empty()) {
+			popFrame();
+			return false;
+		}
+	}
+
+	return execute(frame, result);
+}
+
+Instruction* Interpreter::findHandler(Frame* frame, const Instruction* pc)
+{
+	uint32_t offset = frame->quick->offsetOf(pc);
+
+	for (const Method::ExceptionHandler& handler: frame->method->exceptionTable()) {
+		if (offset < handler.start || offset >= handler.end)
+			continue;
+
+		if (handler.type != 0) {
+			// a catch type that fails to resolve simply does not match
+			JObject* pending = exception_;
+			Class* type = resolveClass(*frame->pool, handler.type);
+			exception_ = pending;
+			error_.clear();
+
+			if (!type || !pending->type()->isSubclassOf(type))
+				continue;
+		}
+
+		return frame->quick->at(handler.handler);
+	}
+
+	return nullptr;
+}
+
+void Interpreter::invalidOpcode(Frame* frame, const Instruction* pc)
+{
+	uint32_t offset = frame->quick->offsetOf(pc);
+	char buf[256];
+	snprintf(buf, sizeof(buf), "invalid opcode 0x%02x at %s.%s%s:%u (line %d)", pc->opcode,
+		frame->method->thisClass()->name()->c_str(),
+		frame->method->name()->c_str(),
+		frame->method->descriptor()->c_str(),
+		offset,
+		frame->method->lineNumber(offset));
+
+	exception_ = nullptr;
+	error_ = buf;
+}
+// }}}
+
+// {{{ compiled code
+void Interpreter::compile(Method* method)
+{
+	QuickCode* quick = method->quickCode();
+	if (quick->compiled())
+		return;
+
+	CompiledMethod* compiled = optimizingEnabled_ ? OptimizingCompiler::compile(method, quick, *loader_) : nullptr;
+	if (!compiled)
+		compiled = BaselineCompiler::compile(method, quick, *loader_);
+	if (compiled) {
+		// a class breaking its assumptions may have been loaded right before
+		if (quick->replaceCompiled(nullptr, compiled) && compiled->isInvalid() &&
+		    quick->replaceCompiled(compiled, nullptr))
+			quick->profile()->reset();
+	}
+}
+
+int32_t Interpreter::runCompiled(Frame* frame, const TraceAnchor* loop)
+{
+	CompiledMethod* compiled = frame->quick->compiled();
+	CompiledMethod::Entry entry = loop ? compiled->osrEntry(loop - frame->quick->loops()) : compiled->entry();
+
+	++jitDepth_;
+	frame->compiled = compiled;
+	int32_t index = entry(frame->locals, frame->stack, this, frame);
+	frame->compiled = nullptr;
+	--jitDepth_;
+
+	if (index >= 0) {
+		frame->pc = frame->code + index;
+		frame->sp = frame->stack + compiled->stackDepth(index);
+	}
+
+	return index;
+}
+
+int32_t Interpreter::jitStep(Interpreter* self, Frame* frame, Instruction* pc, Slot* sp)
+{
+	// the interpreter runs the rest of invalidated code, at the next instruction it can
+	// (traces run on interpreted frames, which have none)
+	CompiledMethod* compiled = frame->compiled;
+	if (compiled && compiled->isInvalid())
+		return -1;
+
+	return continueCompiled(frame, self->step(frame, pc, sp));
+}
+
+int32_t Interpreter::jitInvoke(Interpreter* self, Frame* frame, Instruction* pc, Slot* sp, Method* callee)
+{
+	// once invalidated, the callee may not be the only target anymore
+	if (frame->compiled->isInvalid())
+		return -1;
+
+	return continueCompiled(frame, self->invokeDirect(frame, pc, sp, callee));
+}
+
+int32_t Interpreter::continueCompiled(Frame* frame, int32_t next)
+{
+	CompiledMethod* compiled = frame->compiled;
+	if (next >= 0 && compiled && compiled->isInvalid()) {
+		frame->pc = frame->code + next;
+		frame->sp = frame->stack + compiled->stackDepth(next);
+		return CompiledMethod::Deoptimized;
+	}
+	return next;
+}
+
+int32_t Interpreter::invokeDirect(Frame* frame, Instruction* pc, Slot* sp, Method* callee)
+{
+	if (jitDepth_ >= MaxJitDepth)
+		return -1;
+
+	frame->pc = pc;
+	frame->sp = sp;
+
+	if (!sp[-(int) callee->argumentSlots()].a) {
+		throwNew("java/lang/NullPointerException");
+		return -1;
+	}
+	return stepInvoke(frame, callee, sp) ? (int32_t) (pc - frame->code) + 1 : -1;
+}
+
+int32_t Interpreter::jitTrap(Interpreter* self, Frame* frame, uint32_t safepoint, const uint64_t* registers, const uint64_t* spills)
+{
+	return self->trap(frame, safepoint, registers, spills);
+}
+
+int32_t Interpreter::trap(Frame* frame, uint32_t id, const uint64_t* registers, const uint64_t* spills)
+{
+	CompiledMethod* compiled = frame->compiled;
+	const Safepoint& safepoint = compiled->debugInfo().at(id);
+
+	// a branch assumed never taken just was, which recompilation is to know
+	Instruction* pc = QuickCode::of(safepoint.scopes.back().method)->instructions() + safepoint.trap;
+	Opcode op = (Opcode) pc->opcode;
+	if ((op >= Opcode::ifeq && op <= Opcode::if_acmpne) || op == Opcode::ifnull || op == Opcode::ifnonnull)
+		pc->resolved.branch.branched(true);
+
+	deoptimize(frame, safepoint, registers, spills);
+	if (!safepoint.check)
+		compiled->invalidate();
+	return CompiledMethod::Deoptimized;
+}
+
+void Interpreter::deoptimize(Frame* frame, const Safepoint& safepoint, const uint64_t* registers, const uint64_t* spills)
+{
+	// all values first, as the frames rebuilt may overlap where they are now
+	std::vector<std::vector<Slot>> values;
+	for (const DebugScope& scope: safepoint.scopes) {
+		values.emplace_back();
+		for (const std::vector<ValueLocation>* locations: {&scope.locals, &scope.stack}) {
+			for (const ValueLocation& location: *locations) {
+				Slot value;
+				value.j = 0;
+				switch (location.kind) {
+					case ValueLocation::Kind::Dead: break;
+					case ValueLocation::Kind::Local: value = frame->locals[location.index]; break;
+					case ValueLocation::Kind::Stack: value = frame->stack[location.index]; break;
+					case ValueLocation::Kind::Register: value.j = registers[location.index]; break;
+					case ValueLocation::Kind::Spill: value.j = spills[location.index]; break;
+					case ValueLocation::Kind::Constant: value.j = location.bits; break;
+				}
+				values.back().push_back(value);
+			}
+		}
+	}
+
+	Frame* current = frame;
+	for (size_t k = 0; k < safepoint.scopes.size(); ++k) {
+		const DebugScope& scope = safepoint.scopes[k];
+
+		if (k) {
+			// the caller is at its invoke, with the arguments popped
+			Method* method = scope.method;
+			current = pushFrame(method, QuickCode::of(method), current->sp);
+			if (!current) {
+				while (topFrame() != frame)
+					popFrame();
+				throwNew("java/lang/StackOverflowError");
+				return;
+			}
+		}
+
+		const Slot* value = values[k].data();
+		for (size_t i = 0; i < scope.locals.size(); ++i)
+			current->locals[i] = *value++;
+		for (size_t i = 0; i < scope.stack.size(); ++i)
+			current->stack[i] = *value++;
+		current->pc = current->code + scope.index;
+		current->sp = current->stack + scope.stack.size();
+	}
+}
+
+// operands a and b, result replacing a
+#define STEP_FLOAT(expr) { float b = sp[-1].f, a = sp[-2].f; sp[-2].f = (expr); return next; }
+#define STEP_DOUBLE(expr) { double b = sp[-2].d, a = sp[-4].d; sp[-4].d = (expr); return next; }
+#define STEP_THROW(...) do { throwNew(__VA_ARGS__); return -1; } while (0)
+#define STEP_NULL_CHECK(ref) do { if (!(ref)) STEP_THROW("java/lang/NullPointerException"); } while (0)
+
+#define STEP_GETFIELD(type, field) { \
+		JObject* object = sp[-1].a; \
+		STEP_NULL_CHECK(object); \
+		sp[-1].field = *(type const*) (object->data() + pc->resolved.offset); \
+		return next; \
+	}
+
+#define STEP_PUTFIELD(type, value, slots) { \
+		Slot* v = sp - (slots); \
+		JObject* object = v[-1].a; \
+		STEP_NULL_CHECK(object); \
+		*(type*) (object->data() + pc->resolved.offset) = (type) (value); \
+		return next; \
+	}
+
+#define STEP_GETSTATIC(type, field) { sp->field = *(type const*) pc->resolved.address; return next; }
+#define STEP_PUTSTATIC(type, value, slots) { Slot* v = sp - (slots); *(type*) pc->resolved.address = (type) (value); return next; }
+
+int32_t Interpreter::step(Frame* frame, Instruction* pc, Slot* sp)
+{
+	int32_t next = (int32_t) (pc - frame->code) + 1;
+
+	frame->pc = pc;
+	frame->sp = sp;
+
+	switch ((Opcode) __atomic_load_n(&pc->opcode, __ATOMIC_ACQUIRE)) {
+		// {{{ floating point
+		case Opcode::fadd: STEP_FLOAT(a + b)
+		case Opcode::fsub: STEP_FLOAT(a - b)
+		case Opcode::fmul: STEP_FLOAT(a * b)
+		case Opcode::fdiv: STEP_FLOAT(a / b)
+		case Opcode::frem: STEP_FLOAT(fmodf(a, b))
+		case Opcode::dadd: STEP_DOUBLE(a + b)
+		case Opcode::dsub: STEP_DOUBLE(a - b)
+		case Opcode::dmul: STEP_DOUBLE(a * b)
+		case Opcode::ddiv: STEP_DOUBLE(a / b)
+		case Opcode::drem: STEP_DOUBLE(fmod(a, b))
+		case Opcode::fneg: sp[-1].f = -sp[-1].f; return next;
+		case Opcode::dneg: sp[-2].d = -sp[-2].d; return next;
+		case Opcode::i2f: { int32_t v = sp[-1].i; sp[-1].f = (float) v; return next; }
+		case Opcode::i2d: { int32_t v = sp[-1].i; sp[-1].d = v; return next; }
+		case Opcode::l2f: { int64_t v = sp[-2].j; sp[-2].f = (float) v; return next; }
+		case Opcode::l2d: { int64_t v = sp[-2].j; sp[-2].d = (double) v; return next; }
+		case Opcode::f2i: { float v = sp[-1].f; sp[-1].i = javaF2I<int32_t>(v); return next; }
+		case Opcode::f2l: { float v = sp[-1].f; sp[-1].j = javaF2I<int64_t>(v); return next; }
+		case Opcode::f2d: { float v = sp[-1].f; sp[-1].d = v; return next; }
+		case Opcode::d2i: { double v = sp[-2].d; sp[-2].i = javaF2I<int32_t>(v); return next; }
+		case Opcode::d2l: { double v = sp[-2].d; sp[-2].j = javaF2I<int64_t>(v); return next; }
+		case Opcode::d2f: { double v = sp[-2].d; sp[-2].f = (float) v; return next; }
+		case Opcode::fcmpl: { float b = sp[-1].f, a = sp[-2].f; sp[-2].i = javaCmp(a, b, -1); return next; }
+		case Opcode::fcmpg: { float b = sp[-1].f, a = sp[-2].f; sp[-2].i = javaCmp(a, b, 1); return next; }
+		case Opcode::dcmpl: { double b = sp[-2].d, a = sp[-4].d; sp[-4].i = javaCmp(a, b, -1); return next; }
+		case Opcode::dcmpg: { double b = sp[-2].d, a = sp[-4].d; sp[-4].i = javaCmp(a, b, 1); return next; }
+		// }}}
+
+		// {{{ switches, returning the target
+		case Opcode::tableswitch: {
+			const int32_t* table = frame->quick->switchTable(pc->operand);
+			int32_t index = sp[-1].i;
+			if (index < table[1] || index > table[2])
+				return table[0];
+			return table[3 + ((uint32_t) index - (uint32_t) table[1])];
+		}
+		case Opcode::lookupswitch: {
+			const int32_t* table = frame->quick->switchTable(pc->operand);
+			int32_t key = sp[-1].i;
+			int32_t lo = 0;
+			int32_t hi = table[1] - 1;
+			while (lo <= hi) {
+				int32_t mid = lo + (hi - lo) / 2;
+				int32_t match = table[2 + 2 * mid];
+				if (key < match)
+					hi = mid - 1;
+				else if (key > match)
+					lo = mid + 1;
+				else
+					return table[3 + 2 * mid];
+			}
+			return table[0];
+		}
+		// }}}
+
+		// {{{ instructions quickened after compilation
+		case Opcode::ldc_quick: sp->a = pc->resolved.object; return next;
+		case Opcode::getfield_z: STEP_GETFIELD(uint8_t, i)
+		case Opcode::getfield_b: STEP_GETFIELD(int8_t, i)
+		case Opcode::getfield_c: STEP_GETFIELD(uint16_t, i)
+		case Opcode::getfield_s: STEP_GETFIELD(int16_t, i)
+		case Opcode::getfield_i: STEP_GETFIELD(int32_t, i)
+		case Opcode::getfield_j: STEP_GETFIELD(int64_t, j)
+		case Opcode::getfield_a: STEP_GETFIELD(JObject*, a)
+		case Opcode::putfield_z: STEP_PUTFIELD(uint8_t, v->i & 1, 1)
+		case Opcode::putfield_b: STEP_PUTFIELD(int8_t, v->i, 1)
+		case Opcode::putfield_s: STEP_PUTFIELD(int16_t, v->i, 1)
+		case Opcode::putfield_i: STEP_PUTFIELD(int32_t, v->i, 1)
+		case Opcode::putfield_j: STEP_PUTFIELD(int64_t, v->j, 2)
+		case Opcode::putfield_a: STEP_PUTFIELD(JObject*, v->a, 1)
+		case Opcode::getstatic_z: STEP_GETSTATIC(uint8_t, i)
+		case Opcode::getstatic_b: STEP_GETSTATIC(int8_t, i)
+		case Opcode::getstatic_c: STEP_GETSTATIC(uint16_t, i)
+		case Opcode::getstatic_s: STEP_GETSTATIC(int16_t, i)
+		case Opcode::getstatic_i: STEP_GETSTATIC(int32_t, i)
+		case Opcode::getstatic_j: STEP_GETSTATIC(int64_t, j)
+		case Opcode::getstatic_a: STEP_GETSTATIC(JObject*, a)
+		case Opcode::putstatic_z: STEP_PUTSTATIC(uint8_t, v->i & 1, 1)
+		case Opcode::putstatic_b: STEP_PUTSTATIC(int8_t, v->i, 1)
+		case Opcode::putstatic_s: STEP_PUTSTATIC(int16_t, v->i, 1)
+		case Opcode::putstatic_i: STEP_PUTSTATIC(int32_t, v->i, 1)
+		case Opcode::putstatic_j: STEP_PUTSTATIC(int64_t, v->j, 2)
+		case Opcode::putstatic_a: STEP_PUTSTATIC(JObject*, v->a, 1)
+		// }}}
+
+		// {{{ objects and arrays
+		case Opcode::new_quick:
+			sp->a = heap_.newObject(pc->resolved.type);
+			return next;
+		case Opcode::newarray: {
+			int32_t length = sp[-1].i;
+			if (length < 0)
+				STEP_THROW("java/lang/NegativeArraySizeException");
+			sp[-1].a = heap_.newArray(primitiveArrays_[pc->index], nullptr, length);
+			return next;
+		}
+		case Opcode::anewarray: {
+			int32_t length = sp[-1].i;
+			if (length < 0)
+				STEP_THROW("java/lang/NegativeArraySizeException");
+			JArray* array = newArray(arrayOf(*frame->pool, pc->index), length);
+			if (!array)
+				return -1;
+			sp[-1].a = array;
+			return next;
+		}
+		case Opcode::aastore: {
+			JObject* object = sp[-1].a;
+			int32_t index = sp[-2].i;
+			JArray* array = (JArray*) sp[-3].a;
+			STEP_NULL_CHECK(array);
+			if ((uint32_t) index >= (uint32_t) array->length())
+				STEP_THROW("java/lang/ArrayIndexOutOfBoundsException");
+			if (object && !canStore(array, object))
+				STEP_THROW("java/lang/ArrayStoreException");
+			array->elements<JObject*>()[index] = object;
+			return next;
+		}
+		case Opcode::checkcast_quick:
+			if (JObject* object = sp[-1].a) {
+				Class* c = pc->resolved.type;
+				if (object->type() ? !object->type()->isSubclassOf(c) : !isInstanceOf(object, c->name(), c))
+					STEP_THROW("java/lang/ClassCastException", c->name()->c_str());
+			}
+			return next;
+		case Opcode::instanceof_quick:
+			if (JObject* object = sp[-1].a) {
+				Class* c = pc->resolved.type;
+				sp[-1].i = object->type() ? object->type()->isSubclassOf(c) : isInstanceOf(object, c->name(), c);
+			} else {
+				sp[-1].i = 0;
+			}
+			return next;
+		case Opcode::athrow: {
+			JObject* exception = sp[-1].a;
+			STEP_NULL_CHECK(exception);
+			exception_ = exception;
+			return -1;
+		}
+		case Opcode::monitorenter:
+		case Opcode::monitorexit:
+			STEP_NULL_CHECK(sp[-1].a);
+			return next;
+		// }}}
+
+		// {{{ invocations, nesting the callee on the C++ stack
+		case Opcode::invokevirtual_mono:
+		case Opcode::invokevirtual_poly:
+		case Opcode::invokeinterface_mono:
+		case Opcode::invokeinterface_poly: {
+			if (jitDepth_ >= MaxJitDepth)
+				return -1;
+			CallSite* site = frame->quick->callSite(pc->operand);
+			JObject* receiver = sp[-(int) site->argumentSlots].a;
+			STEP_NULL_CHECK(receiver);
+			Class* type = receiver->type();
+			Method* callee = nullptr;
+			uint32_t size = __atomic_load_n(&site->size, __ATOMIC_ACQUIRE);
+			for (uint32_t i = 0; i < size && !callee; ++i) {
+				if (site->entries[i].receiver == type) {
+					site->hit(site->entries[i]);
+					callee = site->entries[i].target;
+				}
+			}
+			if (!callee && !(callee = lookupCallSite(frame->quick, pc, site->method, receiver)))
+				return -1;
+			return stepInvoke(frame, callee, sp) ? next : -1;
+		}
+		case Opcode::invokevirtual_mega:
+		case Opcode::invokeinterface_mega: {
+			if (jitDepth_ >= MaxJitDepth)
+				return -1;
+			CallSite* site = frame->quick->callSite(pc->operand);
+			JObject* receiver = sp[-(int) site->argumentSlots].a;
+			STEP_NULL_CHECK(receiver);
+			site->miss();
+			Method* callee = site->method;
+			if (pc->opcode == (uint8_t) Opcode::invokeinterface_mega) {
+				if (!(callee = selectInterface(receiver, callee)))
+					return -1;
+			} else if (Class* type = receiver->type()) {
+				callee = type->vtableAt(callee->vtableIndex());
+			}
+			return stepInvoke(frame, callee, sp) ? next : -1;
+		}
+		case Opcode::invokespecial_quick: {
+			if (jitDepth_ >= MaxJitDepth)
+				return -1;
+			Method* callee = pc->resolved.method;
+			STEP_NULL_CHECK(sp[-(int) callee->argumentSlots()].a);
+			return stepInvoke(frame, callee, sp) ? next : -1;
+		}
+		case Opcode::invokestatic_quick:
+			if (jitDepth_ >= MaxJitDepth)
+				return -1;
+			return stepInvoke(frame, pc->resolved.method, sp) ? next : -1;
+		// }}}
+
+		default:
+			// the interpreter resolves and quickens it
+			return -1;
+	}
+}
+
+#undef STEP_FLOAT
+#undef STEP_DOUBLE
+#undef STEP_THROW
+#undef STEP_NULL_CHECK
+#undef STEP_GETFIELD
+#undef STEP_PUTFIELD
+#undef STEP_GETSTATIC
+#undef STEP_PUTSTATIC
+
+bool Interpreter::stepInvoke(Frame* frame, Method* callee, Slot* sp)
+{
+	Slot* args = sp - callee->argumentSlots();
+	Slot value;
+
+	if (callee->isNative()) {
+		if (!callNative(callee, args, &value))
+			return false;
+	} else {
+		frame->sp = args;
+		Frame* next = enter(callee, args);
+		if (!next || !run(next, &value))
+			return false;
+	}
+
+	if (callee->returnSlots())
+		*args = value;
+
+	return true;
+}
+// }}}
+
+// {{{ traces
+bool Interpreter::enterLoop(Frame* frame, TraceAnchor* anchor)
+{
+	// a recording sees a single frame, and traces nest on the C++ stack like compiled code
+	if (recording_ || jitDepth_ >= MaxJitDepth)
+		return true;
+
+	Trace* trace = anchor->compiled();
+	if (!trace) {
+		if (++anchor->count < traceThreshold_ || anchor->aborts >= MaxTraceAborts)
+			return true;
+		anchor->count = 0;
+		if (!recordTrace(frame, anchor, nullptr))
+			return false;
+		trace = anchor->compiled();
+	}
+
+	// recording a branch may end up at the loop header again
+	while (trace && frame->pc == frame->code + trace->start() && frame->sp == frame->stack + trace->depth()) {
+		TraceExit* exit = runTrace(frame, trace);
+		if (exception_ || !error_.empty())
+			return false;
+
+		if (exit->kind != TraceExit::Kind::Guard || exit->aborts >= MaxTraceAborts || ++exit->count < traceThreshold_)
+			return true;
+		exit->count = 0;
+		if (!recordTrace(frame, exit->trace->anchor(), exit))
+			return false;
+	}
+
+	return true;
+}
+
+bool Interpreter::recordTrace(Frame* frame, TraceAnchor* anchor, TraceExit* exit)
+{
+	TraceRecording recording(frame->method, frame->quick, anchor, exit);
+
+	recording_ = &recording;
+	bool completed = executeRecording(frame, nullptr);
+	recording_ = nullptr;
+
+	Trace* trace = completed ? TraceCompiler::compile(recording, loader_->codeCache()) : nullptr;
+	if (!trace)
+		++(exit ? exit->aborts : anchor->aborts);
+	else if (exit)
+		Trace::attach(exit, trace);
+	else
+		anchor->setCompiled(trace);
+
+	return completed;
+}
+
+bool Interpreter::recordInstruction(Frame* frame, Instruction* pc, Slot* sp)
+{
+	TraceRecording& recording = *recording_;
+	std::vector<TraceRecording::Entry>& entries = recording.entries;
+	uint32_t index = pc - frame->code;
+	uint16_t depth = sp - frame->stack;
+
+	if (!entries.empty()) {
+		TraceRecording::Entry& last = entries.back();
+		const Instruction& previous = frame->code[last.index];
+		Opcode op = (Opcode) __atomic_load_n(&previous.opcode, __ATOMIC_ACQUIRE);
+		bool branches = (op >= Opcode::ifeq && op <= Opcode::goto_) || op == Opcode::ifnull || op == Opcode::ifnonnull;
+
+		if (last.index == index && !branches) {
+			// dispatched again, once quickened
+			entries.pop_back();
+		} else {
+			if (branches)
+				last.taken = (int32_t) index == previous.operand;
+
+			// closes at the loop header it started at, or any other with a trace to continue in
+			if (TraceAnchor* anchor = frame->quick->loopAt(index)) {
+				Trace* trace = anchor->compiled();
+				bool closes = trace
+					? trace->depth() == depth
+					: anchor == recording.anchor && !recording.exit && entries.front().depth == depth;
+				if (closes) {
+					recording.end = anchor;
+					return false;
+				}
+			}
+		}
+	}
+
+	Opcode op = (Opcode) __atomic_load_n(&pc->opcode, __ATOMIC_ACQUIRE);
+	if (entries.size() >= TraceCompiler::MaxLength || !TraceCompiler::isTraceable(op))
+		return false;
+
+	TraceRecording::Entry entry = {index, depth, false, nullptr};
+	switch (op) {
+		case Opcode::invokevirtual_mono: case Opcode::invokevirtual_poly:
+		case Opcode::invokeinterface_mono: case Opcode::invokeinterface_poly:
+			if (JObject* receiver = sp[-(int) frame->quick->callSite(pc->operand)->argumentSlots].a)
+				entry.receiver = receiver->type();
+			break;
+		default:
+			break;
+	}
+
+	entries.push_back(entry);
+	return true;
+}
+
+TraceExit* Interpreter::runTrace(Frame* frame, Trace* trace)
+{
+	++jitDepth_;
+	TraceExit* exit = trace->entry()(frame->locals, frame->stack, this, frame);
+	--jitDepth_;
+
+	frame->pc = frame->code + exit->index;
+	frame->sp = frame->stack + exit->depth;
+	return exit;
+}
+// }}}
+
+// {{{ class initialization
+bool Interpreter::initialize(Class* c)
+{
+	switch (c->initState()) {
+		case Class::InitState::Initialized:
+		case Class::InitState::Initializing: // recursive request
+			return true;
+		case Class::InitState::Erroneous:
+			throwNew("java/lang/NoClassDefFoundError", c->name()->c_str());
+			return false;
+		case Class::InitState::Uninitialized:
+			break;
+	}
+
+	c->initState_.store(Class::InitState::Initializing, std::memory_order_release);
+
+	if (c->superClass() && !initialize(c->superClass())) {
+		c->initState_.store(Class::InitState::Erroneous, std::memory_order_release);
+		return false;
+	}
+
+	applyConstantValues(c);
+
+	if (Method* clinit = c->findDeclaredMethod(Symbols::clinit, Symbols::void_signature)) {
+		if (!invoke(clinit, nullptr, nullptr)) {
+			c->initState_.store(Class::InitState::Erroneous, std::memory_order_release);
+			return false;
+		}
+	}
+
+	c->initState_.store(Class::InitState::Initialized, std::memory_order_release);
+	return true;
+}
+
+/**
+ * Initializes static fields with a ConstantValue attribute, as javac
+ * omits their assignment from <clinit>.
+ */
+void Interpreter::applyConstantValues(Class* c)
+{
+	ConstantPool& pool = c->constantPool;
+
+	for (Field* field: c->fields()) {
+		if (!field->isStatic())
+			continue;
+
+		for (const Attribute* attribute: field->attributes()) {
+			const uint8_t* p = (const uint8_t*) attribute;
+			ConstantUtf8* name = pool.utf8((p[0] << 8) | p[1]);
+			if (!name || name->symbol() != Symbols::ConstantValue)
+				continue;
+
+			uint16_t id = (p[6] << 8) | p[7];
+			Slot value;
+			switch (pool.tag(id)) {
+				case ConstantTag::Integer: value.i = pool.integerAt(id); break;
+				case ConstantTag::Float: value.f = pool.floatAt(id); break;
+				case ConstantTag::Long: value.j = pool.longAt(id); break;
+				case ConstantTag::Double: value.d = pool.doubleAt(id); break;
+				case ConstantTag::String:
+					value.a = resolveString(pool, id);
+					if (!value.a) {
+						clearException();
+						continue;
+					}
+					break;
+				default:
+					continue;
+			}
+
+			storeValue(field->descriptor(), c->staticData() + field->offset(), &value);
+		}
+	}
+}
+// }}}
+
+// {{{ exceptions and strings
+void Interpreter::throwNew(const char* className, const char* message)
+{
+	Class* c = loader_->loadClass(className, true);
+	if (!c || !c->isLaidOut()) {
+		// nothing to throw, so abort execution
+		exception_ = nullptr;
+		error_ = className;
+		if (message) {
+			error_ += ": ";
+			error_ += message;
+		}
+		return;
+	}
+
+	JObject* exception = heap_.newObject(c);
+
+	if (message && stringClass()) {
+		if (Field* field = c->findField(intern("detailMessage"), intern("Ljava/lang/String;"))) {
+			if (JObject* s = newString(message, strlen(message)))
+				exception->at<JObject*>(field->offset()) = s;
+		}
+	}
+
+	error_.clear();
+	exception_ = exception;
+}
+
+Class* Interpreter::stringClass()
+{
+	if (!stringClassLoaded_) {
+		stringClass_ = loader_->loadClass("java/lang/String", true);
+		stringClassLoaded_ = true;
+	}
+
+	return stringClass_;
+}
+
+/**
+ * Creates a java/lang/String from (modified) UTF-8.
+ *
+ * Supports strings backed by a char[] (and an optional count), as well as
+ * compact strings backed by a byte[] and a coder.
+ */
+JObject* Interpreter::newString(const char* utf8, size_t length)
+{
+	Class* c = stringClass();
+	if (!c) {
+		throwNew("java/lang/NoClassDefFoundError", "java/lang/String");
+		return nullptr;
+	}
+
+	std::vector<uint16_t> chars;
+	chars.reserve(length);
+	for (size_t i = 0; i < length; ) {
+		uint8_t ch = utf8[i];
+		uint32_t cp;
+		if (ch < 0x80) {
+			cp = ch;
+			i += 1;
+		} else if ((ch & 0xE0) == 0xC0 && i + 1 < length) {
+			cp = ((ch & 0x1F) << 6) | (utf8[i + 1] & 0x3F);
+			i += 2;
+		} else if ((ch & 0xF0) == 0xE0 && i + 2 < length) {
+			cp = ((ch & 0x0F) << 12) | ((utf8[i + 1] & 0x3F) << 6) | (utf8[i + 2] & 0x3F);
+			i += 3;
+		} else if ((ch & 0xF8) == 0xF0 && i + 3 < length) {
+			cp = ((ch & 0x07) << 18) | ((utf8[i + 1] & 0x3F) << 12) | ((utf8[i + 2] & 0x3F) << 6) | (utf8[i + 3] & 0x3F);
+			i += 4;
+		} else {
+			cp = 0xFFFD;
+			i += 1;
+		}
+
+		if (cp >= 0x10000) {
+			chars.push_back(0xD800 + ((cp - 0x10000) >> 10));
+			chars.push_back(0xDC00 + ((cp - 0x10000) & 0x3FF));
+		} else {
+			chars.push_back(cp);
+		}
+	}
+
+	JObject* s = heap_.newObject(c);
+
+	if (Field* value = c->findField(intern("value"), intern("[C"))) {
+		JArray* array = heap_.newArray(primitiveArrays_[5], nullptr, chars.size());
+		memcpy(array->elements<uint16_t>(), chars.data(), chars.size() * 2);
+		s->at<JObject*>(value->offset()) = array;
+
+		if (Field* count = c->findField(intern("count"), intern("I")))
+			s->at<int32_t>(count->offset()) = chars.size();
+	} else if (Field* value = c->findField(intern("value"), intern("[B"))) {
+		bool latin1 = true;
+		for (uint16_t ch: chars)
+			if (ch > 0xFF)
+				latin1 = false;
+
+		JArray* array = heap_.newArray(primitiveArrays_[8], nullptr, chars.size() * (latin1 ? 1 : 2));
+		for (size_t i = 0; i < chars.size(); ++i) {
+			if (latin1)
+				array->elements<uint8_t>()[i] = chars[i];
+			else
+				memcpy(array->elements<uint8_t>() + 2 * i, &chars[i], 2);
+		}
+		s->at<JObject*>(value->offset()) = array;
+
+		if (Field* coder = c->findField(intern("coder"), intern("B")))
+			s->at<int8_t>(coder->offset()) = latin1 ? 0 : 1;
+	}
+
+	return s;
+}
+
+std::string Interpreter::toUtf8(JObject* s) const
+{
+	std::string out;
+	if (!s || s->isArray())
+		return out;
+
+	Class* c = s->type();
+	std::vector<uint16_t> chars;
+
+	if (Field* value = c->findField(intern("value"), intern("[C"))) {
+		if (JArray* array = s->at<JArray*>(value->offset())) {
+			int32_t offset = 0;
+			int32_t count = array->length();
+			if (Field* f = c->findField(intern("offset"), intern("I")))
+				offset = s->at<int32_t>(f->offset());
+			if (Field* f = c->findField(intern("count"), intern("I")))
+				count = s->at<int32_t>(f->offset());
+			chars.assign(array->elements<uint16_t>() + offset, array->elements<uint16_t>() + offset + count);
+		}
+	} else if (Field* value = c->findField(intern("value"), intern("[B"))) {
+		if (JArray* array = s->at<JArray*>(value->offset())) {
+			Field* coder = c->findField(intern("coder"), intern("B"));
+			if (coder && s->at<int8_t>(coder->offset())) {
+				chars.resize(array->length() / 2);
+				memcpy(chars.data(), array->elements<uint8_t>(), chars.size() * 2);
+			} else {
+				chars.assign(array->elements<uint8_t>(), array->elements<uint8_t>() + array->length());
+			}
+		}
+	}
+
+	for (size_t i = 0; i < chars.size(); ++i) {
+		uint32_t cp = chars[i];
+		if (cp >= 0xD800 && cp < 0xDC00 && i + 1 < chars.size() && chars[i + 1] >= 0xDC00 && chars[i + 1] < 0xE000)
+			cp = 0x10000 + ((cp - 0xD800) << 10) + (chars[++i] - 0xDC00);
+
+		if (cp < 0x80) {
+			out += (char) cp;
+		} else if (cp < 0x800) {
+			out += (char) (0xC0 | (cp >> 6));
+			out += (char) (0x80 | (cp & 0x3F));
+		} else if (cp < 0x10000) {
+			out += (char) (0xE0 | (cp >> 12));
+			out += (char) (0x80 | ((cp >> 6) & 0x3F));
+			out += (char) (0x80 | (cp & 0x3F));
+		} else {
+			out += (char) (0xF0 | (cp >> 18));
+			out += (char) (0x80 | ((cp >> 12) & 0x3F));
+			out += (char) (0x80 | ((cp >> 6) & 0x3F));
+			out += (char) (0x80 | (cp & 0x3F));
+		}
+	}
+
+	return out;
+}
+// }}}
+
+// {{{ constant pool resolution
+Class* Interpreter::resolveClass(ConstantPool& pool, uint16_t id)
+{
+	if (pool.isResolved(id))
+		return pool.resolvedClassAt(id);
+
+	ConstantUtf8* name = pool.className(id);
+	Class* c = name ? loader_->loadClass(name->c_str(), true) : nullptr;
+	if (!c || !c->isLaidOut()) {
+		throwNew("java/lang/NoClassDefFoundError", name ? name->c_str() : "?");
+		return nullptr;
+	}
+
+	pool.setResolved(id, (uintptr_t) c);
+	return c;
+}
+
+Field* Interpreter::resolveField(ConstantPool& pool, uint16_t id, bool isStatic)
+{
+	if (pool.isResolved(id))
+		return (Field*) pool.resolvedAt(id);
+
+	Class* c = resolveClass(pool, pool.refAt(id).a);
+	if (!c)
+		return nullptr;
+
+	ConstantUtf8* name = pool.memberName(id);
+	Field* field = c->findField(name->symbol(), pool.memberDescriptor(id)->symbol());
+	if (!field) {
+		throwNew("java/lang/NoSuchFieldError", name->c_str());
+		return nullptr;
+	}
+
+	if (field->isStatic() != isStatic) {
+		throwNew("java/lang/IncompatibleClassChangeError", name->c_str());
+		return nullptr;
+	}
+
+	pool.setResolved(id, (uintptr_t) field);
+	return field;
+}
+
+Method* Interpreter::resolveMethod(ConstantPool& pool, uint16_t id)
+{
+	if (pool.isResolved(id))
+		return (Method*) pool.resolvedAt(id);
+
+	Class* c = resolveClass(pool, pool.refAt(id).a);
+	if (!c)
+		return nullptr;
+
+	ConstantUtf8* name = pool.memberName(id);
+	Method* method = c->findMethod(name->symbol(), pool.memberDescriptor(id)->symbol());
+	if (!method) {
+		throwNew("java/lang/NoSuchMethodError", name->c_str());
+		return nullptr;
+	}
+
+	pool.setResolved(id, (uintptr_t) method);
+	return method;
+}
+
+JObject* Interpreter::resolveString(ConstantPool& pool, uint16_t id)
+{
+	if (pool.isResolved(id))
+		return (JObject*) pool.resolvedAt(id);
+
+	// equal literals yield the same object, across classes
+	ConstantUtf8* utf8 = pool.string(id);
+	const Symbol* symbol = utf8->symbol();
+
+	JObject*& s = strings_[symbol];
+	if (!s)
+		s = newString((const char*) utf8->data, utf8->length);
+	if (!s)
+		return nullptr;
+
+	pool.setResolved(id, (uintptr_t) s);
+	return s;
+}
+// }}}
+
+// {{{ method selection
+//! invokespecial of a superclass method selects it from the direct superclass on (ACC_SUPER).
+Method* Interpreter::selectSpecial(Method* caller, Method* method)
+{
+	Class* current = caller->thisClass();
+	Class* declaring = method->thisClass();
+
+	if (method->name() == Symbols::init || declaring == current || declaring->isInterface()
+			|| !(current->flags() & ClassFlags::Super) || !current->superClass()
+			|| !current->isSubclassOf(declaring))
+		return method;
+
+	Method* selected = current->superClass()->findMethod(method->name(), method->descriptor());
+	return selected ? selected : method;
+}
+
+Method* Interpreter::selectInterface(JObject* receiver, Method* method)
+{
+	if (receiver->isArray())
+		return method;
+
+	Class* type = receiver->type();
+	Method* selected = nullptr;
+
+	// java/lang/Object's methods called through an interface are virtual
+	if (method->vtableIndex() != Method::NoVtableIndex)
+		selected = type->vtableAt(method->vtableIndex());
+	else if (method->itableIndex() != Method::NoItableIndex)
+		selected = type->itableLookup(method);
+
+	// receivers of incompletely linked classes lack itables
+	if (!selected)
+		selected = type->findMethod(method->name(), method->descriptor());
+
+	if (!selected) {
+		throwNew("java/lang/AbstractMethodError", method->name()->c_str());
+		return nullptr;
+	}
+
+	return selected;
+}
+
+Method* Interpreter::lookupCallSite(QuickCode* quick, Instruction* insn, Method* method, JObject* receiver)
+{
+	Class* type = receiver->type();
+	Method* target;
+
+	if (method->vtableIndex() != Method::NoVtableIndex)
+		target = type ? type->vtableAt(method->vtableIndex()) : method;
+	else if (!(target = selectInterface(receiver, method)))
+		return nullptr;
+
+	quick->callSite(insn->operand)->miss();
+	quick->cache(insn, method, type, target);
+
+	return target;
+}
+// }}}
+
+// {{{ arrays and type checks
+const Symbol* Interpreter::arrayOf(ConstantPool& pool, uint16_t classId)
+{
+	const char* name = pool.className(classId)->c_str();
+	if (name[0] == '[')
+		return intern((std::string("[") + name).c_str());
+	else
+		return intern((std::string("[L") + name + ";").c_str());
+}
+
+JArray* Interpreter::newArray(const Symbol* descriptor, int32_t length)
+{
+	Class* elementClass = nullptr;
+
+	const char* type = descriptor->c_str();
+	if (descriptor->size() > 3 && type[1] == 'L') {
+		std::string name(type + 2, descriptor->size() - 3);
+		elementClass = loader_->loadClass(name.c_str(), true);
+		if (!elementClass) {
+			throwNew("java/lang/NoClassDefFoundError", name.c_str());
+			return nullptr;
+		}
+	}
+
+	return heap_.newArray(descriptor, elementClass, length);
+}
+
+JArray* Interpreter::newMultiArray(const Symbol* descriptor, const int32_t* counts, int dimensions)
+{
+	JArray* array = newArray(descriptor, counts[0]);
+	if (!array || dimensions == 1)
+		return array;
+
+	const Symbol* component = intern(descriptor->c_str() + 1, descriptor->size() - 1);
+	for (int32_t i = 0; i < counts[0]; ++i) {
+		JArray* element = newMultiArray(component, counts + 1, dimensions - 1);
+		if (!element)
+			return nullptr;
+		array->elements<JArray*>()[i] = element;
+	}
+
+	return array;
+}
+
+bool Interpreter::isInstanceOf(JObject* object, const Symbol* className, Class* c)
+{
+	const char* name = className->c_str();
+
+	if (!object->isArray())
+		return c && object->type()->isSubclassOf(c);
+
+	if (name[0] == '[')
+		return isArrayAssignable(*this, ((JArray*) object)->descriptor()->c_str(), name);
+
+	return strcmp(name, "java/lang/Object") == 0
+		|| strcmp(name, "java/lang/Cloneable") == 0
+		|| strcmp(name, "java/io/Serializable") == 0;
+}
+
+int Interpreter::checkInstance(ConstantPool& pool, uint16_t classId, JObject* object)
+{
+	const Symbol* name = pool.className(classId)->symbol();
+
+	Class* c = nullptr;
+	if (name->c_str()[0] != '[') {
+		c = resolveClass(pool, classId);
+		if (!c)
+			return -1;
+	}
+
+	return isInstanceOf(object, name, c) ? 1 : 0;
+}
+
+//! aastore type check
+bool Interpreter::canStore(JArray* array, JObject* value)
+{
+	const char* component = array->descriptor()->c_str() + 1;
+
+	if (!value->isArray() && array->elementClass())
+		return value->type()->isSubclassOf(array->elementClass());
+
+	if (value->isArray())
+		return isArrayAssignable(*this, ((JArray*) value)->descriptor()->c_str(), component);
+
+	return false;
+}
+// }}}
@@ -0,0 +1,473 @@
+#pragma once
+
+#include "Heap.h"
+#include "QuickCode.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+class Class;
+class Field;
+class Method;
+class Symbol;
+class ConstantPool;
+class JObject;
+class JArray;
+class VMClassLoader;
+class CompiledMethod;
+class BaselineCompiler;
+class TraceCompiler;
+class Trace;
+struct TraceExit;
+struct TraceRecording;
+struct Safepoint;
+
+/**
+ * A single slot of the local variables or the operand stack.
+ *
+ * long and double values take two slots, with the value in the first one,
+ * so that slot indices match the ones of the bytecode.
+ */
+union Slot {
+	int32_t i;
+	int64_t j;
+	float f;
+	double d;
+	JObject* a;
+	Instruction* pc; //!< return address of jsr
+};
+
+/**
+ * Bytecode interpreter.
+ *
+ * Java calls do not recurse on the C++ stack. Each invocation pushes a
+ * frame onto the interpreter's own stack and continues in the same loop.
+ *
+ * That stack is a single contiguous region, guard-paged at both ends, that
+ * frames are bump-allocated from. A frame consists of the locals, the frame
+ * record and the operand stack. The callee's locals start at the caller's
+ * outgoing arguments, so that invocation copies nothing:
+ *
+ * \code
+ *   caller: | locals | Frame | operands ... args |
+ *   callee:                                | locals      | Frame | operands |
+ * \endcode
+ *
+ * Methods run quickened (see QuickCode), translated on their first
+ * invocation, and profiled (see MethodProfile). A method whose invocations
+ * and back edges add up to the hot threshold is reported to the hot method
+ * handler, once.
+ *
+ * The dispatch loop is compiled from Interpreter.inc: once as a switch,
+ * and, if built with JVM_COMPUTED_GOTO, direct threaded via computed
+ * gotos, where each handler ends with its own indirect jump. The threaded
+ * loop comes twice, once also caching the top of the operand stack in a
+ * register.
+ *
+ * If built with JVM_JIT, hot methods also get compiled (see
+ * OptimizingCompiler, and BaselineCompiler for methods beyond it), and
+ * frames of compiled methods run their native code instead. That code
+ * works on the same frames, so it can hand a frame back to the dispatch
+ * loop at any instruction, and calls back into the interpreter for
+ * invocations (see jitStep()). Each such call nests on the C++ stack, up
+ * to a limit beyond which frames are interpreted. A frame still
+ * interpreted when its method gets compiled, typically the one whose loop
+ * made it hot, moves over to the compiled code at its next back edge,
+ * entering it at the loop header (on-stack replacement).
+ *
+ * Compiled code that finds its speculation wrong takes an uncommon trap
+ * (see jitTrap()), which rebuilds the interpreter frames it stands for
+ * from its debug info and invalidates it; activations of code invalidated
+ * otherwise, like by the loading of a class it assumed absent, return to
+ * the interpreter at their next call into it (deoptimization).
+ *
+ * Loops of hot methods can get traced instead (see Trace): once a loop
+ * header has been reached often enough, the interpreter records the path
+ * that the next iteration takes, in a separate switch-dispatched loop that
+ * sees every instruction before running it, and compiles that path. Side
+ * exits that keep being taken get their own paths recorded, attached to the
+ * exit. Tracing works on interpreted frames only, so with both enabled,
+ * loops of compiled methods run compiled.
+ *
+ * An interpreter executes on a single thread and owns the heap that its
+ * objects are allocated from.
+ */
+class Interpreter {
+public:
+	enum class Dispatch {
+		Switch,
+		Threaded,
+		Cached,     //!< threaded, with the top of stack cached in a register; no faster
+		            //!< than Threaded on code dominated by calls of small methods
+	};
+
+	/**
+	 * Native method implementation.
+	 *
+	 * @param args the arguments, as laid out in slots.
+	 * @param result receives the return value, if any.
+	 * @return false if an exception has been thrown.
+	 */
+	typedef bool (*NativeMethod)(Interpreter& interpreter, Slot* args, Slot* result);
+
+	/**
+	 * Notification of a method turning hot, on the thread of the
+	 * interpreter that counted it past the threshold, before running on.
+	 */
+	typedef std::function<void(Interpreter& interpreter, Method* method)> HotMethodHandler;
+
+	static const uint32_t DefaultHotThreshold = 10000;
+
+	//! Nesting of compiled code on the C++ stack, see jitStep().
+	static const unsigned MaxJitDepth = 256;
+
+	//! Times a loop header or side exit is reached before recording a trace from there.
+	static const uint32_t DefaultTraceThreshold = 64;
+
+	//! Failed recordings after which a loop or side exit is no longer traced.
+	static const uint32_t MaxTraceAborts = 4;
+
+private:
+	friend class BaselineCompiler;
+	friend class OptimizingCompiler;
+	friend class TraceCompiler;
+
+	struct Frame {
+		Frame* caller;
+		Method* method;
+		ConstantPool* pool;
+		QuickCode* quick;
+		Instruction* code;
+		Instruction* pc;     //!< current instruction, or the invoke a callee returns to
+		Slot* locals;
+		Slot* stack;         //!< bottom of the operand stack
+		Slot* sp;            //!< next free operand stack slot
+		CompiledMethod* compiled;  //!< running the frame, if any
+	};
+
+	VMClassLoader* loader_;
+	Heap heap_;
+	Dispatch dispatch_;
+
+	void* mapping_;       //!< the stack, including its guard pages
+	size_t mappingSize_;
+	Slot* stack_;
+	Slot* stackEnd_;
+	Frame* top_;          //!< innermost frame
+
+	uint64_t hotThreshold_;
+	HotMethodHandler hotMethodHandler_;
+
+	bool jitEnabled_;
+	bool optimizingEnabled_;
+	bool osrEnabled_;
+	unsigned jitDepth_;   //!< compiled frames currently running
+
+	bool traceEnabled_;
+	uint32_t traceThreshold_;
+	TraceRecording* recording_;  //!< in progress, if any
+
+	JObject* exception_;  //!< pending exception
+	std::string error_;   //!< reason of an abort that no exception could be thrown for
+
+	std::unordered_map<std::string, NativeMethod> natives_;
+	std::unordered_map<const Method*, NativeMethod> boundNatives_;
+
+	std::unordered_map<const Symbol*, JObject*> strings_; //!< interned string literals
+	Class* stringClass_;
+	bool stringClassLoaded_;
+
+	const Symbol* primitiveArrays_[12]; //!< array descriptors by newarray type code
+
+public:
+	/**
+	 * @param loader class loader to resolve classes through.
+	 * @param stackSlots size of the interpreter stack in slots, which
+	 *                   limits the call depth.
+	 */
+	explicit Interpreter(VMClassLoader* loader, size_t stackSlots = 1 << 20);
+	~Interpreter();
+
+	Interpreter(const Interpreter&) = delete;
+	Interpreter& operator=(const Interpreter&) = delete;
+
+	//! Whether this build includes the computed-goto dispatch loops, Threaded and Cached.
+	static bool hasThreadedDispatch();
+
+	//! Selects the dispatch loop, defaulting to Threaded if available.
+	void setDispatch(Dispatch dispatch);
+	Dispatch dispatch() const { return dispatch_; }
+
+	/**
+	 * Sets the temperature (see MethodProfile::temperature()) at which
+	 * methods turn hot, 0 to never.
+	 *
+	 * A method turns hot once only, with the threshold of the interpreter
+	 * that counts it past there.
+	 */
+	void setHotThreshold(uint32_t threshold) { hotThreshold_ = threshold ? threshold : UINT64_MAX; }
+	uint32_t hotThreshold() const { return hotThreshold_ == UINT64_MAX ? 0 : hotThreshold_; }
+
+	void setHotMethodHandler(HotMethodHandler handler) { hotMethodHandler_ = handler; }
+
+	//! Whether this build includes the JIT compiler.
+	static bool hasJit();
+
+	/**
+	 * Enables or disables compiling hot methods and running compiled code,
+	 * enabled by default if available.
+	 */
+	void setJitEnabled(bool enabled) { jitEnabled_ = enabled && hasJit(); }
+	bool isJitEnabled() const { return jitEnabled_; }
+
+	/**
+	 * Enables or disables compiling hot methods with the optimizing
+	 * compiler rather than the baseline one, which remains for methods it
+	 * does not handle; enabled by default.
+	 */
+	void setOptimizingEnabled(bool enabled) { optimizingEnabled_ = enabled; }
+	bool isOptimizingEnabled() const { return optimizingEnabled_; }
+
+	/**
+	 * Enables or disables on-stack replacement, i.e. interpreted frames of
+	 * compiled methods entering the compiled code at loop back edges rather
+	 * than on their next invocation only, enabled by default.
+	 */
+	void setOsrEnabled(bool enabled) { osrEnabled_ = enabled; }
+	bool isOsrEnabled() const { return osrEnabled_; }
+
+	/**
+	 * Enables or disables tracing loops of hot methods and running the
+	 * traces, disabled by default.
+	 */
+	void setTraceEnabled(bool enabled) { traceEnabled_ = enabled && hasJit(); }
+	bool isTraceEnabled() const { return traceEnabled_; }
+
+	//! Sets how often a loop header or side exit is reached before it gets traced.
+	void setTraceThreshold(uint32_t threshold) { traceThreshold_ = threshold ? threshold : 1; }
+	uint32_t traceThreshold() const { return traceThreshold_; }
+
+	/**
+	 * Invokes a method, initializing its class if needed.
+	 *
+	 * @param args argumentSlots() slots holding the arguments.
+	 * @param result receives the return value, if any.
+	 *
+	 * @return true on normal completion, false if an exception was thrown
+	 *         (see exception()) or execution was aborted (see error()).
+	 */
+	bool invoke(Method* method, const Slot* args, Slot* result);
+
+	JObject* exception() const { return exception_; }
+	const std::string& error() const { return error_; }
+	void clearException() { exception_ = nullptr; error_.clear(); }
+
+	//! Describes the pending exception or abort reason.
+	std::string describeException() const;
+
+	/**
+	 * Registers the implementation of a native method.
+	 *
+	 * @param className binary class name, i.e. "java/lang/System".
+	 */
+	void registerNative(const char* className, const char* name, const char* descriptor, NativeMethod native);
+
+	/**
+	 * Runs the static initializer of \p c and its superclasses, unless done.
+	 *
+	 * @return false if initialization failed, with an exception pending.
+	 */
+	bool initialize(Class* c);
+
+	/**
+	 * Throws a new exception of given class.
+	 *
+	 * Aborts execution instead if the class cannot be loaded.
+	 */
+	void throwNew(const char* className, const char* message = nullptr);
+	void throwException(JObject* exception) { exception_ = exception; }
+
+	//! Creates a java/lang/String, or returns \p nullptr with an exception pending.
+	JObject* newString(const char* utf8, size_t length);
+
+	//! Contents of a java/lang/String as UTF-8.
+	std::string toUtf8(JObject* s) const;
+
+	Heap& heap() { return heap_; }
+	VMClassLoader* loader() const { return loader_; }
+
+	//! Whether \p object can be cast to the class named \p className.
+	bool isInstanceOf(JObject* object, const Symbol* className, Class* c);
+
+private:
+	bool executeSwitch(Frame* entry, Slot* result);
+#if defined(JVM_COMPUTED_GOTO)
+	bool executeThreaded(Frame* entry, Slot* result);
+	bool executeCached(Frame* entry, Slot* result);
+#endif
+#if defined(JVM_JIT)
+	bool executeRecording(Frame* entry, Slot* result);
+#endif
+	bool execute(Frame* entry, Slot* result);
+
+	//! Runs the \p frame just entered to completion, compiled if possible.
+	bool run(Frame* frame, Slot* result);
+
+	/**
+	 * Pushes a frame for \p method, or returns \p nullptr with an exception pending.
+	 *
+	 * @param locals the arguments, in place on the stack, becoming the
+	 *               start of the frame's locals.
+	 */
+	Frame* enter(Method* method, Slot* locals);
+	Frame* pushFrame(Method* method, QuickCode* quick, Slot* locals);
+	void popFrame() { top_ = top_->caller; }
+	Frame* topFrame() { return top_; }
+
+	//! Start of the free stack, past the operand stack of the innermost frame.
+	Slot* stackTop() const;
+
+	//! Marks the profiled method hot once at \p temperature past the threshold.
+	void heat(MethodProfile* profile, uint64_t temperature) {
+		if (temperature >= hotThreshold_ && !profile->isHot())
+			turnedHot(profile);
+	}
+	void turnedHot(MethodProfile* profile);
+
+	// {{{ compiled code
+	void compile(Method* method);
+
+	/**
+	 * Runs the compiled code of \p frame from its pc, or from the header
+	 * of \p loop through its entry for on-stack replacement, with the
+	 * frame's pc and sp at the header.
+	 *
+	 * @return CompiledMethod::Returned, or the index of the instruction it
+	 *         exited at, which \p frame's pc and sp are then set to, or
+	 *         CompiledMethod::Deoptimized with the innermost frame rebuilt
+	 *         at the instruction to continue at.
+	 */
+	int32_t runCompiled(Frame* frame, const TraceAnchor* loop = nullptr);
+
+	/**
+	 * Runs instruction \p pc of \p frame for compiled code, with \p sp
+	 * past its operands.
+	 *
+	 * Compiled code calls this for the instructions it has no template for,
+	 * so it is part of its calling convention.
+	 *
+	 * @return the index of the instruction to continue at, or -1 to exit
+	 *         to the interpreter at \p pc: with an exception pending, an
+	 *         abort, or for the interpreter to run it, or
+	 *         CompiledMethod::Deoptimized if the code got invalidated
+	 *         meanwhile, with \p frame set up to continue.
+	 */
+	static int32_t jitStep(Interpreter* self, Frame* frame, Instruction* pc, Slot* sp);
+	int32_t step(Frame* frame, Instruction* pc, Slot* sp);
+	bool stepInvoke(Frame* frame, Method* callee, Slot* sp);
+
+	/**
+	 * Runs invoke instruction \p pc of \p frame for compiled code like
+	 * jitStep(), calling \p callee directly rather than dispatching on the
+	 * receiver: the only target the class hierarchy allows (see
+	 * ClassHierarchy::uniqueTarget()), as long as the code is valid.
+	 */
+	static int32_t jitInvoke(Interpreter* self, Frame* frame, Instruction* pc, Slot* sp, Method* callee);
+	int32_t invokeDirect(Frame* frame, Instruction* pc, Slot* sp, Method* callee);
+
+	/**
+	 * Continues \p frame at \p next, the result of a call from compiled
+	 * code, unless that code got invalidated meanwhile.
+	 *
+	 * @return \p next, or CompiledMethod::Deoptimized with the frame set
+	 *         up for the interpreter to continue at \p next.
+	 */
+	static int32_t continueCompiled(Frame* frame, int32_t next);
+
+	/**
+	 * Uncommon trap of the code running \p frame at \p safepoint, of its
+	 * debug info: deoptimizes the frame and invalidates the code, unless
+	 * the safepoint is a mere check (see Safepoint::check).
+	 *
+	 * @param registers the general-purpose registers, by number, as saved
+	 *                  by the trap, or \p nullptr if it keeps none.
+	 * @param spills the spill area of the compiled frame, or \p nullptr.
+	 * @return CompiledMethod::Deoptimized, for the code to return.
+	 */
+	static int32_t jitTrap(Interpreter* self, Frame* frame, uint32_t safepoint, const uint64_t* registers, const uint64_t* spills);
+	int32_t trap(Frame* frame, uint32_t safepoint, const uint64_t* registers, const uint64_t* spills);
+
+	/**
+	 * Rebuilds the interpreter state at \p safepoint: \p frame's slots, pc
+	 * and sp, and a frame above it for each inlined method.
+	 *
+	 * Leaves a StackOverflowError pending at \p frame if the inlined
+	 * frames do not fit.
+	 */
+	void deoptimize(Frame* frame, const Safepoint& safepoint, const uint64_t* registers, const uint64_t* spills);
+	// }}}
+
+	// {{{ traces
+	/**
+	 * Continues \p frame, at the header of \p anchor's loop, in the loop's
+	 * trace if there is one, or records one if due.
+	 *
+	 * @return false with an exception pending, or execution aborted, at the
+	 *         frame's pc.
+	 */
+	bool enterLoop(Frame* frame, TraceAnchor* anchor);
+
+	/**
+	 * Records and compiles a trace of \p frame from its pc on: the root of
+	 * \p anchor's loop, or a branch at \p exit.
+	 *
+	 * @return false if recording ended in an exception or abort.
+	 */
+	bool recordTrace(Frame* frame, TraceAnchor* anchor, TraceExit* exit);
+
+	/**
+	 * Adds instruction \p pc of \p frame, with \p sp past its operands, to
+	 * the recording before it runs.
+	 *
+	 * @return false if the recording ends before \p pc, closed or not.
+	 */
+	bool recordInstruction(Frame* frame, Instruction* pc, Slot* sp);
+
+	//! Runs root trace \p trace from \p frame's pc, up to the exit returned.
+	TraceExit* runTrace(Frame* frame, Trace* trace);
+	// }}}
+
+	Instruction* findHandler(Frame* frame, const Instruction* pc);
+	bool callNative(Method* method, Slot* args, Slot* result);
+	void invalidOpcode(Frame* frame, const Instruction* pc);
+	void applyConstantValues(Class* c);
+	Class* stringClass();
+
+	// {{{ constant pool resolution, cached in the pool
+	Class* resolveClass(ConstantPool& pool, uint16_t id);
+	Field* resolveField(ConstantPool& pool, uint16_t id, bool isStatic);
+	Method* resolveMethod(ConstantPool& pool, uint16_t id);
+	JObject* resolveString(ConstantPool& pool, uint16_t id);
+	// }}}
+
+	Method* selectSpecial(Method* caller, Method* method);
+	Method* selectInterface(JObject* receiver, Method* method);
+
+	/**
+	 * Selects the implementation of \p method for \p receiver at the call
+	 * site of \p insn and caches it there.
+	 *
+	 * @return the implementation, or \p nullptr with an exception pending.
+	 */
+	Method* lookupCallSite(QuickCode* quick, Instruction* insn, Method* method, JObject* receiver);
+
+	JArray* newArray(const Symbol* descriptor, int32_t length);
+	JArray* newMultiArray(const Symbol* descriptor, const int32_t* counts, int dimensions);
+	const Symbol* arrayOf(ConstantPool& pool, uint16_t classId);
+
+	//! checkcast/instanceof test, 1 or 0, or -1 with an exception pending.
+	int checkInstance(ConstantPool& pool, uint16_t classId, JObject* object);
+	bool canStore(JArray* array, JObject* value);
+};
@@ -0,0 +1,1600 @@
+#include "Ir.h"
+#include "Class.h"
+#include "ConstantPool.h"
+#include "QuickCode.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
+// {{{ names
+const char* irOpName(IrOp op)
+{
+	static const char* const names[] = {
+#define X(id, name, flags) name,
+		JVM_IR_OPS(X)
+#undef X
+	};
+	return names[(size_t) op];
+}
+
+uint8_t irOpFlags(IrOp op)
+{
+	static const uint8_t flags[] = {
+#define X(id, name, flags) flags,
+		JVM_IR_OPS(X)
+#undef X
+	};
+	return flags[(size_t) op];
+}
+
+const char* irTypeName(IrType type)
+{
+	static const char* const names[] = { "void", "int", "long", "float", "double", "ref" };
+	return names[(size_t) type];
+}
+
+static const char* condName(IrCond cond)
+{
+	static const char* const names[] = { "eq", "ne", "lt", "ge", "gt", "le" };
+	return names[(size_t) cond];
+}
+// }}}
+
+float IrValue::asFloat() const
+{
+	uint32_t bits = (uint32_t) imm;
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+double IrValue::asDouble() const
+{
+	double d;
+	memcpy(&d, &imm, sizeof(d));
+	return d;
+}
+
+size_t IrBlock::phiCount() const
+{
+	size_t n = 0;
+	while (n < values.size() && values[n]->op == IrOp::Phi)
+		++n;
+	return n;
+}
+
+size_t IrBlock::predecessorIndex(const IrBlock* block) const
+{
+	return std::find(predecessors.begin(), predecessors.end(), block) - predecessors.begin();
+}
+
+template<typename T>
+static inline bool contains(const std::vector<T>& v, const T& x)
+{
+	return std::find(v.begin(), v.end(), x) != v.end();
+}
+
+static inline bool isWide(IrType type)
+{
+	return type == IrType::Long || type == IrType::Double;
+}
+
+// {{{ editing
+IrBlock* IrGraph::newBlock(uint32_t start)
+{
+	IrBlock* block = arena_.construct<IrBlock>(nextBlock_++, start);
+	blocks_.push_back(block);
+	return block;
+}
+
+IrValue* IrGraph::newValue(IrOp op, IrType type)
+{
+	return arena_.construct<IrValue>(nextValue_++, op, type);
+}
+
+IrValue* IrGraph::insert(IrBlock* block, IrOp op, IrType type, std::vector<IrValue*> operands, int64_t imm)
+{
+	IrValue* value = newValue(op, type);
+	value->block = block;
+	value->operands = std::move(operands);
+	value->imm = imm;
+	value->index = block->start != UINT32_MAX ? block->start : 0;
+
+	auto at = op == IrOp::Phi ? block->values.begin() + block->phiCount()
+		: block->terminator() ? block->values.end() - 1 : block->values.end();
+	block->values.insert(at, value);
+	return value;
+}
+
+void IrGraph::setConst(IrValue* value, int64_t bits)
+{
+	value->op = IrOp::Const;
+	value->operands.clear();
+	value->cases.clear();
+	value->imm = bits;
+}
+
+void IrGraph::setCopy(IrValue* value, IrValue* source)
+{
+	value->op = IrOp::Copy;
+	value->operands.assign(1, source);
+	value->cases.clear();
+	value->imm = 0;
+}
+
+void IrGraph::replaceUses(IrValue* from, IrValue* to)
+{
+	forwardUses([&](IrValue* value) { return value == from ? to : value; });
+}
+
+void IrGraph::remove(IrValue* value)
+{
+	std::vector<IrValue*>& values = value->block->values;
+	values.erase(std::find(values.begin(), values.end(), value));
+	value->block = nullptr;
+}
+
+void IrGraph::removeEdge(IrBlock* from, IrBlock* to)
+{
+	auto succ = std::find(from->successors.begin(), from->successors.end(), to);
+	if (succ != from->successors.end()) {
+		from->successors.erase(succ);
+	} else {
+		auto handler = std::find(from->handlers.begin(), from->handlers.end(), to);
+		if (handler != from->handlers.end())
+			from->handlers.erase(handler);
+	}
+
+	size_t k = to->predecessorIndex(from);
+	if (k == to->predecessors.size())
+		return;
+
+	to->predecessors.erase(to->predecessors.begin() + k);
+	for (IrValue* value: to->values) {
+		if (value->op != IrOp::Phi)
+			break;
+		value->operands.erase(value->operands.begin() + k);
+	}
+}
+
+void IrGraph::setGoto(IrBlock* block, IrBlock* target)
+{
+	IrValue* term = block->terminator();
+	term->op = IrOp::Goto;
+	term->operands.clear();
+	term->cases.clear();
+	term->imm = 0;
+
+	std::vector<IrBlock*> successors = block->successors;
+	for (IrBlock* successor: successors)
+		if (successor != target)
+			removeEdge(block, successor);
+}
+// }}}
+
+// {{{ analysis
+void IrGraph::computeDominators()
+{
+	for (IrBlock* block: blocks_) {
+		block->idom = nullptr;
+		block->order = UINT32_MAX;
+		block->loopDepth = 0;
+	}
+
+	// postorder over normal and exceptional edges, without recursion
+	std::vector<bool> visited(nextBlock_, false);
+	std::vector<IrBlock*> postorder;
+	std::vector<std::pair<IrBlock*, size_t>> stack;
+	stack.push_back(std::make_pair(entry(), 0));
+	visited[entry()->id] = true;
+
+	while (!stack.empty()) {
+		IrBlock* block = stack.back().first;
+		size_t next = stack.back().second++;
+		size_t n = block->successors.size();
+		if (next < n + block->handlers.size()) {
+			IrBlock* succ = next < n ? block->successors[next] : block->handlers[next - n];
+			if (!visited[succ->id]) {
+				visited[succ->id] = true;
+				stack.push_back(std::make_pair(succ, 0));
+			}
+		} else {
+			postorder.push_back(block);
+			stack.pop_back();
+		}
+	}
+
+	std::vector<IrBlock*> rpo(postorder.rbegin(), postorder.rend());
+	for (size_t i = 0; i < rpo.size(); ++i)
+		rpo[i]->order = i;
+
+	// Cooper, Harvey, Kennedy: A Simple, Fast Dominance Algorithm
+	IrBlock* start = entry();
+	start->idom = start;
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (size_t i = 1; i < rpo.size(); ++i) {
+			IrBlock* idom = nullptr;
+			for (IrBlock* pred: rpo[i]->predecessors) {
+				if (pred->order == UINT32_MAX || !pred->idom)
+					continue;
+				IrBlock* a = pred;
+				IrBlock* b = idom;
+				while (b && a != b) {
+					while (a->order > b->order)
+						a = a->idom;
+					while (b->order > a->order)
+						b = b->idom;
+				}
+				idom = a;
+			}
+			if (rpo[i]->idom != idom) {
+				rpo[i]->idom = idom;
+				changed = true;
+			}
+		}
+	}
+	start->idom = nullptr;
+
+	// natural loops, by header
+	std::vector<bool> body(nextBlock_);
+	std::vector<IrBlock*> work;
+	for (IrBlock* header: rpo) {
+		std::fill(body.begin(), body.end(), false);
+		body[header->id] = true;
+		work.clear();
+		for (IrBlock* pred: header->predecessors)
+			if (dominates(header, pred) && !body[pred->id]) {
+				body[pred->id] = true;
+				work.push_back(pred);
+			}
+		if (work.empty())
+			continue;
+
+		++header->loopDepth;
+		while (!work.empty()) {
+			IrBlock* block = work.back();
+			work.pop_back();
+			++block->loopDepth;
+			for (IrBlock* pred: block->predecessors)
+				if (pred->order != UINT32_MAX && !body[pred->id]) {
+					body[pred->id] = true;
+					work.push_back(pred);
+				}
+		}
+	}
+}
+
+bool IrGraph::dominates(const IrBlock* a, const IrBlock* b)
+{
+	if (a->order == UINT32_MAX)
+		return false;
+	while (b && b->order > a->order)
+		b = b->idom;
+	return b == a;
+}
+
+std::vector<uint32_t> IrGraph::useCounts() const
+{
+	std::vector<uint32_t> uses(nextValue_, 0);
+	for (IrBlock* block: blocks_)
+		for (IrValue* value: block->values)
+			for (IrValue* operand: value->operands)
+				if (operand)
+					++uses[operand->id];
+	return uses;
+}
+
+std::string IrGraph::verify()
+{
+	std::string errors;
+	auto fail = [&](const IrBlock* block, const IrValue* value, const char* what) {
+		char buf[128];
+		if (value)
+			snprintf(buf, sizeof(buf), "B%u: v%u: %s\n", block->id, value->id, what);
+		else
+			snprintf(buf, sizeof(buf), "B%u: %s\n", block->id, what);
+		errors += buf;
+	};
+
+	if (blocks_.empty())
+		return "no blocks\n";
+	if (!entry()->predecessors.empty())
+		fail(entry(), nullptr, "entry block has predecessors");
+
+	computeDominators();
+
+	std::vector<const IrBlock*> definedIn(nextValue_, nullptr);
+	std::vector<size_t> position(nextValue_, 0);
+	std::vector<bool> inGraph(nextBlock_, false);
+	for (IrBlock* block: blocks_) {
+		inGraph[block->id] = true;
+		for (size_t i = 0; i < block->values.size(); ++i) {
+			IrValue* value = block->values[i];
+			if (value->block != block)
+				fail(block, value, "value of another block");
+			definedIn[value->id] = block;
+			position[value->id] = i;
+		}
+	}
+
+	for (IrBlock* block: blocks_) {
+		IrValue* term = block->terminator();
+		if (!term) {
+			fail(block, nullptr, "no terminator");
+			continue;
+		}
+
+		// {{{ structure
+		size_t phis = block->phiCount();
+		for (size_t i = 0; i < block->values.size(); ++i) {
+			IrValue* value = block->values[i];
+			if (value->op == IrOp::Phi && i >= phis)
+				fail(block, value, "phi after other values");
+			if (value->op == IrOp::Phi && value->operands.size() != block->predecessors.size())
+				fail(block, value, "phi operands do not match the predecessors");
+			if (value->isTerminator() && value != term)
+				fail(block, value, "terminator in the middle of a block");
+		}
+
+		size_t successors = block->successors.size();
+		bool ok = true;
+		switch (term->op) {
+			case IrOp::Goto: ok = successors == 1 && term->operands.empty(); break;
+			case IrOp::If: ok = successors == 2 && term->operands.size() == 2; break;
+			case IrOp::Return: ok = successors == 0 && term->operands.size() <= 1; break;
+			case IrOp::Throw: ok = successors == 0 && term->operands.size() == 1; break;
+			case IrOp::Switch:
+				ok = successors >= 1 && term->operands.size() == 1 && term->cases.size() % 2 == 0;
+				for (size_t k = 1; ok && k < term->cases.size(); k += 2)
+					ok = term->cases[k] >= 0 && (size_t) term->cases[k] < successors;
+				break;
+			default: break;
+		}
+		if (!ok)
+			fail(block, term, "terminator does not match the successors");
+
+		for (size_t k = 0; k < successors + block->handlers.size(); ++k) {
+			IrBlock* succ = k < successors ? block->successors[k] : block->handlers[k - successors];
+			if (!inGraph[succ->id] || succ->predecessorIndex(block) == succ->predecessors.size())
+				fail(block, nullptr, "successor without the edge back");
+		}
+		for (size_t k = 0; k < block->predecessors.size(); ++k) {
+			IrBlock* pred = block->predecessors[k];
+			if (!inGraph[pred->id] || (!contains(pred->successors, block) && !contains(pred->handlers, block)))
+				fail(block, nullptr, "predecessor without the edge");
+			if (std::find(block->predecessors.begin() + k + 1, block->predecessors.end(), pred) != block->predecessors.end())
+				fail(block, nullptr, "duplicate edge");
+		}
+		// }}}
+
+		if (block->order == UINT32_MAX)
+			continue;
+
+		// {{{ definitions dominate their uses
+		for (size_t i = 0; i < block->values.size(); ++i) {
+			IrValue* value = block->values[i];
+			for (size_t k = 0; k < value->operands.size(); ++k) {
+				IrValue* operand = value->operands[k];
+				const IrBlock* def = operand ? definedIn[operand->id] : nullptr;
+				if (!def) {
+					fail(block, value, "operand missing or not in the graph");
+					continue;
+				}
+				if (operand->type == IrType::Void) {
+					fail(block, value, "operand without a value");
+					continue;
+				}
+
+				if (value->op == IrOp::Phi) {
+					IrBlock* pred = block->predecessors[k];
+					if (pred->order == UINT32_MAX)
+						continue;
+					// exceptional edges leave at the start of their block
+					if (contains(pred->handlers, block) && def == pred)
+						ok = operand->op == IrOp::Phi;
+					else
+						ok = dominates(def, pred);
+				} else {
+					ok = def == block ? position[operand->id] < i : dominates(def, block);
+				}
+				if (!ok)
+					fail(block, value, "operand does not dominate its use");
+			}
+		}
+
+		// values removed are dead in frame states, the others need to be available
+		auto available = [&](const IrFrameState* state, size_t i) {
+			for (const std::vector<IrValue*>* slots: {&state->locals, &state->stack})
+				for (IrValue* value: *slots) {
+					const IrBlock* def = value ? definedIn[value->id] : nullptr;
+					if (def && !(def == block ? position[value->id] < i : dominates(def, block)))
+						return false;
+				}
+			return true;
+		};
+		if (block->state && !available(block->state, phis))
+			fail(block, nullptr, "frame state of a value not available at the block's start");
+		for (size_t i = 0; i < block->values.size(); ++i) {
+			IrValue* value = block->values[i];
+			if (value->state && !available(value->state, i))
+				fail(block, value, "frame state of a value not available before it");
+		}
+		// }}}
+	}
+
+	return errors;
+}
+// }}}
+
+// {{{ dump
+//! Describes the constant pool entry or variant an op refers to, if any.
+static std::string detail(const IrGraph& graph, const IrValue* value)
+{
+	ConstantPool& pool = graph.method()->thisClass()->constantPool;
+	char buf[256];
+	uint16_t id = value->insn ? value->insn->index : 0;
+
+	switch (value->op) {
+		case IrOp::Param:
+			snprintf(buf, sizeof(buf), " #%lld", (long long) value->imm);
+			return buf;
+		case IrOp::Const:
+			switch (value->type) {
+				case IrType::Int: snprintf(buf, sizeof(buf), " %d", value->asInt()); break;
+				case IrType::Long: snprintf(buf, sizeof(buf), " %lld", (long long) value->asLong()); break;
+				case IrType::Float: snprintf(buf, sizeof(buf), " %.9g", value->asFloat()); break;
+				case IrType::Double: snprintf(buf, sizeof(buf), " %.17g", value->asDouble()); break;
+				default: snprintf(buf, sizeof(buf), " null"); break;
+			}
+			return buf;
+		case IrOp::Convert:
+		case IrOp::ArrayLoad:
+		case IrOp::ArrayStore:
+			snprintf(buf, sizeof(buf), " (%s)", opcodeName((uint8_t) value->imm));
+			return buf;
+		case IrOp::NewArray: {
+			static const char* const types[] = { "boolean", "char", "float", "double", "byte", "short", "int", "long" };
+			return std::string(" (") + (value->imm >= 4 && value->imm <= 11 ? types[value->imm - 4] : "?") + ")";
+		}
+		case IrOp::GetField:
+		case IrOp::PutField:
+		case IrOp::GetStatic:
+		case IrOp::PutStatic:
+		case IrOp::Invoke: {
+			ConstantUtf8* className = pool.memberClassName(id);
+			ConstantUtf8* name = pool.memberName(id);
+			ConstantUtf8* descriptor = pool.memberDescriptor(id);
+			if (!className)
+				return " (?)";
+			snprintf(buf, sizeof(buf), " (%s%s%s.%s%s%s)",
+				value->op == IrOp::Invoke ? opcodeName((uint8_t) value->imm) : "",
+				value->op == IrOp::Invoke ? " " : "",
+				className->c_str(), name->c_str(), value->op == IrOp::Invoke ? "" : ":", descriptor->c_str());
+			return buf;
+		}
+		case IrOp::New:
+		case IrOp::ANewArray:
+		case IrOp::MultiANewArray:
+		case IrOp::CheckCast:
+		case IrOp::InstanceOf: {
+			ConstantUtf8* className = pool.className(id);
+			return std::string(" (") + (className ? className->c_str() : "?") + ")";
+		}
+		case IrOp::Ldc:
+			if (ConstantUtf8* s = pool.string(id))
+				return std::string(" (\"") + s->c_str() + "\")";
+			if (ConstantUtf8* className = pool.className(id))
+				return std::string(" (class ") + className->c_str() + ")";
+			return " (?)";
+		default:
+			return "";
+	}
+}
+
+std::string IrGraph::to_s() const
+{
+	std::string s;
+	char buf[64];
+
+	s += method_->thisClass()->name()->c_str();
+	s += ".";
+	s += method_->name()->c_str();
+	s += method_->descriptor()->c_str();
+	s += "\n";
+
+	for (const IrBlock* block: blocks_) {
+		snprintf(buf, sizeof(buf), "B%u", block->id);
+		s += buf;
+		if (block->start != UINT32_MAX) {
+			snprintf(buf, sizeof(buf), " @%u", quick_->offsetOf(quick_->instructions() + block->start));
+			s += buf;
+		}
+		for (size_t k = 0; k < block->predecessors.size(); ++k) {
+			snprintf(buf, sizeof(buf), "%s B%u", k ? "," : " <-", block->predecessors[k]->id);
+			s += buf;
+		}
+		for (size_t k = 0; k < block->handlers.size(); ++k) {
+			snprintf(buf, sizeof(buf), "%s B%u", k ? "," : " catch", block->handlers[k]->id);
+			s += buf;
+		}
+		s += ":\n";
+
+		for (const IrValue* value: block->values) {
+			s += "  ";
+			if (value->type != IrType::Void) {
+				snprintf(buf, sizeof(buf), "v%u = ", value->id);
+				s += buf;
+			}
+			s += irOpName(value->op);
+			if (value->op == IrOp::If) {
+				s += " ";
+				s += condName((IrCond) value->imm);
+			}
+			if (value->type != IrType::Void) {
+				s += " ";
+				s += irTypeName(value->type);
+			}
+
+			for (size_t k = 0; k < value->operands.size(); ++k) {
+				if (value->op == IrOp::Phi)
+					snprintf(buf, sizeof(buf), " [v%u B%u]", value->operands[k]->id, block->predecessors[k]->id);
+				else
+					snprintf(buf, sizeof(buf), "%s v%u", k ? "," : "", value->operands[k]->id);
+				s += buf;
+			}
+			s += detail(*this, value);
+
+			switch (value->op) {
+				case IrOp::Goto:
+				case IrOp::If:
+					for (size_t k = 0; k < block->successors.size(); ++k) {
+						snprintf(buf, sizeof(buf), "%s B%u", k ? "," : " ->", block->successors[k]->id);
+						s += buf;
+					}
+					break;
+				case IrOp::Switch:
+					for (size_t k = 0; k < value->cases.size(); k += 2) {
+						snprintf(buf, sizeof(buf), " %d: B%u,", value->cases[k], block->successors[value->cases[k + 1]]->id);
+						s += buf;
+					}
+					snprintf(buf, sizeof(buf), " default: B%u", block->successors[0]->id);
+					s += buf;
+					break;
+				default:
+					break;
+			}
+
+			if ((value->flags() & (IrThrows | IrEffect)) && value->insn) {
+				snprintf(buf, sizeof(buf), " @%u", quick_->offsetOf(value->insn));
+				s += buf;
+			}
+			s += "\n";
+		}
+	}
+
+	return s;
+}
+
+void IrGraph::dump() const
+{
+	printf("%s", to_s().c_str());
+}
+// }}}
+
+// {{{ building
+//! Computational type of a field descriptor, or of the return type in a method descriptor.
+static IrType typeOf(char c)
+{
+	switch (c) {
+		case 'Z': case 'B': case 'C': case 'S': case 'I': return IrType::Int;
+		case 'J': return IrType::Long;
+		case 'F': return IrType::Float;
+		case 'D': return IrType::Double;
+		case 'L': case '[': return IrType::Ref;
+		default: return IrType::Void;
+	}
+}
+
+//! Argument types and return type of method \p descriptor.
+static bool parseMethodDescriptor(const char* s, std::vector<IrType>& arguments, IrType& result)
+{
+	if (*s++ != '(')
+		return false;
+
+	while (*s && *s != ')') {
+		IrType type = typeOf(*s);
+		if (type == IrType::Void)
+			return false;
+		while (*s == '[')
+			++s;
+		if (*s == 'L') {
+			s = strchr(s, ';');
+			if (!s)
+				return false;
+		}
+		++s;
+		arguments.push_back(type);
+	}
+	if (*s != ')')
+		return false;
+
+	result = typeOf(s[1]);
+	return result != IrType::Void || s[1] == 'V';
+}
+
+//! The JVM opcode that a quick opcode stands for, i.e. what the IR is concerned with.
+static Opcode genericOf(uint8_t opcode)
+{
+	switch ((Opcode) opcode) {
+		case Opcode::ldc_quick: return Opcode::ldc;
+		case Opcode::invokevirtual_mono: case Opcode::invokevirtual_poly: case Opcode::invokevirtual_mega:
+			return Opcode::invokevirtual;
+		case Opcode::invokeinterface_mono: case Opcode::invokeinterface_poly: case Opcode::invokeinterface_mega:
+			return Opcode::invokeinterface;
+		case Opcode::invokespecial_quick: return Opcode::invokespecial;
+		case Opcode::invokestatic_quick: return Opcode::invokestatic;
+		case Opcode::new_quick: return Opcode::new_;
+		case Opcode::checkcast_quick: return Opcode::checkcast;
+		case Opcode::instanceof_quick: return Opcode::instanceof;
+		default: break;
+	}
+	if (opcode >= (uint8_t) Opcode::getfield_z && opcode <= (uint8_t) Opcode::getfield_a)
+		return Opcode::getfield;
+	if (opcode >= (uint8_t) Opcode::putfield_z && opcode <= (uint8_t) Opcode::putfield_a)
+		return Opcode::putfield;
+	if (opcode >= (uint8_t) Opcode::getstatic_z && opcode <= (uint8_t) Opcode::getstatic_a)
+		return Opcode::getstatic;
+	if (opcode >= (uint8_t) Opcode::putstatic_z && opcode <= (uint8_t) Opcode::putstatic_a)
+		return Opcode::putstatic;
+	return (Opcode) opcode;
+}
+
+static bool isConditionalBranch(Opcode op)
+{
+	return (op >= Opcode::ifeq && op <= Opcode::if_acmpne) || op == Opcode::ifnull || op == Opcode::ifnonnull;
+}
+
+//! Whether \p op may throw, and thereby reach an exception handler.
+static bool mayThrow(Opcode op)
+{
+	switch (op) {
+		case Opcode::ldc:
+		case Opcode::idiv: case Opcode::ldiv: case Opcode::irem: case Opcode::lrem:
+		case Opcode::newarray: case Opcode::anewarray: case Opcode::multianewarray: case Opcode::arraylength:
+		case Opcode::athrow: case Opcode::checkcast: case Opcode::instanceof:
+		case Opcode::monitorenter: case Opcode::monitorexit:
+			return true;
+		default:
+			return (op >= Opcode::iaload && op <= Opcode::saload)
+				|| (op >= Opcode::iastore && op <= Opcode::sastore)
+				|| (op >= Opcode::getstatic && op <= Opcode::new_);
+	}
+}
+
+/**
+ * Builds an IrGraph in two passes: the first splits the instructions into
+ * basic blocks and links them, the second translates each block in
+ * reverse postorder, simulating the locals and operand stack with the
+ * values that define them.
+ *
+ * Join blocks and exception handlers start with a phi for every local
+ * and stack slot, their operands filled in once all blocks are done.
+ * Those that turn out trivial or unused get removed afterwards, which
+ * leaves the phis of pruned SSA form.
+ */
+class IrBuilder {
+private:
+	//! Values of the locals and stack slots; the upper slot of a long or double holds \p nullptr.
+	struct State {
+		std::vector<IrValue*> locals;
+		std::vector<IrValue*> stack;
+	};
+
+	//! A phi of a join block, for a local or, past maxLocals, an operand stack slot.
+	struct PendingPhi {
+		IrValue* phi;
+		uint32_t slot;
+	};
+
+	IrGraph& graph_;
+	Method* method_;
+	QuickCode* quick_;
+	ConstantPool& pool_;
+	const Instruction* insns_;
+	uint32_t size_;
+	uint32_t maxLocals_;
+
+	std::vector<IrBlock*> blockAt_;   //!< by leading instruction index
+	std::vector<uint32_t> end_;       //!< by block id, the instruction index past its last
+	std::vector<bool> isHandler_;     //!< by block id
+	std::vector<bool> done_;          //!< by block id
+	std::vector<State> entry_;        //!< by block id
+	std::vector<State> exit_;         //!< by block id
+	std::vector<PendingPhi> phis_;
+
+	IrBlock* block_;
+	State state_;
+	State before_;                    //!< state_ before the current instruction
+	uint32_t index_;
+	const char* error_;
+
+public:
+	IrBuilder(IrGraph& graph, Method* method, QuickCode* quick) :
+		graph_(graph), method_(method), quick_(quick), pool_(method->thisClass()->constantPool),
+		insns_(quick->instructions()), size_(quick->size()), maxLocals_(method->maxLocals()),
+		blockAt_(), end_(), isHandler_(), done_(), entry_(), exit_(), phis_(),
+		block_(nullptr), state_(), before_(), index_(0), error_(nullptr) {}
+
+	bool build() { return buildBlocks() && buildValues() && completePhis(); }
+
+	const char* error() const { return error_; }
+	uint32_t index() const { return index_; }
+
+private:
+	bool fail(const char* what) {
+		if (!error_)
+			error_ = what;
+		return false;
+	}
+
+	Opcode opcodeAt(uint32_t i) const { return genericOf(__atomic_load_n(&insns_[i].opcode, __ATOMIC_ACQUIRE)); }
+	uint32_t offsetAt(uint32_t i) const { return quick_->offsetOf(insns_ + i); }
+
+	bool buildBlocks();
+	bool buildValues();
+	bool completePhis();
+
+	static void link(IrBlock* from, IrBlock* to) {
+		if (!contains(from->successors, to)) {
+			from->successors.push_back(to);
+			to->predecessors.push_back(from);
+		}
+	}
+
+	void enter(IrBlock* block);
+	bool translate();
+
+	// {{{ values
+	IrValue* emit(IrOp op, IrType type, std::vector<IrValue*> operands = {}, int64_t imm = 0) {
+		IrValue* value = graph_.newValue(op, type);
+		value->block = block_;
+		value->operands = std::move(operands);
+		value->imm = imm;
+		value->index = index_;
+		value->insn = insns_ + index_;
+		if (value->flags() & (IrThrows | IrEffect))
+			value->state = frameState(before_);
+		block_->values.push_back(value);
+		return value;
+	}
+
+	IrFrameState* frameState(const State& state) {
+		return graph_.arena().construct<IrFrameState>(index_, state.locals, state.stack);
+	}
+
+	IrValue* phi(IrType type, uint32_t slot) {
+		IrValue* value = emit(IrOp::Phi, type);
+		value->insn = nullptr;
+		phis_.push_back({value, slot});
+		return value;
+	}
+
+	bool push(IrValue* value) {
+		state_.stack.push_back(value);
+		if (isWide(value->type))
+			state_.stack.push_back(nullptr);
+		return true;
+	}
+
+	IrValue* pop(IrType type) {
+		size_t n = isWide(type) ? 2 : 1;
+		size_t depth = state_.stack.size();
+		if (depth < n)
+			return fail("operand stack underflow"), nullptr;
+		IrValue* value = state_.stack[depth - n];
+		if (!value || (n == 2 && state_.stack.back()))
+			return fail("operand of the wrong size"), nullptr;
+		if (value->type != type && value->type != IrType::Void)
+			return fail("operand of the wrong type"), nullptr;
+		state_.stack.resize(depth - n);
+		return value;
+	}
+
+	IrValue* load(uint32_t slot, IrType type) {
+		IrValue* value = slot < maxLocals_ ? state_.locals[slot] : nullptr;
+		if (!value)
+			return fail("load of an undefined local"), nullptr;
+		if (value->type != type && value->type != IrType::Void)
+			return fail("load of a local of the wrong type"), nullptr;
+		return value;
+	}
+
+	bool store(uint32_t slot, IrValue* value) {
+		uint32_t n = isWide(value->type) ? 2 : 1;
+		if (slot + n > maxLocals_)
+			return fail("store past max_locals");
+		if (slot > 0 && state_.locals[slot - 1] && isWide(state_.locals[slot - 1]->type))
+			state_.locals[slot - 1] = nullptr;
+		state_.locals[slot] = value;
+		if (n == 2)
+			state_.locals[slot + 1] = nullptr;
+		return true;
+	}
+
+	//! Checks that \p n raw stack slots are there to shuffle around.
+	bool slots(size_t n) {
+		return state_.stack.size() >= n || fail("operand stack underflow");
+	}
+
+	bool binary(IrOp op, IrType type) {
+		IrValue* b = pop(type);
+		IrValue* a = b ? pop(type) : nullptr;
+		return a && push(emit(op, type, {a, b}));
+	}
+
+	bool shift(IrOp op, IrType type) {
+		IrValue* n = pop(IrType::Int);
+		IrValue* a = n ? pop(type) : nullptr;
+		return a && push(emit(op, type, {a, n}));
+	}
+
+	bool unary(IrOp op, IrType from, IrType to, int64_t imm = 0) {
+		IrValue* a = pop(from);
+		return a && push(emit(op, to, {a}, imm));
+	}
+
+	bool compare(IrOp op, IrType type) {
+		IrValue* b = pop(type);
+		IrValue* a = b ? pop(type) : nullptr;
+		return a && push(emit(op, IrType::Int, {a, b}));
+	}
+
+	//! Terminates the block with an If, or a Goto if both ways lead to the same block.
+	bool branch(IrCond cond, IrValue* a, IrValue* b) {
+		if (!a || !b)
+			return false;
+		if (block_->successors.size() == 1)
+			emit(IrOp::Goto, IrType::Void);
+		else
+			emit(IrOp::If, IrType::Void, {a, b}, (int64_t) cond);
+		return true;
+	}
+
+	bool arrayLoad(Opcode op, IrType type) {
+		IrValue* index = pop(IrType::Int);
+		IrValue* array = index ? pop(IrType::Ref) : nullptr;
+		return array && push(emit(IrOp::ArrayLoad, type, {array, index}, (int64_t) op));
+	}
+
+	bool arrayStore(Opcode op, IrType type) {
+		IrValue* value = pop(type);
+		IrValue* index = value ? pop(IrType::Int) : nullptr;
+		IrValue* array = index ? pop(IrType::Ref) : nullptr;
+		return array && emit(IrOp::ArrayStore, IrType::Void, {array, index, value}, (int64_t) op);
+	}
+
+	bool ret(IrType type) {
+		IrValue* value = pop(type);
+		return value && emit(IrOp::Return, IrType::Void, {value});
+	}
+
+	bool field(Opcode op);
+	bool invoke(Opcode op);
+	bool switch_(Opcode op);
+	// }}}
+};
+
+bool IrBuilder::buildBlocks()
+{
+	// {{{ leaders
+	std::vector<bool> leader(size_ + 1, false);
+	leader[0] = true;
+
+	for (uint32_t i = 0; i < size_; ++i) {
+		Opcode op = opcodeAt(i);
+		const Instruction& insn = insns_[i];
+		switch (op) {
+			case Opcode::jsr: case Opcode::ret: case Opcode::invokedynamic:
+				index_ = i;
+				return fail("unsupported instruction");
+			case Opcode::goto_:
+				leader[insn.operand] = true;
+				leader[i + 1] = true;
+				break;
+			case Opcode::tableswitch:
+			case Opcode::lookupswitch: {
+				const int32_t* table = quick_->switchTable(insn.operand);
+				leader[table[0]] = true;
+				if (op == Opcode::tableswitch) {
+					for (int64_t k = 0; k <= (int64_t) table[2] - table[1]; ++k)
+						leader[table[3 + k]] = true;
+				} else {
+					for (int32_t k = 0; k < table[1]; ++k)
+						leader[table[3 + 2 * k]] = true;
+				}
+				leader[i + 1] = true;
+				break;
+			}
+			case Opcode::ireturn: case Opcode::lreturn: case Opcode::freturn: case Opcode::dreturn:
+			case Opcode::areturn: case Opcode::return_: case Opcode::athrow:
+				leader[i + 1] = true;
+				break;
+			default:
+				if (isConditionalBranch(op)) {
+					leader[insn.operand] = true;
+					leader[i + 1] = true;
+				}
+				break;
+		}
+	}
+
+	// handlers see the locals at the instruction that threw, so those end their blocks
+	const ArrayView<Method::ExceptionHandler>& handlers = method_->exceptionTable();
+	for (const Method::ExceptionHandler& handler: handlers) {
+		leader[quick_->at(handler.handler) - insns_] = true;
+		for (uint32_t i = 0; i < size_; ++i) {
+			uint32_t offset = offsetAt(i);
+			if (offset >= handler.start && offset < handler.end && mayThrow(opcodeAt(i)))
+				leader[i] = true;
+		}
+	}
+	// }}}
+
+	// {{{ blocks and edges
+	IrBlock* entry = graph_.newBlock(UINT32_MAX);
+	blockAt_.assign(size_, nullptr);
+	for (uint32_t i = 0; i < size_; ++i)
+		if (leader[i])
+			blockAt_[i] = graph_.newBlock(i);
+
+	size_t blockCount = graph_.blocks().size();
+	end_.assign(blockCount, 0);
+	isHandler_.assign(blockCount, false);
+	for (size_t k = 1; k < blockCount; ++k)
+		end_[k] = k + 1 < blockCount ? graph_.blocks()[k + 1]->start : size_;
+
+	link(entry, blockAt_[0]);
+
+	for (size_t k = 1; k < blockCount; ++k) {
+		IrBlock* block = graph_.blocks()[k];
+		uint32_t last = end_[k] - 1;
+		Opcode op = opcodeAt(last);
+		const Instruction& insn = insns_[last];
+		index_ = last;
+
+		bool fallsThrough = true;
+		if (isConditionalBranch(op)) {
+			link(block, blockAt_[insn.operand]);
+		} else if (op == Opcode::goto_) {
+			link(block, blockAt_[insn.operand]);
+			fallsThrough = false;
+		} else if (op == Opcode::tableswitch || op == Opcode::lookupswitch) {
+			const int32_t* table = quick_->switchTable(insn.operand);
+			link(block, blockAt_[table[0]]);
+			if (op == Opcode::tableswitch) {
+				for (int64_t j = 0; j <= (int64_t) table[2] - table[1]; ++j)
+					link(block, blockAt_[table[3 + j]]);
+			} else {
+				for (int32_t j = 0; j < table[1]; ++j)
+					link(block, blockAt_[table[3 + 2 * j]]);
+			}
+			fallsThrough = false;
+		} else if ((op >= Opcode::ireturn && op <= Opcode::return_) || op == Opcode::athrow) {
+			fallsThrough = false;
+		}
+
+		if (fallsThrough) {
+			if (end_[k] == size_)
+				return fail("control flow falls off the end of the code");
+			link(block, blockAt_[end_[k]]);
+		}
+
+		if (!mayThrow(opcodeAt(block->start)))
+			continue;
+		uint32_t offset = offsetAt(block->start);
+		for (const Method::ExceptionHandler& handler: handlers) {
+			if (offset < handler.start || offset >= handler.end)
+				continue;
+			IrBlock* target = blockAt_[quick_->at(handler.handler) - insns_];
+			if (!contains(block->handlers, target)) {
+				block->handlers.push_back(target);
+				target->predecessors.push_back(block);
+				isHandler_[target->id] = true;
+			}
+		}
+	}
+
+	for (IrBlock* block: graph_.blocks())
+		for (IrBlock* succ: block->successors)
+			if (isHandler_[succ->id]) {
+				index_ = succ->start;
+				return fail("exception handler also reached by normal control flow");
+			}
+	// }}}
+
+	// dead code is left out
+	graph_.computeDominators();
+	std::vector<IrBlock*>& blocks = graph_.blocks();
+	for (IrBlock* block: blocks) {
+		if (block->order != UINT32_MAX)
+			continue;
+		std::vector<IrBlock*> successors = block->successors;
+		successors.insert(successors.end(), block->handlers.begin(), block->handlers.end());
+		for (IrBlock* succ: successors)
+			IrGraph::removeEdge(block, succ);
+	}
+	blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+		[](IrBlock* block) { return block->order == UINT32_MAX; }), blocks.end());
+
+	return true;
+}
+
+bool IrBuilder::buildValues()
+{
+	size_t blockCount = end_.size();
+	done_.assign(blockCount, false);
+	entry_.resize(blockCount);
+	exit_.resize(blockCount);
+
+	// {{{ parameters
+	block_ = graph_.entry();
+	index_ = 0;
+	state_.locals.assign(maxLocals_, nullptr);
+
+	std::vector<IrType> arguments;
+	IrType result;
+	if (!parseMethodDescriptor(method_->descriptor()->c_str(), arguments, result))
+		return fail("malformed method descriptor");
+	if (!method_->isStatic())
+		arguments.insert(arguments.begin(), IrType::Ref);
+
+	uint32_t slot = 0;
+	for (IrType type: arguments) {
+		IrValue* param = emit(IrOp::Param, type, {}, slot);
+		param->insn = nullptr;
+		if (!store(slot, param))
+			return fail("arguments exceed max_locals");
+		slot += isWide(type) ? 2 : 1;
+	}
+	emit(IrOp::Goto, IrType::Void)->insn = nullptr;
+	exit_[block_->id] = state_;
+	done_[block_->id] = true;
+	// }}}
+
+	std::vector<IrBlock*> rpo = graph_.blocks();
+	std::sort(rpo.begin(), rpo.end(), [](IrBlock* a, IrBlock* b) { return a->order < b->order; });
+
+	for (size_t k = 1; k < rpo.size(); ++k) {
+		IrBlock* block = rpo[k];
+		enter(block);
+		entry_[block->id] = state_;
+		if (quick_->loopAt(block->start))
+			block->state = frameState(state_);
+
+		for (index_ = block->start; index_ < end_[block->id]; ++index_) {
+			before_ = state_;
+			if (!translate())
+				return false;
+		}
+
+		if (!block->terminator()) {
+			index_ = end_[block->id] - 1;
+			emit(IrOp::Goto, IrType::Void);
+		}
+		exit_[block->id] = state_;
+		done_[block->id] = true;
+	}
+
+	return true;
+}
+
+void IrBuilder::enter(IrBlock* block)
+{
+	block_ = block;
+	index_ = block->start;
+
+	if (isHandler_[block->id]) {
+		for (uint32_t slot = 0; slot < maxLocals_; ++slot)
+			state_.locals[slot] = phi(IrType::Void, slot);
+		state_.stack.assign(1, emit(IrOp::Catch, IrType::Ref));
+		return;
+	}
+
+	IrBlock* reference = nullptr;
+	for (IrBlock* pred: block->predecessors)
+		if (done_[pred->id]) {
+			reference = pred;
+			break;
+		}
+
+	state_ = exit_[reference->id];
+	if (block->predecessors.size() == 1)
+		return;
+
+	for (uint32_t slot = 0; slot < maxLocals_; ++slot) {
+		IrValue* value = state_.locals[slot];
+		state_.locals[slot] = phi(value ? value->type : IrType::Void, slot);
+	}
+	for (uint32_t k = 0; k < state_.stack.size(); ++k)
+		if (IrValue* value = state_.stack[k])
+			state_.stack[k] = phi(value->type, maxLocals_ + k);
+}
+
+bool IrBuilder::field(Opcode op)
+{
+	ConstantUtf8* descriptor = pool_.memberDescriptor(insns_[index_].index);
+	IrType type = descriptor ? typeOf(descriptor->c_str()[0]) : IrType::Void;
+	if (type == IrType::Void)
+		return fail("bad field reference");
+
+	switch (op) {
+		case Opcode::getstatic:
+			return push(emit(IrOp::GetStatic, type));
+		case Opcode::putstatic: {
+			IrValue* value = pop(type);
+			return value && emit(IrOp::PutStatic, IrType::Void, {value});
+		}
+		case Opcode::getfield: {
+			IrValue* object = pop(IrType::Ref);
+			return object && push(emit(IrOp::GetField, type, {object}));
+		}
+		default: {
+			IrValue* value = pop(type);
+			IrValue* object = value ? pop(IrType::Ref) : nullptr;
+			return object && emit(IrOp::PutField, IrType::Void, {object, value});
+		}
+	}
+}
+
+bool IrBuilder::invoke(Opcode op)
+{
+	ConstantUtf8* descriptor = pool_.memberDescriptor(insns_[index_].index);
+	std::vector<IrType> arguments;
+	IrType result;
+	if (!descriptor || !parseMethodDescriptor(descriptor->c_str(), arguments, result))
+		return fail("bad method reference");
+	if (op != Opcode::invokestatic)
+		arguments.insert(arguments.begin(), IrType::Ref);
+
+	std::vector<IrValue*> operands(arguments.size());
+	for (size_t k = arguments.size(); k-- > 0; )
+		if (!(operands[k] = pop(arguments[k])))
+			return false;
+
+	IrValue* value = emit(IrOp::Invoke, result, std::move(operands), (int64_t) op);
+	return result == IrType::Void || push(value);
+}
+
+bool IrBuilder::switch_(Opcode op)
+{
+	IrValue* key = pop(IrType::Int);
+	if (!key)
+		return false;
+	if (block_->successors.size() == 1) {
+		emit(IrOp::Goto, IrType::Void);
+		return true;
+	}
+
+	IrValue* value = emit(IrOp::Switch, IrType::Void, {key});
+	const int32_t* table = quick_->switchTable(insns_[index_].operand);
+	auto add = [&](int32_t match, int32_t target) {
+		size_t k = std::find(block_->successors.begin(), block_->successors.end(), blockAt_[target])
+			- block_->successors.begin();
+		if (k != 0) {
+			value->cases.push_back(match);
+			value->cases.push_back(k);
+		}
+	};
+
+	if (op == Opcode::tableswitch) {
+		for (int64_t k = 0; k <= (int64_t) table[2] - table[1]; ++k)
+			add(table[1] + k, table[3 + k]);
+	} else {
+		for (int32_t k = 0; k < table[1]; ++k)
+			add(table[2 + 2 * k], table[3 + 2 * k]);
+	}
+	return true;
+}
+
+bool IrBuilder::translate()
+{
+	const Instruction& insn = insns_[index_];
+	Opcode op = opcodeAt(index_);
+	std::vector<IrValue*>& stack = state_.stack;
+
+	switch (op) {
+		case Opcode::nop:
+			return true;
+
+		// {{{ constants
+		case Opcode::aconst_null:
+			return push(emit(IrOp::Const, IrType::Ref));
+		case Opcode::iconst_m1: case Opcode::iconst_0: case Opcode::iconst_1: case Opcode::iconst_2:
+		case Opcode::iconst_3: case Opcode::iconst_4: case Opcode::iconst_5:
+			return push(emit(IrOp::Const, IrType::Int, {}, (int) op - (int) Opcode::iconst_0));
+		case Opcode::lconst_0: case Opcode::lconst_1:
+			return push(emit(IrOp::Const, IrType::Long, {}, (int) op - (int) Opcode::lconst_0));
+		case Opcode::fconst_0: case Opcode::fconst_1: case Opcode::fconst_2: {
+			float f = (float) ((int) op - (int) Opcode::fconst_0);
+			uint32_t bits;
+			memcpy(&bits, &f, sizeof(bits));
+			return push(emit(IrOp::Const, IrType::Float, {}, bits));
+		}
+		case Opcode::dconst_0: case Opcode::dconst_1: {
+			double d = (double) ((int) op - (int) Opcode::dconst_0);
+			int64_t bits;
+			memcpy(&bits, &d, sizeof(bits));
+			return push(emit(IrOp::Const, IrType::Double, {}, bits));
+		}
+		case Opcode::bipush: case Opcode::sipush:
+			return push(emit(IrOp::Const, IrType::Int, {}, insn.operand));
+		case Opcode::ldc_int:
+			if (pool_.tag(insn.index) == ConstantTag::Float)
+				return push(emit(IrOp::Const, IrType::Float, {}, (uint32_t) insn.operand));
+			return push(emit(IrOp::Const, IrType::Int, {}, insn.operand));
+		case Opcode::ldc:
+			return push(emit(IrOp::Ldc, IrType::Ref));
+		case Opcode::ldc2_w:
+			return push(emit(IrOp::Const, pool_.tag(insn.index) == ConstantTag::Double ? IrType::Double : IrType::Long,
+				{}, insn.resolved.bits));
+		// }}}
+
+		// {{{ locals
+		case Opcode::iload: case Opcode::iload_0: case Opcode::iload_1: case Opcode::iload_2: case Opcode::iload_3:
+		case Opcode::lload: case Opcode::lload_0: case Opcode::lload_1: case Opcode::lload_2: case Opcode::lload_3:
+		case Opcode::fload: case Opcode::fload_0: case Opcode::fload_1: case Opcode::fload_2: case Opcode::fload_3:
+		case Opcode::dload: case Opcode::dload_0: case Opcode::dload_1: case Opcode::dload_2: case Opcode::dload_3:
+		case Opcode::aload: case Opcode::aload_0: case Opcode::aload_1: case Opcode::aload_2: case Opcode::aload_3: {
+			static const IrType types[] = { IrType::Int, IrType::Long, IrType::Float, IrType::Double, IrType::Ref };
+			bool shortForm = op >= Opcode::iload_0;
+			int k = shortForm ? ((int) op - (int) Opcode::iload_0) / 4 : (int) op - (int) Opcode::iload;
+			uint32_t slot = shortForm ? ((int) op - (int) Opcode::iload_0) % 4 : insn.index;
+			IrValue* value = load(slot, types[k]);
+			return value && push(value);
+		}
+		case Opcode::istore: case Opcode::istore_0: case Opcode::istore_1: case Opcode::istore_2: case Opcode::istore_3:
+		case Opcode::lstore: case Opcode::lstore_0: case Opcode::lstore_1: case Opcode::lstore_2: case Opcode::lstore_3:
+		case Opcode::fstore: case Opcode::fstore_0: case Opcode::fstore_1: case Opcode::fstore_2: case Opcode::fstore_3:
+		case Opcode::dstore: case Opcode::dstore_0: case Opcode::dstore_1: case Opcode::dstore_2: case Opcode::dstore_3:
+		case Opcode::astore: case Opcode::astore_0: case Opcode::astore_1: case Opcode::astore_2: case Opcode::astore_3: {
+			static const IrType types[] = { IrType::Int, IrType::Long, IrType::Float, IrType::Double, IrType::Ref };
+			bool shortForm = op >= Opcode::istore_0;
+			int k = shortForm ? ((int) op - (int) Opcode::istore_0) / 4 : (int) op - (int) Opcode::istore;
+			uint32_t slot = shortForm ? ((int) op - (int) Opcode::istore_0) % 4 : insn.index;
+			IrValue* value = pop(types[k]);
+			return value && store(slot, value);
+		}
+		case Opcode::iinc: {
+			IrValue* value = load(insn.index, IrType::Int);
+			if (!value)
+				return false;
+			IrValue* delta = emit(IrOp::Const, IrType::Int, {}, insn.operand);
+			return store(insn.index, emit(IrOp::Add, IrType::Int, {value, delta}));
+		}
+		// }}}
+
+		// {{{ arrays
+		case Opcode::iaload: return arrayLoad(op, IrType::Int);
+		case Opcode::laload: return arrayLoad(op, IrType::Long);
+		case Opcode::faload: return arrayLoad(op, IrType::Float);
+		case Opcode::daload: return arrayLoad(op, IrType::Double);
+		case Opcode::aaload: return arrayLoad(op, IrType::Ref);
+		case Opcode::baload: case Opcode::caload: case Opcode::saload: return arrayLoad(op, IrType::Int);
+		case Opcode::iastore: return arrayStore(op, IrType::Int);
+		case Opcode::lastore: return arrayStore(op, IrType::Long);
+		case Opcode::fastore: return arrayStore(op, IrType::Float);
+		case Opcode::dastore: return arrayStore(op, IrType::Double);
+		case Opcode::aastore: return arrayStore(op, IrType::Ref);
+		case Opcode::bastore: case Opcode::castore: case Opcode::sastore: return arrayStore(op, IrType::Int);
+		case Opcode::arraylength: return unary(IrOp::ArrayLength, IrType::Ref, IrType::Int);
+		// }}}
+
+		// {{{ operand stack, by raw slots
+		case Opcode::pop:
+			return slots(1) && (stack.pop_back(), true);
+		case Opcode::pop2:
+			return slots(2) && (stack.resize(stack.size() - 2), true);
+		case Opcode::dup:
+			return slots(1) && (stack.push_back(stack.back()), true);
+		case Opcode::dup_x1:
+			return slots(2) && (stack.insert(stack.end() - 2, stack.back()), true);
+		case Opcode::dup_x2:
+			return slots(3) && (stack.insert(stack.end() - 3, stack.back()), true);
+		case Opcode::dup2:
+		case Opcode::dup2_x1:
+		case Opcode::dup2_x2: {
+			size_t below = op == Opcode::dup2 ? 2 : op == Opcode::dup2_x1 ? 3 : 4;
+			if (!slots(below))
+				return false;
+			IrValue* top[] = { stack[stack.size() - 2], stack.back() };
+			stack.insert(stack.end() - below, top, top + 2);
+			return true;
+		}
+		case Opcode::swap:
+			return slots(2) && (std::swap(stack[stack.size() - 1], stack[stack.size() - 2]), true);
+		// }}}
+
+		// {{{ arithmetic
+		case Opcode::iadd: return binary(IrOp::Add, IrType::Int);
+		case Opcode::ladd: return binary(IrOp::Add, IrType::Long);
+		case Opcode::fadd: return binary(IrOp::Add, IrType::Float);
+		case Opcode::dadd: return binary(IrOp::Add, IrType::Double);
+		case Opcode::isub: return binary(IrOp::Sub, IrType::Int);
+		case Opcode::lsub: return binary(IrOp::Sub, IrType::Long);
+		case Opcode::fsub: return binary(IrOp::Sub, IrType::Float);
+		case Opcode::dsub: return binary(IrOp::Sub, IrType::Double);
+		case Opcode::imul: return binary(IrOp::Mul, IrType::Int);
+		case Opcode::lmul: return binary(IrOp::Mul, IrType::Long);
+		case Opcode::fmul: return binary(IrOp::Mul, IrType::Float);
+		case Opcode::dmul: return binary(IrOp::Mul, IrType::Double);
+		case Opcode::idiv: return binary(IrOp::Div, IrType::Int);
+		case Opcode::ldiv: return binary(IrOp::Div, IrType::Long);
+		case Opcode::fdiv: return binary(IrOp::Div, IrType::Float);
+		case Opcode::ddiv: return binary(IrOp::Div, IrType::Double);
+		case Opcode::irem: return binary(IrOp::Rem, IrType::Int);
+		case Opcode::lrem: return binary(IrOp::Rem, IrType::Long);
+		case Opcode::frem: return binary(IrOp::Rem, IrType::Float);
+		case Opcode::drem: return binary(IrOp::Rem, IrType::Double);
+		case Opcode::ineg: return unary(IrOp::Neg, IrType::Int, IrType::Int);
+		case Opcode::lneg: return unary(IrOp::Neg, IrType::Long, IrType::Long);
+		case Opcode::fneg: return unary(IrOp::Neg, IrType::Float, IrType::Float);
+		case Opcode::dneg: return unary(IrOp::Neg, IrType::Double, IrType::Double);
+		case Opcode::ishl: return shift(IrOp::Shl, IrType::Int);
+		case Opcode::lshl: return shift(IrOp::Shl, IrType::Long);
+		case Opcode::ishr: return shift(IrOp::Shr, IrType::Int);
+		case Opcode::lshr: return shift(IrOp::Shr, IrType::Long);
+		case Opcode::iushr: return shift(IrOp::Ushr, IrType::Int);
+		case Opcode::lushr: return shift(IrOp::Ushr, IrType::Long);
+		case Opcode::iand: return binary(IrOp::And, IrType::Int);
+		case Opcode::land: return binary(IrOp::And, IrType::Long);
+		case Opcode::ior: return binary(IrOp::Or, IrType::Int);
+		case Opcode::lor: return binary(IrOp::Or, IrType::Long);
+		case Opcode::ixor: return binary(IrOp::Xor, IrType::Int);
+		case Opcode::lxor: return binary(IrOp::Xor, IrType::Long);
+		// }}}
+
+		// {{{ conversions and comparisons
+		case Opcode::i2l: return unary(IrOp::Convert, IrType::Int, IrType::Long, (int64_t) op);
+		case Opcode::i2f: return unary(IrOp::Convert, IrType::Int, IrType::Float, (int64_t) op);
+		case Opcode::i2d: return unary(IrOp::Convert, IrType::Int, IrType::Double, (int64_t) op);
+		case Opcode::l2i: return unary(IrOp::Convert, IrType::Long, IrType::Int, (int64_t) op);
+		case Opcode::l2f: return unary(IrOp::Convert, IrType::Long, IrType::Float, (int64_t) op);
+		case Opcode::l2d: return unary(IrOp::Convert, IrType::Long, IrType::Double, (int64_t) op);
+		case Opcode::f2i: return unary(IrOp::Convert, IrType::Float, IrType::Int, (int64_t) op);
+		case Opcode::f2l: return unary(IrOp::Convert, IrType::Float, IrType::Long, (int64_t) op);
+		case Opcode::f2d: return unary(IrOp::Convert, IrType::Float, IrType::Double, (int64_t) op);
+		case Opcode::d2i: return unary(IrOp::Convert, IrType::Double, IrType::Int, (int64_t) op);
+		case Opcode::d2l: return unary(IrOp::Convert, IrType::Double, IrType::Long, (int64_t) op);
+		case Opcode::d2f: return unary(IrOp::Convert, IrType::Double, IrType::Float, (int64_t) op);
+		case Opcode::i2b: case Opcode::i2c: case Opcode::i2s:
+			return unary(IrOp::Convert, IrType::Int, IrType::Int, (int64_t) op);
+		case Opcode::lcmp: return compare(IrOp::Cmp, IrType::Long);
+		case Opcode::fcmpl: return compare(IrOp::Cmpl, IrType::Float);
+		case Opcode::fcmpg: return compare(IrOp::Cmpg, IrType::Float);
+		case Opcode::dcmpl: return compare(IrOp::Cmpl, IrType::Double);
+		case Opcode::dcmpg: return compare(IrOp::Cmpg, IrType::Double);
+		// }}}
+
+		// {{{ control flow
+		case Opcode::ifeq: case Opcode::ifne: case Opcode::iflt:
+		case Opcode::ifge: case Opcode::ifgt: case Opcode::ifle: {
+			IrValue* a = pop(IrType::Int);
+			return a && branch((IrCond) ((int) op - (int) Opcode::ifeq), a, emit(IrOp::Const, IrType::Int));
+		}
+		case Opcode::if_icmpeq: case Opcode::if_icmpne: case Opcode::if_icmplt:
+		case Opcode::if_icmpge: case Opcode::if_icmpgt: case Opcode::if_icmple: {
+			IrValue* b = pop(IrType::Int);
+			IrValue* a = b ? pop(IrType::Int) : nullptr;
+			return branch((IrCond) ((int) op - (int) Opcode::if_icmpeq), a, b);
+		}
+		case Opcode::if_acmpeq: case Opcode::if_acmpne: {
+			IrValue* b = pop(IrType::Ref);
+			IrValue* a = b ? pop(IrType::Ref) : nullptr;
+			return branch(op == Opcode::if_acmpeq ? IrCond::Eq : IrCond::Ne, a, b);
+		}
+		case Opcode::ifnull: case Opcode::ifnonnull: {
+			IrValue* a = pop(IrType::Ref);
+			return a && branch(op == Opcode::ifnull ? IrCond::Eq : IrCond::Ne, a, emit(IrOp::Const, IrType::Ref));
+		}
+		case Opcode::goto_:
+			return emit(IrOp::Goto, IrType::Void);
+		case Opcode::tableswitch:
+		case Opcode::lookupswitch:
+			return switch_(op);
+		case Opcode::ireturn: return ret(IrType::Int);
+		case Opcode::lreturn: return ret(IrType::Long);
+		case Opcode::freturn: return ret(IrType::Float);
+		case Opcode::dreturn: return ret(IrType::Double);
+		case Opcode::areturn: return ret(IrType::Ref);
+		case Opcode::return_:
+			return emit(IrOp::Return, IrType::Void);
+		case Opcode::athrow: {
+			IrValue* exception = pop(IrType::Ref);
+			return exception && emit(IrOp::Throw, IrType::Void, {exception});
+		}
+		// }}}
+
+		// {{{ objects
+		case Opcode::getstatic: case Opcode::putstatic: case Opcode::getfield: case Opcode::putfield:
+			return field(op);
+		case Opcode::invokevirtual: case Opcode::invokespecial: case Opcode::invokestatic: case Opcode::invokeinterface:
+			return invoke(op);
+		case Opcode::new_:
+			return push(emit(IrOp::New, IrType::Ref));
+		case Opcode::newarray: {
+			IrValue* count = pop(IrType::Int);
+			return count && push(emit(IrOp::NewArray, IrType::Ref, {count}, insn.index));
+		}
+		case Opcode::anewarray:
+			return unary(IrOp::ANewArray, IrType::Int, IrType::Ref);
+		case Opcode::multianewarray: {
+			std::vector<IrValue*> counts(insn.operand);
+			for (size_t k = counts.size(); k-- > 0; )
+				if (!(counts[k] = pop(IrType::Int)))
+					return false;
+			return push(emit(IrOp::MultiANewArray, IrType::Ref, std::move(counts)));
+		}
+		case Opcode::checkcast:
+			return unary(IrOp::CheckCast, IrType::Ref, IrType::Ref);
+		case Opcode::instanceof:
+			return unary(IrOp::InstanceOf, IrType::Ref, IrType::Int);
+		case Opcode::monitorenter:
+		case Opcode::monitorexit: {
+			IrValue* object = pop(IrType::Ref);
+			return object && emit(op == Opcode::monitorenter ? IrOp::MonitorEnter : IrOp::MonitorExit, IrType::Void, {object});
+		}
+		// }}}
+
+		default:
+			return fail("unsupported instruction");
+	}
+}
+
+bool IrBuilder::completePhis()
+{
+	index_ = 0;
+
+	// {{{ operands, from the end of normal predecessors and the start of throwing ones
+	for (IrBlock* block: graph_.blocks()) {
+		if (isHandler_[block->id] || block->predecessors.size() < 2)
+			continue;
+		for (IrBlock* pred: block->predecessors)
+			if (exit_[pred->id].stack.size() != exit_[block->predecessors[0]->id].stack.size()) {
+				index_ = block->start;
+				return fail("operand stack depths differ where control flow merges");
+			}
+	}
+
+	for (const PendingPhi& pending: phis_) {
+		IrBlock* block = pending.phi->block;
+		for (IrBlock* pred: block->predecessors) {
+			const State& state = contains(pred->handlers, block) ? entry_[pred->id] : exit_[pred->id];
+			pending.phi->operands.push_back(pending.slot < maxLocals_
+				? state.locals[pending.slot] : state.stack[pending.slot - maxLocals_]);
+		}
+	}
+	// }}}
+
+	// {{{ trivial phis, forwarding to the one value they merge
+	std::vector<IrValue*> forward(graph_.valueCount(), nullptr);
+	auto resolve = [&](IrValue* value) {
+		while (value && forward[value->id])
+			value = forward[value->id];
+		return value;
+	};
+
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (const PendingPhi& pending: phis_) {
+			IrValue* phi = pending.phi;
+			if (forward[phi->id])
+				continue;
+
+			IrValue* same = nullptr;
+			bool trivial = true;
+			for (IrValue*& operand: phi->operands) {
+				operand = resolve(operand);
+				if (operand == phi || (operand && operand == same))
+					continue;
+				if (same || !operand) {
+					trivial = false;
+					break;
+				}
+				same = operand;
+			}
+			if (trivial && same) {
+				forward[phi->id] = same;
+				changed = true;
+			}
+		}
+	}
+
+	graph_.forwardUses(resolve);
+	// }}}
+
+	// {{{ unused phis, e.g. of locals that are dead at the join
+	std::vector<bool> live(graph_.valueCount(), false);
+	std::vector<IrValue*> work;
+	for (IrBlock* block: graph_.blocks())
+		for (IrValue* value: block->values)
+			if (value->op != IrOp::Phi)
+				for (IrValue* operand: value->operands)
+					if (operand->op == IrOp::Phi && !live[operand->id]) {
+						live[operand->id] = true;
+						work.push_back(operand);
+					}
+	while (!work.empty()) {
+		IrValue* phi = work.back();
+		work.pop_back();
+		for (IrValue* operand: phi->operands)
+			if (operand && operand->op == IrOp::Phi && !live[operand->id]) {
+				live[operand->id] = true;
+				work.push_back(operand);
+			}
+	}
+
+	for (IrBlock* block: graph_.blocks()) {
+		std::vector<IrValue*>& values = block->values;
+		values.erase(std::remove_if(values.begin(), values.end(),
+			[&](IrValue* value) { return value->op == IrOp::Phi && !live[value->id]; }), values.end());
+	}
+	// }}}
+
+	// {{{ types, flowing into the phis left
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (const PendingPhi& pending: phis_) {
+			IrValue* phi = pending.phi;
+			if (!live[phi->id] || phi->type != IrType::Void)
+				continue;
+			for (IrValue* operand: phi->operands)
+				if (operand && operand->type != IrType::Void) {
+					phi->type = operand->type;
+					changed = true;
+					break;
+				}
+		}
+	}
+
+	for (const PendingPhi& pending: phis_) {
+		IrValue* phi = pending.phi;
+		if (!live[phi->id])
+			continue;
+		bool ok = phi->type != IrType::Void;
+		for (IrValue* operand: phi->operands)
+			ok = ok && operand && operand->type == phi->type;
+		if (!ok) {
+			index_ = phi->index;
+			return fail("use of a local or stack slot undefined or of conflicting types where control flow merges");
+		}
+	}
+	// }}}
+
+	return true;
+}
+
+std::unique_ptr<IrGraph> IrGraph::build(Method* method)
+{
+	if (method->code().empty())
+		return nullptr;
+
+	QuickCode* quick = QuickCode::of(method);
+	if (!quick)
+		return nullptr;
+
+	std::unique_ptr<IrGraph> graph(new IrGraph(method, quick));
+	IrBuilder builder(*graph, method, quick);
+	if (!builder.build()) {
+		printf("WARNING: cannot build the IR of method %s.%s%s at @%u: %s\n",
+			method->thisClass()->name()->c_str(), method->name()->c_str(), method->descriptor()->c_str(),
+			quick->offsetOf(quick->instructions() + builder.index()), builder.error());
+		return nullptr;
+	}
+
+	graph->computeDominators();
+	return graph;
+}
+// }}}
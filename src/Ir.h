@@ -0,0 +1,310 @@
+#pragma once
+
+#include "Arena.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Method;
+class QuickCode;
+struct Instruction;
+struct IrBlock;
+struct IrValue;
+
+//! Computational types of IR values.
+enum class IrType : uint8_t {
+	Void,      //!< no value
+	Int,       //!< also boolean, byte, char and short
+	Long,
+	Float,
+	Double,
+	Ref,
+};
+
+//! Properties of IR ops.
+enum IrFlags : uint8_t {
+	IrPure = 1,        //!< depends on its operands only, no side effects
+	IrThrows = 2,      //!< may throw
+	IrEffect = 4,      //!< writes memory, allocates, calls or synchronizes
+	IrTerminator = 8,  //!< ends its block
+};
+
+// X(id, name, flags)
+#define JVM_IR_OPS(X) \
+	X(Param,          "param",          IrPure) \
+	X(Const,          "const",          IrPure) \
+	X(Phi,            "phi",            IrPure) \
+	X(Copy,           "copy",           IrPure) \
+	X(Catch,          "catch",          0) \
+	X(Add,            "add",            IrPure) \
+	X(Sub,            "sub",            IrPure) \
+	X(Mul,            "mul",            IrPure) \
+	X(Div,            "div",            IrPure | IrThrows) \
+	X(Rem,            "rem",            IrPure | IrThrows) \
+	X(Neg,            "neg",            IrPure) \
+	X(Shl,            "shl",            IrPure) \
+	X(Shr,            "shr",            IrPure) \
+	X(Ushr,           "ushr",           IrPure) \
+	X(And,            "and",            IrPure) \
+	X(Or,             "or",             IrPure) \
+	X(Xor,            "xor",            IrPure) \
+	X(Cmp,            "cmp",            IrPure) \
+	X(Cmpl,           "cmpl",           IrPure) \
+	X(Cmpg,           "cmpg",           IrPure) \
+	X(Convert,        "convert",        IrPure) \
+	X(ArrayLength,    "arraylength",    IrPure | IrThrows) \
+	X(ArrayLoad,      "arrayload",      IrThrows) \
+	X(ArrayStore,     "arraystore",     IrThrows | IrEffect) \
+	X(GetField,       "getfield",       IrThrows) \
+	X(PutField,       "putfield",       IrThrows | IrEffect) \
+	X(GetStatic,      "getstatic",      IrThrows) \
+	X(PutStatic,      "putstatic",      IrThrows | IrEffect) \
+	X(Ldc,            "ldc",            IrThrows) \
+	X(New,            "new",            IrThrows | IrEffect) \
+	X(NewArray,       "newarray",       IrThrows | IrEffect) \
+	X(ANewArray,      "anewarray",      IrThrows | IrEffect) \
+	X(MultiANewArray, "multianewarray", IrThrows | IrEffect) \
+	X(CheckCast,      "checkcast",      IrThrows) \
+	X(InstanceOf,     "instanceof",     IrThrows) \
+	X(MonitorEnter,   "monitorenter",   IrThrows | IrEffect) \
+	X(MonitorExit,    "monitorexit",    IrThrows | IrEffect) \
+	X(Invoke,         "invoke",         IrThrows | IrEffect) \
+	X(Goto,           "goto",           IrTerminator) \
+	X(If,             "if",             IrTerminator) \
+	X(Switch,         "switch",         IrTerminator) \
+	X(Return,         "return",         IrTerminator) \
+	X(Throw,          "throw",          IrTerminator | IrThrows)
+
+enum class IrOp : uint8_t {
+#define X(id, name, flags) id,
+	JVM_IR_OPS(X)
+#undef X
+};
+
+//! Conditions of If, comparing its two operands.
+enum class IrCond : uint8_t { Eq, Ne, Lt, Ge, Gt, Le };
+
+const char* irOpName(IrOp op);
+const char* irTypeName(IrType type);
+uint8_t irOpFlags(IrOp op);
+
+/**
+ * The locals and operand stack slots before an instruction, by the values
+ * they hold: the interpreter state that compiled code deoptimizes to (see
+ * DebugInfo).
+ *
+ * States do not keep values alive. Passes forward them like operands, but
+ * a value removed as unused was in no slot that is read anymore, so it is
+ * dead wherever a state still refers to it.
+ */
+struct IrFrameState {
+	uint32_t index;                 //!< of the instruction
+	std::vector<IrValue*> locals;   //!< \p nullptr for undefined slots and upper halves of longs and doubles
+	std::vector<IrValue*> stack;    //!< bottom first, likewise
+
+	IrFrameState(uint32_t index, const std::vector<IrValue*>& locals, const std::vector<IrValue*>& stack) :
+		index(index), locals(locals), stack(stack) {}
+};
+
+/**
+ * A value, i.e. an instruction of the IR, in SSA form.
+ *
+ * What imm holds depends on the op: the bits of a Const (sign-extended
+ * ints, floats in the low half), the local slot of a Param, the IrCond of
+ * an If, and the bytecode opcode the op came from for the ones that come
+ * in variants (Convert, ArrayLoad, ArrayStore, Invoke, NewArray).
+ */
+struct IrValue {
+	uint32_t id;
+	IrOp op;
+	IrType type;
+	IrBlock* block;
+	std::vector<IrValue*> operands;
+	int64_t imm;
+	uint32_t index;            //!< of the instruction it came from, in the method's QuickCode
+	const Instruction* insn;   //!< that instruction, e.g. for its constant pool reference, or \p nullptr
+	std::vector<int32_t> cases; //!< of a Switch: key and successor index pairs; successor 0 is the default
+	IrFrameState* state;       //!< before it, of values that may throw or have effects
+
+	IrValue(uint32_t id, IrOp op, IrType type) :
+		id(id), op(op), type(type), block(nullptr), operands(), imm(0), index(0), insn(nullptr), cases(), state(nullptr) {}
+
+	uint8_t flags() const { return irOpFlags(op); }
+	bool isPure() const { return flags() & IrPure; }
+	bool isTerminator() const { return flags() & IrTerminator; }
+
+	//! Whether it may throw: ops flagged so, except floating-point division.
+	bool mayThrow() const {
+		return (flags() & IrThrows) && !((op == IrOp::Div || op == IrOp::Rem) && (type == IrType::Float || type == IrType::Double));
+	}
+
+	bool isConst() const { return op == IrOp::Const; }
+	int32_t asInt() const { return (int32_t) imm; }
+	int64_t asLong() const { return imm; }
+	float asFloat() const;
+	double asDouble() const;
+};
+
+/**
+ * A basic block: phis first, a terminator last.
+ *
+ * Blocks covered by an exception handler end after their first
+ * instruction that may throw, so that the handler sees the locals of the
+ * block's entry.
+ */
+struct IrBlock {
+	uint32_t id;
+	uint32_t start;                       //!< index of its first instruction, UINT32_MAX if none
+	std::vector<IrValue*> values;
+	std::vector<IrBlock*> predecessors;   //!< by control flow and exceptions, in the order of phi operands
+	std::vector<IrBlock*> successors;     //!< If: taken, not taken; Switch: see IrValue::cases
+	std::vector<IrBlock*> handlers;       //!< exception handlers, if its instructions may throw
+	IrFrameState* state;                  //!< at its start, of loop headers
+
+	// computed by IrGraph::computeDominators()
+	IrBlock* idom;
+	uint32_t order;                       //!< in reverse postorder
+	uint32_t loopDepth;
+
+	IrBlock(uint32_t id, uint32_t start) :
+		id(id), start(start), values(), predecessors(), successors(), handlers(), state(nullptr),
+		idom(nullptr), order(0), loopDepth(0) {}
+
+	IrValue* terminator() const { return values.empty() || !values.back()->isTerminator() ? nullptr : values.back(); }
+	size_t phiCount() const;
+	size_t predecessorIndex(const IrBlock* block) const;
+};
+
+/**
+ * Control flow graph in SSA form of a method, built from its quickened
+ * instructions (see QuickCode), which decode its bytecode.
+ *
+ * The operand stack and the locals turn into values, with phis where
+ * control flow merges. Types come from the opcodes and from the method,
+ * field and constant descriptors, and flow along into phis. long and
+ * double keep taking two local and stack slots while building, so that
+ * slot-shuffling stack ops translate exactly.
+ *
+ * Values and blocks live in the graph's arena, so passes simply unlink
+ * what they remove.
+ */
+class IrGraph {
+private:
+	Arena arena_;
+	Method* method_;
+	QuickCode* quick_;
+	std::vector<IrBlock*> blocks_;   //!< entry first
+	uint32_t nextValue_;
+	uint32_t nextBlock_;
+
+public:
+	IrGraph(Method* method, QuickCode* quick) :
+		arena_(), method_(method), quick_(quick), blocks_(), nextValue_(0), nextBlock_(0) {}
+
+	IrGraph(const IrGraph&) = delete;
+	IrGraph& operator=(const IrGraph&) = delete;
+
+	/**
+	 * Builds the graph of \p method.
+	 *
+	 * @return the graph, or \p nullptr if the method has no code, uses
+	 *         jsr/ret, or its bytecode does not verify as far as building
+	 *         goes (prints a warning then).
+	 */
+	static std::unique_ptr<IrGraph> build(Method* method);
+
+	Method* method() const { return method_; }
+	QuickCode* quick() const { return quick_; }
+	IrBlock* entry() const { return blocks_.front(); }
+	const std::vector<IrBlock*>& blocks() const { return blocks_; }
+	std::vector<IrBlock*>& blocks() { return blocks_; }
+
+	//! Value ids are below.
+	uint32_t valueCount() const { return nextValue_; }
+
+	//! Block ids are below.
+	uint32_t blockCount() const { return nextBlock_; }
+
+	// {{{ editing
+	IrBlock* newBlock(uint32_t start);
+	IrValue* newValue(IrOp op, IrType type);
+
+	//! New value appended to \p block, before its terminator if any.
+	IrValue* insert(IrBlock* block, IrOp op, IrType type, std::vector<IrValue*> operands, int64_t imm = 0);
+
+	//! Makes \p value a constant in place.
+	static void setConst(IrValue* value, int64_t bits);
+
+	//! Makes \p value a copy of \p source in place.
+	static void setCopy(IrValue* value, IrValue* source);
+
+	//! Replaces \p from by \p to as an operand, and in frame states.
+	void replaceUses(IrValue* from, IrValue* to);
+
+	/**
+	 * Replaces each value that \p resolve maps to another one, as an
+	 * operand and in frame states.
+	 */
+	template<typename F>
+	void forwardUses(F resolve) {
+		for (IrBlock* block: blocks_) {
+			if (block->state)
+				forwardState(block->state, resolve);
+			for (IrValue* value: block->values) {
+				for (IrValue*& operand: value->operands)
+					if (operand)
+						operand = resolve(operand);
+				if (value->state)
+					forwardState(value->state, resolve);
+			}
+		}
+	}
+
+	//! Unlinks \p value from its block.
+	static void remove(IrValue* value);
+
+	//! Removes the edge, and the phi operands that come with it.
+	static void removeEdge(IrBlock* from, IrBlock* to);
+
+	//! Replaces \p block's terminator by a Goto to \p target, removing the other edges.
+	void setGoto(IrBlock* block, IrBlock* target);
+	// }}}
+
+	// {{{ analysis
+	/**
+	 * Orders the blocks in reverse postorder, dropping unreachable ones
+	 * unlinked, and computes dominators and loop depths.
+	 */
+	void computeDominators();
+
+	static bool dominates(const IrBlock* a, const IrBlock* b);
+
+	//! Number of uses per value id.
+	std::vector<uint32_t> useCounts() const;
+
+	/**
+	 * Checks the graph's structure and SSA form.
+	 *
+	 * @return an empty string if valid, otherwise what is wrong.
+	 */
+	std::string verify();
+	// }}}
+
+	//! Textual form, one value per line.
+	std::string to_s() const;
+	void dump() const;
+
+private:
+	friend class IrBuilder;
+	Arena& arena() { return arena_; }
+
+	template<typename F>
+	static void forwardState(IrFrameState* state, F resolve) {
+		for (std::vector<IrValue*>* slots: {&state->locals, &state->stack})
+			for (IrValue*& value: *slots)
+				if (value)
+					value = resolve(value);
+	}
+};
@@ -0,0 +1,869 @@
+#include "IrPasses.h"
+#include "Ir.h"
+#include "Class.h"
+#include "Opcodes.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <tuple>
+
+template<typename T>
+static inline bool contains(const std::vector<T>& v, const T& x)
+{
+	return std::find(v.begin(), v.end(), x) != v.end();
+}
+
+static inline bool isConstant(const IrValue* value, int64_t bits)
+{
+	return value->isConst() && value->imm == bits;
+}
+
+//! Blocks in reverse postorder, as of the last IrGraph::computeDominators().
+static std::vector<IrBlock*> reversePostorder(IrGraph& graph)
+{
+	std::vector<IrBlock*> rpo;
+	for (IrBlock* block: graph.blocks())
+		if (block->order != UINT32_MAX)
+			rpo.push_back(block);
+	std::sort(rpo.begin(), rpo.end(), [](IrBlock* a, IrBlock* b) { return a->order < b->order; });
+	return rpo;
+}
+
+//! Replaces operands by what they were forwarded to, and removes the forwarded values.
+static void applyForwarding(IrGraph& graph, const std::vector<IrValue*>& forward)
+{
+	auto resolve = [&](IrValue* value) {
+		while (forward[value->id])
+			value = forward[value->id];
+		return value;
+	};
+
+	for (IrBlock* block: graph.blocks()) {
+		std::vector<IrValue*>& values = block->values;
+		values.erase(std::remove_if(values.begin(), values.end(),
+			[&](IrValue* value) { return forward[value->id] != nullptr; }), values.end());
+	}
+	graph.forwardUses(resolve);
+}
+
+// {{{ fold
+namespace {
+
+template<typename T>
+static int64_t bitsOf(T x)
+{
+	typedef typename std::conditional<sizeof(T) == 4, uint32_t, int64_t>::type Bits;
+	Bits bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+//! Java's narrowing of floating-point values to integers: NaN is 0, and out of range saturates.
+template<typename T>
+static T toIntegral(double x)
+{
+	if (x != x)
+		return 0;
+	if (x >= (double) std::numeric_limits<T>::max())
+		return std::numeric_limits<T>::max();
+	if (x <= (double) std::numeric_limits<T>::min())
+		return std::numeric_limits<T>::min();
+	return (T) x;
+}
+
+//! Integer arithmetic with Java semantics, i.e. wrapping around; fails on division by zero.
+template<typename T, typename U>
+static bool integral(IrOp op, T x, T y, T& r)
+{
+	const unsigned mask = sizeof(T) * 8 - 1;
+	switch (op) {
+		case IrOp::Add: r = (T) ((U) x + (U) y); return true;
+		case IrOp::Sub: r = (T) ((U) x - (U) y); return true;
+		case IrOp::Mul: r = (T) ((U) x * (U) y); return true;
+		case IrOp::Div: if (!y) return false; r = y == -1 ? (T) (0 - (U) x) : x / y; return true;
+		case IrOp::Rem: if (!y) return false; r = y == -1 ? 0 : x % y; return true;
+		case IrOp::Neg: r = (T) (0 - (U) x); return true;
+		case IrOp::Shl: r = (T) ((U) x << (y & mask)); return true;
+		case IrOp::Shr: r = x >> (y & mask); return true;
+		case IrOp::Ushr: r = (T) ((U) x >> (y & mask)); return true;
+		case IrOp::And: r = x & y; return true;
+		case IrOp::Or: r = x | y; return true;
+		case IrOp::Xor: r = x ^ y; return true;
+		default: return false;
+	}
+}
+
+template<typename T>
+static bool floating(IrOp op, T x, T y, T& r)
+{
+	switch (op) {
+		case IrOp::Add: r = x + y; return true;
+		case IrOp::Sub: r = x - y; return true;
+		case IrOp::Mul: r = x * y; return true;
+		case IrOp::Div: r = x / y; return true;
+		case IrOp::Rem: r = fmod(x, y); return true;
+		case IrOp::Neg: r = -x; return true;
+		default: return false;
+	}
+}
+
+static bool convert(Opcode op, const IrValue* a, int64_t& out)
+{
+	switch (op) {
+		case Opcode::i2l: out = a->asInt(); return true;
+		case Opcode::i2f: out = bitsOf((float) a->asInt()); return true;
+		case Opcode::i2d: out = bitsOf((double) a->asInt()); return true;
+		case Opcode::l2i: out = (int32_t) a->asLong(); return true;
+		case Opcode::l2f: out = bitsOf((float) a->asLong()); return true;
+		case Opcode::l2d: out = bitsOf((double) a->asLong()); return true;
+		case Opcode::f2i: out = toIntegral<int32_t>(a->asFloat()); return true;
+		case Opcode::f2l: out = toIntegral<int64_t>(a->asFloat()); return true;
+		case Opcode::f2d: out = bitsOf((double) a->asFloat()); return true;
+		case Opcode::d2i: out = toIntegral<int32_t>(a->asDouble()); return true;
+		case Opcode::d2l: out = toIntegral<int64_t>(a->asDouble()); return true;
+		case Opcode::d2f: out = bitsOf((float) a->asDouble()); return true;
+		case Opcode::i2b: out = (int8_t) a->asInt(); return true;
+		case Opcode::i2c: out = (uint16_t) a->asInt(); return true;
+		case Opcode::i2s: out = (int16_t) a->asInt(); return true;
+		default: return false;
+	}
+}
+
+//! Result of \p value with constant operands, as the bits of a Const.
+static bool evaluate(const IrValue* value, int64_t& out)
+{
+	const IrValue* a = value->operands[0];
+	const IrValue* b = value->operands.size() > 1 ? value->operands[1] : a;
+
+	switch (value->op) {
+		case IrOp::Cmp:
+			out = a->asLong() < b->asLong() ? -1 : a->asLong() > b->asLong();
+			return true;
+		case IrOp::Cmpl:
+		case IrOp::Cmpg: {
+			double x = a->type == IrType::Float ? a->asFloat() : a->asDouble();
+			double y = b->type == IrType::Float ? b->asFloat() : b->asDouble();
+			if (x != x || y != y)
+				out = value->op == IrOp::Cmpl ? -1 : 1;
+			else
+				out = x < y ? -1 : x > y;
+			return true;
+		}
+		case IrOp::Convert:
+			return convert((Opcode) value->imm, a, out);
+		default:
+			break;
+	}
+
+	switch (value->type) {
+		case IrType::Int: {
+			int32_t r;
+			if (!integral<int32_t, uint32_t>(value->op, a->asInt(), b->asInt(), r))
+				return false;
+			out = r;
+			return true;
+		}
+		case IrType::Long: {
+			int64_t r;
+			if (!integral<int64_t, uint64_t>(value->op, a->asLong(), b->asLong(), r))
+				return false;
+			out = r;
+			return true;
+		}
+		case IrType::Float: {
+			float r;
+			if (!floating<float>(value->op, a->asFloat(), b->asFloat(), r))
+				return false;
+			out = bitsOf(r);
+			return true;
+		}
+		case IrType::Double: {
+			double r;
+			if (!floating<double>(value->op, a->asDouble(), b->asDouble(), r))
+				return false;
+			out = bitsOf(r);
+			return true;
+		}
+		default:
+			return false;
+	}
+}
+
+//! Whether \p value is a reference that cannot be null.
+static bool isNonNull(const IrValue* value)
+{
+	switch (value->op) {
+		case IrOp::New: case IrOp::NewArray: case IrOp::ANewArray: case IrOp::MultiANewArray:
+		case IrOp::Ldc: case IrOp::Catch:
+			return true;
+		default:
+			return false;
+	}
+}
+
+class ConstantFolding : public IrPass {
+public:
+	const char* name() const { return "fold"; }
+
+	bool run(IrGraph& graph) {
+		bool changed = false;
+		for (bool again = true; again; ) {
+			again = false;
+			for (IrBlock* block: graph.blocks()) {
+				again |= foldPhis(block);
+				for (IrValue* value: block->values)
+					again |= fold(value);
+				again |= foldBranch(graph, block);
+			}
+			changed |= again;
+		}
+		return changed;
+	}
+
+private:
+	/**
+	 * Makes phis that merge the same constant from every predecessor that
+	 * constant, moved behind the block's other phis.
+	 */
+	static bool foldPhis(IrBlock* block) {
+		bool changed = false;
+		std::vector<IrValue*>& values = block->values;
+		size_t phis = block->phiCount();
+		for (size_t i = 0; i < phis; ) {
+			IrValue* phi = values[i];
+			bool constant = !phi->operands.empty();
+			for (IrValue* operand: phi->operands)
+				constant = constant && operand->isConst() && operand->imm == phi->operands[0]->imm;
+			if (!constant) {
+				++i;
+				continue;
+			}
+
+			IrGraph::setConst(phi, phi->operands[0]->imm);
+			values.erase(values.begin() + i);
+			values.insert(values.begin() + --phis, phi);
+			changed = true;
+		}
+		return changed;
+	}
+
+	static bool fold(IrValue* value) {
+		if (!value->isPure() || value->operands.empty())
+			return false;
+		switch (value->op) {
+			case IrOp::Const: case IrOp::Param: case IrOp::Phi: case IrOp::Copy:
+				return false;
+			default:
+				break;
+		}
+
+		bool constant = true;
+		for (IrValue* operand: value->operands)
+			constant = constant && operand->isConst();
+
+		int64_t bits;
+		if (constant && evaluate(value, bits)) {
+			IrGraph::setConst(value, bits);
+			return true;
+		}
+
+		return simplify(value);
+	}
+
+	//! Algebraic identities, of integers only, as -0.0 and NaN get in the way of floating-point ones.
+	static bool simplify(IrValue* value) {
+		if (value->type != IrType::Int && value->type != IrType::Long)
+			return false;
+		if (value->operands.size() != 2)
+			return false;
+
+		IrValue* a = value->operands[0];
+		IrValue* b = value->operands[1];
+		switch (value->op) {
+			case IrOp::Add:
+			case IrOp::Or:
+				if (isConstant(b, 0)) return IrGraph::setCopy(value, a), true;
+				if (isConstant(a, 0)) return IrGraph::setCopy(value, b), true;
+				if (value->op == IrOp::Or && a == b) return IrGraph::setCopy(value, a), true;
+				return false;
+			case IrOp::Sub:
+				if (isConstant(b, 0)) return IrGraph::setCopy(value, a), true;
+				if (a == b) return IrGraph::setConst(value, 0), true;
+				return false;
+			case IrOp::Mul:
+				if (isConstant(b, 1)) return IrGraph::setCopy(value, a), true;
+				if (isConstant(a, 1)) return IrGraph::setCopy(value, b), true;
+				if (isConstant(a, 0) || isConstant(b, 0)) return IrGraph::setConst(value, 0), true;
+				return false;
+			case IrOp::Div:
+				if (isConstant(b, 1)) return IrGraph::setCopy(value, a), true;
+				return false;
+			case IrOp::And:
+				if (isConstant(a, 0) || isConstant(b, 0)) return IrGraph::setConst(value, 0), true;
+				if (isConstant(b, -1) || a == b) return IrGraph::setCopy(value, a), true;
+				if (isConstant(a, -1)) return IrGraph::setCopy(value, b), true;
+				return false;
+			case IrOp::Xor:
+				if (isConstant(b, 0)) return IrGraph::setCopy(value, a), true;
+				if (isConstant(a, 0)) return IrGraph::setCopy(value, b), true;
+				if (a == b) return IrGraph::setConst(value, 0), true;
+				return false;
+			case IrOp::Shl:
+			case IrOp::Shr:
+			case IrOp::Ushr:
+				if (b->isConst() && (b->imm & (value->type == IrType::Int ? 31 : 63)) == 0)
+					return IrGraph::setCopy(value, a), true;
+				return false;
+			case IrOp::Cmp:
+				if (a == b) return IrGraph::setConst(value, 0), true;
+				return false;
+			default:
+				return false;
+		}
+	}
+
+	//! Turns branches whose outcome is known into gotos.
+	static bool foldBranch(IrGraph& graph, IrBlock* block) {
+		IrValue* term = block->terminator();
+		if (term->op == IrOp::If) {
+			IrValue* a = term->operands[0];
+			IrValue* b = term->operands[1];
+			IrCond cond = (IrCond) term->imm;
+			int outcome = -1;
+
+			if (a->isConst() && b->isConst()) {
+				int64_t x = a->imm;
+				int64_t y = b->imm;
+				switch (cond) {
+					case IrCond::Eq: outcome = x == y; break;
+					case IrCond::Ne: outcome = x != y; break;
+					case IrCond::Lt: outcome = x < y; break;
+					case IrCond::Ge: outcome = x >= y; break;
+					case IrCond::Gt: outcome = x > y; break;
+					case IrCond::Le: outcome = x <= y; break;
+				}
+			} else if (a == b) {
+				outcome = cond == IrCond::Eq || cond == IrCond::Ge || cond == IrCond::Le;
+			} else if ((cond == IrCond::Eq || cond == IrCond::Ne)
+					&& ((isConstant(b, 0) && isNonNull(a) && a->type == IrType::Ref)
+						|| (isConstant(a, 0) && isNonNull(b) && b->type == IrType::Ref))) {
+				outcome = cond == IrCond::Ne;
+			}
+
+			if (outcome < 0)
+				return false;
+			graph.setGoto(block, block->successors[outcome ? 0 : 1]);
+			return true;
+		}
+
+		if (term->op == IrOp::Switch && term->operands[0]->isConst()) {
+			int32_t key = term->operands[0]->asInt();
+			size_t target = 0;
+			for (size_t k = 0; k < term->cases.size(); k += 2)
+				if (term->cases[k] == key)
+					target = term->cases[k + 1];
+			graph.setGoto(block, block->successors[target]);
+			return true;
+		}
+
+		return false;
+	}
+};
+// }}}
+
+// {{{ dbe
+class DeadBlockElimination : public IrPass {
+public:
+	const char* name() const { return "dbe"; }
+
+	bool run(IrGraph& graph) {
+		bool changed = false;
+		std::vector<IrBlock*>& blocks = graph.blocks();
+
+		graph.computeDominators();
+		for (IrBlock* block: blocks) {
+			if (block->order != UINT32_MAX)
+				continue;
+			std::vector<IrBlock*> successors = block->successors;
+			successors.insert(successors.end(), block->handlers.begin(), block->handlers.end());
+			for (IrBlock* succ: successors)
+				IrGraph::removeEdge(block, succ);
+			changed = true;
+		}
+		blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+			[](IrBlock* block) { return block->order == UINT32_MAX; }), blocks.end());
+
+		// phis of blocks left with a single predecessor merge nothing
+		for (IrBlock* block: blocks) {
+			if (block->predecessors.size() != 1)
+				continue;
+			for (IrValue* value: block->values) {
+				if (value->op != IrOp::Phi)
+					continue;
+				IrGraph::setCopy(value, value->operands[0]);
+				changed = true;
+			}
+		}
+
+		// straight-line blocks, outside of exception handling
+		std::vector<bool> merged(graph.blockCount(), false);
+		for (IrBlock* block: blocks) {
+			if (merged[block->id])
+				continue;
+			for (;;) {
+				IrValue* term = block->terminator();
+				if (term->op != IrOp::Goto || !block->handlers.empty())
+					break;
+				IrBlock* next = block->successors[0];
+				if (next == block || next->predecessors.size() != 1 || !next->handlers.empty())
+					break;
+
+				block->values.pop_back();
+				for (IrValue* value: next->values) {
+					value->block = block;
+					block->values.push_back(value);
+				}
+				next->values.clear();
+
+				block->successors = next->successors;
+				for (IrBlock* succ: next->successors)
+					*std::find(succ->predecessors.begin(), succ->predecessors.end(), next) = block;
+				next->successors.clear();
+				next->predecessors.clear();
+				merged[next->id] = true;
+				changed = true;
+			}
+		}
+		blocks.erase(std::remove_if(blocks.begin(), blocks.end(),
+			[&](IrBlock* block) { return merged[block->id]; }), blocks.end());
+
+		graph.computeDominators();
+		std::sort(blocks.begin(), blocks.end(), [](IrBlock* a, IrBlock* b) { return a->order < b->order; });
+		return changed;
+	}
+};
+// }}}
+
+// {{{ copyprop
+class CopyPropagation : public IrPass {
+public:
+	const char* name() const { return "copyprop"; }
+
+	bool run(IrGraph& graph) {
+		std::vector<IrValue*> forward(graph.valueCount(), nullptr);
+		auto resolve = [&](IrValue* value) {
+			while (forward[value->id])
+				value = forward[value->id];
+			return value;
+		};
+
+		bool changed = false;
+		for (IrBlock* block: graph.blocks())
+			for (IrValue* value: block->values)
+				if (value->op == IrOp::Copy) {
+					forward[value->id] = value->operands[0];
+					changed = true;
+				}
+
+		// phis that merge a single value, once copies are seen through
+		for (bool again = true; again; ) {
+			again = false;
+			for (IrBlock* block: graph.blocks()) {
+				for (IrValue* value: block->values) {
+					if (value->op != IrOp::Phi)
+						break;
+					if (forward[value->id])
+						continue;
+
+					IrValue* same = nullptr;
+					bool trivial = true;
+					for (IrValue* operand: value->operands) {
+						operand = resolve(operand);
+						if (operand == value || operand == same)
+							continue;
+						if (same) {
+							trivial = false;
+							break;
+						}
+						same = operand;
+					}
+					if (trivial && same) {
+						forward[value->id] = same;
+						again = changed = true;
+					}
+				}
+			}
+		}
+
+		if (changed)
+			applyForwarding(graph, forward);
+		return changed;
+	}
+};
+// }}}
+
+// {{{ gvn
+/**
+ * Global value numbering over the dominator tree: a pure value equal to
+ * one in a dominating position is replaced by the latter. Values are
+ * equal if their ops, types, immediates and operands are, commutative
+ * operands in either order. Phis are only equal within the same block.
+ */
+class GlobalValueNumbering : public IrPass {
+private:
+	typedef std::tuple<IrOp, IrType, int64_t, uint32_t, std::vector<uint32_t>> Key;
+
+public:
+	const char* name() const { return "gvn"; }
+
+	bool run(IrGraph& graph) {
+		graph.computeDominators();
+		std::vector<IrBlock*> rpo = reversePostorder(graph);
+
+		std::vector<std::vector<IrBlock*>> children(graph.blockCount());
+		for (IrBlock* block: rpo)
+			if (block->idom)
+				children[block->idom->id].push_back(block);
+
+		std::vector<IrValue*> forward(graph.valueCount(), nullptr);
+		auto resolve = [&](IrValue* value) {
+			while (forward[value->id])
+				value = forward[value->id];
+			return value;
+		};
+
+		std::map<Key, IrValue*> table;
+		std::vector<std::map<Key, IrValue*>::iterator> scope;
+		struct Visit { IrBlock* block; size_t child; size_t scope; };
+		std::vector<Visit> stack;
+		bool changed = false;
+
+		stack.push_back({graph.entry(), 0, 0});
+		number(graph.entry(), table, scope, forward, resolve, changed);
+		while (!stack.empty()) {
+			Visit& visit = stack.back();
+			const std::vector<IrBlock*>& next = children[visit.block->id];
+			if (visit.child < next.size()) {
+				IrBlock* child = next[visit.child++];
+				stack.push_back({child, 0, scope.size()});
+				number(child, table, scope, forward, resolve, changed);
+			} else {
+				while (scope.size() > visit.scope) {
+					table.erase(scope.back());
+					scope.pop_back();
+				}
+				stack.pop_back();
+			}
+		}
+
+		if (changed)
+			applyForwarding(graph, forward);
+		return changed;
+	}
+
+private:
+	static bool isNumbered(const IrValue* value) {
+		return value->isPure() && value->op != IrOp::Param && value->op != IrOp::Copy;
+	}
+
+	static bool isCommutative(const IrValue* value) {
+		switch (value->op) {
+			case IrOp::Add: case IrOp::Mul: case IrOp::And: case IrOp::Or: case IrOp::Xor:
+				return value->type == IrType::Int || value->type == IrType::Long;
+			default:
+				return false;
+		}
+	}
+
+	template<typename Resolve>
+	static void number(IrBlock* block, std::map<Key, IrValue*>& table,
+			std::vector<std::map<Key, IrValue*>::iterator>& scope,
+			std::vector<IrValue*>& forward, Resolve resolve, bool& changed) {
+		for (IrValue* value: block->values) {
+			for (IrValue*& operand: value->operands)
+				operand = resolve(operand);
+			if (!isNumbered(value))
+				continue;
+
+			std::vector<uint32_t> operands;
+			for (IrValue* operand: value->operands)
+				operands.push_back(operand->id);
+			if (isCommutative(value))
+				std::sort(operands.begin(), operands.end());
+
+			Key key(value->op, value->type, value->imm, value->op == IrOp::Phi ? block->id : 0, std::move(operands));
+			auto found = table.find(key);
+			if (found != table.end()) {
+				forward[value->id] = found->second;
+				changed = true;
+			} else {
+				scope.push_back(table.insert(std::make_pair(key, value)).first);
+			}
+		}
+	}
+};
+// }}}
+
+// {{{ licm
+struct Loop {
+	IrBlock* header;
+	std::vector<bool> body;   //!< by block id
+	size_t size;
+};
+
+//! Natural loops, one per header, as of the last IrGraph::computeDominators().
+static std::vector<Loop> findLoops(IrGraph& graph)
+{
+	std::vector<Loop> loops;
+	std::vector<IrBlock*> work;
+
+	for (IrBlock* header: reversePostorder(graph)) {
+		Loop loop = { header, std::vector<bool>(graph.blockCount(), false), 1 };
+		loop.body[header->id] = true;
+		for (IrBlock* pred: header->predecessors)
+			if (IrGraph::dominates(header, pred) && !loop.body[pred->id]) {
+				loop.body[pred->id] = true;
+				work.push_back(pred);
+			}
+		if (work.empty())
+			continue;
+
+		while (!work.empty()) {
+			IrBlock* block = work.back();
+			work.pop_back();
+			++loop.size;
+			for (IrBlock* pred: block->predecessors)
+				if (pred->order != UINT32_MAX && !loop.body[pred->id]) {
+					loop.body[pred->id] = true;
+					work.push_back(pred);
+				}
+		}
+		loops.push_back(std::move(loop));
+	}
+
+	return loops;
+}
+
+/**
+ * Loop-invariant code motion: pure values that cannot throw, and whose
+ * operands are all defined outside a loop, move into the loop's
+ * preheader, innermost loops first. Loops whose header has more than one
+ * predecessor from outside get a preheader block inserted first, taking
+ * over the header's phi operands of those.
+ */
+class LoopInvariantCodeMotion : public IrPass {
+public:
+	const char* name() const { return "licm"; }
+
+	bool run(IrGraph& graph) {
+		bool changed = false;
+
+		graph.computeDominators();
+		std::vector<Loop> loops = findLoops(graph);
+		if (loops.empty())
+			return false;
+		for (Loop& loop: loops)
+			changed |= addPreheader(graph, loop);
+
+		if (changed) {
+			graph.computeDominators();
+			loops = findLoops(graph);
+		}
+		std::sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.size < b.size; });
+
+		for (Loop& loop: loops) {
+			IrBlock* preheader = preheaderOf(loop);
+			if (!preheader)
+				continue;
+
+			std::vector<IrBlock*> body;
+			for (IrBlock* block: graph.blocks())
+				if (loop.body[block->id])
+					body.push_back(block);
+			std::sort(body.begin(), body.end(), [](IrBlock* a, IrBlock* b) { return a->order < b->order; });
+
+			for (IrBlock* block: body) {
+				std::vector<IrValue*>& values = block->values;
+				for (size_t i = 0; i < values.size(); ) {
+					IrValue* value = values[i];
+					if (!isInvariant(value, loop)) {
+						++i;
+						continue;
+					}
+					values.erase(values.begin() + i);
+					value->block = preheader;
+					preheader->values.insert(preheader->values.end() - 1, value);
+					changed = true;
+				}
+			}
+		}
+
+		return changed;
+	}
+
+private:
+	//! The single predecessor from outside, if it leads to the header only.
+	static IrBlock* preheaderOf(const Loop& loop) {
+		IrBlock* preheader = nullptr;
+		for (IrBlock* pred: loop.header->predecessors) {
+			if (loop.body[pred->id])
+				continue;
+			if (preheader || pred->successors.size() != 1 || pred->successors[0] != loop.header)
+				return nullptr;
+			preheader = pred;
+		}
+		return preheader;
+	}
+
+	static bool addPreheader(IrGraph& graph, const Loop& loop) {
+		if (preheaderOf(loop))
+			return false;
+
+		IrBlock* header = loop.header;
+		std::vector<IrBlock*> outside;
+		std::vector<IrBlock*> inside;
+		for (IrBlock* pred: header->predecessors) {
+			if (contains(pred->handlers, header))
+				return false;
+			(loop.body[pred->id] ? inside : outside).push_back(pred);
+		}
+
+		IrBlock* preheader = graph.newBlock(header->start);
+		graph.insert(preheader, IrOp::Goto, IrType::Void, {});
+
+		for (IrValue* phi: header->values) {
+			if (phi->op != IrOp::Phi)
+				break;
+			std::vector<IrValue*> merged;
+			std::vector<IrValue*> operands;
+			for (size_t k = 0; k < header->predecessors.size(); ++k)
+				(loop.body[header->predecessors[k]->id] ? operands : merged).push_back(phi->operands[k]);
+
+			bool same = std::all_of(merged.begin(), merged.end(), [&](IrValue* v) { return v == merged[0]; });
+			operands.insert(operands.begin(), same ? merged[0] : graph.insert(preheader, IrOp::Phi, phi->type, merged));
+			phi->operands = std::move(operands);
+		}
+
+		for (IrBlock* pred: outside)
+			*std::find(pred->successors.begin(), pred->successors.end(), header) = preheader;
+		preheader->predecessors = outside;
+		preheader->successors.assign(1, header);
+		inside.insert(inside.begin(), preheader);
+		header->predecessors = std::move(inside);
+		return true;
+	}
+
+	static bool isInvariant(const IrValue* value, const Loop& loop) {
+		if (!value->isPure() || value->mayThrow() || value->op == IrOp::Phi || value->op == IrOp::Param)
+			return false;
+		for (IrValue* operand: value->operands)
+			if (loop.body[operand->block->id])
+				return false;
+		return true;
+	}
+};
+// }}}
+
+// {{{ dce
+class DeadCodeElimination : public IrPass {
+public:
+	const char* name() const { return "dce"; }
+
+	bool run(IrGraph& graph) {
+		std::vector<bool> live(graph.valueCount(), false);
+		std::vector<IrValue*> work;
+
+		for (IrBlock* block: graph.blocks())
+			for (IrValue* value: block->values)
+				if (!isRemovable(value)) {
+					live[value->id] = true;
+					work.push_back(value);
+				}
+
+		while (!work.empty()) {
+			IrValue* value = work.back();
+			work.pop_back();
+			for (IrValue* operand: value->operands)
+				if (!live[operand->id]) {
+					live[operand->id] = true;
+					work.push_back(operand);
+				}
+		}
+
+		bool changed = false;
+		for (IrBlock* block: graph.blocks()) {
+			std::vector<IrValue*>& values = block->values;
+			size_t before = values.size();
+			values.erase(std::remove_if(values.begin(), values.end(),
+				[&](IrValue* value) { return !live[value->id]; }), values.end());
+			changed |= values.size() != before;
+		}
+		return changed;
+	}
+
+private:
+	static bool isRemovable(const IrValue* value) {
+		return value->isPure() && !value->mayThrow() && value->op != IrOp::Param;
+	}
+};
+// }}}
+
+} // namespace
+
+bool IrPassManager::add(const std::string& name)
+{
+	IrPass* pass = createPass(name);
+	if (!pass)
+		return false;
+	add(pass);
+	return true;
+}
+
+void IrPassManager::addStandardPipeline()
+{
+	add(new ConstantFolding());
+	add(new DeadBlockElimination());
+	add(new CopyPropagation());
+	add(new LoopInvariantCodeMotion());
+	add(new GlobalValueNumbering());
+	add(new DeadCodeElimination());
+}
+
+bool IrPassManager::run(IrGraph& graph)
+{
+	for (const std::unique_ptr<IrPass>& pass: passes_) {
+		bool changed = pass->run(graph);
+
+		if (trace_ && changed) {
+			printf("--- after %s\n", pass->name());
+			graph.dump();
+		}
+
+		if (verify_) {
+			std::string errors = graph.verify();
+			if (!errors.empty()) {
+				Method* method = graph.method();
+				printf("WARNING: invalid IR of method %s.%s%s after pass %s:\n%s",
+					method->thisClass()->name()->c_str(), method->name()->c_str(), method->descriptor()->c_str(),
+					pass->name(), errors.c_str());
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+IrPass* IrPassManager::createPass(const std::string& name)
+{
+	if (name == "fold") return new ConstantFolding();
+	if (name == "dbe") return new DeadBlockElimination();
+	if (name == "copyprop") return new CopyPropagation();
+	if (name == "gvn") return new GlobalValueNumbering();
+	if (name == "licm") return new LoopInvariantCodeMotion();
+	if (name == "dce") return new DeadCodeElimination();
+	return nullptr;
+}
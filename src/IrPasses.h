@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+class IrGraph;
+
+/**
+ * A transformation of an IrGraph, keeping it in valid SSA form.
+ */
+class IrPass {
+public:
+	virtual ~IrPass() {}
+
+	virtual const char* name() const = 0;
+
+	//! Transforms \p graph, returning whether anything changed.
+	virtual bool run(IrGraph& graph) = 0;
+};
+
+/**
+ * Runs a sequence of passes over IR graphs.
+ *
+ * The passes available by name:
+ * <ul>
+ *   <li>fold: constant folding and algebraic simplification, including
+ *       branches on constants</li>
+ *   <li>dbe: dead block elimination, removing unreachable blocks and
+ *       merging straight-line ones</li>
+ *   <li>copyprop: copy propagation, including phis that merge one value</li>
+ *   <li>gvn: global value numbering of pure values, over the dominator tree</li>
+ *   <li>licm: loop-invariant code motion, hoisting pure values that cannot
+ *       throw into loop preheaders</li>
+ *   <li>dce: dead code elimination of unused values without effects</li>
+ * </ul>
+ */
+class IrPassManager {
+private:
+	std::vector<std::unique_ptr<IrPass>> passes_;
+	bool verify_;
+	bool trace_;
+
+public:
+	IrPassManager() : passes_(), verify_(false), trace_(false) {}
+
+	//! Appends \p pass, taking ownership.
+	void add(IrPass* pass) { passes_.emplace_back(pass); }
+
+	//! Appends the pass named \p name, returning false if there is none.
+	bool add(const std::string& name);
+
+	//! Appends the passes of the optimizing pipeline.
+	void addStandardPipeline();
+
+	size_t size() const { return passes_.size(); }
+
+	//! Verifies the graph after each pass.
+	void setVerify(bool verify) { verify_ = verify; }
+
+	//! Dumps the graph after each pass that changed it.
+	void setTrace(bool trace) { trace_ = trace; }
+
+	/**
+	 * Runs all passes over \p graph in order.
+	 *
+	 * @return false if verification failed after a pass, which stops
+	 *         the pipeline (printing what is wrong).
+	 */
+	bool run(IrGraph& graph);
+
+	//! New pass named \p name, or \p nullptr.
+	static IrPass* createPass(const std::string& name);
+};
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
+class Class;
+class Symbol;
 class JObject;
 
 struct JValue {
@@ -16,15 +21,68 @@ struct JValue {
 	};
 };
 
+/**
+ * Header of every heap object, followed by its instance data.
+ *
+ * Field offsets, as assigned at link time, are relative to data().
+ */
 class JObject {
+protected:
+	Class* type_; //!< nullptr for arrays
+
+public:
+	explicit JObject(Class* type) : type_(type) {}
+
+	Class* type() const { return type_; }
+	bool isArray() const { return type_ == nullptr; }
+
+	uint8_t* data() { return (uint8_t*) (this + 1); }
+
+	//! Offsets of the class and data() from the object, for compiled code.
+	static size_t typeOffset() { return offsetof(JObject, type_); }
+	static size_t dataOffset() { return sizeof(JObject); }
+
+	template<typename T>
+	T& at(uint32_t offset) { return *(T*) (data() + offset); }
+};
+
+/**
+ * Array object, followed by its elements.
+ */
+class JArray : public JObject {
 private:
-	Class* type_;
-	uint8_t* data_[];
+	const Symbol* descriptor_; //!< array type, i.e. "[I" or "[Ljava/lang/String;"
+	Class* elementClass_;      //!< class of the elements of object arrays, if loaded
+	int32_t length_;
+	uint32_t elementSize_;
 
 public:
-	JObject(Class* type);
-	~JObject();
+	JArray(const Symbol* descriptor, Class* elementClass, int32_t length, uint32_t elementSize) :
+		JObject(nullptr),
+		descriptor_(descriptor),
+		elementClass_(elementClass),
+		length_(length),
+		elementSize_(elementSize)
+	{}
+
+	const Symbol* descriptor() const { return descriptor_; }
+	Class* elementClass() const { return elementClass_; }
+	int32_t length() const { return length_; }
+	uint32_t elementSize() const { return elementSize_; }
 
-	JValue getField(uint16_t id);
-	JValue getStatic(uint16_t id);
+	template<typename T>
+	T* elements() { return (T*) (this + 1); }
+
+	// {{{ layout, for compiled code
+	static size_t descriptorOffset() { return (const uint8_t*) &probe().descriptor_ - (const uint8_t*) &probe(); }
+	static size_t lengthOffset() { return (const uint8_t*) &probe().length_ - (const uint8_t*) &probe(); }
+	static size_t elementsOffset() { return sizeof(JArray); }
+	// }}}
+
+private:
+	// offsetof() is not defined for classes with base classes
+	static const JArray& probe() {
+		static const JArray array(nullptr, nullptr, 0, 0);
+		return array;
+	}
 };
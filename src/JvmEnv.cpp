@@ -15,11 +15,12 @@ JvmEnv::JvmEnv()
 
 JvmEnv::~JvmEnv()
 {
+	delete classLoader_;
 }
 
-void JvmEnv::addClassPath(const std::string& path)
+bool JvmEnv::addClassPath(const std::string& path)
 {
-	classLoader_->addClassPath(path);
+	return classLoader_->addClassPath(path);
 }
 
 /**
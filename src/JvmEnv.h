@@ -17,7 +17,7 @@ public:
 	JvmEnv();
 	~JvmEnv();
 
-	void addClassPath(const std::string& path);
+	bool addClassPath(const std::string& path);
 
 	/**
 	 * \param className fully qualified class name, i.e. "java/lang/Object".
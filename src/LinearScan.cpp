@@ -0,0 +1,444 @@
+#include "LinearScan.h"
+#include "Class.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <algorithm>
+#include <limits>
+
+const Reg LinearScan::Registers[] = {
+	Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10,
+	Reg::rbx, Reg::r12, Reg::r13, Reg::r14, Reg::r15,
+};
+
+const size_t LinearScan::RegisterCount = sizeof(Registers) / sizeof(Registers[0]);
+
+bool LinearScan::isCalleeSaved(Reg reg)
+{
+	switch (reg) {
+		case Reg::rbx: case Reg::rbp: case Reg::r12: case Reg::r13: case Reg::r14: case Reg::r15:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// {{{ intervals
+bool LinearScan::Interval::covers(uint32_t position) const
+{
+	for (const Range& range: ranges) {
+		if (position < range.from)
+			return false;
+		if (position < range.to)
+			return true;
+	}
+	return false;
+}
+
+bool LinearScan::Interval::intersects(const Interval& other) const
+{
+	size_t i = 0, j = 0;
+	while (i < ranges.size() && j < other.ranges.size()) {
+		const Range& a = ranges[i];
+		const Range& b = other.ranges[j];
+		if (a.from < b.to && b.from < a.to)
+			return true;
+		if (a.to <= b.to)
+			++i;
+		else
+			++j;
+	}
+	return false;
+}
+// }}}
+
+LinearScan::LinearScan(const MachineFunction& function) :
+	function_(function), order_(function.blockCount(), UINT32_MAX), first_(), liveIn_(), liveOut_(), calls_(),
+	intervals_(), spillSlots_(0), error_()
+{
+	uint32_t count = 0;
+	for (size_t i = 0; i < function.blocks().size(); ++i) {
+		const MachineBlock* block = function.blocks()[i];
+		order_[block->id] = i;
+		first_.push_back(count);
+		count += block->instrs.size();
+	}
+}
+
+// {{{ liveness
+void LinearScan::analyze()
+{
+	const std::vector<MachineBlock*>& blocks = function_.blocks();
+	size_t words = (function_.vregCount() + 63) / 64;
+	std::vector<LiveSet> gen(blocks.size(), LiveSet(words));
+	std::vector<LiveSet> kill(blocks.size(), LiveSet(words));
+	liveIn_.assign(blocks.size(), LiveSet(words));
+	liveOut_.assign(blocks.size(), LiveSet(words));
+
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		for (const MachineInstr& instr: blocks[i]->instrs) {
+			forEachRead(instr, [&](VReg reg, bool) {
+				if (!contains(kill[i], reg))
+					insert(gen[i], reg);
+			});
+			instr.forEachDef([&](VReg reg) { insert(kill[i], reg); });
+		}
+	}
+
+	for (bool changed = true; changed; ) {
+		changed = false;
+		for (size_t i = blocks.size(); i-- > 0; ) {
+			LiveSet out(words);
+			for (const MachineBlock* successor: blocks[i]->successors) {
+				const LiveSet& in = liveIn_[order_[successor->id]];
+				for (size_t w = 0; w < words; ++w)
+					out[w] |= in[w];
+			}
+			for (size_t w = 0; w < words; ++w) {
+				uint64_t in = gen[i][w] | (out[w] & ~kill[i][w]);
+				if (in != liveIn_[i][w]) {
+					liveIn_[i][w] = in;
+					changed = true;
+				}
+			}
+			liveOut_[i] = std::move(out);
+		}
+	}
+}
+
+std::vector<VReg> LinearScan::liveIn(const MachineBlock* block) const
+{
+	std::vector<VReg> regs;
+	const LiveSet& in = liveIn_[order_[block->id]];
+	for (VReg reg = 0; reg < function_.vregCount(); ++reg)
+		if (contains(in, reg))
+			regs.push_back(reg);
+	return regs;
+}
+// }}}
+
+// {{{ allocation
+bool LinearScan::run()
+{
+	analyze();
+
+	for (const MachineBlock* block: function_.blocks()) {
+		if (!block->predecessors.empty())
+			continue;
+		std::vector<VReg> live = liveIn(block);
+		if (!live.empty()) {
+			char buf[64];
+			snprintf(buf, sizeof(buf), "v%u is live at entry M%u", live.front(), block->id);
+			error_ = buf;
+			return false;
+		}
+	}
+
+	buildIntervals();
+	allocateRegisters();
+	assignSpillSlots();
+	return true;
+}
+
+void LinearScan::addRange(VReg reg, uint32_t from, uint32_t to)
+{
+	// built backwards: the new range precedes the ones so far, which are in descending order
+	assert(reg < intervals_.size());
+	std::vector<Range>& ranges = intervals_[reg].ranges;
+	if (!ranges.empty() && ranges.back().from <= to) {
+		ranges.back().from = std::min(ranges.back().from, from);
+		ranges.back().to = std::max(ranges.back().to, to);
+	} else {
+		ranges.push_back({from, to});
+	}
+}
+
+void LinearScan::buildIntervals()
+{
+	const std::vector<MachineBlock*>& blocks = function_.blocks();
+	intervals_.assign(function_.vregCount(), Interval());
+	calls_.clear();
+
+	for (size_t i = blocks.size(); i-- > 0; ) {
+		const MachineBlock* block = blocks[i];
+		uint32_t from = 2 * first_[i];
+		uint32_t to = 2 * (first_[i] + block->instrs.size());
+		float weight = 1;
+		for (uint32_t depth = 0; depth < std::min<uint32_t>(block->loopDepth, 4); ++depth)
+			weight *= 8;
+
+		for (VReg reg = 0; reg < function_.vregCount(); ++reg)
+			if (contains(liveOut_[i], reg))
+				addRange(reg, from, to);
+
+		for (size_t k = block->instrs.size(); k-- > 0; ) {
+			const MachineInstr& instr = block->instrs[k];
+			uint32_t position = from + 2 * k;
+
+			instr.forEachDef([&](VReg reg) {
+				Interval& interval = intervals_[reg];
+				std::vector<Range>& ranges = interval.ranges;
+				if (!ranges.empty() && ranges.back().from <= position + 1 && position + 1 < ranges.back().to)
+					ranges.back().from = position + 1;
+				else
+					ranges.push_back({position + 1, position + 2});
+				interval.weight += weight;
+			});
+
+			if (instr.isCall())
+				calls_.push_back(position);
+
+			forEachRead(instr, [&](VReg reg, bool afterCall) {
+				addRange(reg, from, position + (afterCall ? 2 : 1));
+				intervals_[reg].weight += weight;
+			});
+
+			if (instr.op == MachineOp::Mov && instr.a.isVReg()) {
+				intervals_[instr.dst].hints.push_back(instr.a.reg);
+				intervals_[instr.a.reg].hints.push_back(instr.dst);
+			} else if (instr.op == MachineOp::Moves) {
+				assert(instr.dsts.size() == instr.args.size());
+				for (size_t m = 0; m < instr.dsts.size(); ++m) {
+					if (!instr.args[m].isVReg())
+						continue;
+					intervals_[instr.dsts[m]].hints.push_back(instr.args[m].reg);
+					intervals_[instr.args[m].reg].hints.push_back(instr.dsts[m]);
+				}
+			}
+		}
+	}
+
+	std::reverse(calls_.begin(), calls_.end());
+	for (Interval& interval: intervals_) {
+		std::reverse(interval.ranges.begin(), interval.ranges.end());
+
+		// per position live: spilling a long interval that is rarely used frees the most
+		uint32_t length = 0;
+		for (const Range& range: interval.ranges)
+			length += range.to - range.from;
+		if (length)
+			interval.weight /= length;
+
+		// live across a call: from before its reads to after its results
+		for (const Range& range: interval.ranges) {
+			auto call = std::lower_bound(calls_.begin(), calls_.end(), range.from);
+			if (call != calls_.end() && *call + 1 < range.to) {
+				interval.crossesCall = true;
+				break;
+			}
+		}
+	}
+}
+
+void LinearScan::allocateRegisters()
+{
+	std::vector<VReg> unhandled;
+	for (VReg reg = 0; reg < intervals_.size(); ++reg)
+		if (!intervals_[reg].empty())
+			unhandled.push_back(reg);
+	std::stable_sort(unhandled.begin(), unhandled.end(),
+		[this](VReg a, VReg b) { return intervals_[a].start() < intervals_[b].start(); });
+
+	std::vector<VReg> active;    // covering the current position, in a register
+	std::vector<VReg> inactive;  // in a register, but in a lifetime hole at the current position
+
+	auto spill = [this](VReg reg) {
+		intervals_[reg].location = {Location::Kind::Spill, Reg::rax, -1};
+	};
+
+	for (VReg current: unhandled) {
+		Interval& interval = intervals_[current];
+		uint32_t position = interval.start();
+
+		for (size_t k = 0; k < active.size(); ) {
+			const Interval& other = intervals_[active[k]];
+			if (other.end() <= position) {
+				active.erase(active.begin() + k);
+			} else if (!other.covers(position)) {
+				inactive.push_back(active[k]);
+				active.erase(active.begin() + k);
+			} else {
+				++k;
+			}
+		}
+		for (size_t k = 0; k < inactive.size(); ) {
+			const Interval& other = intervals_[inactive[k]];
+			if (other.end() <= position) {
+				inactive.erase(inactive.begin() + k);
+			} else if (other.covers(position)) {
+				active.push_back(inactive[k]);
+				inactive.erase(inactive.begin() + k);
+			} else {
+				++k;
+			}
+		}
+
+		// the registers not taken by any interval overlapping this one
+		bool free[16];
+		for (size_t r = 0; r < 16; ++r)
+			free[r] = false;
+		for (size_t r = 0; r < RegisterCount; ++r)
+			free[(size_t) Registers[r]] = !interval.crossesCall || isCalleeSaved(Registers[r]);
+		for (VReg other: active)
+			free[(size_t) intervals_[other].location.reg] = false;
+		for (VReg other: inactive)
+			if (intervals_[other].intersects(interval))
+				free[(size_t) intervals_[other].location.reg] = false;
+
+		int chosen = -1;
+		for (VReg hint: interval.hints) {
+			const Location& location = intervals_[hint].location;
+			if (location.isRegister() && free[(size_t) location.reg]) {
+				chosen = (int) location.reg;
+				break;
+			}
+		}
+		for (size_t r = 0; r < RegisterCount && chosen < 0; ++r)
+			if (free[(size_t) Registers[r]])
+				chosen = (int) Registers[r];
+
+		if (chosen < 0) {
+			// take over the register whose overlapping intervals weigh least, unless this one weighs less
+			float cheapest = std::numeric_limits<float>::max();
+			for (size_t r = 0; r < RegisterCount; ++r) {
+				Reg reg = Registers[r];
+				if (interval.crossesCall && !isCalleeSaved(reg))
+					continue;
+				float cost = 0;
+				for (VReg other: active)
+					if (intervals_[other].location.reg == reg)
+						cost += intervals_[other].weight;
+				for (VReg other: inactive)
+					if (intervals_[other].location.reg == reg && intervals_[other].intersects(interval))
+						cost += intervals_[other].weight;
+				if (cost < cheapest) {
+					cheapest = cost;
+					chosen = (int) reg;
+				}
+			}
+
+			if (cheapest >= interval.weight) {
+				spill(current);
+				continue;
+			}
+
+			for (std::vector<VReg>* list: {&active, &inactive}) {
+				for (size_t k = 0; k < list->size(); ) {
+					const Interval& other = intervals_[(*list)[k]];
+					if ((int) other.location.reg == chosen && (list == &active || other.intersects(interval))) {
+						spill((*list)[k]);
+						list->erase(list->begin() + k);
+					} else {
+						++k;
+					}
+				}
+			}
+		}
+
+		interval.location = {Location::Kind::Register, (Reg) chosen, 0};
+		active.push_back(current);
+	}
+}
+
+void LinearScan::assignSpillSlots()
+{
+	std::vector<VReg> spilled;
+	for (VReg reg = 0; reg < intervals_.size(); ++reg)
+		if (intervals_[reg].location.isSpill())
+			spilled.push_back(reg);
+	std::stable_sort(spilled.begin(), spilled.end(),
+		[this](VReg a, VReg b) { return intervals_[a].start() < intervals_[b].start(); });
+
+	std::vector<std::vector<VReg>> slots;  // intervals per spill slot
+	auto fits = [&](int32_t slot, const Interval& interval) {
+		for (VReg other: slots[slot])
+			if (intervals_[other].intersects(interval))
+				return false;
+		return true;
+	};
+
+	for (VReg reg: spilled) {
+		Interval& interval = intervals_[reg];
+		int32_t chosen = -1;
+		for (VReg hint: interval.hints) {
+			const Location& location = intervals_[hint].location;
+			if (location.isSpill() && location.slot >= 0 && fits(location.slot, interval)) {
+				chosen = location.slot;
+				break;
+			}
+		}
+		for (int32_t slot = 0; slot < (int32_t) slots.size() && chosen < 0; ++slot)
+			if (fits(slot, interval))
+				chosen = slot;
+		if (chosen < 0) {
+			chosen = slots.size();
+			slots.emplace_back();
+		}
+
+		slots[chosen].push_back(reg);
+		interval.location.slot = chosen;
+	}
+
+	spillSlots_ = slots.size();
+}
+// }}}
+
+StackMap LinearScan::stackMap(uint32_t position, VReg result) const
+{
+	StackMap map = {0, {}};
+	for (VReg reg = 0; reg < intervals_.size(); ++reg) {
+		const Interval& interval = intervals_[reg];
+		if (reg == result || function_.typeOf(reg) != IrType::Ref || !interval.covers(position))
+			continue;
+		if (interval.location.isRegister())
+			map.registers |= 1 << (unsigned) interval.location.reg;
+		else if (interval.location.isSpill())
+			map.spills.push_back(interval.location.slot);
+	}
+	return map;
+}
+
+// {{{ dump
+static const char* registerName(Reg reg)
+{
+	static const char* const names[] = {
+		"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+		"r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+	};
+	return names[(size_t) reg];
+}
+
+std::string LinearScan::to_s() const
+{
+	std::string s;
+	char buf[64];
+
+	for (VReg reg = 0; reg < intervals_.size(); ++reg) {
+		const Interval& interval = intervals_[reg];
+		if (interval.empty())
+			continue;
+
+		snprintf(buf, sizeof(buf), "v%u:", reg);
+		s += buf;
+		for (const Range& range: interval.ranges) {
+			snprintf(buf, sizeof(buf), " [%u, %u)", range.from, range.to);
+			s += buf;
+		}
+		if (interval.location.isRegister())
+			snprintf(buf, sizeof(buf), " -> %s", registerName(interval.location.reg));
+		else
+			snprintf(buf, sizeof(buf), " -> spill %d", interval.location.slot);
+		s += buf;
+		if (interval.crossesCall)
+			s += " (across calls)";
+		s += "\n";
+	}
+
+	return s;
+}
+
+void LinearScan::dump() const
+{
+	printf("%s", to_s().c_str());
+}
+// }}}
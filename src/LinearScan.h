@@ -0,0 +1,158 @@
+#pragma once
+
+#include "DebugInfo.h"
+#include "MachineIr.h"
+#include "X86Assembler.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/**
+ * Linear-scan register allocation of a MachineFunction (after Poletto and
+ * Sarkar), with lifetime holes (after Wimmer and Mössenböck) but without
+ * splitting: each virtual register gets one location, a register or a
+ * spill slot, for all of its lifetime.
+ *
+ * Instructions are numbered in layout order, instruction k reading its
+ * operands at position 2k and writing its results at 2k+1; so are calls,
+ * which the frame states they deoptimize to read after the call, at 2k+1.
+ * Liveness comes from a backward dataflow analysis over the blocks. An
+ * interval is the list of position ranges where its virtual register is
+ * live: a loop variable, for one, has a hole between its last read in the
+ * loop body and the move at the back edge, which lets the incremented
+ * value take the same register.
+ *
+ * Intervals get registers in order of their start, any register that no
+ * other interval live at the same time holds. A move between two virtual
+ * registers hints at giving them the same one, which makes the move go
+ * away. If none is free for the whole interval, the one with the lowest
+ * spill weight (reads and writes weighted by loop depth, per position
+ * live) goes to memory:
+ * either the new interval, or the ones holding the register that is
+ * cheapest to take over. Intervals live across a call only get
+ * callee-saved registers, as calls clobber the others.
+ *
+ * Spilled intervals share a spill slot where they do not overlap, slots
+ * of intervals they move to or from first, so that such moves go away
+ * too.
+ */
+class LinearScan {
+public:
+	struct Location {
+		enum class Kind : uint8_t { None, Register, Spill };
+
+		Kind kind;
+		Reg reg;
+		int32_t slot;   //!< of the spill area, 8 bytes each
+
+		bool isRegister() const { return kind == Kind::Register; }
+		bool isSpill() const { return kind == Kind::Spill; }
+	};
+
+	//! Registers allocated, caller-saved ones first; the others are the code generator's scratch registers.
+	static const Reg Registers[];
+	static const size_t RegisterCount;
+
+	static bool isCalleeSaved(Reg reg);
+
+private:
+	struct Range {
+		uint32_t from;
+		uint32_t to;   //!< exclusive
+	};
+
+	struct Interval {
+		std::vector<Range> ranges;   //!< ascending, disjoint
+		std::vector<VReg> hints;     //!< virtual registers it moves to or from
+		float weight;
+		bool crossesCall;
+		Location location;
+
+		Interval() : ranges(), hints(), weight(0), crossesCall(false), location({Location::Kind::None, Reg::rax, 0}) {}
+
+		bool empty() const { return ranges.empty(); }
+		uint32_t start() const { return ranges.front().from; }
+		uint32_t end() const { return ranges.back().to; }
+		bool covers(uint32_t position) const;
+		bool intersects(const Interval& other) const;
+	};
+
+	typedef std::vector<uint64_t> LiveSet;
+
+	const MachineFunction& function_;
+	std::vector<uint32_t> order_;      //!< layout index by block id
+	std::vector<uint32_t> first_;      //!< number of the first instruction, by layout index
+	std::vector<LiveSet> liveIn_;      //!< by layout index
+	std::vector<LiveSet> liveOut_;
+	std::vector<uint32_t> calls_;      //!< positions of calls, ascending
+	std::vector<Interval> intervals_;  //!< by virtual register
+	uint32_t spillSlots_;
+	std::string error_;
+
+public:
+	explicit LinearScan(const MachineFunction& function);
+
+	LinearScan(const LinearScan&) = delete;
+	LinearScan& operator=(const LinearScan&) = delete;
+
+	//! Computes which virtual registers are live where.
+	void analyze();
+
+	//! Virtual registers live at the start of \p block, once analyzed.
+	std::vector<VReg> liveIn(const MachineBlock* block) const;
+
+	/**
+	 * Analyzes the function and allocates its virtual registers.
+	 *
+	 * @return false if some virtual register is read before being
+	 *         written, i.e. live at an entry (see error()).
+	 */
+	bool run();
+
+	//! Why run() failed.
+	const std::string& error() const { return error_; }
+
+	//! Position of the uses of instruction \p k of \p block, its results coming one later.
+	uint32_t position(const MachineBlock* block, size_t k) const { return 2 * (first_[order_[block->id]] + k); }
+
+	const Location& location(VReg reg) const { return intervals_[reg].location; }
+	uint32_t spillSlots() const { return spillSlots_; }
+
+	/**
+	 * References live at \p position other than \p result, i.e. held in
+	 * registers or spill slots there.
+	 */
+	StackMap stackMap(uint32_t position, VReg result = NoVReg) const;
+
+	//! Textual form: the intervals and where they went.
+	std::string to_s() const;
+	void dump() const;
+
+private:
+	static bool contains(const LiveSet& set, VReg reg) { return (set[reg / 64] >> (reg % 64)) & 1; }
+	static void insert(LiveSet& set, VReg reg) { set[reg / 64] |= (uint64_t) 1 << (reg % 64); }
+
+	//! Calls \p f on each virtual register that \p instr reads, with whether it reads it after a call.
+	template<typename F>
+	void forEachRead(const MachineInstr& instr, F f) const {
+		instr.forEachUse([&](VReg reg) { f(reg, false); });
+		switch (instr.op) {
+			case MachineOp::Guard:
+			case MachineOp::Deopt:
+				function_.forEachStateUse(instr.state, [&](VReg reg) { f(reg, false); });
+				break;
+			case MachineOp::Call:
+				function_.forEachStateUse(instr.state, [&](VReg reg) { f(reg, true); });
+				function_.forEachStateUse(instr.state + 1, [&](VReg reg) { f(reg, true); });
+				break;
+			default:
+				break;
+		}
+	}
+
+	void buildIntervals();
+	void addRange(VReg reg, uint32_t from, uint32_t to);
+	void allocateRegisters();
+	void assignSpillSlots();
+};
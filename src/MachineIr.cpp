@@ -0,0 +1,208 @@
+#include "MachineIr.h"
+#include "Class.h"
+#include "Opcodes.h"
+#include "QuickCode.h"
+
+#include <stdio.h>
+
+// {{{ names
+const char* machineOpName(MachineOp op)
+{
+	static const char* const names[] = {
+#define X(id, name) name,
+		JVM_MACHINE_OPS(X)
+#undef X
+	};
+	return names[(size_t) op];
+}
+
+static const char* condName(Cond cond)
+{
+	static const char* const names[] = {
+		"o", "no", "b", "ae", "e", "ne", "be", "a", "s", "ns", "p", "np", "l", "ge", "le", "g",
+	};
+	return names[(size_t) cond];
+}
+
+static const char* accessName(MachineAccess access)
+{
+	static const char* const names[] = { "u8", "s8", "u16", "s16", "i32", "i64" };
+	return names[(size_t) access];
+}
+// }}}
+
+// {{{ dump
+static std::string operandString(const MOperand& operand)
+{
+	char buf[64];
+	switch (operand.kind) {
+		case MOperand::Kind::None:
+			return "-";
+		case MOperand::Kind::VReg:
+			snprintf(buf, sizeof(buf), "v%u", operand.reg);
+			return buf;
+		case MOperand::Kind::Imm:
+			snprintf(buf, sizeof(buf), "%lld", (long long) operand.imm);
+			return buf;
+		case MOperand::Kind::Mem:
+			if (operand.scale)
+				snprintf(buf, sizeof(buf), "[v%u + v%u*%u + %lld]", operand.reg, operand.index, operand.scale,
+					(long long) operand.imm);
+			else
+				snprintf(buf, sizeof(buf), "[v%u + %lld]", operand.reg, (long long) operand.imm);
+			return buf;
+	}
+	return "?";
+}
+
+static std::string instrString(const MachineFunction& function, const MachineBlock* block, const MachineInstr& instr)
+{
+	std::string s;
+	char buf[64];
+
+	if (instr.dst != NoVReg) {
+		snprintf(buf, sizeof(buf), "v%u %s = ", instr.dst, irTypeName(function.typeOf(instr.dst)));
+		s += buf;
+	}
+	s += machineOpName(instr.op);
+
+	switch (instr.op) {
+		case MachineOp::Load:
+		case MachineOp::Store:
+			s += ".";
+			s += accessName(instr.access);
+			break;
+		case MachineOp::Select:
+		case MachineOp::Guard:
+		case MachineOp::Branch:
+			s += " ";
+			s += condName(instr.cond);
+			break;
+		case MachineOp::Local:
+		case MachineOp::Stack:
+			snprintf(buf, sizeof(buf), " %lld", (long long) instr.imm);
+			s += buf;
+			break;
+		case MachineOp::Convert:
+			s += " ";
+			s += opcodeName((uint8_t) instr.imm);
+			break;
+		case MachineOp::Call:
+			s += " ";
+			s += opcodeName(__atomic_load_n(&instr.insn->opcode, __ATOMIC_ACQUIRE));
+			if (instr.callee) {
+				s += " ";
+				s += instr.callee->thisClass()->name()->c_str();
+				s += ".";
+				s += instr.callee->name()->c_str();
+			}
+			break;
+		default:
+			break;
+	}
+
+	bool first = true;
+	for (const MOperand* operand: {&instr.a, &instr.b, &instr.c, &instr.d}) {
+		if (operand->isNone())
+			continue;
+		s += first ? " " : ", ";
+		s += operandString(*operand);
+		first = false;
+	}
+	for (size_t k = 0; k < instr.args.size(); ++k) {
+		s += first ? " " : ", ";
+		if (instr.op == MachineOp::Moves) {
+			snprintf(buf, sizeof(buf), "v%u <- ", instr.dsts[k]);
+			s += buf;
+		}
+		s += operandString(instr.args[k]);
+		first = false;
+	}
+
+	if (instr.op == MachineOp::Guard || instr.op == MachineOp::Deopt || instr.op == MachineOp::Call) {
+		snprintf(buf, sizeof(buf), " @s%u", instr.state);
+		s += buf;
+	}
+
+	switch (instr.op) {
+		case MachineOp::Jump:
+		case MachineOp::Branch:
+			for (size_t k = 0; k < block->successors.size(); ++k) {
+				snprintf(buf, sizeof(buf), "%s M%u", k ? "," : " ->", block->successors[k]->id);
+				s += buf;
+			}
+			break;
+		case MachineOp::Switch:
+			snprintf(buf, sizeof(buf), " -> default M%u", block->successors[0]->id);
+			s += buf;
+			for (size_t k = 0; k < instr.keys.size(); ++k) {
+				snprintf(buf, sizeof(buf), ", %d M%u", instr.keys[k], block->successors[k + 1]->id);
+				s += buf;
+			}
+			break;
+		default:
+			break;
+	}
+
+	return s;
+}
+
+std::string MachineFunction::to_s() const
+{
+	std::string s;
+	char buf[64];
+
+	s += method_->thisClass()->name()->c_str();
+	s += ".";
+	s += method_->name()->c_str();
+	s += method_->descriptor()->c_str();
+	s += "\n";
+
+	for (const MachineBlock* block: blocks_) {
+		snprintf(buf, sizeof(buf), "M%u", block->id);
+		s += buf;
+		for (size_t k = 0; k < block->predecessors.size(); ++k) {
+			snprintf(buf, sizeof(buf), "%s M%u", k ? "," : " <-", block->predecessors[k]->id);
+			s += buf;
+		}
+		if (block->isOsrEntry()) {
+			snprintf(buf, sizeof(buf), " (entry of loop %d)", block->osrLoop);
+			s += buf;
+		}
+		s += ":\n";
+
+		for (const MachineInstr& instr: block->instrs) {
+			s += "  ";
+			s += instrString(*this, block, instr);
+			s += "\n";
+		}
+	}
+
+	for (size_t id = 0; id < states_.size(); ++id) {
+		const MachineState& state = states_[id];
+		snprintf(buf, sizeof(buf), "s%zu: @%u", id, state.index);
+		s += buf;
+		for (const std::vector<MachineSlot>* slots: {&state.locals, &state.stack}) {
+			s += slots == &state.locals ? " locals [" : " stack [";
+			for (size_t k = 0; k < slots->size(); ++k) {
+				const MOperand& value = (*slots)[k].value;
+				if (k)
+					s += " ";
+				if (slots == &state.stack && state.framed >= 0 && (int32_t) k >= state.framed)
+					s += "frame";
+				else
+					s += value.isNone() ? "-" : operandString(value);
+			}
+			s += "]";
+		}
+		s += "\n";
+	}
+
+	return s;
+}
+
+void MachineFunction::dump() const
+{
+	printf("%s", to_s().c_str());
+}
+// }}}
@@ -0,0 +1,238 @@
+#pragma once
+
+#include "Arena.h"
+#include "Ir.h"
+#include "X86Assembler.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class Method;
+struct Instruction;
+
+//! Virtual register, numbering the values of a MachineFunction.
+typedef uint32_t VReg;
+
+static const VReg NoVReg = UINT32_MAX;
+
+// X(id, name)
+#define JVM_MACHINE_OPS(X) \
+	X(Mov,     "mov")      /* dst = a */ \
+	X(Local,   "local")    /* dst = local imm of the interpreter frame */ \
+	X(Stack,   "stack")    /* dst = operand stack slot imm of the interpreter frame */ \
+	X(Load,    "load")     /* dst = memory a */ \
+	X(Store,   "store")    /* memory a = b */ \
+	X(Lea,     "lea")      /* dst = address of memory a */ \
+	X(Add,     "add")      /* dst = a op b, for these and the ones down to Rem */ \
+	X(Sub,     "sub") \
+	X(Mul,     "mul") \
+	X(And,     "and") \
+	X(Or,      "or") \
+	X(Xor,     "xor") \
+	X(Shl,     "shl") \
+	X(Shr,     "shr") \
+	X(Sar,     "sar") \
+	X(Div,     "div")      /* Java's: rounding towards zero, MIN / -1 being MIN */ \
+	X(Rem,     "rem") \
+	X(Neg,     "neg")      /* dst = -a */ \
+	X(Convert, "convert")  /* dst = a converted by the bytecode opcode imm */ \
+	X(Cmp3,    "cmp3")     /* dst = -1, 0 or 1 as a is less than, equal to or greater than b */ \
+	X(Select,  "select")   /* dst = a cond b ? c : d */ \
+	X(Guard,   "guard")    /* traps to state if a cond b */ \
+	X(Call,    "call")     /* runs insn via the interpreter on args, dst = its result */ \
+	X(Deopt,   "deopt")    /* traps to state */ \
+	X(Moves,   "moves")    /* dsts = args, all at once */ \
+	X(Jump,    "jump")     /* to successor 0 */ \
+	X(Branch,  "branch")   /* to successor 0 if a cond b, else 1 */ \
+	X(Switch,  "switch")   /* to the successor after the default one whose key a equals, else 0 */ \
+	X(Return,  "return")   /* returns a, if any */
+
+enum class MachineOp : uint8_t {
+#define X(id, name) id,
+	JVM_MACHINE_OPS(X)
+#undef X
+};
+
+const char* machineOpName(MachineOp op);
+
+//! Memory accesses of Load and Store, by width and how loads extend.
+enum class MachineAccess : uint8_t { U8, S8, U16, S16, I32, I64 };
+
+/**
+ * Operand of a machine instruction: a virtual register, an immediate, or
+ * memory at [reg + index * scale + imm].
+ */
+struct MOperand {
+	enum class Kind : uint8_t { None, VReg, Imm, Mem };
+
+	Kind kind;
+	uint8_t scale;   //!< of Mem's index, 0 without one
+	VReg reg;        //!< VReg, or base of Mem
+	VReg index;
+	int64_t imm;     //!< Imm, or displacement of Mem
+
+	static MOperand none() { return {Kind::None, 0, NoVReg, NoVReg, 0}; }
+	static MOperand vreg(VReg reg) { return {Kind::VReg, 0, reg, NoVReg, 0}; }
+	static MOperand immediate(int64_t imm) { return {Kind::Imm, 0, NoVReg, NoVReg, imm}; }
+	static MOperand memory(VReg base, int32_t disp) { return {Kind::Mem, 0, base, NoVReg, disp}; }
+	static MOperand memory(VReg base, VReg index, uint8_t scale, int32_t disp) {
+		return {Kind::Mem, scale, base, index, disp};
+	}
+
+	bool isNone() const { return kind == Kind::None; }
+	bool isVReg() const { return kind == Kind::VReg; }
+	bool isImm() const { return kind == Kind::Imm; }
+	bool isMem() const { return kind == Kind::Mem; }
+};
+
+struct MachineInstr {
+	MachineOp op;
+	IrType type;              //!< of the operation: Int takes 32 bits, Long and Ref 64
+	Cond cond;                //!< of Select, Guard and Branch
+	MachineAccess access;     //!< of Load and Store
+	VReg dst;
+	MOperand a, b, c, d;
+	int64_t imm;              //!< slot of Local and Stack, opcode of Convert
+	uint32_t state;           //!< of Guard, Deopt and Call: the MachineState before it
+	const Instruction* insn;  //!< of Call
+	Method* callee;           //!< of Call: the only target of the invoke it runs, or \p nullptr
+	std::vector<MOperand> args;   //!< of Call: its operands, bottom first; of Moves: the sources
+	std::vector<IrType> types;    //!< of Call: of args
+	std::vector<VReg> dsts;       //!< of Moves
+	std::vector<int32_t> keys;    //!< of Switch: per successor after the default one
+
+	MachineInstr(MachineOp op, IrType type) :
+		op(op), type(type), cond(Cond::e), access(MachineAccess::I64), dst(NoVReg),
+		a(MOperand::none()), b(MOperand::none()), c(MOperand::none()), d(MOperand::none()),
+		imm(0), state(0), insn(nullptr), callee(nullptr), args(), types(), dsts(), keys() {}
+
+	bool isWide() const { return type != IrType::Int; }
+
+	//! Whether it calls into the runtime, which clobbers caller-saved registers.
+	bool isCall() const { return op == MachineOp::Call; }
+
+	//! Calls \p f on each virtual register it reads.
+	template<typename F>
+	void forEachUse(F f) const {
+		for (const MOperand* operand: {&a, &b, &c, &d})
+			use(*operand, f);
+		for (const MOperand& operand: args)
+			use(operand, f);
+	}
+
+	//! Calls \p f on each virtual register it writes.
+	template<typename F>
+	void forEachDef(F f) const {
+		if (dst != NoVReg)
+			f(dst);
+		for (VReg reg: dsts)
+			f(reg);
+	}
+
+private:
+	template<typename F>
+	static void use(const MOperand& operand, F f) {
+		if (operand.isVReg() || operand.isMem())
+			f(operand.reg);
+		if (operand.isMem() && operand.scale)
+			f(operand.index);
+	}
+};
+
+//! The value of a slot in a MachineState: a virtual register, a constant, or none if dead.
+struct MachineSlot {
+	IrType type;
+	MOperand value;
+};
+
+/**
+ * An interpreter frame state that machine code deoptimizes to, in terms
+ * of virtual registers (see IrFrameState).
+ */
+struct MachineState {
+	uint32_t index;                  //!< instruction to continue at
+	uint32_t trap;                   //!< instruction that trapped
+	std::vector<MachineSlot> locals;
+	std::vector<MachineSlot> stack;
+	int32_t framed;                  //!< first operand stack slot kept in the interpreter frame by a call, or -1
+
+	MachineState() : index(0), trap(0), locals(), stack(), framed(-1) {}
+};
+
+struct MachineBlock {
+	uint32_t id;
+	std::vector<MachineInstr> instrs;
+	std::vector<MachineBlock*> successors;     //!< Branch: taken, not taken; Switch: the default first
+	std::vector<MachineBlock*> predecessors;
+	uint32_t loopDepth;
+	int32_t osrLoop;                           //!< QuickCode loop it enters the code at, or -1
+
+	MachineBlock(uint32_t id, uint32_t loopDepth) :
+		id(id), instrs(), successors(), predecessors(), loopDepth(loopDepth), osrLoop(-1) {}
+
+	bool isOsrEntry() const { return osrLoop >= 0; }
+};
+
+/**
+ * A method lowered to x86-64 instructions on virtual registers, in the
+ * order that the code is to be laid out: instruction selection's result,
+ * and the register allocator's input (see LinearScan).
+ *
+ * Besides the method entry, which is the first block, blocks without
+ * predecessors are entries at loop headers (see CompiledMethod::osrEntry()).
+ */
+class MachineFunction {
+private:
+	Arena arena_;
+	Method* method_;
+	std::vector<MachineBlock*> blocks_;   //!< in layout order
+	std::vector<IrType> vregs_;           //!< by number
+	std::vector<MachineState> states_;
+	uint32_t nextBlock_;
+
+public:
+	explicit MachineFunction(Method* method) :
+		arena_(), method_(method), blocks_(), vregs_(), states_(), nextBlock_(0) {}
+
+	MachineFunction(const MachineFunction&) = delete;
+	MachineFunction& operator=(const MachineFunction&) = delete;
+
+	Method* method() const { return method_; }
+
+	const std::vector<MachineBlock*>& blocks() const { return blocks_; }
+	std::vector<MachineBlock*>& blocks() { return blocks_; }
+
+	//! New block, yet to be placed into the layout.
+	MachineBlock* newBlock(uint32_t loopDepth) { return arena_.construct<MachineBlock>(nextBlock_++, loopDepth); }
+
+	static void addEdge(MachineBlock* from, MachineBlock* to) {
+		from->successors.push_back(to);
+		to->predecessors.push_back(from);
+	}
+
+	VReg newVReg(IrType type) { vregs_.push_back(type); return vregs_.size() - 1; }
+	IrType typeOf(VReg reg) const { return vregs_[reg]; }
+	uint32_t vregCount() const { return vregs_.size(); }
+
+	uint32_t addState(MachineState&& state) { states_.push_back(std::move(state)); return states_.size() - 1; }
+	const MachineState& state(uint32_t id) const { return states_[id]; }
+	const std::vector<MachineState>& states() const { return states_; }
+
+	//! Calls \p f on each virtual register that state \p id refers to.
+	template<typename F>
+	void forEachStateUse(uint32_t id, F f) const {
+		const MachineState& s = states_[id];
+		for (const std::vector<MachineSlot>* slots: {&s.locals, &s.stack})
+			for (const MachineSlot& slot: *slots)
+				if (slot.value.isVReg())
+					f(slot.value.reg);
+	}
+
+	//! Block ids are below.
+	uint32_t blockCount() const { return nextBlock_; }
+
+	//! Textual form, one instruction per line.
+	std::string to_s() const;
+	void dump() const;
+};
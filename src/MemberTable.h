@@ -0,0 +1,60 @@
+#pragma once
+
+#include "Arena.h"
+#include "Symbol.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/**
+ * Immutable hash table of the fields or methods declared by a class,
+ * keyed by name and descriptor symbol.
+ *
+ * Probes only compare symbol pointers.
+ */
+template<typename T>
+class MemberTable {
+private:
+	T** slots_;
+	size_t mask_;
+
+public:
+	MemberTable() : slots_(nullptr), mask_(0) {}
+
+	bool empty() const { return slots_ == nullptr; }
+
+	//! Builds the table from \p members, allocating it from \p arena.
+	void build(Arena& arena, const std::vector<T*>& members) {
+		size_t capacity = 4;
+		while (capacity < members.size() * 2)
+			capacity *= 2;
+
+		slots_ = arena.allocateArray<T*>(capacity);
+		mask_ = capacity - 1;
+		for (size_t i = 0; i < capacity; ++i)
+			slots_[i] = nullptr;
+
+		for (T* member: members) {
+			size_t i = hash(member->name(), member->descriptor()) & mask_;
+			while (slots_[i])
+				i = (i + 1) & mask_;
+			slots_[i] = member;
+		}
+	}
+
+	T* find(const Symbol* name, const Symbol* descriptor) const {
+		if (!slots_)
+			return nullptr;
+
+		for (size_t i = hash(name, descriptor) & mask_; ; i = (i + 1) & mask_) {
+			T* member = slots_[i];
+			if (!member || (member->name() == name && member->descriptor() == descriptor))
+				return member;
+		}
+	}
+
+private:
+	static size_t hash(const Symbol* name, const Symbol* descriptor) {
+		return name->hash() * 31 + descriptor->hash();
+	}
+};
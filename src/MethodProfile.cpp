@@ -0,0 +1,57 @@
+#include "MethodProfile.h"
+#include "QuickCode.h"
+#include "Class.h"
+
+#include <stdio.h>
+
+static bool isConditionalBranch(uint8_t opcode)
+{
+	return (opcode >= (uint8_t) Opcode::ifeq && opcode <= (uint8_t) Opcode::if_acmpne)
+		|| opcode == (uint8_t) Opcode::ifnull
+		|| opcode == (uint8_t) Opcode::ifnonnull;
+}
+
+void MethodProfile::dump() const
+{
+	printf("profile of %s.%s%s: invocations=%u backedges=%u%s\n",
+		method_->thisClass()->name()->c_str(), method_->name()->c_str(), method_->descriptor()->c_str(),
+		invocations_, backedges_, isHot() ? " hot" : "");
+
+	const QuickCode* quick = method_->quickCode();
+	for (uint32_t i = 0; i < quick->size(); ++i) {
+		const Instruction& insn = quick->instructions()[i];
+		uint8_t opcode = __atomic_load_n(&insn.opcode, __ATOMIC_RELAXED);
+		bool isBranch = isConditionalBranch(opcode);
+		bool isCall = opcode == (uint8_t) Opcode::invokevirtual || opcode == (uint8_t) Opcode::invokeinterface
+			|| (opcode >= (uint8_t) Opcode::invokevirtual_mono && opcode <= (uint8_t) Opcode::invokevirtual_mega)
+			|| (opcode >= (uint8_t) Opcode::invokeinterface_mono && opcode <= (uint8_t) Opcode::invokeinterface_mega);
+
+		if (!isBranch && !isCall)
+			continue;
+
+		uint32_t offset = quick->offsetOf(&insn);
+		int line = method_->lineNumber(offset);
+		printf("  @%-5u", offset);
+		if (line >= 0)
+			printf(" line %-5d", line);
+		else
+			printf("           ");
+		printf(" %-22s", opcodeName(opcode));
+
+		if (isBranch) {
+			const BranchProfile& branch = insn.resolved.branch;
+			uint64_t total = (uint64_t) branch.taken + branch.notTaken;
+			printf(" taken=%u not-taken=%u", branch.taken, branch.notTaken);
+			if (total)
+				printf(" (%.1f%% taken)", 100.0 * branch.taken / total);
+		} else {
+			const CallSite* site = quick->callSite(insn.operand);
+			printf(" misses=%u", site->misses);
+			for (uint32_t k = 0; k < site->size; ++k) {
+				const CallSite::Entry& entry = site->entries[k];
+				printf(" %s=%u", entry.receiver ? entry.receiver->name()->c_str() : "[]", entry.count);
+			}
+		}
+		printf("\n");
+	}
+}
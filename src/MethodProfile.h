@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Method;
+
+/**
+ * Execution profile of a method, for tiered compilation to pick hot
+ * methods and to lay out and specialize their code.
+ *
+ * Counts invocations and loop back edges, i.e. taken branches to an
+ * earlier instruction. The outcomes of conditional branches are counted
+ * in their quickened instructions (see BranchProfile), and the receiver
+ * classes of invokevirtual and invokeinterface by their inline caches (see
+ * CallSite).
+ *
+ * Allocated along with the method's QuickCode, i.e. on its first
+ * invocation, so methods that never run have none. The interpreters of
+ * all threads count without synchronization: increments may get lost
+ * under contention, and counters saturate instead of wrapping around.
+ */
+class MethodProfile {
+private:
+	friend class QuickCode;
+
+	Method* method_;
+	uint32_t invocations_;
+	uint32_t backedges_;
+	bool hot_;
+
+	explicit MethodProfile(Method* method) :
+		method_(method), invocations_(0), backedges_(0), hot_(false) {}
+
+public:
+	Method* method() const { return method_; }
+
+	uint32_t invocations() const { return invocations_; }
+	uint32_t backedges() const { return backedges_; }
+
+	//! Sum of invocations and back edges, which the hot threshold applies to.
+	uint64_t temperature() const { return (uint64_t) invocations_ + backedges_; }
+
+	//! Counts an invocation, returning the new temperature().
+	uint64_t invoked() { count(&invocations_); return temperature(); }
+
+	//! Counts a back edge, returning the new temperature().
+	uint64_t backedge() { count(&backedges_); return temperature(); }
+
+	//! Whether the method has crossed a hot threshold.
+	bool isHot() const { return __atomic_load_n(&hot_, __ATOMIC_RELAXED); }
+
+	//! Marks the method hot, returning false if it already was.
+	bool markHot() { return !__atomic_exchange_n(&hot_, true, __ATOMIC_RELAXED); }
+
+	//! Counts invocations and back edges anew, for the method to turn hot again.
+	void reset() {
+		__atomic_store_n(&invocations_, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&backedges_, 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&hot_, false, __ATOMIC_RELAXED);
+	}
+
+	/**
+	 * Prints the counters, along with the branch and receiver profiles by
+	 * their location in the bytecode.
+	 */
+	void dump() const;
+
+	static void count(uint32_t* counter) {
+		uint32_t value = __atomic_load_n(counter, __ATOMIC_RELAXED);
+		if (value != UINT32_MAX)
+			__atomic_store_n(counter, value + 1, __ATOMIC_RELAXED);
+	}
+};
+
+/**
+ * Outcomes of a conditional branch.
+ *
+ * Kept in the branch instruction itself, which the interpreter has at hand
+ * anyway, rather than in a side table of the MethodProfile.
+ */
+struct BranchProfile {
+	uint32_t taken;
+	uint32_t notTaken;
+
+	void branched(bool taken) { MethodProfile::count(taken ? &this->taken : &notTaken); }
+};
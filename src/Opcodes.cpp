@@ -0,0 +1,26 @@
+#include "Opcodes.h"
+
+static const char* const opcodeNames[QuickOpcodeEnd] = {
+#define X(id, name, opcode, length) name,
+	JVM_OPCODES(X)
+#undef X
+#define X(id, name, opcode) name,
+	JVM_QUICK_OPCODES(X)
+#undef X
+};
+
+static const uint8_t opcodeLengths[OpcodeCount] = {
+#define X(id, name, opcode, length) length,
+	JVM_OPCODES(X)
+#undef X
+};
+
+const char* opcodeName(uint8_t opcode)
+{
+	return opcode < QuickOpcodeEnd ? opcodeNames[opcode] : nullptr;
+}
+
+size_t opcodeLength(uint8_t opcode)
+{
+	return opcode < OpcodeCount ? opcodeLengths[opcode] : 0;
+}
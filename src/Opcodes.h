@@ -0,0 +1,289 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * The JVM instruction set (JVMS 6.5), in opcode order.
+ *
+ * X(id, name, opcode, length), where \p length is the size of the
+ * instruction including its operands, or 0 if variable (the switches and
+ * wide). Identifiers that are C++ keywords get a trailing underscore.
+ */
+#define JVM_OPCODES(X) \
+	X(nop,             "nop",             0x00, 1) \
+	X(aconst_null,     "aconst_null",     0x01, 1) \
+	X(iconst_m1,       "iconst_m1",       0x02, 1) \
+	X(iconst_0,        "iconst_0",        0x03, 1) \
+	X(iconst_1,        "iconst_1",        0x04, 1) \
+	X(iconst_2,        "iconst_2",        0x05, 1) \
+	X(iconst_3,        "iconst_3",        0x06, 1) \
+	X(iconst_4,        "iconst_4",        0x07, 1) \
+	X(iconst_5,        "iconst_5",        0x08, 1) \
+	X(lconst_0,        "lconst_0",        0x09, 1) \
+	X(lconst_1,        "lconst_1",        0x0a, 1) \
+	X(fconst_0,        "fconst_0",        0x0b, 1) \
+	X(fconst_1,        "fconst_1",        0x0c, 1) \
+	X(fconst_2,        "fconst_2",        0x0d, 1) \
+	X(dconst_0,        "dconst_0",        0x0e, 1) \
+	X(dconst_1,        "dconst_1",        0x0f, 1) \
+	X(bipush,          "bipush",          0x10, 2) \
+	X(sipush,          "sipush",          0x11, 3) \
+	X(ldc,             "ldc",             0x12, 2) \
+	X(ldc_w,           "ldc_w",           0x13, 3) \
+	X(ldc2_w,          "ldc2_w",          0x14, 3) \
+	X(iload,           "iload",           0x15, 2) \
+	X(lload,           "lload",           0x16, 2) \
+	X(fload,           "fload",           0x17, 2) \
+	X(dload,           "dload",           0x18, 2) \
+	X(aload,           "aload",           0x19, 2) \
+	X(iload_0,         "iload_0",         0x1a, 1) \
+	X(iload_1,         "iload_1",         0x1b, 1) \
+	X(iload_2,         "iload_2",         0x1c, 1) \
+	X(iload_3,         "iload_3",         0x1d, 1) \
+	X(lload_0,         "lload_0",         0x1e, 1) \
+	X(lload_1,         "lload_1",         0x1f, 1) \
+	X(lload_2,         "lload_2",         0x20, 1) \
+	X(lload_3,         "lload_3",         0x21, 1) \
+	X(fload_0,         "fload_0",         0x22, 1) \
+	X(fload_1,         "fload_1",         0x23, 1) \
+	X(fload_2,         "fload_2",         0x24, 1) \
+	X(fload_3,         "fload_3",         0x25, 1) \
+	X(dload_0,         "dload_0",         0x26, 1) \
+	X(dload_1,         "dload_1",         0x27, 1) \
+	X(dload_2,         "dload_2",         0x28, 1) \
+	X(dload_3,         "dload_3",         0x29, 1) \
+	X(aload_0,         "aload_0",         0x2a, 1) \
+	X(aload_1,         "aload_1",         0x2b, 1) \
+	X(aload_2,         "aload_2",         0x2c, 1) \
+	X(aload_3,         "aload_3",         0x2d, 1) \
+	X(iaload,          "iaload",          0x2e, 1) \
+	X(laload,          "laload",          0x2f, 1) \
+	X(faload,          "faload",          0x30, 1) \
+	X(daload,          "daload",          0x31, 1) \
+	X(aaload,          "aaload",          0x32, 1) \
+	X(baload,          "baload",          0x33, 1) \
+	X(caload,          "caload",          0x34, 1) \
+	X(saload,          "saload",          0x35, 1) \
+	X(istore,          "istore",          0x36, 2) \
+	X(lstore,          "lstore",          0x37, 2) \
+	X(fstore,          "fstore",          0x38, 2) \
+	X(dstore,          "dstore",          0x39, 2) \
+	X(astore,          "astore",          0x3a, 2) \
+	X(istore_0,        "istore_0",        0x3b, 1) \
+	X(istore_1,        "istore_1",        0x3c, 1) \
+	X(istore_2,        "istore_2",        0x3d, 1) \
+	X(istore_3,        "istore_3",        0x3e, 1) \
+	X(lstore_0,        "lstore_0",        0x3f, 1) \
+	X(lstore_1,        "lstore_1",        0x40, 1) \
+	X(lstore_2,        "lstore_2",        0x41, 1) \
+	X(lstore_3,        "lstore_3",        0x42, 1) \
+	X(fstore_0,        "fstore_0",        0x43, 1) \
+	X(fstore_1,        "fstore_1",        0x44, 1) \
+	X(fstore_2,        "fstore_2",        0x45, 1) \
+	X(fstore_3,        "fstore_3",        0x46, 1) \
+	X(dstore_0,        "dstore_0",        0x47, 1) \
+	X(dstore_1,        "dstore_1",        0x48, 1) \
+	X(dstore_2,        "dstore_2",        0x49, 1) \
+	X(dstore_3,        "dstore_3",        0x4a, 1) \
+	X(astore_0,        "astore_0",        0x4b, 1) \
+	X(astore_1,        "astore_1",        0x4c, 1) \
+	X(astore_2,        "astore_2",        0x4d, 1) \
+	X(astore_3,        "astore_3",        0x4e, 1) \
+	X(iastore,         "iastore",         0x4f, 1) \
+	X(lastore,         "lastore",         0x50, 1) \
+	X(fastore,         "fastore",         0x51, 1) \
+	X(dastore,         "dastore",         0x52, 1) \
+	X(aastore,         "aastore",         0x53, 1) \
+	X(bastore,         "bastore",         0x54, 1) \
+	X(castore,         "castore",         0x55, 1) \
+	X(sastore,         "sastore",         0x56, 1) \
+	X(pop,             "pop",             0x57, 1) \
+	X(pop2,            "pop2",            0x58, 1) \
+	X(dup,             "dup",             0x59, 1) \
+	X(dup_x1,          "dup_x1",          0x5a, 1) \
+	X(dup_x2,          "dup_x2",          0x5b, 1) \
+	X(dup2,            "dup2",            0x5c, 1) \
+	X(dup2_x1,         "dup2_x1",         0x5d, 1) \
+	X(dup2_x2,         "dup2_x2",         0x5e, 1) \
+	X(swap,            "swap",            0x5f, 1) \
+	X(iadd,            "iadd",            0x60, 1) \
+	X(ladd,            "ladd",            0x61, 1) \
+	X(fadd,            "fadd",            0x62, 1) \
+	X(dadd,            "dadd",            0x63, 1) \
+	X(isub,            "isub",            0x64, 1) \
+	X(lsub,            "lsub",            0x65, 1) \
+	X(fsub,            "fsub",            0x66, 1) \
+	X(dsub,            "dsub",            0x67, 1) \
+	X(imul,            "imul",            0x68, 1) \
+	X(lmul,            "lmul",            0x69, 1) \
+	X(fmul,            "fmul",            0x6a, 1) \
+	X(dmul,            "dmul",            0x6b, 1) \
+	X(idiv,            "idiv",            0x6c, 1) \
+	X(ldiv,            "ldiv",            0x6d, 1) \
+	X(fdiv,            "fdiv",            0x6e, 1) \
+	X(ddiv,            "ddiv",            0x6f, 1) \
+	X(irem,            "irem",            0x70, 1) \
+	X(lrem,            "lrem",            0x71, 1) \
+	X(frem,            "frem",            0x72, 1) \
+	X(drem,            "drem",            0x73, 1) \
+	X(ineg,            "ineg",            0x74, 1) \
+	X(lneg,            "lneg",            0x75, 1) \
+	X(fneg,            "fneg",            0x76, 1) \
+	X(dneg,            "dneg",            0x77, 1) \
+	X(ishl,            "ishl",            0x78, 1) \
+	X(lshl,            "lshl",            0x79, 1) \
+	X(ishr,            "ishr",            0x7a, 1) \
+	X(lshr,            "lshr",            0x7b, 1) \
+	X(iushr,           "iushr",           0x7c, 1) \
+	X(lushr,           "lushr",           0x7d, 1) \
+	X(iand,            "iand",            0x7e, 1) \
+	X(land,            "land",            0x7f, 1) \
+	X(ior,             "ior",             0x80, 1) \
+	X(lor,             "lor",             0x81, 1) \
+	X(ixor,            "ixor",            0x82, 1) \
+	X(lxor,            "lxor",            0x83, 1) \
+	X(iinc,            "iinc",            0x84, 3) \
+	X(i2l,             "i2l",             0x85, 1) \
+	X(i2f,             "i2f",             0x86, 1) \
+	X(i2d,             "i2d",             0x87, 1) \
+	X(l2i,             "l2i",             0x88, 1) \
+	X(l2f,             "l2f",             0x89, 1) \
+	X(l2d,             "l2d",             0x8a, 1) \
+	X(f2i,             "f2i",             0x8b, 1) \
+	X(f2l,             "f2l",             0x8c, 1) \
+	X(f2d,             "f2d",             0x8d, 1) \
+	X(d2i,             "d2i",             0x8e, 1) \
+	X(d2l,             "d2l",             0x8f, 1) \
+	X(d2f,             "d2f",             0x90, 1) \
+	X(i2b,             "i2b",             0x91, 1) \
+	X(i2c,             "i2c",             0x92, 1) \
+	X(i2s,             "i2s",             0x93, 1) \
+	X(lcmp,            "lcmp",            0x94, 1) \
+	X(fcmpl,           "fcmpl",           0x95, 1) \
+	X(fcmpg,           "fcmpg",           0x96, 1) \
+	X(dcmpl,           "dcmpl",           0x97, 1) \
+	X(dcmpg,           "dcmpg",           0x98, 1) \
+	X(ifeq,            "ifeq",            0x99, 3) \
+	X(ifne,            "ifne",            0x9a, 3) \
+	X(iflt,            "iflt",            0x9b, 3) \
+	X(ifge,            "ifge",            0x9c, 3) \
+	X(ifgt,            "ifgt",            0x9d, 3) \
+	X(ifle,            "ifle",            0x9e, 3) \
+	X(if_icmpeq,       "if_icmpeq",       0x9f, 3) \
+	X(if_icmpne,       "if_icmpne",       0xa0, 3) \
+	X(if_icmplt,       "if_icmplt",       0xa1, 3) \
+	X(if_icmpge,       "if_icmpge",       0xa2, 3) \
+	X(if_icmpgt,       "if_icmpgt",       0xa3, 3) \
+	X(if_icmple,       "if_icmple",       0xa4, 3) \
+	X(if_acmpeq,       "if_acmpeq",       0xa5, 3) \
+	X(if_acmpne,       "if_acmpne",       0xa6, 3) \
+	X(goto_,           "goto",            0xa7, 3) \
+	X(jsr,             "jsr",             0xa8, 3) \
+	X(ret,             "ret",             0xa9, 2) \
+	X(tableswitch,     "tableswitch",     0xaa, 0) \
+	X(lookupswitch,    "lookupswitch",    0xab, 0) \
+	X(ireturn,         "ireturn",         0xac, 1) \
+	X(lreturn,         "lreturn",         0xad, 1) \
+	X(freturn,         "freturn",         0xae, 1) \
+	X(dreturn,         "dreturn",         0xaf, 1) \
+	X(areturn,         "areturn",         0xb0, 1) \
+	X(return_,         "return",          0xb1, 1) \
+	X(getstatic,       "getstatic",       0xb2, 3) \
+	X(putstatic,       "putstatic",       0xb3, 3) \
+	X(getfield,        "getfield",        0xb4, 3) \
+	X(putfield,        "putfield",        0xb5, 3) \
+	X(invokevirtual,   "invokevirtual",   0xb6, 3) \
+	X(invokespecial,   "invokespecial",   0xb7, 3) \
+	X(invokestatic,    "invokestatic",    0xb8, 3) \
+	X(invokeinterface, "invokeinterface", 0xb9, 5) \
+	X(invokedynamic,   "invokedynamic",   0xba, 5) \
+	X(new_,            "new",             0xbb, 3) \
+	X(newarray,        "newarray",        0xbc, 2) \
+	X(anewarray,       "anewarray",       0xbd, 3) \
+	X(arraylength,     "arraylength",     0xbe, 1) \
+	X(athrow,          "athrow",          0xbf, 1) \
+	X(checkcast,       "checkcast",       0xc0, 3) \
+	X(instanceof,      "instanceof",      0xc1, 3) \
+	X(monitorenter,    "monitorenter",    0xc2, 1) \
+	X(monitorexit,     "monitorexit",     0xc3, 1) \
+	X(wide,            "wide",            0xc4, 0) \
+	X(multianewarray,  "multianewarray",  0xc5, 4) \
+	X(ifnull,          "ifnull",          0xc6, 3) \
+	X(ifnonnull,       "ifnonnull",       0xc7, 3) \
+	X(goto_w,          "goto_w",          0xc8, 5) \
+	X(jsr_w,           "jsr_w",           0xc9, 5)
+
+/**
+ * Internal opcodes of quickened code (see QuickCode.h), using the range
+ * the JVMS leaves unassigned.
+ *
+ * X(id, name, opcode). Each replaces a JVM instruction once its constant
+ * pool operand is resolved, or a constant load whose value is known at
+ * translation time. The field variants are by storage size and
+ * signedness: z (boolean), b (byte), c (char), s (short), i (int, float),
+ * j (long, double) and a (references). Stores to char and short fields
+ * share the s variant. The invokevirtual and invokeinterface variants are
+ * by the state of their inline cache (see CallSite).
+ */
+#define JVM_QUICK_OPCODES(X) \
+	X(ldc_int,               "ldc_int",               0xca) \
+	X(ldc_quick,             "ldc_quick",             0xcb) \
+	X(getfield_z,            "getfield_z",            0xcc) \
+	X(getfield_b,            "getfield_b",            0xcd) \
+	X(getfield_c,            "getfield_c",            0xce) \
+	X(getfield_s,            "getfield_s",            0xcf) \
+	X(getfield_i,            "getfield_i",            0xd0) \
+	X(getfield_j,            "getfield_j",            0xd1) \
+	X(getfield_a,            "getfield_a",            0xd2) \
+	X(putfield_z,            "putfield_z",            0xd3) \
+	X(putfield_b,            "putfield_b",            0xd4) \
+	X(putfield_s,            "putfield_s",            0xd5) \
+	X(putfield_i,            "putfield_i",            0xd6) \
+	X(putfield_j,            "putfield_j",            0xd7) \
+	X(putfield_a,            "putfield_a",            0xd8) \
+	X(getstatic_z,           "getstatic_z",           0xd9) \
+	X(getstatic_b,           "getstatic_b",           0xda) \
+	X(getstatic_c,           "getstatic_c",           0xdb) \
+	X(getstatic_s,           "getstatic_s",           0xdc) \
+	X(getstatic_i,           "getstatic_i",           0xdd) \
+	X(getstatic_j,           "getstatic_j",           0xde) \
+	X(getstatic_a,           "getstatic_a",           0xdf) \
+	X(putstatic_z,           "putstatic_z",           0xe0) \
+	X(putstatic_b,           "putstatic_b",           0xe1) \
+	X(putstatic_s,           "putstatic_s",           0xe2) \
+	X(putstatic_i,           "putstatic_i",           0xe3) \
+	X(putstatic_j,           "putstatic_j",           0xe4) \
+	X(putstatic_a,           "putstatic_a",           0xe5) \
+	X(invokevirtual_mono,    "invokevirtual_mono",    0xe6) \
+	X(invokevirtual_poly,    "invokevirtual_poly",    0xe7) \
+	X(invokevirtual_mega,    "invokevirtual_mega",    0xe8) \
+	X(invokespecial_quick,   "invokespecial_quick",   0xe9) \
+	X(invokestatic_quick,    "invokestatic_quick",    0xea) \
+	X(invokeinterface_mono,  "invokeinterface_mono",  0xeb) \
+	X(invokeinterface_poly,  "invokeinterface_poly",  0xec) \
+	X(invokeinterface_mega,  "invokeinterface_mega",  0xed) \
+	X(new_quick,             "new_quick",             0xee) \
+	X(checkcast_quick,       "checkcast_quick",       0xef) \
+	X(instanceof_quick,      "instanceof_quick",      0xf0)
+
+enum class Opcode : uint8_t {
+#define X(id, name, opcode, length) id = opcode,
+	JVM_OPCODES(X)
+#undef X
+#define X(id, name, opcode) id = opcode,
+	JVM_QUICK_OPCODES(X)
+#undef X
+};
+
+//! Number of JVM opcodes, all of them below this value.
+static const size_t OpcodeCount = 0xca;
+
+//! End of the quick opcodes, which start at OpcodeCount.
+static const size_t QuickOpcodeEnd = 0xf1;
+
+//! Mnemonic of given JVM or quick opcode, or \p nullptr for undefined ones.
+const char* opcodeName(uint8_t opcode);
+
+//! Fixed instruction length of given opcode, or 0 if variable or undefined.
+size_t opcodeLength(uint8_t opcode);
@@ -0,0 +1,2086 @@
+#include "OptimizingCompiler.h"
+#include "BaselineCompiler.h"
+#include "Class.h"
+#include "ClassHierarchy.h"
+#include "CodeCache.h"
+#include "CompiledMethod.h"
+#include "Interpreter.h"
+#include "Ir.h"
+#include "IrPasses.h"
+#include "JObject.h"
+#include "LinearScan.h"
+#include "MachineIr.h"
+#include "Opcodes.h"
+#include "QuickCode.h"
+#include "Symbol.h"
+#include "VMClassLoader.h"
+#include "X86Assembler.h"
+#include "X86Templates.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <utility>
+
+static IrValue* resolve(IrValue* value)
+{
+	while (value->op == IrOp::Copy)
+		value = value->operands[0];
+	return value;
+}
+
+static int slotsOf(IrType type)
+{
+	return type == IrType::Long || type == IrType::Double ? 2 : 1;
+}
+
+static Opcode quickenedOpcode(const Instruction* insn)
+{
+	return (Opcode) __atomic_load_n(&insn->opcode, __ATOMIC_ACQUIRE);
+}
+
+//! Condition with the operands swapped.
+static Cond mirror(Cond cc)
+{
+	switch (cc) {
+		case Cond::l: return Cond::g;
+		case Cond::g: return Cond::l;
+		case Cond::le: return Cond::ge;
+		case Cond::ge: return Cond::le;
+		case Cond::b: return Cond::a;
+		case Cond::a: return Cond::b;
+		case Cond::be: return Cond::ae;
+		case Cond::ae: return Cond::be;
+		default: return cc;
+	}
+}
+
+static bool isInt32(int64_t v)
+{
+	return v >= INT32_MIN && v <= INT32_MAX;
+}
+
+//! k if \p v is 2^k, with 0 < k <= 30, or 0.
+static int powerOfTwo(int64_t v)
+{
+	if (v < 2 || v > (1 << 30) || (v & (v - 1)))
+		return 0;
+	int k = 0;
+	while ((v >> k) != 1)
+		++k;
+	return k;
+}
+
+// {{{ instruction selection
+namespace {
+
+class Selector {
+private:
+	IrGraph& graph_;
+	QuickCode* quick_;
+	MachineFunction& function_;
+	const ClassHierarchy* hierarchy_;         //!< devirtualizing calls, if any
+	std::vector<Dependency>& dependencies_;
+
+	std::vector<IrBlock*> order_;            //!< blocks reachable without exceptions, in reverse postorder
+	std::vector<MachineBlock*> blocks_;      //!< by IR block id, \p nullptr for the others
+	std::vector<bool> skipped_;              //!< arms of diamonds turned into selects, by IR block id
+	std::vector<VReg> vregs_;                //!< by IR value id
+	std::vector<IrValue*> values_;           //!< by virtual register, \p nullptr for temporaries
+	std::vector<uint32_t> uses_;             //!< as an operand, by IR value id
+	std::vector<bool> stated_;               //!< in some frame state, by IR value id
+	std::vector<bool> present_;              //!< in a selected block, by IR value id
+	std::vector<bool> folded_;               //!< loads folded into their user, and lcmps into their branch
+	std::vector<std::vector<const IrBlock*>> checked_;  //!< blocks checking a value against null or zero, by IR value id
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<const IrBlock*>> boundsChecked_;  //!< by array and index id
+	std::vector<MachineBlock*> edges_;       //!< split critical edges of the current block
+	MachineBlock* current_;
+	const IrBlock* block_;
+	bool checks_;                            //!< off while recomputing values at loop entries
+	bool failed_;
+	const char* failure_;                    //!< why, the first reason only
+
+public:
+	Selector(IrGraph& graph, MachineFunction& function, const ClassHierarchy* hierarchy,
+	         std::vector<Dependency>& dependencies) :
+		graph_(graph), quick_(graph.quick()), function_(function), hierarchy_(hierarchy), dependencies_(dependencies),
+		order_(), blocks_(graph.blockCount(), nullptr), skipped_(graph.blockCount(), false),
+		vregs_(graph.valueCount(), NoVReg), values_(), uses_(graph.valueCount(), 0),
+		stated_(graph.valueCount(), false), present_(graph.valueCount(), false), folded_(graph.valueCount(), false),
+		checked_(graph.valueCount()), boundsChecked_(), edges_(), current_(nullptr), block_(nullptr),
+		checks_(true), failed_(false), failure_(nullptr)
+	{}
+
+	//! Lowers the graph, whose dominators are computed; false if it uses what the compiler does not support.
+	bool run();
+
+	//! What the compiler does not support, once run() failed.
+	const char* failure() const { return failure_; }
+
+private:
+	bool prepare();
+	void fold(IrBlock* block);
+	void addLoopEntries();
+	bool define(VReg reg, const IrFrameState* state, std::vector<bool>& defined);
+
+	// {{{ operands
+	VReg vreg(IrValue* value) {
+		value = resolve(value);
+		if (vregs_[value->id] == NoVReg) {
+			vregs_[value->id] = function_.newVReg(value->type);
+			values_.push_back(value);
+		}
+		return vregs_[value->id];
+	}
+
+	VReg temp(IrType type) {
+		values_.push_back(nullptr);
+		return function_.newVReg(type);
+	}
+
+	MOperand operand(IrValue* value) {
+		value = resolve(value);
+		return value->isConst() ? MOperand::immediate(value->imm) : MOperand::vreg(vreg(value));
+	}
+
+	//! Operand in a register, moving constants into a temporary.
+	MOperand inRegister(IrValue* value) {
+		MOperand result = operand(value);
+		if (result.isImm()) {
+			VReg reg = temp(resolve(value)->type);
+			MachineInstr& mov = emit(MachineOp::Mov, resolve(value)->type);
+			mov.dst = reg;
+			mov.a = result;
+			result = MOperand::vreg(reg);
+		}
+		return result;
+	}
+
+	//! Register holding reference \p value, as the base of memory operands.
+	VReg base(IrValue* value) { return inRegister(value).reg; }
+
+	//! Memory that native load \p value reads.
+	MOperand memoryOf(IrValue* value);
+
+	bool isFolded(IrValue* value) { return folded_[resolve(value)->id]; }
+	// }}}
+
+	MachineInstr& emit(MachineOp op, IrType type) {
+		current_->instrs.emplace_back(op, type);
+		return current_->instrs.back();
+	}
+
+	MachineState snapshot(const IrFrameState* state, uint32_t trap);
+	uint32_t state(const IrFrameState* state, uint32_t trap) { return function_.addState(snapshot(state, trap)); }
+	MachineSlot slotOf(IrValue* value);
+
+	void zeroCheck(IrValue* value, uint32_t state);
+	void boundsCheck(IrValue* array, IrValue* index, uint32_t state);
+
+	void select(IrValue* value);
+	void arithmetic(IrValue* value, MachineOp op);
+	void divide(IrValue* value, MachineOp op);
+	void shift(IrValue* value, MachineOp op);
+	void convert(IrValue* value);
+	void arrayLoad(IrValue* value);
+	void arrayStore(IrValue* value);
+	void field(IrValue* value);
+	void call(IrValue* value, Method* callee);
+	void invoke(IrValue* value);
+
+	void terminator(IrBlock* block, IrValue* value);
+	void branch(IrBlock* block, IrValue* value);
+	bool diamond(IrBlock* block, Cond cond, IrType type, const MOperand& a, const MOperand& b);
+	void phiMoves(MachineBlock* into, IrBlock* from, IrBlock* to);
+	MachineBlock* edge(IrBlock* from, IrBlock* to);
+	void fail(const char* what) {
+		if (!failed_)
+			failure_ = what;
+		failed_ = true;
+	}
+};
+
+bool Selector::prepare()
+{
+	// blocks reachable only through exception handlers stay with the interpreter
+	std::vector<bool> reached(graph_.blockCount(), false);
+	std::vector<IrBlock*> work = {graph_.entry()};
+	reached[graph_.entry()->id] = true;
+	while (!work.empty()) {
+		IrBlock* block = work.back();
+		work.pop_back();
+		for (IrBlock* successor: block->successors) {
+			if (!reached[successor->id]) {
+				reached[successor->id] = true;
+				work.push_back(successor);
+			}
+		}
+	}
+
+	for (IrBlock* block: graph_.blocks())
+		if (reached[block->id] && block->order != UINT32_MAX)
+			order_.push_back(block);
+	std::sort(order_.begin(), order_.end(), [](IrBlock* a, IrBlock* b) { return a->order < b->order; });
+
+	for (IrBlock* block: order_) {
+		if (block->state)
+			for (const std::vector<IrValue*>* slots: {&block->state->locals, &block->state->stack})
+				for (IrValue* value: *slots)
+					if (value)
+						stated_[resolve(value)->id] = true;
+
+		for (IrValue* value: block->values) {
+			present_[value->id] = true;
+			if (value->type == IrType::Float || value->type == IrType::Double) {
+				fail("floating-point");
+				return false;
+			}
+			for (IrValue* operand: value->operands) {
+				IrValue* source = resolve(operand);
+				if (source->type == IrType::Float || source->type == IrType::Double) {
+					fail("floating-point");
+					return false;
+				}
+				++uses_[source->id];
+			}
+			if (value->state)
+				for (const std::vector<IrValue*>* slots: {&value->state->locals, &value->state->stack})
+					for (IrValue* slot: *slots)
+						if (slot)
+							stated_[resolve(slot)->id] = true;
+		}
+	}
+
+	for (IrBlock* block: order_)
+		fold(block);
+	return true;
+}
+
+void Selector::fold(IrBlock* block)
+{
+	auto foldable = [&](IrValue* load, IrValue* user, size_t at) {
+		load = resolve(load);
+		if (load->block != block || uses_[load->id] != 1 || stated_[load->id] || load->type != user->operands[0]->type)
+			return false;
+
+		switch (load->op) {
+			case IrOp::ArrayLength:
+				break;
+			case IrOp::ArrayLoad:
+				if ((Opcode) load->imm != Opcode::iaload && (Opcode) load->imm != Opcode::laload)
+					return false;
+				break;
+			case IrOp::GetField: {
+				Opcode op = quickenedOpcode(quick_->instructions() + load->index);
+				if (op != Opcode::getfield_i && op != Opcode::getfield_j)
+					return false;
+				break;
+			}
+			default:
+				return false;
+		}
+
+		// nothing in between may write what it reads
+		auto from = std::find(block->values.begin(), block->values.end(), load);
+		for (auto i = from + 1; i != block->values.begin() + at; ++i)
+			if ((*i)->flags() & IrEffect)
+				return false;
+		return true;
+	};
+
+	for (size_t at = 0; at < block->values.size(); ++at) {
+		IrValue* value = block->values[at];
+		switch (value->op) {
+			case IrOp::Add: case IrOp::Mul: case IrOp::And: case IrOp::Or: case IrOp::Xor:
+				if (value->type != IrType::Int && value->type != IrType::Long)
+					break;
+				if (foldable(value->operands[1], value, at))
+					folded_[resolve(value->operands[1])->id] = true;
+				else if (foldable(value->operands[0], value, at))
+					folded_[resolve(value->operands[0])->id] = true;
+				break;
+			case IrOp::Sub:
+				if ((value->type == IrType::Int || value->type == IrType::Long) && foldable(value->operands[1], value, at))
+					folded_[resolve(value->operands[1])->id] = true;
+				break;
+			case IrOp::If: {
+				IrValue* a = resolve(value->operands[0]);
+				IrValue* b = resolve(value->operands[1]);
+				if (a->op == IrOp::Cmp && b->isConst() && b->imm == 0 && uses_[a->id] == 1 && !stated_[a->id] &&
+				    a->block == block)
+					folded_[a->id] = true;
+				else if (foldable(b, value, at))
+					folded_[b->id] = true;
+				else if (foldable(a, value, at))
+					folded_[a->id] = true;
+				break;
+			}
+			default:
+				break;
+		}
+	}
+}
+
+bool Selector::run()
+{
+	if (!prepare())
+		return false;
+
+	for (IrBlock* block: order_)
+		blocks_[block->id] = function_.newBlock(block->loopDepth);
+
+	for (IrBlock* block: order_) {
+		if (skipped_[block->id])
+			continue;
+		current_ = blocks_[block->id];
+		block_ = block;
+		function_.blocks().push_back(current_);
+
+		for (IrValue* value: block->values) {
+			if (value->isTerminator())
+				terminator(block, value);
+			else
+				select(value);
+			if (failed_)
+				return false;
+		}
+
+		// the moves of edges from branches come right after them
+		for (MachineBlock* edge: edges_)
+			function_.blocks().push_back(edge);
+		edges_.clear();
+	}
+
+	addLoopEntries();
+	return !failed_;
+}
+// }}}
+
+// {{{ frame states
+MachineSlot Selector::slotOf(IrValue* value)
+{
+	if (!value)
+		return {IrType::Void, MOperand::none()};
+	value = resolve(value);
+	if (!present_[value->id] || value->type == IrType::Void || isFolded(value))
+		return {IrType::Void, MOperand::none()};
+	return {value->type, operand(value)};
+}
+
+MachineState Selector::snapshot(const IrFrameState* state, uint32_t trap)
+{
+	MachineState result;
+	result.index = state->index;
+	result.trap = trap;
+	for (IrValue* value: state->locals)
+		result.locals.push_back(slotOf(value));
+	for (IrValue* value: state->stack)
+		result.stack.push_back(slotOf(value));
+	return result;
+}
+// }}}
+
+// {{{ checks
+//! Traps to \p state if reference \p value is null, or divisor \p value zero.
+void Selector::zeroCheck(IrValue* value, uint32_t state)
+{
+	value = resolve(value);
+	if (!checks_)
+		return;
+
+	switch (value->op) {
+		case IrOp::New: case IrOp::NewArray: case IrOp::ANewArray: case IrOp::MultiANewArray: case IrOp::Ldc:
+		case IrOp::Catch:
+			return;
+		case IrOp::Param:
+			if (value->imm == 0 && !graph_.method()->isStatic())
+				return;
+			break;
+		default:
+			break;
+	}
+
+	// a check that dominates this one already passed
+	std::vector<const IrBlock*>& checked = checked_[value->id];
+	for (const IrBlock* block: checked)
+		if (block == block_ || IrGraph::dominates(block, block_))
+			return;
+	checked.push_back(block_);
+
+	MachineInstr& guard = emit(MachineOp::Guard, value->type);
+	guard.cond = Cond::e;
+	guard.a = operand(value);
+	guard.b = MOperand::immediate(0);
+	guard.state = state;
+}
+
+void Selector::boundsCheck(IrValue* array, IrValue* index, uint32_t state)
+{
+	array = resolve(array);
+	index = resolve(index);
+	if (!checks_)
+		return;
+
+	std::vector<const IrBlock*>& checked = boundsChecked_[std::make_pair(array->id, index->id)];
+	for (const IrBlock* block: checked)
+		if (block == block_ || IrGraph::dominates(block, block_))
+			return;
+	checked.push_back(block_);
+
+	// unsigned, so that negative indices fail too
+	MOperand length = MOperand::memory(base(array), JArray::lengthOffset());
+	MachineInstr& guard = emit(MachineOp::Guard, IrType::Int);
+	guard.cond = Cond::ae;
+	guard.a = operand(index);
+	guard.b = length;
+	guard.state = state;
+}
+// }}}
+
+// {{{ values
+MOperand Selector::memoryOf(IrValue* value)
+{
+	value = resolve(value);
+	switch (value->op) {
+		case IrOp::ArrayLength:
+			return MOperand::memory(base(value->operands[0]), JArray::lengthOffset());
+		case IrOp::ArrayLoad: {
+			static const uint8_t scales[] = {4, 8, 4, 8, 8, 1, 2, 2};
+			uint8_t scale = scales[(int) value->imm - (int) Opcode::iaload];
+			MOperand index = operand(value->operands[1]);
+			VReg array = base(value->operands[0]);
+			if (index.isImm() && isInt32(JArray::elementsOffset() + index.imm * scale))
+				return MOperand::memory(array, (int32_t) (JArray::elementsOffset() + index.imm * scale));
+			return MOperand::memory(array, vreg(value->operands[1]), scale, JArray::elementsOffset());
+		}
+		case IrOp::GetField:
+			return MOperand::memory(base(value->operands[0]),
+				(int32_t) (JObject::dataOffset() + quick_->instructions()[value->index].resolved.offset));
+		default:
+			return MOperand::none();
+	}
+}
+
+void Selector::select(IrValue* value)
+{
+	switch (value->op) {
+		case IrOp::Param: {
+			MachineInstr& instr = emit(MachineOp::Local, value->type);
+			instr.dst = vreg(value);
+			instr.imm = value->imm;
+			break;
+		}
+		case IrOp::Phi:
+			// an operand per predecessor, taken by the moves on the edges (see phiMoves())
+			assert(value->operands.size() == block_->predecessors.size());
+			break;
+		case IrOp::Const:
+		case IrOp::Copy:
+			break;
+
+		case IrOp::Add: arithmetic(value, MachineOp::Add); break;
+		case IrOp::Sub: arithmetic(value, MachineOp::Sub); break;
+		case IrOp::Mul: arithmetic(value, MachineOp::Mul); break;
+		case IrOp::And: arithmetic(value, MachineOp::And); break;
+		case IrOp::Or: arithmetic(value, MachineOp::Or); break;
+		case IrOp::Xor: arithmetic(value, MachineOp::Xor); break;
+		case IrOp::Div: divide(value, MachineOp::Div); break;
+		case IrOp::Rem: divide(value, MachineOp::Rem); break;
+		case IrOp::Shl: shift(value, MachineOp::Shl); break;
+		case IrOp::Shr: shift(value, MachineOp::Sar); break;
+		case IrOp::Ushr: shift(value, MachineOp::Shr); break;
+
+		case IrOp::Neg: {
+			MOperand a = inRegister(value->operands[0]);
+			MachineInstr& instr = emit(MachineOp::Neg, value->type);
+			instr.dst = vreg(value);
+			instr.a = a;
+			break;
+		}
+
+		case IrOp::Cmp: {
+			if (isFolded(value) && checks_)
+				break;
+			MOperand a = inRegister(value->operands[0]);
+			MachineInstr& instr = emit(MachineOp::Cmp3, IrType::Long);
+			instr.dst = vreg(value);
+			instr.a = a;
+			instr.b = operand(value->operands[1]);
+			break;
+		}
+
+		case IrOp::Convert:
+			convert(value);
+			break;
+
+		case IrOp::ArrayLength:
+			if (value->state)
+				zeroCheck(value->operands[0], state(value->state, value->index));
+			if (!isFolded(value) || !checks_) {
+				MOperand length = memoryOf(value);
+				MachineInstr& instr = emit(MachineOp::Load, IrType::Int);
+				instr.access = MachineAccess::I32;
+				instr.dst = vreg(value);
+				instr.a = length;
+			}
+			break;
+
+		case IrOp::ArrayLoad:
+			arrayLoad(value);
+			break;
+		case IrOp::ArrayStore:
+			arrayStore(value);
+			break;
+
+		case IrOp::GetField: case IrOp::PutField: case IrOp::GetStatic: case IrOp::PutStatic:
+			field(value);
+			break;
+
+		case IrOp::Ldc: {
+			const Instruction* insn = quick_->instructions() + value->index;
+			if (quickenedOpcode(insn) != Opcode::ldc_quick) {
+				call(value, nullptr);
+				break;
+			}
+			// constants stay where they are, there being no moving collector
+			MachineInstr& instr = emit(MachineOp::Mov, IrType::Ref);
+			instr.dst = vreg(value);
+			instr.a = MOperand::immediate((int64_t) (uintptr_t) insn->resolved.object);
+			break;
+		}
+
+		case IrOp::Invoke:
+			invoke(value);
+			break;
+
+		case IrOp::New: case IrOp::NewArray: case IrOp::ANewArray: case IrOp::MultiANewArray:
+		case IrOp::CheckCast: case IrOp::InstanceOf: case IrOp::MonitorEnter: case IrOp::MonitorExit:
+			call(value, nullptr);
+			break;
+
+		default:
+			fail(irOpName(value->op));
+			break;
+	}
+}
+
+void Selector::arithmetic(IrValue* value, MachineOp op)
+{
+	IrValue* x = resolve(value->operands[0]);
+	IrValue* y = resolve(value->operands[1]);
+	bool commutative = op != MachineOp::Sub;
+	if (commutative && (x->isConst() || (isFolded(x) && checks_)))
+		std::swap(x, y);
+
+	if (op == MachineOp::Mul && y->isConst()) {
+		// strength reduction: x * 2^k as a shift, x * 3, 5 and 9 as lea
+		int k = powerOfTwo(y->imm);
+		if (k) {
+			MOperand a = inRegister(x);
+			MachineInstr& instr = emit(MachineOp::Shl, value->type);
+			instr.dst = vreg(value);
+			instr.a = a;
+			instr.b = MOperand::immediate(k);
+			return;
+		}
+		if (y->imm == 3 || y->imm == 5 || y->imm == 9) {
+			VReg a = inRegister(x).reg;
+			MachineInstr& instr = emit(MachineOp::Lea, value->type);
+			instr.dst = vreg(value);
+			instr.a = MOperand::memory(a, a, (uint8_t) (y->imm - 1), 0);
+			return;
+		}
+	}
+
+	if (op == MachineOp::Add && !y->isConst()) {
+		// x + (y << 1, 2 or 3) as lea, unless the shift is needed anyway
+		for (int k = 0; k < 2; ++k) {
+			IrValue* shifted = resolve(value->operands[1 - k]);
+			IrValue* other = resolve(value->operands[k]);
+			IrValue* count = shifted->op == IrOp::Shl ? resolve(shifted->operands[1]) : nullptr;
+			if (!count || !count->isConst() || count->imm < 1 || count->imm > 3 || uses_[shifted->id] != 1 ||
+			    stated_[shifted->id] || other->isConst() || (isFolded(other) && checks_))
+				continue;
+			VReg base = inRegister(other).reg;
+			VReg index = inRegister(shifted->operands[0]).reg;
+			MachineInstr& instr = emit(MachineOp::Lea, value->type);
+			instr.dst = vreg(value);
+			instr.a = MOperand::memory(base, index, (uint8_t) (1 << count->imm), 0);
+			return;
+		}
+	}
+
+	MOperand a = inRegister(x);
+	MOperand b = isFolded(y) && checks_ ? memoryOf(y) : operand(y);
+	MachineInstr& instr = emit(op, value->type);
+	instr.dst = vreg(value);
+	instr.a = a;
+	instr.b = b;
+}
+
+void Selector::divide(IrValue* value, MachineOp op)
+{
+	IrValue* divisor = resolve(value->operands[1]);
+	if (!divisor->isConst() || divisor->imm == 0) {
+		if (!value->state)
+			return fail("division without a frame state");
+		zeroCheck(divisor, state(value->state, value->index));
+		if (divisor->isConst()) {
+			// never gets past the check, but defines the value all the same
+			MachineInstr& instr = emit(MachineOp::Mov, value->type);
+			instr.dst = vreg(value);
+			instr.a = MOperand::immediate(0);
+			return;
+		}
+	}
+
+	MOperand a = operand(value->operands[0]);
+	MachineInstr& instr = emit(op, value->type);
+	instr.dst = vreg(value);
+	instr.a = a;
+	instr.b = operand(divisor);
+}
+
+void Selector::shift(IrValue* value, MachineOp op)
+{
+	MOperand a = inRegister(value->operands[0]);
+	MOperand b = operand(value->operands[1]);
+	if (b.isImm())
+		b.imm &= value->type == IrType::Long ? 63 : 31;
+
+	MachineInstr& instr = emit(op, value->type);
+	instr.dst = vreg(value);
+	instr.a = a;
+	instr.b = b;
+}
+
+void Selector::convert(IrValue* value)
+{
+	MOperand a = inRegister(value->operands[0]);
+	MachineInstr& instr = emit(MachineOp::Convert, value->type);
+	instr.dst = vreg(value);
+	instr.a = a;
+	instr.imm = value->imm;
+}
+
+void Selector::arrayLoad(IrValue* value)
+{
+	Opcode op = (Opcode) value->imm;
+	if (!value->state)
+		return fail("array load without a frame state");
+
+	uint32_t s = state(value->state, value->index);
+	zeroCheck(value->operands[0], s);
+	boundsCheck(value->operands[0], value->operands[1], s);
+	if (isFolded(value) && checks_)
+		return;
+
+	static const MachineAccess accesses[] = {
+		MachineAccess::I32, MachineAccess::I64, MachineAccess::I32, MachineAccess::I64,
+		MachineAccess::I64, MachineAccess::S8, MachineAccess::U16, MachineAccess::S16,
+	};
+	MOperand element = memoryOf(value);
+	MachineInstr& instr = emit(MachineOp::Load, value->type);
+	instr.access = accesses[(int) op - (int) Opcode::iaload];
+	instr.dst = vreg(value);
+	instr.a = element;
+}
+
+void Selector::arrayStore(IrValue* value)
+{
+	Opcode op = (Opcode) value->imm;
+	if (op == Opcode::aastore) {
+		// stores of references check the element type
+		call(value, nullptr);
+		return;
+	}
+	if (!value->state)
+		return fail("array store without a frame state");
+
+	uint32_t s = state(value->state, value->index);
+	zeroCheck(value->operands[0], s);
+	boundsCheck(value->operands[0], value->operands[1], s);
+
+	static const uint8_t scales[] = {4, 8, 4, 8, 8, 1, 2, 2};
+	static const MachineAccess accesses[] = {
+		MachineAccess::I32, MachineAccess::I64, MachineAccess::I32, MachineAccess::I64,
+		MachineAccess::I64, MachineAccess::U8, MachineAccess::U16, MachineAccess::U16,
+	};
+	uint8_t scale = scales[(int) op - (int) Opcode::iastore];
+	VReg array = base(value->operands[0]);
+	MOperand index = operand(value->operands[1]);
+	MOperand element = index.isImm() && isInt32(JArray::elementsOffset() + index.imm * scale)
+		? MOperand::memory(array, (int32_t) (JArray::elementsOffset() + index.imm * scale))
+		: MOperand::memory(array, inRegister(value->operands[1]).reg, scale, JArray::elementsOffset());
+	MOperand stored = operand(value->operands[2]);
+
+	if (op == Opcode::bastore) {
+		// boolean[] shares the instruction with byte[], and stores 0 or 1 only
+		VReg descriptor = temp(IrType::Ref);
+		MachineInstr& load = emit(MachineOp::Load, IrType::Ref);
+		load.dst = descriptor;
+		load.a = MOperand::memory(array, JArray::descriptorOffset());
+
+		MOperand source = stored.isImm() ? inRegister(value->operands[2]) : stored;
+		VReg bit = temp(IrType::Int);
+		MachineInstr& mask = emit(MachineOp::And, IrType::Int);
+		mask.dst = bit;
+		mask.a = source;
+		mask.b = MOperand::immediate(1);
+
+		VReg byte = temp(IrType::Int);
+		MachineInstr& select = emit(MachineOp::Select, IrType::Ref);
+		select.cond = Cond::e;
+		select.dst = byte;
+		select.a = MOperand::vreg(descriptor);
+		select.b = MOperand::immediate((int64_t) (uintptr_t) intern("[Z"));
+		select.c = MOperand::vreg(bit);
+		select.d = source;
+		stored = MOperand::vreg(byte);
+	}
+
+	MachineInstr& instr = emit(MachineOp::Store, IrType::Void);
+	instr.access = accesses[(int) op - (int) Opcode::iastore];
+	instr.a = element;
+	instr.b = stored;
+}
+
+void Selector::field(IrValue* value)
+{
+	const Instruction* insn = quick_->instructions() + value->index;
+	Opcode op = quickenedOpcode(insn);
+
+	MachineAccess access;
+	switch (op) {
+		case Opcode::getfield_z: case Opcode::getstatic_z: case Opcode::putfield_z: case Opcode::putstatic_z:
+			access = MachineAccess::U8;
+			break;
+		case Opcode::getfield_b: case Opcode::getstatic_b: case Opcode::putfield_b: case Opcode::putstatic_b:
+			access = MachineAccess::S8;
+			break;
+		case Opcode::getfield_c: case Opcode::getstatic_c:
+			access = MachineAccess::U16;
+			break;
+		case Opcode::getfield_s: case Opcode::getstatic_s: case Opcode::putfield_s: case Opcode::putstatic_s:
+			access = MachineAccess::S16;
+			break;
+		case Opcode::getfield_i: case Opcode::getstatic_i: case Opcode::putfield_i: case Opcode::putstatic_i:
+			access = MachineAccess::I32;
+			break;
+		case Opcode::getfield_j: case Opcode::getstatic_j: case Opcode::putfield_j: case Opcode::putstatic_j:
+		case Opcode::getfield_a: case Opcode::getstatic_a: case Opcode::putfield_a: case Opcode::putstatic_a:
+			access = MachineAccess::I64;
+			break;
+		default:
+			// not resolved yet: the interpreter does that
+			call(value, nullptr);
+			return;
+	}
+	if (!value->state)
+		return fail("field access without a frame state");
+
+	MOperand address;
+	if (value->op == IrOp::GetField || value->op == IrOp::PutField) {
+		zeroCheck(value->operands[0], state(value->state, value->index));
+		if (value->op == IrOp::GetField && isFolded(value) && checks_)
+			return;
+		address = MOperand::memory(base(value->operands[0]), (int32_t) (JObject::dataOffset() + insn->resolved.offset));
+	} else {
+		VReg base = temp(IrType::Ref);
+		MachineInstr& mov = emit(MachineOp::Mov, IrType::Ref);
+		mov.dst = base;
+		mov.a = MOperand::immediate((int64_t) (uintptr_t) insn->resolved.address);
+		address = MOperand::memory(base, 0);
+	}
+
+	if (value->op == IrOp::GetField || value->op == IrOp::GetStatic) {
+		MachineInstr& instr = emit(MachineOp::Load, value->type);
+		instr.access = access;
+		instr.dst = vreg(value);
+		instr.a = address;
+		return;
+	}
+
+	MOperand stored = operand(value->operands.back());
+	if (op == Opcode::putfield_z || op == Opcode::putstatic_z) {
+		VReg bit = temp(IrType::Int);
+		MOperand source = inRegister(value->operands.back());
+		MachineInstr& mask = emit(MachineOp::And, IrType::Int);
+		mask.dst = bit;
+		mask.a = source;
+		mask.b = MOperand::immediate(1);
+		stored = MOperand::vreg(bit);
+	}
+
+	MachineInstr& instr = emit(MachineOp::Store, IrType::Void);
+	instr.access = access == MachineAccess::S8 ? MachineAccess::U8 : access == MachineAccess::S16 ? MachineAccess::U16 : access;
+	instr.a = address;
+	instr.b = stored;
+}
+
+void Selector::call(IrValue* value, Method* callee)
+{
+	if (!value->state)
+		return fail("call without a frame state");
+
+	// the operands go to the top of the frame's operand stack, which is where the result comes back
+	uint32_t slots = 0;
+	for (IrValue* operand: value->operands)
+		slots += slotsOf(resolve(operand)->type);
+	uint32_t depth = value->state->stack.size();
+	if (slots > depth)
+		return fail("operands beyond the operand stack");
+	int32_t base = depth - slots;
+
+	MachineState before = snapshot(value->state, value->index);
+	MachineState after = before;
+	before.framed = base;
+	for (uint32_t k = base; k < depth; ++k)
+		before.stack[k].value = MOperand::none();
+
+	after.index = value->index + 1;
+	after.stack.resize(base);
+	if (value->type != IrType::Void) {
+		after.framed = base;
+		after.stack.push_back({value->type, MOperand::none()});
+		if (slotsOf(value->type) == 2)
+			after.stack.push_back({IrType::Void, MOperand::none()});
+	}
+	uint32_t id = function_.addState(std::move(before));
+	function_.addState(std::move(after));
+
+	MachineInstr& instr = emit(MachineOp::Call, value->type == IrType::Void ? IrType::Int : value->type);
+	instr.dst = value->type != IrType::Void ? vreg(value) : NoVReg;
+	instr.state = id;
+	instr.insn = quick_->instructions() + value->index;
+	instr.callee = callee;
+	for (IrValue* operand: value->operands) {
+		instr.args.push_back(this->operand(operand));
+		instr.types.push_back(resolve(operand)->type);
+	}
+}
+
+void Selector::invoke(IrValue* value)
+{
+	const Instruction* insn = quick_->instructions() + value->index;
+	switch (quickenedOpcode(insn)) {
+		case Opcode::invokevirtual_mono: case Opcode::invokevirtual_poly: case Opcode::invokevirtual_mega:
+		case Opcode::invokeinterface_mono: case Opcode::invokeinterface_poly: case Opcode::invokeinterface_mega: {
+			// calls the only possible target directly, as long as it stays the only one
+			Dependency dependency;
+			Method* callee = hierarchy_ ? hierarchy_->uniqueTarget(quick_->callSite(insn->operand)->method, dependency) : nullptr;
+			if (callee)
+				dependencies_.push_back(dependency);
+			call(value, callee);
+			break;
+		}
+		default:
+			call(value, nullptr);
+			break;
+	}
+}
+// }}}
+
+// {{{ control flow
+void Selector::phiMoves(MachineBlock* into, IrBlock* from, IrBlock* to)
+{
+	size_t k = to->predecessorIndex(from);
+	assert(k < to->predecessors.size());
+	MachineInstr moves(MachineOp::Moves, IrType::Void);
+	for (IrValue* phi: to->values) {
+		if (phi->op != IrOp::Phi)
+			break;
+		assert(phi->operands.size() == to->predecessors.size());
+		if (phi->type == IrType::Void)
+			continue;
+		MOperand source = operand(phi->operands[k]);
+		VReg reg = vreg(phi);
+		if (source.isVReg() && source.reg == reg)
+			continue;
+		moves.dsts.push_back(reg);
+		moves.args.push_back(source);
+	}
+	if (!moves.dsts.empty())
+		into->instrs.push_back(std::move(moves));
+}
+
+MachineBlock* Selector::edge(IrBlock* from, IrBlock* to)
+{
+	MachineBlock* target = blocks_[to->id];
+	bool phis = false;
+	for (IrValue* phi: to->values)
+		if (phi->op == IrOp::Phi && phi->type != IrType::Void)
+			phis = true;
+	if (!phis)
+		return target;
+
+	// a critical edge: the moves go on a block of their own
+	MachineBlock* split = function_.newBlock(std::min(from->loopDepth, to->loopDepth));
+	phiMoves(split, from, to);
+	split->instrs.emplace_back(MachineOp::Jump, IrType::Void);
+	MachineFunction::addEdge(split, target);
+	edges_.push_back(split);
+	return split;
+}
+
+void Selector::terminator(IrBlock* block, IrValue* value)
+{
+	switch (value->op) {
+		case IrOp::Goto: {
+			IrBlock* target = block->successors[0];
+			phiMoves(current_, block, target);
+			emit(MachineOp::Jump, IrType::Void);
+			MachineFunction::addEdge(current_, blocks_[target->id]);
+			break;
+		}
+
+		case IrOp::If:
+			branch(block, value);
+			break;
+
+		case IrOp::Switch: {
+			MOperand key = inRegister(value->operands[0]);
+			std::vector<MachineBlock*> targets = {edge(block, block->successors[0])};
+			std::vector<int32_t> keys;
+			for (size_t k = 0; k + 1 < value->cases.size(); k += 2) {
+				keys.push_back(value->cases[k]);
+				targets.push_back(edge(block, block->successors[value->cases[k + 1]]));
+			}
+			MachineInstr& instr = emit(MachineOp::Switch, IrType::Int);
+			instr.a = key;
+			instr.keys = std::move(keys);
+			for (MachineBlock* target: targets)
+				MachineFunction::addEdge(current_, target);
+			break;
+		}
+
+		case IrOp::Return: {
+			MachineInstr& instr = emit(MachineOp::Return, value->operands.empty() ? IrType::Void
+				: resolve(value->operands[0])->type);
+			if (!value->operands.empty())
+				instr.a = operand(value->operands[0]);
+			break;
+		}
+
+		case IrOp::Throw: {
+			// the interpreter throws it
+			if (!value->state)
+				return fail("throw without a frame state");
+			MachineInstr& instr = emit(MachineOp::Deopt, IrType::Void);
+			instr.state = state(value->state, value->index);
+			break;
+		}
+
+		default:
+			fail(irOpName(value->op));
+			break;
+	}
+}
+
+void Selector::branch(IrBlock* block, IrValue* value)
+{
+	static const Cond conds[] = { Cond::e, Cond::ne, Cond::l, Cond::ge, Cond::g, Cond::le };
+	Cond cond = conds[value->imm];
+	IrValue* x = resolve(value->operands[0]);
+	IrValue* y = resolve(value->operands[1]);
+	IrType type = x->type;
+
+	MOperand a, b;
+	if (x->op == IrOp::Cmp && isFolded(x)) {
+		// lcmp and a branch on its result as one comparison
+		type = IrType::Long;
+		a = operand(x->operands[0]);
+		b = operand(x->operands[1]);
+	} else if (isFolded(y)) {
+		a = operand(x);
+		b = memoryOf(y);
+	} else if (isFolded(x)) {
+		a = operand(y);
+		b = memoryOf(x);
+		cond = mirror(cond);
+	} else {
+		a = operand(x);
+		b = operand(y);
+	}
+
+	if (a.isImm() && b.isVReg()) {
+		std::swap(a, b);
+		cond = mirror(cond);
+	} else if (a.isImm()) {
+		VReg reg = temp(type);
+		MachineInstr& mov = emit(MachineOp::Mov, type);
+		mov.dst = reg;
+		mov.a = a;
+		a = MOperand::vreg(reg);
+	}
+
+	if (diamond(block, cond, type, a, b))
+		return;
+
+	MachineBlock* taken = edge(block, block->successors[0]);
+	MachineBlock* notTaken = edge(block, block->successors[1]);
+	MachineInstr& instr = emit(MachineOp::Branch, type);
+	instr.cond = cond;
+	instr.a = a;
+	instr.b = b;
+	MachineFunction::addEdge(current_, taken);
+	MachineFunction::addEdge(current_, notTaken);
+}
+
+bool Selector::diamond(IrBlock* block, Cond cond, IrType type, const MOperand& a, const MOperand& b)
+{
+	// an arm that only leads on to the join
+	auto empty = [&](IrBlock* arm) {
+		return arm != block && arm->predecessors.size() == 1 && arm->values.size() == 1 &&
+			arm->successors.size() == 1 && arm->handlers.empty() && !arm->state;
+	};
+
+	IrBlock* taken = block->successors[0];
+	IrBlock* notTaken = block->successors[1];
+	IrBlock* join;
+	IrBlock* takenPred = block;
+	IrBlock* notTakenPred = block;
+	if (empty(taken) && empty(notTaken) && taken->successors[0] == notTaken->successors[0]) {
+		join = taken->successors[0];
+		takenPred = taken;
+		notTakenPred = notTaken;
+	} else if (empty(notTaken) && notTaken->successors[0] == taken) {
+		join = taken;
+		notTakenPred = notTaken;
+	} else if (empty(taken) && taken->successors[0] == notTaken) {
+		join = notTaken;
+		takenPred = taken;
+	} else {
+		return false;
+	}
+	if (join == block || join->predecessors.size() != 2 || join->state)
+		return false;
+
+	for (IrValue* phi: join->values) {
+		if (phi->op != IrOp::Phi)
+			break;
+		assert(phi->operands.size() == 2);
+		if (phi->type == IrType::Void)
+			continue;
+		MOperand ifTaken = operand(phi->operands[join->predecessorIndex(takenPred)]);
+		MOperand ifNotTaken = operand(phi->operands[join->predecessorIndex(notTakenPred)]);
+		MachineInstr& select = emit(MachineOp::Select, type);
+		select.cond = cond;
+		select.dst = vreg(phi);
+		select.a = a;
+		select.b = b;
+		select.c = ifTaken;
+		select.d = ifNotTaken;
+	}
+
+	if (takenPred != block)
+		skipped_[takenPred->id] = true;
+	if (notTakenPred != block)
+		skipped_[notTakenPred->id] = true;
+	emit(MachineOp::Jump, IrType::Void);
+	MachineFunction::addEdge(current_, blocks_[join->id]);
+	return true;
+}
+// }}}
+
+// {{{ loop entries
+void Selector::addLoopEntries()
+{
+	LinearScan liveness(function_);
+	liveness.analyze();
+
+	for (IrBlock* header: order_) {
+		TraceAnchor* loop = header->state && !skipped_[header->id] ? quick_->loopAt(header->start) : nullptr;
+		if (!loop)
+			continue;
+
+		// the values live at the header, from the interpreter frame or recomputed from ones that are
+		MachineBlock* target = blocks_[header->id];
+		MachineBlock* entry = function_.newBlock(0);
+		entry->osrLoop = loop - quick_->loops();
+		current_ = entry;
+		checks_ = false;
+		std::vector<bool> defined(function_.vregCount(), false);
+		bool complete = true;
+		for (VReg reg: liveness.liveIn(target))
+			if (!(complete = define(reg, header->state, defined)))
+				break;
+		checks_ = true;
+		if (!complete)
+			continue;
+
+		// out of the way of the method's own control flow
+		entry->instrs.emplace_back(MachineOp::Jump, IrType::Void);
+		MachineFunction::addEdge(entry, target);
+		function_.blocks().push_back(entry);
+	}
+}
+
+bool Selector::define(VReg reg, const IrFrameState* state, std::vector<bool>& defined)
+{
+	if (reg < defined.size() && defined[reg])
+		return true;
+	IrValue* value = reg < values_.size() ? values_[reg] : nullptr;
+	if (!value)
+		return false;
+	if (defined.size() < function_.vregCount())
+		defined.resize(function_.vregCount(), false);
+
+	for (const std::vector<IrValue*>* slots: {&state->locals, &state->stack}) {
+		for (size_t k = 0; k < slots->size(); ++k) {
+			if ((*slots)[k] && resolve((*slots)[k]) == value) {
+				MachineInstr& instr = emit(slots == &state->locals ? MachineOp::Local : MachineOp::Stack, value->type);
+				instr.dst = reg;
+				instr.imm = k;
+				defined[reg] = true;
+				return true;
+			}
+		}
+	}
+
+	// the interpreter computed it before reaching the loop, so it cannot throw now
+	if (!value->isPure() || value->op == IrOp::Phi || value->op == IrOp::Param || value->op == IrOp::Const)
+		return false;
+
+	MachineBlock* entry = current_;
+	MachineBlock scratch(UINT32_MAX, 0);
+	current_ = &scratch;
+	select(value);
+	current_ = entry;
+	if (failed_)
+		return false;
+
+	std::vector<VReg> local;
+	for (const MachineInstr& instr: scratch.instrs) {
+		bool ok = true;
+		instr.forEachUse([&](VReg use) {
+			if (ok && std::find(local.begin(), local.end(), use) == local.end())
+				ok = define(use, state, defined);
+		});
+		if (!ok)
+			return false;
+		instr.forEachDef([&](VReg def) { local.push_back(def); });
+	}
+
+	if (defined.size() < function_.vregCount())
+		defined.resize(function_.vregCount(), false);
+	for (MachineInstr& instr: scratch.instrs) {
+		instr.forEachDef([&](VReg def) { defined[def] = true; });
+		entry->instrs.push_back(std::move(instr));
+	}
+	return true;
+}
+// }}}
+
+} // namespace
+// }}}
+
+// {{{ code generation
+namespace {
+
+class Emitter {
+private:
+	// the compiled frame, above the callee-saved registers: entry arguments, saved registers, spill slots
+	static const int32_t SelfSlot = 0;
+	static const int32_t FrameSlot = 8;
+	static const int32_t LocalsSlot = 16;
+	static const int32_t StackSlot = 24;
+	static const int32_t SaveArea = 32;
+	static const int32_t SpillArea = SaveArea + 16 * 8;
+
+	X86Assembler as_;
+	const X86Templates::Runtime& runtime_;
+	const MachineFunction& function_;
+	const LinearScan& allocation_;
+	int32_t frameSize_;
+	std::vector<size_t> labels_;      //!< by block id
+	std::vector<size_t> stubs_;       //!< trap per state, or SIZE_MAX
+	std::vector<uint32_t> positions_; //!< where each state is taken, for its stack map
+	std::vector<VReg> results_;       //!< of the call each state belongs to, or NoVReg
+	std::vector<uint32_t> osrEntries_;
+	std::vector<size_t> osrLabels_;   //!< by loop index, or SIZE_MAX
+	size_t epilogue_;
+	size_t commonTrap_;
+	size_t resume_;
+
+public:
+	Emitter(const X86Templates::Runtime& runtime, const MachineFunction& function, const LinearScan& allocation,
+	        uint32_t loopCount) :
+		as_(), runtime_(runtime), function_(function), allocation_(allocation), frameSize_(0),
+		labels_(), stubs_(function.states().size(), SIZE_MAX), positions_(function.states().size(), 0),
+		results_(function.states().size(), NoVReg), osrEntries_(), osrLabels_(loopCount, SIZE_MAX),
+		epilogue_(as_.label()), commonTrap_(as_.label()), resume_(as_.label())
+	{
+		for (uint32_t id = 0; id < function.blockCount(); ++id)
+			labels_.push_back(as_.label());
+
+		// 5 callee-saved registers and the return address
+		frameSize_ = SpillArea + 8 * allocation.spillSlots();
+		if ((frameSize_ + 48) % 16)
+			frameSize_ += 8;
+	}
+
+	const std::vector<uint8_t>& generate();
+
+	//! Code offsets of the loop entries, once generated.
+	std::vector<uint32_t> osrEntries() const {
+		std::vector<uint32_t> offsets;
+		for (size_t label: osrLabels_)
+			offsets.push_back(label == SIZE_MAX ? CompiledMethod::NoEntry : as_.offset(label));
+		return offsets;
+	}
+
+	//! A safepoint per frame state, once generated.
+	DebugInfo debugInfo() const;
+
+private:
+	void prologue();
+	void epilogue();
+	void block(size_t index);
+	void instruction(const MachineBlock* block, size_t k, const MachineBlock* next);
+
+	//! Trap to \p state, created on demand.
+	size_t stub(uint32_t state, uint32_t position, VReg result = NoVReg) {
+		if (stubs_[state] == SIZE_MAX) {
+			stubs_[state] = as_.label();
+			positions_[state] = position;
+			results_[state] = result;
+		}
+		return stubs_[state];
+	}
+
+	// {{{ operands
+	static Mem spill(int32_t slot) { return mem(Reg::rsp, SpillArea + 8 * slot); }
+
+	bool isWide(VReg reg) const { return function_.typeOf(reg) != IrType::Int; }
+
+	//! Materializes immediate \p imm of \p type, keeping the upper half of ints zero.
+	void materialize(Reg r, int64_t imm, IrType type) {
+		as_.mov(r, type == IrType::Int ? (int64_t) (uint32_t) imm : imm);
+	}
+
+	//! Register holding \p reg, loaded into \p scratch if spilled.
+	Reg use(VReg reg, Reg scratch) {
+		const LinearScan::Location& location = allocation_.location(reg);
+		if (location.isRegister())
+			return location.reg;
+		as_.mov(isWide(reg), scratch, spill(location.slot));
+		return scratch;
+	}
+
+	//! Register holding \p operand, a virtual register or an immediate.
+	Reg use(const MOperand& operand, IrType type, Reg scratch) {
+		if (operand.isImm()) {
+			materialize(scratch, operand.imm, type);
+			return scratch;
+		}
+		return use(operand.reg, scratch);
+	}
+
+	//! Register to compute \p reg in: its own, or \p scratch if spilled (see commit()).
+	Reg target(VReg reg, Reg scratch) {
+		const LinearScan::Location& location = allocation_.location(reg);
+		return location.isRegister() ? location.reg : scratch;
+	}
+
+	//! Stores \p reg computed in \p r if spilled.
+	void commit(VReg reg, Reg r) {
+		const LinearScan::Location& location = allocation_.location(reg);
+		if (location.isSpill())
+			as_.mov(true, spill(location.slot), r);
+		else if (location.reg != r)
+			as_.mov(true, location.reg, r);
+	}
+
+	bool isRegister(const MOperand& operand, Reg r) const {
+		if (!operand.isVReg())
+			return false;
+		const LinearScan::Location& location = allocation_.location(operand.reg);
+		return location.isRegister() && location.reg == r;
+	}
+
+	bool addresses(const MOperand& memory, Reg r) const {
+		if (!memory.isMem())
+			return false;
+		const LinearScan::Location& base = allocation_.location(memory.reg);
+		if (base.isRegister() && base.reg == r)
+			return true;
+		if (!memory.scale)
+			return false;
+		const LinearScan::Location& index = allocation_.location(memory.index);
+		return index.isRegister() && index.reg == r;
+	}
+
+	//! Memory operand \p memory, loading spilled registers into rcx and rdx.
+	Mem address(const MOperand& memory) {
+		Reg base = use(memory.reg, Reg::rcx);
+		if (!memory.scale)
+			return mem(base, (int32_t) memory.imm);
+		return mem(base, use(memory.index, Reg::rdx), memory.scale, (int32_t) memory.imm);
+	}
+
+	//! Loads \p operand into \p r.
+	void load(Reg r, const MOperand& operand, IrType type) {
+		if (operand.isImm()) {
+			materialize(r, operand.imm, type);
+		} else if (operand.isMem()) {
+			as_.mov(type != IrType::Int, r, address(operand));
+		} else {
+			const LinearScan::Location& location = allocation_.location(operand.reg);
+			if (location.isSpill())
+				as_.mov(type != IrType::Int, r, spill(location.slot));
+			else if (location.reg != r)
+				as_.mov(true, r, location.reg);
+		}
+	}
+
+	//! Sets the flags comparing \p a to \p b.
+	void compare(bool wide, const MOperand& a, const MOperand& b);
+	// }}}
+
+	void arithmetic(const MachineInstr& instr);
+	void divide(const MachineInstr& instr);
+	void shift(const MachineInstr& instr);
+	void convert(const MachineInstr& instr);
+	void select(const MachineInstr& instr);
+	void call(const MachineInstr& instr, uint32_t position);
+	void moves(const MachineInstr& instr);
+	void jump(const MachineBlock* to, const MachineBlock* next) {
+		if (to != next)
+			as_.jmp(labels_[to->id]);
+	}
+};
+
+const std::vector<uint8_t>& Emitter::generate()
+{
+	prologue();
+
+	// resume at the frame's pc, unless at the method's start
+	as_.mov(true, Reg::rax, mem(Reg::rcx, runtime_.pcOffset));
+	as_.sub(true, Reg::rax, mem(Reg::rcx, runtime_.codeOffset));
+	as_.jcc(Cond::ne, resume_);
+
+	const std::vector<MachineBlock*>& blocks = function_.blocks();
+	for (size_t i = 0; i < blocks.size(); ++i)
+		block(i);
+
+	// loop entries: a prologue of their own
+	for (const MachineBlock* block: blocks) {
+		if (!block->isOsrEntry())
+			continue;
+		osrLabels_[block->osrLoop] = as_.label();
+		as_.bind(osrLabels_[block->osrLoop]);
+		prologue();
+		as_.jmp(labels_[block->id]);
+	}
+
+	epilogue();
+	return as_.finish();
+}
+
+void Emitter::prologue()
+{
+	for (Reg r: {Reg::rbx, Reg::r12, Reg::r13, Reg::r14, Reg::r15})
+		as_.push(r);
+	as_.sub(true, Reg::rsp, frameSize_);
+	as_.mov(true, mem(Reg::rsp, SelfSlot), Reg::rdx);
+	as_.mov(true, mem(Reg::rsp, FrameSlot), Reg::rcx);
+	as_.mov(true, mem(Reg::rsp, LocalsSlot), Reg::rdi);
+	as_.mov(true, mem(Reg::rsp, StackSlot), Reg::rsi);
+}
+
+void Emitter::epilogue()
+{
+	as_.bind(epilogue_);
+	as_.add(true, Reg::rsp, frameSize_);
+	for (Reg r: {Reg::r15, Reg::r14, Reg::r13, Reg::r12, Reg::rbx})
+		as_.pop(r);
+	as_.ret();
+
+	// from a byte offset into the instructions, to the index to continue at in the interpreter
+	static_assert(sizeof(Instruction) == 16, "resuming assumes 16-byte instructions");
+	as_.bind(resume_);
+	as_.shr(true, Reg::rax, 4);
+	as_.jmp(epilogue_);
+
+	for (uint32_t id = 0; id < stubs_.size(); ++id) {
+		if (stubs_[id] == SIZE_MAX)
+			continue;
+		as_.bind(stubs_[id]);
+		as_.mov(Reg::rdx, (int64_t) id);
+		as_.jmp(commonTrap_);
+	}
+
+	// saves the registers for Interpreter::jitTrap() to read values from, and returns what it does
+	as_.bind(commonTrap_);
+	for (size_t r = 0; r < LinearScan::RegisterCount; ++r)
+		as_.mov(true, mem(Reg::rsp, SaveArea + 8 * (int32_t) LinearScan::Registers[r]), LinearScan::Registers[r]);
+	as_.mov(true, Reg::rdi, mem(Reg::rsp, SelfSlot));
+	as_.mov(true, Reg::rsi, mem(Reg::rsp, FrameSlot));
+	as_.lea(Reg::rcx, mem(Reg::rsp, SaveArea));
+	as_.lea(Reg::r8, mem(Reg::rsp, SpillArea));
+	as_.mov(Reg::rax, (int64_t) runtime_.trap);
+	as_.call(Reg::rax);
+	as_.jmp(epilogue_);
+}
+
+void Emitter::block(size_t index)
+{
+	const std::vector<MachineBlock*>& blocks = function_.blocks();
+	const MachineBlock* block = blocks[index];
+	const MachineBlock* next = index + 1 < blocks.size() ? blocks[index + 1] : nullptr;
+
+	as_.bind(labels_[block->id]);
+	for (size_t k = 0; k < block->instrs.size(); ++k)
+		instruction(block, k, next);
+}
+
+void Emitter::instruction(const MachineBlock* block, size_t k, const MachineBlock* next)
+{
+	const MachineInstr& instr = block->instrs[k];
+	uint32_t position = allocation_.position(block, k);
+	bool wide = instr.isWide();
+
+	switch (instr.op) {
+		case MachineOp::Mov: {
+			const LinearScan::Location& location = allocation_.location(instr.dst);
+			if (instr.a.isImm() && location.isSpill() && (instr.type == IrType::Int || isInt32(instr.a.imm))) {
+				as_.mov(instr.type != IrType::Int, spill(location.slot), (int32_t) instr.a.imm);
+				break;
+			}
+			Reg r = target(instr.dst, Reg::rax);
+			load(r, instr.a, instr.type);
+			commit(instr.dst, r);
+			break;
+		}
+
+		case MachineOp::Local:
+		case MachineOp::Stack: {
+			Reg r = target(instr.dst, Reg::rax);
+			as_.mov(true, Reg::r11, mem(Reg::rsp, instr.op == MachineOp::Local ? LocalsSlot : StackSlot));
+			as_.mov(wide, r, mem(Reg::r11, 8 * (int32_t) instr.imm));
+			commit(instr.dst, r);
+			break;
+		}
+
+		case MachineOp::Load: {
+			Reg r = target(instr.dst, Reg::rax);
+			Mem m = address(instr.a);
+			switch (instr.access) {
+				case MachineAccess::U8: as_.movzx8(r, m); break;
+				case MachineAccess::S8: as_.movsx8(r, m); break;
+				case MachineAccess::U16: as_.movzx16(r, m); break;
+				case MachineAccess::S16: as_.movsx16(r, m); break;
+				case MachineAccess::I32: as_.mov(false, r, m); break;
+				case MachineAccess::I64: as_.mov(true, r, m); break;
+			}
+			commit(instr.dst, r);
+			break;
+		}
+
+		case MachineOp::Store: {
+			Mem m = address(instr.a);
+			bool small = instr.access != MachineAccess::I32 && instr.access != MachineAccess::I64;
+			if (instr.b.isImm() && !small && isInt32(instr.b.imm)) {
+				as_.mov(instr.access == MachineAccess::I64, m, (int32_t) instr.b.imm);
+				break;
+			}
+			Reg r = use(instr.b, instr.access == MachineAccess::I64 ? IrType::Long : IrType::Int, Reg::rax);
+			switch (instr.access) {
+				case MachineAccess::U8: case MachineAccess::S8: as_.store8(m, r); break;
+				case MachineAccess::U16: case MachineAccess::S16: as_.store16(m, r); break;
+				case MachineAccess::I32: as_.mov(false, m, r); break;
+				case MachineAccess::I64: as_.mov(true, m, r); break;
+			}
+			break;
+		}
+
+		case MachineOp::Lea: {
+			Reg r = target(instr.dst, Reg::rax);
+			as_.lea(wide, r, address(instr.a));
+			commit(instr.dst, r);
+			break;
+		}
+
+		case MachineOp::Add: case MachineOp::Sub: case MachineOp::Mul:
+		case MachineOp::And: case MachineOp::Or: case MachineOp::Xor:
+			arithmetic(instr);
+			break;
+
+		case MachineOp::Div: case MachineOp::Rem:
+			divide(instr);
+			break;
+
+		case MachineOp::Shl: case MachineOp::Shr: case MachineOp::Sar:
+			shift(instr);
+			break;
+
+		case MachineOp::Neg: {
+			Reg r = target(instr.dst, Reg::rax);
+			load(r, instr.a, instr.type);
+			as_.neg(wide, r);
+			commit(instr.dst, r);
+			break;
+		}
+
+		case MachineOp::Convert:
+			convert(instr);
+			break;
+
+		case MachineOp::Cmp3: {
+			compare(true, instr.a, instr.b);
+			as_.setcc(Cond::g, Reg::rax);
+			as_.setcc(Cond::l, Reg::rcx);
+			as_.movzx8(Reg::rax, Reg::rax);
+			as_.movzx8(Reg::rcx, Reg::rcx);
+			as_.sub(false, Reg::rax, Reg::rcx);
+			commit(instr.dst, Reg::rax);
+			break;
+		}
+
+		case MachineOp::Select:
+			select(instr);
+			break;
+
+		case MachineOp::Guard:
+			compare(wide, instr.a, instr.b);
+			as_.jcc(instr.cond, stub(instr.state, position));
+			break;
+
+		case MachineOp::Deopt:
+			as_.jmp(stub(instr.state, position));
+			break;
+
+		case MachineOp::Call:
+			call(instr, position);
+			break;
+
+		case MachineOp::Moves:
+			moves(instr);
+			break;
+
+		case MachineOp::Jump:
+			jump(block->successors[0], next);
+			break;
+
+		case MachineOp::Branch: {
+			compare(wide, instr.a, instr.b);
+			const MachineBlock* taken = block->successors[0];
+			const MachineBlock* notTaken = block->successors[1];
+			if (taken == next) {
+				as_.jcc(negate(instr.cond), labels_[notTaken->id]);
+			} else {
+				as_.jcc(instr.cond, labels_[taken->id]);
+				jump(notTaken, next);
+			}
+			break;
+		}
+
+		case MachineOp::Switch: {
+			Reg key = use(instr.a, IrType::Int, Reg::rax);
+			for (size_t i = 0; i < instr.keys.size(); ++i) {
+				if (instr.keys[i] == 0)
+					as_.test(false, key, key);
+				else
+					as_.cmp(false, key, instr.keys[i]);
+				as_.jcc(Cond::e, labels_[block->successors[i + 1]->id]);
+			}
+			jump(block->successors[0], next);
+			break;
+		}
+
+		case MachineOp::Return:
+			if (!instr.a.isNone()) {
+				as_.mov(true, Reg::r11, mem(Reg::rsp, StackSlot));
+				if (instr.a.isImm() && isInt32(instr.a.imm)) {
+					as_.mov(true, mem(Reg::r11), (int32_t) instr.a.imm);
+				} else {
+					Reg r = use(instr.a, instr.type, Reg::rax);
+					as_.mov(true, mem(Reg::r11), r);
+				}
+			}
+			as_.mov(Reg::rax, (int64_t) CompiledMethod::Returned);
+			as_.jmp(epilogue_);
+			break;
+	}
+}
+
+void Emitter::compare(bool wide, const MOperand& a, const MOperand& b)
+{
+	IrType type = wide ? IrType::Long : IrType::Int;
+	Reg r;
+	if (a.isVReg()) {
+		r = use(a.reg, Reg::rax);
+	} else {
+		r = Reg::rax;
+		load(r, a, type);
+	}
+
+	if (b.isImm()) {
+		if (b.imm == 0) {
+			as_.test(wide, r, r);
+		} else if (!wide || isInt32(b.imm)) {
+			as_.cmp(wide, r, (int32_t) b.imm);
+		} else {
+			as_.mov(Reg::r11, b.imm);
+			as_.cmp(wide, r, Reg::r11);
+		}
+	} else if (b.isMem()) {
+		as_.cmp(wide, r, address(b));
+	} else {
+		const LinearScan::Location& location = allocation_.location(b.reg);
+		if (location.isSpill())
+			as_.cmp(wide, r, spill(location.slot));
+		else
+			as_.cmp(wide, r, location.reg);
+	}
+}
+
+
+void Emitter::arithmetic(const MachineInstr& instr)
+{
+	bool wide = instr.isWide();
+	const LinearScan::Location& dst = allocation_.location(instr.dst);
+	MOperand a = instr.a;
+	MOperand b = instr.b;
+
+	// three operands as lea
+	if ((instr.op == MachineOp::Add || instr.op == MachineOp::Sub) && dst.isRegister() && a.isVReg() &&
+	    allocation_.location(a.reg).isRegister() && allocation_.location(a.reg).reg != dst.reg) {
+		Reg ra = allocation_.location(a.reg).reg;
+		int64_t displacement = instr.op == MachineOp::Sub ? -b.imm : b.imm;
+		if (b.isImm() && isInt32(displacement)) {
+			as_.lea(wide, dst.reg, mem(ra, (int32_t) displacement));
+			return;
+		}
+		if (instr.op == MachineOp::Add && b.isVReg() && allocation_.location(b.reg).isRegister()) {
+			as_.lea(wide, dst.reg, mem(ra, allocation_.location(b.reg).reg, 1));
+			return;
+		}
+	}
+
+	Reg r = target(instr.dst, Reg::rax);
+	if (instr.op == MachineOp::Mul && b.isImm() && isInt32(b.imm)) {
+		as_.imul(wide, r, use(a, instr.type, r), (int32_t) b.imm);
+		commit(instr.dst, r);
+		return;
+	}
+
+	// loading a into r must not overwrite b
+	if (!isRegister(a, r) && (isRegister(b, r) || addresses(b, r))) {
+		if (instr.op != MachineOp::Sub && b.isVReg())
+			std::swap(a, b);
+		else
+			r = Reg::rax;
+	}
+	load(r, a, instr.type);
+
+	if (b.isImm() && isInt32(b.imm)) {
+		int32_t imm = (int32_t) b.imm;
+		switch (instr.op) {
+			case MachineOp::Add: as_.add(wide, r, imm); break;
+			case MachineOp::Sub: as_.sub(wide, r, imm); break;
+			case MachineOp::And: as_.and_(wide, r, imm); break;
+			case MachineOp::Or: as_.or_(wide, r, imm); break;
+			case MachineOp::Xor: as_.xor_(wide, r, imm); break;
+			default: break;
+		}
+	} else if (b.isImm() || (b.isVReg() && allocation_.location(b.reg).isRegister())) {
+		Reg rb = use(b, instr.type, Reg::r11);
+		switch (instr.op) {
+			case MachineOp::Add: as_.add(wide, r, rb); break;
+			case MachineOp::Sub: as_.sub(wide, r, rb); break;
+			case MachineOp::Mul: as_.imul(wide, r, rb); break;
+			case MachineOp::And: as_.and_(wide, r, rb); break;
+			case MachineOp::Or: as_.or_(wide, r, rb); break;
+			case MachineOp::Xor: as_.xor_(wide, r, rb); break;
+			default: break;
+		}
+	} else {
+		Mem m = b.isMem() ? address(b) : spill(allocation_.location(b.reg).slot);
+		switch (instr.op) {
+			case MachineOp::Add: as_.add(wide, r, m); break;
+			case MachineOp::Sub: as_.sub(wide, r, m); break;
+			case MachineOp::Mul: as_.imul(wide, r, m); break;
+			case MachineOp::And: as_.and_(wide, r, m); break;
+			case MachineOp::Or: as_.or_(wide, r, m); break;
+			case MachineOp::Xor: as_.xor_(wide, r, m); break;
+			default: break;
+		}
+	}
+
+	commit(instr.dst, r);
+}
+
+void Emitter::divide(const MachineInstr& instr)
+{
+	bool wide = instr.isWide();
+	bool rem = instr.op == MachineOp::Rem;
+	int bits = wide ? 64 : 32;
+
+	if (instr.b.isImm()) {
+		int64_t divisor = instr.b.imm;
+		load(Reg::rax, instr.a, instr.type);
+		if (divisor == 1 || divisor == -1) {
+			if (rem)
+				as_.mov(Reg::rax, (int64_t) 0);
+			else if (divisor == -1)
+				as_.neg(wide, Reg::rax);
+			commit(instr.dst, Reg::rax);
+			return;
+		}
+		if (int k = powerOfTwo(divisor)) {
+			// rounding towards zero: negative dividends get divisor - 1 added first
+			as_.mov(wide, Reg::rdx, Reg::rax);
+			as_.sar(wide, Reg::rdx, bits - 1);
+			as_.shr(wide, Reg::rdx, bits - k);
+			if (rem) {
+				as_.add(wide, Reg::rdx, Reg::rax);
+				as_.and_(wide, Reg::rdx, (int32_t) -divisor);
+				as_.sub(wide, Reg::rax, Reg::rdx);
+			} else {
+				as_.add(wide, Reg::rax, Reg::rdx);
+				as_.sar(wide, Reg::rax, k);
+			}
+			commit(instr.dst, Reg::rax);
+			return;
+		}
+	}
+
+	Reg divisor = use(instr.b, instr.type, Reg::r11);
+	load(Reg::rax, instr.a, instr.type);
+
+	// MIN / -1 overflows idiv, and -x is what Java wants anyway
+	size_t done = as_.label();
+	size_t divide = as_.label();
+	if (!instr.b.isImm()) {
+		as_.cmp(wide, divisor, -1);
+		as_.jcc(Cond::ne, divide);
+		if (rem)
+			as_.mov(Reg::rax, (int64_t) 0);
+		else
+			as_.neg(wide, Reg::rax);
+		as_.jmp(done);
+	}
+	as_.bind(divide);
+	as_.cdq(wide);
+	as_.idiv(wide, divisor);
+	if (rem)
+		as_.mov(true, Reg::rax, Reg::rdx);
+	as_.bind(done);
+	commit(instr.dst, Reg::rax);
+}
+
+void Emitter::shift(const MachineInstr& instr)
+{
+	bool wide = instr.isWide();
+	Reg r = target(instr.dst, Reg::rax);
+
+	if (instr.b.isImm()) {
+		load(r, instr.a, instr.type);
+		uint8_t count = (uint8_t) instr.b.imm;
+		switch (instr.op) {
+			case MachineOp::Shl: as_.shl(wide, r, count); break;
+			case MachineOp::Shr: as_.shr(wide, r, count); break;
+			default: as_.sar(wide, r, count); break;
+		}
+	} else {
+		// the count first, r may hold it; x86 masks it like Java does
+		load(Reg::rcx, instr.b, IrType::Int);
+		load(r, instr.a, instr.type);
+		switch (instr.op) {
+			case MachineOp::Shl: as_.shl(wide, r); break;
+			case MachineOp::Shr: as_.shr(wide, r); break;
+			default: as_.sar(wide, r); break;
+		}
+	}
+
+	commit(instr.dst, r);
+}
+
+void Emitter::convert(const MachineInstr& instr)
+{
+	Reg r = target(instr.dst, Reg::rax);
+	Reg a = use(instr.a, IrType::Int, Reg::rax);
+	switch ((Opcode) instr.imm) {
+		case Opcode::i2l: as_.movsxd(r, a); break;
+		case Opcode::l2i: as_.mov(false, r, a); break;
+		case Opcode::i2b: as_.movsx8(r, a); break;
+		case Opcode::i2c: as_.movzx16(r, a); break;
+		case Opcode::i2s: as_.movsx16(r, a); break;
+		default: break;
+	}
+	commit(instr.dst, r);
+}
+
+void Emitter::select(const MachineInstr& instr)
+{
+	bool wide = function_.typeOf(instr.dst) != IrType::Int;
+	IrType type = function_.typeOf(instr.dst);
+	compare(instr.isWide(), instr.a, instr.b);
+
+	// moves leave the flags alone
+	Reg r = target(instr.dst, Reg::rax);
+	Cond cond = instr.cond;
+	MOperand ifTrue = instr.c;
+	MOperand ifFalse = instr.d;
+	if (isRegister(ifTrue, r)) {
+		std::swap(ifTrue, ifFalse);
+		cond = negate(cond);
+	}
+	load(r, ifFalse, type);
+	Reg source = use(ifTrue, type, Reg::r11);
+	as_.cmov(wide, cond, r, source);
+	commit(instr.dst, r);
+}
+
+void Emitter::call(const MachineInstr& instr, uint32_t position)
+{
+	// operands into the frame's operand stack, for the interpreter to take from there
+	int32_t slot = function_.state(instr.state).framed;
+	as_.mov(true, Reg::r11, mem(Reg::rsp, StackSlot));
+	for (size_t k = 0; k < instr.args.size(); ++k) {
+		const MOperand& arg = instr.args[k];
+		if (arg.isImm() && isInt32(arg.imm))
+			as_.mov(true, mem(Reg::r11, 8 * slot), (int32_t) arg.imm);
+		else
+			as_.mov(true, mem(Reg::r11, 8 * slot), use(arg, instr.types[k], Reg::rax));
+		slot += slotsOf(instr.types[k]);
+	}
+
+	as_.mov(true, Reg::rdi, mem(Reg::rsp, SelfSlot));
+	as_.mov(true, Reg::rsi, mem(Reg::rsp, FrameSlot));
+	as_.mov(Reg::rdx, (int64_t) (uintptr_t) instr.insn);
+	as_.lea(Reg::rcx, mem(Reg::r11, 8 * slot));
+	if (instr.callee) {
+		as_.mov(Reg::r8, (int64_t) (uintptr_t) instr.callee);
+		as_.mov(Reg::rax, (int64_t) runtime_.invoke);
+	} else {
+		as_.mov(Reg::rax, (int64_t) runtime_.step);
+	}
+	as_.call(Reg::rax);
+
+	// not run: deoptimize to before it; invalidated meanwhile: to after it
+	size_t ok = as_.label();
+	as_.test(false, Reg::rax, Reg::rax);
+	as_.jcc(Cond::ns, ok);
+	as_.cmp(false, Reg::rax, CompiledMethod::Deoptimized);
+	as_.jcc(Cond::e, stub(instr.state + 1, position + 1, instr.dst));
+	as_.jmp(stub(instr.state, position + 1, instr.dst));
+	as_.bind(ok);
+
+	if (instr.dst != NoVReg) {
+		Reg r = target(instr.dst, Reg::rax);
+		as_.mov(true, Reg::r11, mem(Reg::rsp, StackSlot));
+		as_.mov(isWide(instr.dst), r, mem(Reg::r11, 8 * function_.state(instr.state).framed));
+		commit(instr.dst, r);
+	}
+}
+
+void Emitter::moves(const MachineInstr& instr)
+{
+	// sources by location, the ones reading a destination not yet written holding it back
+	struct Move {
+		LinearScan::Location to;
+		IrType type;
+		MOperand from;
+		LinearScan::Location source;   //!< of a virtual register, or r11 once saved there
+	};
+	auto same = [](const LinearScan::Location& a, const LinearScan::Location& b) {
+		return a.kind == b.kind && (a.isRegister() ? a.reg == b.reg : a.slot == b.slot);
+	};
+
+	std::vector<Move> pending;
+	for (size_t k = 0; k < instr.dsts.size(); ++k) {
+		Move move = {allocation_.location(instr.dsts[k]), function_.typeOf(instr.dsts[k]), instr.args[k],
+			{LinearScan::Location::Kind::None, Reg::rax, 0}};
+		if (move.from.isVReg()) {
+			move.source = allocation_.location(move.from.reg);
+			if (same(move.source, move.to))
+				continue;
+		}
+		pending.push_back(move);
+	}
+
+	auto perform = [&](const Move& move) {
+		Reg r = move.to.isRegister() ? move.to.reg : Reg::rax;
+		if (move.from.isImm()) {
+			if (move.to.isSpill() && (move.type == IrType::Int || isInt32(move.from.imm))) {
+				as_.mov(move.type != IrType::Int, spill(move.to.slot), (int32_t) move.from.imm);
+				return;
+			}
+			materialize(r, move.from.imm, move.type);
+		} else if (move.source.isRegister()) {
+			r = move.source.reg;
+		} else {
+			as_.mov(move.type != IrType::Int, r, spill(move.source.slot));
+		}
+		if (move.to.isSpill())
+			as_.mov(true, spill(move.to.slot), r);
+		else if (move.to.reg != r)
+			as_.mov(true, move.to.reg, r);
+	};
+
+	while (!pending.empty()) {
+		bool progress = false;
+		for (size_t k = 0; k < pending.size(); ++k) {
+			bool blocked = false;
+			for (size_t j = 0; j < pending.size() && !blocked; ++j)
+				blocked = j != k && !pending[j].from.isImm() && same(pending[j].source, pending[k].to);
+			if (blocked)
+				continue;
+			perform(pending[k]);
+			pending.erase(pending.begin() + k);
+			progress = true;
+			break;
+		}
+		if (progress)
+			continue;
+
+		// a cycle: save one destination in r11, and have its readers read that instead
+		LinearScan::Location saved = pending.front().to;
+		if (saved.isRegister())
+			as_.mov(true, Reg::r11, saved.reg);
+		else
+			as_.mov(true, Reg::r11, spill(saved.slot));
+		for (Move& move: pending)
+			if (!move.from.isImm() && same(move.source, saved))
+				move.source = {LinearScan::Location::Kind::Register, Reg::r11, 0};
+	}
+}
+
+DebugInfo Emitter::debugInfo() const
+{
+	DebugInfo debugInfo;
+	for (uint32_t id = 0; id < stubs_.size(); ++id) {
+		const MachineState& state = function_.state(id);
+		DebugScope scope = {function_.method(), state.index, {}, {}};
+
+		auto location = [&](const MachineSlot& slot) {
+			if (slot.value.isImm())
+				return ValueLocation::constant(slot.value.imm, slot.type);
+			if (!slot.value.isVReg())
+				return ValueLocation::dead();
+			const LinearScan::Location& where = allocation_.location(slot.value.reg);
+			if (where.isRegister())
+				return ValueLocation::reg((int32_t) where.reg, slot.type);
+			return ValueLocation::spill(where.slot, slot.type);
+		};
+		for (const MachineSlot& slot: state.locals)
+			scope.locals.push_back(location(slot));
+		for (size_t k = 0; k < state.stack.size(); ++k) {
+			if (state.framed >= 0 && (int32_t) k >= state.framed)
+				scope.stack.push_back(ValueLocation::stack(k, state.stack[k].type));
+			else
+				scope.stack.push_back(location(state.stack[k]));
+		}
+
+		// also for states that no code traps to, keeping safepoint ids those of the states
+		Safepoint safepoint = {stubs_[id] == SIZE_MAX ? 0 : (uint32_t) as_.offset(stubs_[id]), state.trap, {}, true,
+			stubs_[id] == SIZE_MAX ? StackMap() : allocation_.stackMap(positions_[id], results_[id])};
+		safepoint.scopes.push_back(std::move(scope));
+		debugInfo.add(std::move(safepoint));
+	}
+	return debugInfo;
+}
+
+} // namespace
+// }}}
+
+/**
+ * Lowers \p method, the code of calls that \p hierarchy (if any)
+ * devirtualizes depending on \p dependencies; otherwise sets \p error.
+ */
+static bool lower(Method* method, const ClassHierarchy* hierarchy, MachineFunction& function,
+                  std::vector<Dependency>& dependencies, std::string& error)
+{
+	std::unique_ptr<IrGraph> graph = IrGraph::build(method);
+	if (!graph) {
+		error = "no IR";
+		return false;
+	}
+
+	// passes and selection rely on valid SSA form: one a pass broke leaves the method to the baseline compiler
+	IrPassManager pipeline;
+	pipeline.addStandardPipeline();
+	pipeline.setVerify(true);
+	if (!pipeline.run(*graph)) {
+		error = "invalid IR";
+		return false;
+	}
+	graph->computeDominators();
+
+	Selector selector(*graph, function, hierarchy, dependencies);
+	if (!selector.run()) {
+		error = selector.failure();
+		return false;
+	}
+	return true;
+}
+
+CompiledMethod* OptimizingCompiler::compile(Method* method, QuickCode* quick, VMClassLoader& loader)
+{
+	std::vector<uint16_t> depths;
+	if (!BaselineCompiler::computeStackDepths(method, quick, depths))
+		return nullptr;
+
+	// methods beyond the compiler are common, and left to the baseline compiler without a word
+	MachineFunction function(method);
+	std::vector<Dependency> dependencies;
+	std::string error;
+	if (!lower(method, &loader.hierarchy(), function, dependencies, error))
+		return nullptr;
+
+	LinearScan allocation(function);
+	if (!allocation.run())
+		return nullptr;
+
+	X86Templates::Runtime runtime = {
+		offsetof(Interpreter::Frame, pc),
+		offsetof(Interpreter::Frame, code),
+		(uintptr_t) &Interpreter::jitStep,
+		(uintptr_t) &Interpreter::jitTrap,
+		(uintptr_t) &Interpreter::jitInvoke,
+	};
+
+	Emitter emitter(runtime, function, allocation, quick->loopCount());
+	const std::vector<uint8_t>& code = emitter.generate();
+
+	CodeCache& cache = loader.codeCache();
+	const uint8_t* entry = cache.install(code.data(), code.size());
+	if (!entry)
+		return nullptr;
+
+	CompiledMethod* compiled = cache.add(new CompiledMethod(method, CompiledMethod::Tier::Optimized, entry, code.size(),
+		std::move(depths), emitter.osrEntries(), emitter.debugInfo()));
+
+	// a class loaded since compilation may already have broken an assumption
+	for (const Dependency& dependency: dependencies) {
+		if (!loader.addDependency(dependency, compiled)) {
+			compiled->invalidate();
+			break;
+		}
+	}
+
+	return compiled;
+}
+
+std::string OptimizingCompiler::dump(Method* method, std::string& error)
+{
+	MachineFunction function(method);
+	std::vector<Dependency> dependencies;
+	if (!lower(method, nullptr, function, dependencies, error))
+		return std::string();
+
+	LinearScan allocation(function);
+	if (!allocation.run()) {
+		error = allocation.error();
+		return std::string();
+	}
+
+	return function.to_s() + allocation.to_s();
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+
+class Method;
+class QuickCode;
+class VMClassLoader;
+class CompiledMethod;
+
+/**
+ * Optimizing JIT compiler, translating the SSA IR of a method (see
+ * IrGraph), after the standard pass pipeline, into x86-64 machine code
+ * that keeps values in registers.
+ *
+ * Instruction selection lowers the IR into a MachineFunction, matching
+ * x86 addressing modes: array and field accesses fold into memory
+ * operands, including loads with a single user that is an arithmetic
+ * instruction or a comparison, additions and scaled indices become lea,
+ * and the phis of simple diamonds conditional moves. LinearScan then maps
+ * virtual registers to machine registers and spill slots, and phis turn
+ * into parallel moves on the edges into their block.
+ *
+ * Like baseline code, optimized code leaves throwing to the interpreter,
+ * but its values are not in the interpreter frame: a failing null, bounds
+ * or division check, and instructions it runs through the interpreter
+ * (calls, allocations, type checks, monitors, unresolved references), have
+ * a Safepoint whose frame state says where each local and stack slot is.
+ * When the check fails, or the interpreter cannot run the instruction to
+ * completion, the code deoptimizes to the interpreter (see
+ * Interpreter::jitTrap()), and stays valid. Each safepoint comes with a
+ * StackMap of the references live in registers and spill slots.
+ *
+ * Loop headers whose frame state covers all values live there get
+ * entries for on-stack replacement, which load those values from the
+ * interpreter frame.
+ *
+ * Floating-point code is left to the baseline compiler, as is anything
+ * the IR cannot represent.
+ */
+class OptimizingCompiler {
+public:
+	/**
+	 * Compiles \p method into the code cache of \p loader, recording the
+	 * dependencies of the code with it.
+	 *
+	 * @return the compiled method, owned by the code cache, invalidated
+	 *         already if a class loaded meanwhile broke its dependencies,
+	 *         or \p nullptr if the method is beyond the compiler (uses
+	 *         floating-point, jsr/ret or invokedynamic), its IR does not
+	 *         verify after an optimization pass, or the cache is full.
+	 */
+	static CompiledMethod* compile(Method* method, QuickCode* quick, VMClassLoader& loader);
+
+	/**
+	 * Lowered and register-allocated form of \p method, as text.
+	 *
+	 * @return the text, or an empty string with \p error set to why if
+	 *         the method cannot be compiled.
+	 */
+	static std::string dump(Method* method, std::string& error);
+};
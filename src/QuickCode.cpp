@@ -0,0 +1,442 @@
+#include "QuickCode.h"
+#include "Class.h"
+#include "ConstantPool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+static inline int16_t be16(const uint8_t* p)
+{
+	return (int16_t) ((p[0] << 8) | p[1]);
+}
+
+static inline int32_t be32(const uint8_t* p)
+{
+	return (int32_t) (((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+//! Monomorphic variant of an invokevirtual or invokeinterface in any state, or 0.
+static inline uint8_t monomorphicOf(uint8_t opcode)
+{
+	switch ((Opcode) opcode) {
+		case Opcode::invokevirtual:
+		case Opcode::invokevirtual_mono:
+		case Opcode::invokevirtual_poly:
+		case Opcode::invokevirtual_mega:
+			return (uint8_t) Opcode::invokevirtual_mono;
+		case Opcode::invokeinterface:
+		case Opcode::invokeinterface_mono:
+		case Opcode::invokeinterface_poly:
+		case Opcode::invokeinterface_mega:
+			return (uint8_t) Opcode::invokeinterface_mono;
+		default:
+			return 0;
+	}
+}
+
+QuickCode* QuickCode::of(Method* method)
+{
+	if (QuickCode* code = method->quickCode())
+		return code;
+
+	method->materialize();
+
+	// the class arena is not thread-safe, so share the class' link lock
+	std::lock_guard<std::mutex> _l(method->thisClass()->linkLock_);
+
+	if (QuickCode* code = method->quickCode_.load(std::memory_order_relaxed))
+		return code;
+
+	QuickCode* code = translate(method);
+	if (!code) {
+		printf("WARNING: malformed bytecode in method %s.%s%s\n",
+			method->thisClass()->name()->c_str(), method->name()->c_str(), method->descriptor()->c_str());
+		return nullptr;
+	}
+
+	method->quickCode_.store(code, std::memory_order_release);
+	return code;
+}
+
+Instruction* QuickCode::at(uint32_t offset) const
+{
+	const uint32_t* end = offsets_ + size_;
+	const uint32_t* i = std::lower_bound((const uint32_t*) offsets_, end, offset);
+	return i != end && *i == offset ? instructions_ + (i - offsets_) : nullptr;
+}
+
+/**
+ * Translates in two passes: the first finds the instruction boundaries,
+ * the second decodes operands and maps branch targets to instruction
+ * indices, which requires the former for forward branches.
+ */
+QuickCode* QuickCode::translate(Method* method)
+{
+	const ByteView& bytecode = method->code();
+	const uint8_t* code = bytecode.data();
+	const uint32_t length = bytecode.size();
+	ConstantPool& pool = method->thisClass()->constantPool;
+
+	// {{{ instruction boundaries
+	std::vector<int32_t> indexOf(length, -1);
+	std::vector<uint32_t> offsets;
+	size_t switchSize = 0;
+	uint32_t callSiteCount = 0;
+
+	for (uint32_t pc = 0; pc < length; ) {
+		uint8_t opcode = code[pc];
+		size_t size = opcodeLength(opcode);
+
+		if (opcode >= OpcodeCount)
+			return nullptr;
+
+		if (opcode == (uint8_t) Opcode::tableswitch || opcode == (uint8_t) Opcode::lookupswitch) {
+			uint32_t table = (pc + 4) & ~3;
+			if (table + 12 > length)
+				return nullptr;
+
+			int64_t count;
+			if (opcode == (uint8_t) Opcode::tableswitch) {
+				count = (int64_t) be32(code + table + 8) - be32(code + table + 4) + 1;
+				if (count < 1 || table + 12 + count * 4 > length)
+					return nullptr;
+				size = table + 12 + count * 4 - pc;
+				switchSize += 3 + count;
+			} else {
+				count = be32(code + table + 4);
+				if (count < 0 || table + 8 + count * 8 > length)
+					return nullptr;
+				size = table + 8 + count * 8 - pc;
+				switchSize += 2 + 2 * count;
+			}
+		} else if (opcode == (uint8_t) Opcode::wide) {
+			size = pc + 1 < length && code[pc + 1] == (uint8_t) Opcode::iinc ? 6 : 4;
+		} else if (opcode == (uint8_t) Opcode::invokevirtual || opcode == (uint8_t) Opcode::invokeinterface) {
+			++callSiteCount;
+		}
+
+		if (pc + size > length)
+			return nullptr;
+
+		indexOf[pc] = offsets.size();
+		offsets.push_back(pc);
+		pc += size;
+	}
+
+	// every handler must start at an instruction
+	for (const Method::ExceptionHandler& handler: method->exceptionTable())
+		if (handler.handler >= length || indexOf[handler.handler] < 0)
+			return nullptr;
+	// }}}
+
+	Arena& arena = method->thisClass()->arena_;
+	QuickCode* quick = new (arena.allocate(sizeof(QuickCode), alignof(QuickCode))) QuickCode();
+	Instruction* insns = arena.allocateArray<Instruction>(offsets.size() + 1);
+	int32_t* switches = arena.allocateArray<int32_t>(switchSize);
+	size_t switchEnd = 0;
+	CallSite* callSites = arena.allocateArray<CallSite>(callSiteCount);
+	uint32_t callSiteEnd = 0;
+
+	memset(insns, 0, sizeof(Instruction) * (offsets.size() + 1));
+	if (callSiteCount)
+		memset(callSites, 0, sizeof(CallSite) * callSiteCount);
+
+	auto target = [&](uint32_t pc, int32_t delta, int32_t* index) -> bool {
+		int64_t to = (int64_t) pc + delta;
+		if (to < 0 || to >= length || indexOf[to] < 0)
+			return false;
+		*index = indexOf[to];
+		return true;
+	};
+
+	for (size_t i = 0; i < offsets.size(); ++i) {
+		const uint32_t pc = offsets[i];
+		const uint8_t* p = code + pc;
+		Instruction& insn = insns[i];
+		insn.opcode = *p;
+
+		switch ((Opcode) *p) {
+			case Opcode::bipush:
+				insn.operand = (int8_t) p[1];
+				break;
+			case Opcode::sipush:
+				insn.operand = be16(p + 1);
+				break;
+			case Opcode::ldc:
+			case Opcode::ldc_w: {
+				uint16_t id = *p == (uint8_t) Opcode::ldc ? p[1] : (uint16_t) be16(p + 1);
+				if (id == 0 || id >= pool.size())
+					return nullptr;
+
+				insn.opcode = (uint8_t) Opcode::ldc;
+				insn.index = id;
+				if (pool.tag(id) == ConstantTag::Integer) {
+					insn.opcode = (uint8_t) Opcode::ldc_int;
+					insn.operand = pool.integerAt(id);
+				} else if (pool.tag(id) == ConstantTag::Float) {
+					float f = pool.floatAt(id);
+					insn.opcode = (uint8_t) Opcode::ldc_int;
+					memcpy(&insn.operand, &f, sizeof(f));
+				}
+				break;
+			}
+			case Opcode::ldc2_w: {
+				uint16_t id = be16(p + 1);
+				if (id == 0 || id >= pool.size())
+					return nullptr;
+				insn.index = id;
+				if (pool.tag(id) == ConstantTag::Long) {
+					insn.resolved.bits = pool.longAt(id);
+				} else if (pool.tag(id) == ConstantTag::Double) {
+					double d = pool.doubleAt(id);
+					memcpy(&insn.resolved.bits, &d, sizeof(d));
+				} else {
+					return nullptr;
+				}
+				break;
+			}
+			case Opcode::iload:
+			case Opcode::lload:
+			case Opcode::fload:
+			case Opcode::dload:
+			case Opcode::aload:
+			case Opcode::istore:
+			case Opcode::lstore:
+			case Opcode::fstore:
+			case Opcode::dstore:
+			case Opcode::astore:
+			case Opcode::ret:
+				insn.index = p[1];
+				break;
+			case Opcode::iinc:
+				insn.index = p[1];
+				insn.operand = (int8_t) p[2];
+				break;
+			case Opcode::wide:
+				insn.opcode = p[1];
+				insn.index = (uint16_t) be16(p + 2);
+				switch ((Opcode) p[1]) {
+					case Opcode::iinc:
+						insn.operand = be16(p + 4);
+						break;
+					case Opcode::iload:
+					case Opcode::lload:
+					case Opcode::fload:
+					case Opcode::dload:
+					case Opcode::aload:
+					case Opcode::istore:
+					case Opcode::lstore:
+					case Opcode::fstore:
+					case Opcode::dstore:
+					case Opcode::astore:
+					case Opcode::ret:
+						break;
+					default:
+						return nullptr;
+				}
+				break;
+			case Opcode::ifeq:
+			case Opcode::ifne:
+			case Opcode::iflt:
+			case Opcode::ifge:
+			case Opcode::ifgt:
+			case Opcode::ifle:
+			case Opcode::if_icmpeq:
+			case Opcode::if_icmpne:
+			case Opcode::if_icmplt:
+			case Opcode::if_icmpge:
+			case Opcode::if_icmpgt:
+			case Opcode::if_icmple:
+			case Opcode::if_acmpeq:
+			case Opcode::if_acmpne:
+			case Opcode::goto_:
+			case Opcode::jsr:
+			case Opcode::ifnull:
+			case Opcode::ifnonnull:
+				if (!target(pc, be16(p + 1), &insn.operand))
+					return nullptr;
+				break;
+			case Opcode::goto_w:
+			case Opcode::jsr_w:
+				insn.opcode = *p == (uint8_t) Opcode::goto_w ? (uint8_t) Opcode::goto_ : (uint8_t) Opcode::jsr;
+				if (!target(pc, be32(p + 1), &insn.operand))
+					return nullptr;
+				break;
+			case Opcode::tableswitch: {
+				const uint8_t* table = code + ((pc + 4) & ~3);
+				int32_t low = be32(table + 4);
+				int32_t high = be32(table + 8);
+				int32_t* out = switches + switchEnd;
+				if (!target(pc, be32(table), &out[0]))
+					return nullptr;
+				out[1] = low;
+				out[2] = high;
+				for (int64_t k = 0; k <= (int64_t) high - low; ++k)
+					if (!target(pc, be32(table + 12 + 4 * k), &out[3 + k]))
+						return nullptr;
+				insn.operand = switchEnd;
+				switchEnd += 3 + ((int64_t) high - low + 1);
+				break;
+			}
+			case Opcode::lookupswitch: {
+				const uint8_t* table = code + ((pc + 4) & ~3);
+				int32_t count = be32(table + 4);
+				int32_t* out = switches + switchEnd;
+				if (!target(pc, be32(table), &out[0]))
+					return nullptr;
+				out[1] = count;
+				for (int32_t k = 0; k < count; ++k) {
+					out[2 + 2 * k] = be32(table + 8 + 8 * k);
+					if (!target(pc, be32(table + 12 + 8 * k), &out[3 + 2 * k]))
+						return nullptr;
+				}
+				insn.operand = switchEnd;
+				switchEnd += 2 + 2 * count;
+				break;
+			}
+			case Opcode::new_:
+			case Opcode::anewarray:
+			case Opcode::checkcast:
+			case Opcode::instanceof:
+				insn.index = (uint16_t) be16(p + 1);
+				if (!pool.className(insn.index))
+					return nullptr;
+				break;
+			case Opcode::invokevirtual:
+			case Opcode::invokeinterface:
+				insn.operand = callSiteEnd++;
+				// fall through
+			case Opcode::getstatic:
+			case Opcode::putstatic:
+			case Opcode::getfield:
+			case Opcode::putfield:
+			case Opcode::invokespecial:
+			case Opcode::invokestatic:
+			case Opcode::invokedynamic:
+				insn.index = (uint16_t) be16(p + 1);
+				if (insn.index == 0 || insn.index >= pool.size())
+					return nullptr;
+				break;
+			case Opcode::newarray:
+				if (p[1] < 4 || p[1] > 11)
+					return nullptr;
+				insn.index = p[1];
+				break;
+			case Opcode::multianewarray:
+				insn.index = (uint16_t) be16(p + 1);
+				insn.operand = p[3];
+				if (!pool.className(insn.index) || insn.operand == 0)
+					return nullptr;
+				break;
+			default:
+				break;
+		}
+	}
+
+	// falling off the end of the code hits an invalid instruction instead
+	insns[offsets.size()].opcode = 0xff;
+
+	// {{{ loops, numbered by header for the back edges to refer to them
+	std::vector<uint32_t> headers;
+	for (uint32_t i = 0; i < offsets.size(); ++i) {
+		Instruction& insn = insns[i];
+		Opcode op = (Opcode) insn.opcode;
+		bool branches = (op >= Opcode::ifeq && op <= Opcode::goto_) || op == Opcode::ifnull || op == Opcode::ifnonnull;
+		if (!branches || insn.operand > (int32_t) i)
+			continue;
+		auto header = std::find(headers.begin(), headers.end(), (uint32_t) insn.operand);
+		insn.index = header - headers.begin();
+		if (header == headers.end())
+			headers.push_back(insn.operand);
+	}
+
+	TraceAnchor* loops = arena.allocateArray<TraceAnchor>(headers.size());
+	for (size_t i = 0; i < headers.size(); ++i)
+		loops[i] = {headers[i], 0, 0, nullptr};
+	// }}}
+
+	uint32_t* offsetTable = arena.allocateArray<uint32_t>(offsets.size() + 1);
+	std::copy(offsets.begin(), offsets.end(), offsetTable);
+	offsetTable[offsets.size()] = length;
+
+	MethodProfile* profile = new (arena.allocate(sizeof(MethodProfile), alignof(MethodProfile))) MethodProfile(method);
+
+	quick->method_ = method;
+	quick->instructions_ = insns;
+	quick->offsets_ = offsetTable;
+	quick->switches_ = switches;
+	quick->callSites_ = callSites;
+	quick->loops_ = loops;
+	quick->profile_ = profile;
+	quick->size_ = offsets.size();
+	quick->callSiteCount_ = callSiteCount;
+	quick->loopCount_ = headers.size();
+
+	return quick;
+}
+
+void QuickCode::cache(Instruction* insn, Method* method, Class* receiver, Method* target)
+{
+	std::lock_guard<std::mutex> _l(method_->thisClass()->linkLock_);
+
+	CallSite& site = callSites_[insn->operand];
+	uint8_t opcode = __atomic_load_n(&insn->opcode, __ATOMIC_RELAXED);
+	uint8_t mono = monomorphicOf(opcode);
+
+	// the state may have moved on since the caller's lookup
+	if (opcode == mono + 2)
+		return;
+
+	for (uint32_t i = 0; i < site.size; ++i)
+		if (site.entries[i].receiver == receiver)
+			return;
+
+	if (!site.method) {
+		site.method = method;
+		site.argumentSlots = method->argumentSlots();
+	}
+
+	if (site.size == CallSite::Entries) {
+		++site.transitions;
+		quicken(insn, (Opcode) (mono + 2));
+		return;
+	}
+
+	site.entries[site.size].receiver = receiver;
+	site.entries[site.size].target = target;
+	site.entries[site.size].count = 0;
+	__atomic_store_n(&site.size, site.size + 1, __ATOMIC_RELEASE);
+
+	// unresolved to monomorphic, and monomorphic to polymorphic
+	if (site.size <= 2) {
+		++site.transitions;
+		quicken(insn, (Opcode) (mono + site.size - 1));
+	}
+}
+
+void QuickCode::dump(const Method* method) const
+{
+	for (uint32_t i = 0; i < size_; ++i) {
+		const Instruction& insn = instructions_[i];
+		int line = method->lineNumber(offsets_[i]);
+		const char* name = opcodeName(insn.opcode);
+
+		printf("%5u  @%-5u", i, offsets_[i]);
+		if (line >= 0)
+			printf(" line %-5d", line);
+		else
+			printf("           ");
+		printf(" %-22s index=%u operand=%d", name ? name : "?", insn.index, insn.operand);
+
+		if (monomorphicOf(insn.opcode)) {
+			const CallSite& site = callSites_[insn.operand];
+			printf(" hits=%llu misses=%u transitions=%u", (unsigned long long) site.hits(), site.misses,
+				site.transitions);
+			for (uint32_t k = 0; k < site.size; ++k)
+				printf(" %s", site.entries[k].receiver ? site.entries[k].receiver->name()->c_str() : "[]");
+		}
+		printf("\n");
+	}
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+#include "Opcodes.h"
+#include "MethodProfile.h"
+#include <stdint.h>
+#include <stddef.h>
+
+class Class;
+class Method;
+class JObject;
+class CompiledMethod;
+class Trace;
+
+/**
+ * A pre-decoded instruction of quickened code.
+ *
+ * Operands are widened and in native byte order, and branch targets are
+ * instruction indices. Instructions that need a constant pool entry start
+ * out with its index, and get rewritten into their quick variant (see
+ * JVM_QUICK_OPCODES) with the resolved entry once first executed.
+ */
+struct Instruction {
+	uint8_t opcode;
+	uint8_t reserved_;
+	uint16_t index;    //!< local variable, constant pool index, argument slots, newarray type or loop of a back edge
+	int32_t operand;   //!< immediate, branch target, iinc delta, dimensions, vtable index or switch table
+
+	union {
+		int64_t bits;       //!< ldc2_w value
+		uint32_t offset;    //!< getfield/putfield byte offset into the instance data
+		uint8_t* address;   //!< getstatic/putstatic address of the static field
+		Method* method;     //!< invoke target
+		Class* type;        //!< new/checkcast/instanceof class
+		JObject* object;    //!< ldc string
+		BranchProfile branch; //!< outcomes of a conditional branch
+	} resolved;
+};
+
+static_assert(sizeof(Instruction) == 16, "instructions must stay two words");
+
+/**
+ * Inline cache of an invokevirtual or invokeinterface instruction, which
+ * refers to it by its operand.
+ *
+ * Its state is the instruction's quick variant: monomorphic once the first
+ * receiver class is cached, polymorphic with up to \p Entries of them,
+ * and megamorphic beyond, dispatching through the vtable or itables
+ * without caching.
+ *
+ * Entries are only ever appended, under the owning class' link lock, and
+ * published by a release store of \p size. The counters are statistics,
+ * updated without synchronization between threads (see MethodProfile), and
+ * the entries' counts make up the call site's receiver type profile.
+ */
+struct CallSite {
+	static const unsigned Entries = 4;
+
+	struct Entry {
+		Class* receiver;     //!< \p nullptr for arrays
+		Method* target;
+		uint32_t count;      //!< calls with this receiver class, once cached
+	};
+
+	Entry entries[Entries];
+	uint32_t size;
+	uint16_t argumentSlots;  //!< of the resolved method, locating the receiver
+	Method* method;          //!< the resolved method
+
+	uint32_t misses;         //!< calls that looked up their target, including all megamorphic ones
+	uint32_t transitions;    //!< state changes, from unresolved to megamorphic at most three
+
+	void hit(Entry& entry) { MethodProfile::count(&entry.count); }
+	void miss() { MethodProfile::count(&misses); }
+
+	//! Calls to a cached receiver class.
+	uint64_t hits() const {
+		uint64_t sum = 0;
+		for (uint32_t i = 0; i < size; ++i)
+			sum += entries[i].count;
+		return sum;
+	}
+};
+
+/**
+ * A loop header of quickened code, i.e. the target of a backward branch.
+ *
+ * The backward branches to it refer to it by their index. Root traces
+ * start here (see Trace), recorded once the header's back edges counted
+ * past the trace threshold in a hot method. Recordings that fail count as
+ * aborts, and too many of them blacklist the loop.
+ */
+struct TraceAnchor {
+	uint32_t header;   //!< instruction index
+	uint32_t count;    //!< back edges taken to the header since the last recording
+	uint32_t aborts;
+	Trace* trace;      //!< root trace, once compiled
+
+	Trace* compiled() const { return __atomic_load_n(&trace, __ATOMIC_ACQUIRE); }
+	void setCompiled(Trace* compiled) { __atomic_store_n(&trace, compiled, __ATOMIC_RELEASE); }
+};
+
+/**
+ * Quickened method body, the interpreter's internal form of bytecode.
+ *
+ * Translated once per method on its first invocation and kept in the
+ * class arena. The original bytecode stays untouched, and each instruction
+ * maps back to its bytecode offset for exception tables, line numbers and
+ * diagnostics.
+ *
+ * Switch tables are kept out of line:
+ * tableswitch:  default, low, high, targets[high - low + 1]
+ * lookupswitch: default, npairs, {match, target}[npairs], sorted by match
+ *
+ * So are the inline caches of invokevirtual and invokeinterface (see
+ * CallSite), and the loop headers (see TraceAnchor).
+ *
+ * Once the method turned hot, it may also have native code, compiled from
+ * the quickened instructions (see CompiledMethod).
+ */
+class QuickCode {
+private:
+	Method* method_;
+	Instruction* instructions_;  //!< followed by an invalid instruction as guard
+	uint32_t* offsets_;          //!< bytecode offset of each instruction, and of the guard
+	int32_t* switches_;
+	CallSite* callSites_;
+	TraceAnchor* loops_;
+	MethodProfile* profile_;
+	CompiledMethod* compiled_;
+	uint32_t size_;
+	uint32_t callSiteCount_;
+	uint32_t loopCount_;
+
+	QuickCode() :
+		method_(nullptr), instructions_(nullptr), offsets_(nullptr), switches_(nullptr),
+		callSites_(nullptr), loops_(nullptr), profile_(nullptr), compiled_(nullptr), size_(0),
+		callSiteCount_(0), loopCount_(0) {}
+
+public:
+	/**
+	 * Quickened body of \p method, translating it unless done yet.
+	 *
+	 * Safe to call concurrently. Returns \p nullptr if the bytecode is
+	 * malformed, i.e. has undefined opcodes, truncated instructions or
+	 * branches to the middle of an instruction.
+	 */
+	static QuickCode* of(Method* method);
+
+	Instruction* instructions() const { return instructions_; }
+	uint32_t size() const { return size_; }
+
+	//! Bytecode offset of given instruction.
+	uint32_t offsetOf(const Instruction* insn) const { return offsets_[insn - instructions_]; }
+
+	//! Instruction starting at bytecode \p offset, or \p nullptr.
+	Instruction* at(uint32_t offset) const;
+
+	const int32_t* switchTable(int32_t index) const { return switches_ + index; }
+
+	CallSite* callSite(int32_t index) const { return callSites_ + index; }
+	CallSite* callSites() const { return callSites_; }
+	uint32_t callSiteCount() const { return callSiteCount_; }
+
+	//! Loop of a backward branch, by its index.
+	TraceAnchor* loop(uint16_t index) const { return loops_ + index; }
+	TraceAnchor* loops() const { return loops_; }
+	uint32_t loopCount() const { return loopCount_; }
+
+	//! Loop with its header at instruction \p index, or \p nullptr.
+	TraceAnchor* loopAt(uint32_t index) const {
+		for (uint32_t i = 0; i < loopCount_; ++i)
+			if (loops_[i].header == index)
+				return loops_ + i;
+		return nullptr;
+	}
+
+	MethodProfile* profile() const { return profile_; }
+
+	//! Native code of this method, or \p nullptr unless compiled.
+	CompiledMethod* compiled() const { return __atomic_load_n(&compiled_, __ATOMIC_ACQUIRE); }
+	void setCompiled(CompiledMethod* compiled) { __atomic_store_n(&compiled_, compiled, __ATOMIC_RELEASE); }
+
+	//! Replaces the native code by \p compiled if still \p expected.
+	bool replaceCompiled(CompiledMethod* expected, CompiledMethod* compiled) {
+		return __atomic_compare_exchange_n(&compiled_, &expected, compiled, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+	}
+
+	/**
+	 * Caches \p target for \p receiver at the call site of \p insn, an
+	 * invokevirtual or invokeinterface in any state, and advances its state.
+	 *
+	 * @param method the resolved method, when called on first execution.
+	 */
+	void cache(Instruction* insn, Method* method, Class* receiver, Method* target);
+
+	/**
+	 * Replaces \p insn with its quick variant, whose operands must
+	 * have been stored into \p insn before.
+	 *
+	 * Other threads running the same method either still see the old
+	 * instruction, or the new one along with its operands.
+	 */
+	static void quicken(Instruction* insn, Opcode opcode) {
+		__atomic_store_n(&insn->opcode, (uint8_t) opcode, __ATOMIC_RELEASE);
+	}
+
+	void dump(const Method* method) const;
+
+private:
+	static QuickCode* translate(Method* method);
+};
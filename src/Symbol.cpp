@@ -0,0 +1,87 @@
+#include "Symbol.h"
+
+SymbolTable::SymbolTable()
+{
+	for (Shard& shard: shards_) {
+		shard.count = 0;
+		shard.slots.resize(64, nullptr);
+	}
+}
+
+SymbolTable& SymbolTable::global()
+{
+	// never destroyed, as symbols may be referenced during static destruction
+	static SymbolTable* table = new SymbolTable();
+	return *table;
+}
+
+uint32_t SymbolTable::hash(const char* s, size_t n)
+{
+	// FNV-1a
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < n; ++i) {
+		h ^= (uint8_t) s[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+Symbol** SymbolTable::probe(Shard& shard, uint32_t hash, const char* s, size_t n)
+{
+	// the low bits select the shard, so probe by the high ones
+	size_t mask = shard.slots.size() - 1;
+	for (size_t i = (hash >> 6) & mask; ; i = (i + 1) & mask) {
+		Symbol*& slot = shard.slots[i];
+		if (!slot || (slot->hash_ == hash && slot->equals(s, n)))
+			return &slot;
+	}
+}
+
+const Symbol* SymbolTable::intern(const char* s, size_t n)
+{
+	uint32_t h = hash(s, n);
+	Shard& shard = shards_[h % ShardCount];
+	std::lock_guard<std::mutex> _l(shard.lock);
+
+	Symbol** slot = probe(shard, h, s, n);
+	if (*slot)
+		return *slot;
+
+	if ((shard.count + 1) * 2 > shard.slots.size()) {
+		std::vector<Symbol*> old(shard.slots.size() * 2, nullptr);
+		old.swap(shard.slots);
+		for (Symbol* symbol: old)
+			if (symbol)
+				*probe(shard, symbol->hash_, symbol->c_str(), symbol->size()) = symbol;
+
+		slot = probe(shard, h, s, n);
+	}
+
+	*slot = new Symbol(h, s, n);
+	++shard.count;
+
+	return *slot;
+}
+
+const Symbol* SymbolTable::lookup(const char* s, size_t n)
+{
+	uint32_t h = hash(s, n);
+	Shard& shard = shards_[h % ShardCount];
+	std::lock_guard<std::mutex> _l(shard.lock);
+
+	return *probe(shard, h, s, n);
+}
+
+size_t SymbolTable::size()
+{
+	size_t total = 0;
+	for (Shard& shard: shards_) {
+		std::lock_guard<std::mutex> _l(shard.lock);
+		total += shard.count;
+	}
+	return total;
+}
+
+#define X(id, str) const Symbol* const Symbols::id = SymbolTable::global().intern(str);
+JVM_SYMBOLS(X)
+#undef X
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <jvm/Utf8String.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+
+/**
+ * Interned, immutable UTF-8 name.
+ *
+ * There is exactly one Symbol per distinct string within the process, so
+ * symbols compare equal if and only if their pointers do.
+ */
+class Symbol {
+private:
+	friend class SymbolTable;
+
+	uint32_t hash_;
+	Utf8String value_;
+
+	Symbol(uint32_t hash, const char* s, size_t n) : hash_(hash), value_((const uint8_t*) s, n) {}
+
+public:
+	Symbol(const Symbol&) = delete;
+	Symbol& operator=(const Symbol&) = delete;
+
+	uint32_t hash() const { return hash_; }
+	size_t size() const { return value_.size(); }
+	const char* c_str() const { return value_.c_str(); }
+	const Utf8String& value() const { return value_; }
+
+	bool equals(const char* s, size_t n) const { return value_.equals(s, n); }
+	bool equals(const char* s) const { return equals(s, strlen(s)); }
+};
+
+/**
+ * Process-wide table of interned symbols.
+ *
+ * Symbols are never freed. The table is split into independently locked
+ * shards, so concurrent class loading rarely contends on it.
+ */
+class SymbolTable {
+private:
+	static const size_t ShardCount = 64;
+
+	struct Shard {
+		std::mutex lock;
+		size_t count;
+		std::vector<Symbol*> slots; // open addressing, power of two
+	};
+
+	Shard shards_[ShardCount];
+
+	SymbolTable();
+
+public:
+	SymbolTable(const SymbolTable&) = delete;
+	SymbolTable& operator=(const SymbolTable&) = delete;
+
+	static SymbolTable& global();
+
+	//! Returns the symbol for given string, creating it if needed.
+	const Symbol* intern(const char* s, size_t n);
+	const Symbol* intern(const char* s) { return intern(s, strlen(s)); }
+	const Symbol* intern(const std::string& s) { return intern(s.data(), s.size()); }
+
+	//! Returns the symbol for given string, or \p nullptr if never interned.
+	const Symbol* lookup(const char* s, size_t n);
+	const Symbol* lookup(const char* s) { return lookup(s, strlen(s)); }
+
+	//! Number of symbols interned so far.
+	size_t size();
+
+	static uint32_t hash(const char* s, size_t n);
+
+private:
+	static Symbol** probe(Shard& shard, uint32_t hash, const char* s, size_t n);
+};
+
+//! Shortcut for SymbolTable::global().intern().
+inline const Symbol* intern(const char* s, size_t n) { return SymbolTable::global().intern(s, n); }
+inline const Symbol* intern(const char* s) { return SymbolTable::global().intern(s); }
+
+/**
+ * Well-known symbols, interned once at startup.
+ */
+#define JVM_SYMBOLS(X) \
+	X(Code, "Code") \
+	X(ConstantValue, "ConstantValue") \
+	X(Deprecated, "Deprecated") \
+	X(Exceptions, "Exceptions") \
+	X(LineNumberTable, "LineNumberTable") \
+	X(LocalVariableTable, "LocalVariableTable") \
+	X(LocalVariableTypeTable, "LocalVariableTypeTable") \
+	X(Signature, "Signature") \
+	X(SourceFile, "SourceFile") \
+	X(StackMapTable, "StackMapTable") \
+	X(init, "<init>") \
+	X(clinit, "<clinit>") \
+	X(main, "main") \
+	X(main_signature, "([Ljava/lang/String;)V") \
+	X(void_signature, "()V") \
+	X(java_lang_Object, "java/lang/Object")
+
+struct Symbols {
+#define X(id, str) static const Symbol* const id;
+	JVM_SYMBOLS(X)
+#undef X
+};
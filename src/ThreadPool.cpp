@@ -0,0 +1,78 @@
+#include "ThreadPool.h"
+
+#include <atomic>
+
+ThreadPool::ThreadPool(size_t threadCount) :
+	workers_(),
+	tasks_(),
+	lock_(),
+	cond_(),
+	stopping_(false)
+{
+	for (size_t i = 0; i < threadCount; ++i)
+		workers_.push_back(std::thread(&ThreadPool::work, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> _l(lock_);
+		stopping_ = true;
+	}
+	cond_.notify_all();
+
+	for (std::thread& worker: workers_)
+		worker.join();
+}
+
+void ThreadPool::enqueue(Task task)
+{
+	{
+		std::lock_guard<std::mutex> _l(lock_);
+		tasks_.push_back(std::move(task));
+	}
+	cond_.notify_one();
+}
+
+void ThreadPool::work()
+{
+	for (;;) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> l(lock_);
+			cond_.wait(l, [&]() { return stopping_ || !tasks_.empty(); });
+			if (tasks_.empty())
+				return;
+
+			task = std::move(tasks_.front());
+			tasks_.pop_front();
+		}
+		task();
+	}
+}
+
+void ThreadPool::run(std::vector<Task>& tasks)
+{
+	if (tasks.empty())
+		return;
+
+	std::mutex doneLock;
+	std::condition_variable doneCond;
+	size_t pending = tasks.size() - 1;
+
+	for (size_t i = 1; i < tasks.size(); ++i) {
+		Task* task = &tasks[i];
+		enqueue([&, task]() {
+			(*task)();
+
+			std::lock_guard<std::mutex> _l(doneLock);
+			if (--pending == 0)
+				doneCond.notify_one();
+		});
+	}
+
+	tasks[0]();
+
+	std::unique_lock<std::mutex> l(doneLock);
+	doneCond.wait(l, [&]() { return pending == 0; });
+}
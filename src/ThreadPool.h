@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/**
+ * Fixed-size pool of worker threads executing queued tasks.
+ */
+class ThreadPool {
+public:
+	typedef std::function<void()> Task;
+
+private:
+	std::vector<std::thread> workers_;
+	std::deque<Task> tasks_;
+	std::mutex lock_;
+	std::condition_variable cond_;
+	bool stopping_;
+
+public:
+	explicit ThreadPool(size_t threadCount);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	size_t size() const { return workers_.size(); }
+
+	void enqueue(Task task);
+
+	/**
+	 * Runs all tasks and returns once all of them have completed.
+	 *
+	 * The calling thread runs tasks, too, rather than idling.
+	 */
+	void run(std::vector<Task>& tasks);
+
+private:
+	void work();
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <vector>
+
+class Class;
+class Method;
+class QuickCode;
+class Interpreter;
+class Trace;
+struct TraceAnchor;
+union Slot;
+
+/**
+ * Side exit of a trace, where execution leaves the recorded path.
+ *
+ * Each exit has its own stub in the trace's code that jumps to target,
+ * with the exit in rax. That is the trace's leave code at first, returning
+ * the exit to the interpreter. Once the exit has been taken often enough
+ * for the path beyond it to be recorded, target becomes that branch
+ * trace's code instead, so that execution stays native.
+ */
+struct TraceExit {
+	enum class Kind : uint8_t {
+		Guard,   //!< a branch or receiver class other than recorded
+		Check,   //!< a failing check, or an instruction for the interpreter to run
+	};
+
+	const void* target;   //!< jumped to by the exit stub; first, for it to load
+	Trace* trace;
+	uint32_t index;       //!< instruction to continue at
+	uint16_t depth;       //!< operand stack slots in use there
+	Kind kind;
+	uint32_t count;       //!< times taken to the interpreter
+	uint32_t aborts;      //!< failed recordings of a branch
+	Trace* branch;        //!< attached branch trace, if any
+};
+
+/**
+ * Native code of a linear path through a loop, as recorded.
+ *
+ * A root trace starts at a loop header (see TraceAnchor) and runs the
+ * path taken most recently through the loop's body, over and over. A
+ * branch trace continues at one of the side exits of a trace instead. Both
+ * end by jumping to the loop of a root trace: their own, or the one of the
+ * loop header they reached. Together they form a tree of traces per loop,
+ * of which only the root is entered from the interpreter.
+ *
+ * Like compiled methods, traces run on the interpreter frame, see
+ * CompiledMethod.
+ */
+class Trace {
+public:
+	//! Root trace entry, returning the exit taken.
+	typedef TraceExit* (*Entry)(Slot* locals, Slot* stack, Interpreter* interpreter, void* frame);
+
+private:
+	Method* method_;
+	TraceAnchor* anchor_;    //!< loop of a root trace
+	TraceExit* parent_;      //!< exit of a branch trace
+	uint32_t start_;         //!< instruction index
+	uint16_t depth_;         //!< operand stack slots in use at the start
+	uint32_t length_;        //!< recorded instructions
+	const uint8_t* code_;
+	size_t codeSize_;
+	size_t loopOffset_;
+	std::deque<TraceExit> exits_;  //!< stable addresses, for the exit stubs
+
+public:
+	Trace(Method* method, TraceAnchor* anchor, TraceExit* parent, uint32_t start, uint16_t depth, uint32_t length) :
+		method_(method), anchor_(anchor), parent_(parent), start_(start), depth_(depth), length_(length),
+		code_(nullptr), codeSize_(0), loopOffset_(0), exits_() {}
+
+	Trace(const Trace&) = delete;
+	Trace& operator=(const Trace&) = delete;
+
+	Method* method() const { return method_; }
+	bool isRoot() const { return parent_ == nullptr; }
+	TraceAnchor* anchor() const { return anchor_; }
+	TraceExit* parent() const { return parent_; }
+	uint32_t start() const { return start_; }
+	uint16_t depth() const { return depth_; }
+	uint32_t length() const { return length_; }
+
+	Entry entry() const { return (Entry) code_; }
+	const uint8_t* code() const { return code_; }
+	size_t codeSize() const { return codeSize_; }
+
+	//! Code that other traces continue at, past the entry of a root.
+	const uint8_t* loop() const { return code_ + loopOffset_; }
+
+	TraceExit* addExit(TraceExit::Kind kind, uint32_t index, uint16_t depth) {
+		exits_.push_back({nullptr, this, index, depth, kind, 0, 0, nullptr});
+		return &exits_.back();
+	}
+	size_t exitCount() const { return exits_.size(); }
+
+	//! Sets the installed code, with all exits leaving at \p leaveOffset.
+	void setCode(const uint8_t* code, size_t size, size_t loopOffset, size_t leaveOffset) {
+		code_ = code;
+		codeSize_ = size;
+		loopOffset_ = loopOffset;
+		for (TraceExit& exit: exits_)
+			exit.target = code + leaveOffset;
+	}
+
+	//! Continues \p exit in \p branch's code from now on.
+	static void attach(TraceExit* exit, Trace* branch) {
+		exit->branch = branch;
+		__atomic_store_n(&exit->target, (const void*) branch->loop(), __ATOMIC_RELEASE);
+	}
+};
+
+/**
+ * A trace being recorded by the interpreter, one instruction at a time
+ * before it runs.
+ */
+struct TraceRecording {
+	struct Entry {
+		uint32_t index;
+		uint16_t depth;     //!< operand stack slots in use before it
+		bool taken;         //!< of a conditional branch
+		Class* receiver;    //!< of a virtual call, \p nullptr if an array
+	};
+
+	Method* method;
+	QuickCode* quick;
+	TraceAnchor* anchor;   //!< loop of the tree
+	TraceExit* exit;       //!< that a branch trace starts at, \p nullptr for a root
+	std::vector<Entry> entries;
+	TraceAnchor* end;      //!< loop header that the recording closed at, if any
+
+	TraceRecording(Method* method, QuickCode* quick, TraceAnchor* anchor, TraceExit* exit) :
+		method(method), quick(quick), anchor(anchor), exit(exit), entries(), end(nullptr) {}
+};
@@ -0,0 +1,191 @@
+#include "TraceCompiler.h"
+#include "CodeCache.h"
+#include "Interpreter.h"
+#include "JObject.h"
+#include "QuickCode.h"
+#include "Trace.h"
+#include "X86Assembler.h"
+#include "X86Templates.h"
+
+#include <stddef.h>
+#include <memory>
+#include <utility>
+#include <vector>
+
+//! Whether \p op has yet to resolve its operands, which only the interpreter does.
+static bool isUnresolved(Opcode op)
+{
+	switch (op) {
+		case Opcode::ldc: case Opcode::ldc_w:
+		case Opcode::getstatic: case Opcode::putstatic: case Opcode::getfield: case Opcode::putfield:
+		case Opcode::invokevirtual: case Opcode::invokespecial: case Opcode::invokestatic: case Opcode::invokeinterface:
+		case Opcode::new_: case Opcode::checkcast: case Opcode::instanceof:
+			return true;
+		default:
+			return false;
+	}
+}
+
+bool TraceCompiler::isTraceable(Opcode op)
+{
+	switch (op) {
+		case Opcode::ireturn: case Opcode::lreturn: case Opcode::freturn: case Opcode::dreturn:
+		case Opcode::areturn: case Opcode::return_: case Opcode::athrow:
+		case Opcode::tableswitch: case Opcode::lookupswitch:
+		case Opcode::jsr: case Opcode::jsr_w: case Opcode::ret:
+		case Opcode::wide: case Opcode::invokedynamic: case Opcode::multianewarray:
+			return false;
+		default:
+			return (size_t) op < QuickOpcodeEnd;
+	}
+}
+
+// {{{ code generation
+namespace {
+
+class Codegen {
+private:
+	X86Assembler as_;
+	X86Templates templates_;
+	const TraceRecording& recording_;
+	Trace* trace_;
+	size_t loop_;
+	size_t leave_;
+	std::vector<std::pair<size_t, TraceExit*>> exits_;
+
+public:
+	Codegen(const X86Templates::Runtime& runtime, const TraceRecording& recording, Trace* trace) :
+		as_(), templates_(as_, runtime), recording_(recording), trace_(trace),
+		loop_(as_.label()), leave_(as_.label()), exits_() {}
+
+	//! Code, or \p nullptr if some instruction cannot be compiled.
+	const std::vector<uint8_t>* generate();
+
+	size_t loopOffset() const { return as_.offset(loop_); }
+	size_t leaveOffset() const { return as_.offset(leave_); }
+
+private:
+	bool instruction(const TraceRecording::Entry& entry);
+
+	//! Side exit to the interpreter at instruction \p index with \p depth operand slots.
+	size_t exit(TraceExit::Kind kind, uint32_t index, int depth) {
+		size_t label = as_.label();
+		exits_.push_back(std::make_pair(label, trace_->addExit(kind, index, depth)));
+		return label;
+	}
+};
+
+const std::vector<uint8_t>* Codegen::generate()
+{
+	if (trace_->isRoot())
+		templates_.prologue();
+	as_.bind(loop_);
+
+	for (const TraceRecording::Entry& entry: recording_.entries)
+		if (!instruction(entry))
+			return nullptr;
+
+	// on to the loop header that the recording reached
+	if (recording_.end == recording_.anchor && trace_->isRoot()) {
+		as_.jmp(loop_);
+	} else {
+		as_.mov(Reg::rax, (int64_t) (uintptr_t) recording_.end->compiled()->loop());
+		as_.jmp(Reg::rax);
+	}
+
+	as_.bind(leave_);
+	templates_.epilogue();
+
+	for (const auto& stub: exits_) {
+		as_.bind(stub.first);
+		as_.mov(Reg::rax, (int64_t) (uintptr_t) stub.second);
+		as_.jmp(mem(Reg::rax, offsetof(TraceExit, target)));
+	}
+
+	return &as_.finish();
+}
+
+bool Codegen::instruction(const TraceRecording::Entry& entry)
+{
+	const Instruction& insn = recording_.quick->instructions()[entry.index];
+	Opcode op = (Opcode) __atomic_load_n(&insn.opcode, __ATOMIC_ACQUIRE);
+	uint32_t i = entry.index;
+	int d = entry.depth;
+
+	if (X86Templates::isConditionalBranch(op)) {
+		// a guard to stay on the path recorded
+		if (insn.operand == (int32_t) i + 1)
+			return true;
+		Cond taken = templates_.compare(op, d);
+		int after = d - X86Templates::branchOperands(op);
+		if (entry.taken)
+			as_.jcc(negate(taken), exit(TraceExit::Kind::Guard, i + 1, after));
+		else
+			as_.jcc(taken, exit(TraceExit::Kind::Guard, insn.operand, after));
+		return true;
+	}
+
+	switch (op) {
+		case Opcode::goto_:
+			return true;
+
+		case Opcode::invokevirtual_mono: case Opcode::invokevirtual_poly:
+		case Opcode::invokeinterface_mono: case Opcode::invokeinterface_poly:
+			if (entry.receiver) {
+				// the interpreter throws the NullPointerException
+				const CallSite* site = recording_.quick->callSite(insn.operand);
+				as_.mov(true, Reg::rax, X86Templates::slot(d - site->argumentSlots));
+				as_.test(true, Reg::rax, Reg::rax);
+				as_.jcc(Cond::e, exit(TraceExit::Kind::Check, i, d));
+				as_.mov(Reg::rcx, (int64_t) (uintptr_t) entry.receiver);
+				as_.cmp(true, Reg::rcx, mem(Reg::rax, JObject::typeOffset()));
+				as_.jcc(Cond::ne, exit(TraceExit::Kind::Guard, i, d));
+			}
+			break;
+
+		default:
+			if (isUnresolved(op) || !TraceCompiler::isTraceable(op))
+				return false;
+			if (templates_.emit(insn, op, d, [this, i, d]() { return exit(TraceExit::Kind::Check, i, d); }))
+				return true;
+			break;
+	}
+
+	templates_.step(insn, d);
+	as_.test(false, Reg::rax, Reg::rax);
+	as_.jcc(Cond::s, exit(TraceExit::Kind::Check, i, d));
+	return true;
+}
+
+} // namespace
+// }}}
+
+Trace* TraceCompiler::compile(const TraceRecording& recording, CodeCache& cache)
+{
+	if (recording.entries.empty() || !recording.end)
+		return nullptr;
+
+	const TraceRecording::Entry& start = recording.entries.front();
+	std::unique_ptr<Trace> trace(new Trace(recording.method, recording.anchor, recording.exit,
+		start.index, start.depth, recording.entries.size()));
+
+	X86Templates::Runtime runtime = {
+		offsetof(Interpreter::Frame, pc),
+		offsetof(Interpreter::Frame, code),
+		(uintptr_t) &Interpreter::jitStep,
+		(uintptr_t) &Interpreter::jitTrap,
+		(uintptr_t) &Interpreter::jitInvoke,
+	};
+
+	Codegen codegen(runtime, recording, trace.get());
+	const std::vector<uint8_t>* code = codegen.generate();
+	if (!code)
+		return nullptr;
+
+	const uint8_t* installed = cache.install(code->data(), code->size());
+	if (!installed)
+		return nullptr;
+
+	trace->setCode(installed, code->size(), codegen.loopOffset(), codegen.leaveOffset());
+	return cache.add(trace.release());
+}
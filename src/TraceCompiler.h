@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Opcodes.h"
+
+class CodeCache;
+class Trace;
+struct TraceRecording;
+
+/**
+ * Trace JIT compiler, translating a recorded path through a loop into
+ * straight x86-64 machine code (see Trace).
+ *
+ * Instructions translate with the templates of the baseline compiler, at
+ * the operand stack depths recorded. The path's conditional branches turn
+ * into guards that side-exit where the recording went the other way, and
+ * virtual calls get a guard on the recorded receiver class. Anything the
+ * templates do not cover calls back into the interpreter like baseline
+ * code does, and exits on failure.
+ */
+class TraceCompiler {
+public:
+	//! Longest recording compiled, in instructions.
+	static const size_t MaxLength = 512;
+
+	/**
+	 * Compiles the closed \p recording into \p cache.
+	 *
+	 * @return the trace, owned by \p cache, or \p nullptr if it contains an
+	 *         instruction left unresolved, or the cache is full.
+	 */
+	static Trace* compile(const TraceRecording& recording, CodeCache& cache);
+
+	/**
+	 * Whether recording may continue through \p op.
+	 *
+	 * Traces run forward through a single frame, so they end before
+	 * returns, throws, switches and subroutines.
+	 */
+	static bool isTraceable(Opcode op);
+};
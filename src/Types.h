@@ -1,15 +1,7 @@
 #pragma once
 
 class ConstantPool;
-class Constant;
-
-class ConstantInteger;
-class ConstantLong;
-class ConstantFloat;
-class ConstantDouble;
-class ConstantUtf8;
-class ConstantMember;
-class ConstantClass;
+struct ConstantUtf8;
 
 class Class;
 
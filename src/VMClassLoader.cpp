@@ -1,10 +1,18 @@
 #include "VMClassLoader.h"
 #include "ConstantPool.h"
 #include "Class.h"
+#include "ClassfileBuffer.h"
+#include "ClassfileReader.h"
+#include "ClassPath.h"
+#include "ClassPathIndex.h"
+#include "ThreadPool.h"
+#include "ClassArchive.h"
 #include "JvmEnv.h"
+#include "Symbol.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -12,6 +20,8 @@
 #include <string>
 #include <memory>
 #include <initializer_list>
+#include <algorithm>
+#include <functional>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -21,399 +31,773 @@
 
 VMClassLoader::VMClassLoader() :
 	classes_(),
-	classpaths_()
+	classpaths_(),
+	index_(nullptr),
+	zeroCopy_(true),
+	lazyMethods_(false),
+	loadLock_(),
+	loadDone_(),
+	loading_(),
+	workers_(nullptr),
+	archive_(nullptr),
+	codeCache_()
 {
 }
 
 VMClassLoader::~VMClassLoader()
 {
+	// unloading the loader unloads all of its classes
+	classes_.forEach([](Class* c) { delete c; });
+
+	delete archive_;
+	delete workers_;
+	delete index_;
+
+	for (ClassPathEntry* entry: classpaths_)
+		delete entry;
 }
 
-void VMClassLoader::addClassPath(const std::string& path)
+bool VMClassLoader::addClassPath(const std::string& path)
 {
-	classpaths_.push_back(path);
+	ClassPathEntry* entry = ClassPathEntry::create(path);
+	if (!entry)
+		return false;
+
+	classpaths_.push_back(entry);
+
+	if (index_)
+		index_->add(entry);
+
+	return true;
 }
 
-Class* VMClassLoader::findLoadedClass(const char* className)
+void VMClassLoader::enableClassPathIndex(bool watch)
 {
-	auto i = classes_.find(className);
-	if (i != classes_.end())
-		return i->second;
+	if (!index_) {
+		index_ = new ClassPathIndex();
+		index_->build(classpaths_);
+	}
 
-	return nullptr;
+	if (watch && !index_->isWatching())
+		index_->watch(classpaths_);
+}
+
+void VMClassLoader::setWorkerThreads(size_t count)
+{
+	delete workers_;
+	workers_ = count ? new ThreadPool(count) : nullptr;
+}
+
+size_t VMClassLoader::metadataBytes() const
+{
+	size_t total = 0;
+	classes_.forEach([&](Class* c) { total += c->metadataBytes(); });
+	return total;
+}
+
+size_t VMClassLoader::unmaterializedMethodCount() const
+{
+	size_t count = 0;
+	classes_.forEach([&](Class* c) {
+		for (Method* method: c->methods())
+			if (!method->isMaterialized())
+				++count;
+	});
+	return count;
+}
+
+Class* VMClassLoader::findLoadedClass(const Symbol* className)
+{
+	return classes_.find(className);
+}
+
+Class* VMClassLoader::findLoadedClass(const char* className)
+{
+	// no class can be defined under a name that was never interned
+	const Symbol* symbol = SymbolTable::global().lookup(className);
+	return symbol ? classes_.find(symbol) : nullptr;
 }
 
 Class* VMClassLoader::findClass(const char* className)
+{
+	// intern names only of classes that may get defined, so that probing
+	// for missing ones leaves the symbol table as it was
+	const Symbol* symbol = SymbolTable::global().lookup(className);
+	if (!symbol) {
+		if (!onClassPath(fileNameOf(className)))
+			return nullptr;
+		symbol = SymbolTable::global().intern(className);
+	}
+	return findClass(symbol);
+}
+
+Class* VMClassLoader::findClass(const Symbol* className)
 {
 	if (Class* c = findLoadedClass(className))
 		return c;
 
-	std::string normalizedClassName = className;
-	for (int i = 0; i < normalizedClassName.size(); ++i)
-		if (normalizedClassName[i] == '.')
-			normalizedClassName[i] = '/';
+	// make sure only one thread loads a given class, with any other thread
+	// asking for it meanwhile waiting for that load to complete.
+	std::shared_ptr<LoadRecord> record;
+	{
+		std::unique_lock<std::mutex> l(loadLock_);
 
-	for (auto path: classpaths_) {
-		path += "/";
-		path += normalizedClassName;
-		path += ".class";
+		if (Class* c = findLoadedClass(className))
+			return c;
 
-		struct stat st;
-		if (stat(path.c_str(), &st) < 0)
-			continue;
+		auto i = loading_.find(className);
+		if (i != loading_.end()) {
+			record = i->second;
+			loadDone_.wait(l, [&]() { return record->done; });
+			return record->result;
+		}
 
-		int fd = open(path.c_str(), O_RDONLY);
-		if (fd < 0)
-			continue;
+		record = std::make_shared<LoadRecord>();
+		loading_[className] = record;
+	}
 
-		uint8_t* classfile = (uint8_t*) mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
-		if (!classfile) {
-			close(fd);
+	Class* c = loadFromClassPath(className);
+
+	{
+		std::lock_guard<std::mutex> _l(loadLock_);
+		record->result = c;
+		record->done = true;
+		loading_.erase(className);
+	}
+	loadDone_.notify_all();
+
+	return c;
+}
+
+std::string VMClassLoader::fileNameOf(const char* className)
+{
+	std::string fileName = className;
+	for (size_t i = 0; i < fileName.size(); ++i)
+		if (fileName[i] == '.')
+			fileName[i] = '/';
+	return fileName;
+}
+
+bool VMClassLoader::onClassPath(const std::string& fileName)
+{
+	if (archive_ && archive_->find(fileName.data(), fileName.size()) != ClassArchive::NoIndex)
+		return true;
+
+	// the index is authoritative, as for loading
+	if (index_)
+		return index_->find(fileName) != nullptr;
+
+	ClassPathEntry::FileInfo info;
+	for (ClassPathEntry* entry: classpaths_)
+		if (entry->stat(fileName + ".class", info))
+			return true;
+	return false;
+}
+
+Class* VMClassLoader::loadFromClassPath(const Symbol* className)
+{
+	std::string fileName = fileNameOf(className->c_str());
+
+	if (archive_) {
+		uint32_t index = archive_->find(fileName.data(), fileName.size());
+		if (index != ClassArchive::NoIndex)
+			return loadFromArchive(className, fileName + ".class", index);
+	}
+
+	if (index_) {
+		ClassPathEntry* entry = index_->find(fileName);
+		if (!entry)
 			return nullptr;
-		}
 
-		Class* result = defineClass(className, classfile, st.st_size);
+		fileName += ".class";
+		if (std::shared_ptr<ClassfileBuffer> classfile = entry->open(fileName, zeroCopy_))
+			return defineClass(className->c_str(), classfile);
+
+		// stale index entry (file got removed), fall back to probing
+	} else {
+		fileName += ".class";
+	}
 
-		munmap(classfile, st.st_size);
-		close(fd);
+	for (ClassPathEntry* entry: classpaths_) {
+		std::shared_ptr<ClassfileBuffer> classfile = entry->open(fileName, zeroCopy_);
+		if (!classfile)
+			continue;
 
-		return result;
+		return defineClass(className->c_str(), classfile);
 	}
 	return nullptr;
 }
 
-Class* VMClassLoader::defineClass(const char* className, const uint8_t* classfile, size_t size)
+ClassPathEntry* VMClassLoader::locate(const std::string& fileName, ClassPathEntry::FileInfo& info)
 {
-	size_t readOffset = 0;
+	if (index_) {
+		ClassPathEntry* entry = index_->find(fileName.substr(0, fileName.size() - 6));
+		if (entry && entry->stat(fileName, info))
+			return entry;
+	}
 
-	auto read8  = [&]() -> uint8_t {
-		if (readOffset < size)
-			return classfile[readOffset++];
-		else
-			return EOF;
-	};
+	for (ClassPathEntry* entry: classpaths_)
+		if (entry->stat(fileName, info))
+			return entry;
 
-	auto read16 = [&]() -> uint16_t {
-		return (read8() << 8) | read8();
-	};
+	return nullptr;
+}
 
-	auto read32 = [&]() -> uint32_t {
-		return (read16() << 16) | read16();
-	};
+Class* VMClassLoader::loadFromArchive(const Symbol* className, const std::string& fileName, uint32_t index)
+{
+	// the classfile still decides whether the class exists and is up to date
+	ClassPathEntry::FileInfo info;
+	ClassPathEntry* entry = locate(fileName, info);
+	if (!entry)
+		return nullptr;
 
-	auto consume = [&](size_t n) {
-		readOffset += n;
-	};
+	ClassArchive::Source source = archive_->source(index);
+	bool valid = source.size == info.size && (source.mtime == info.mtime || (info.hasCrc && source.crc == info.crc));
 
-	auto readn = [&](uint8_t* buf, size_t n) {
-		for (size_t i = 0; i < n; ++i)
-			buf[i] = read8();
-	};
+	std::shared_ptr<ClassfileBuffer> classfile;
+	if (!valid) {
+		// touched but possibly unchanged, so compare the contents
+		classfile = entry->open(fileName, zeroCopy_);
+		if (!classfile)
+			return nullptr;
 
-	// -------------------------------------------------------------------------
+		valid = ClassArchive::crc32(classfile->data(), classfile->size()) == source.crc;
+	}
 
-	uint32_t magic = read32();
-	if (magic != 0xcafebabe) {
-		// wrong classfile magic
-		return nullptr;
+	Class* c = valid ? archive_->instantiate(index) : nullptr;
+	if (!c) {
+		archive_->markStale();
+		if (!classfile)
+			classfile = entry->open(fileName, zeroCopy_);
+
+		return classfile ? defineClass(className->c_str(), classfile) : nullptr;
 	}
 
-	Class* c = new Class();
-	classes_[className] = c;
+	Class* defined = classes_.insert(className, c);
+	if (defined != c) {
+		printf("WARNING: class %s already defined\n", className->c_str());
+		delete c;
+	} else {
+		archive_->registerInstance(index, c);
+	}
+
+	return defined;
+}
 
-	c->minor_ = read16();
-	c->major_ = read16();
+bool VMClassLoader::mapArchive(const std::string& path)
+{
+	ClassArchive* archive = ClassArchive::open(path);
+	if (!archive)
+		return false;
 
-	uint16_t constantCount = read16();
+	delete archive_;
+	archive_ = archive;
+	return true;
+}
 
-	struct class_const { uint16_t selfIndex; uint16_t nameIndex; };
-	struct member_const { uint16_t selfIndex; ConstantTag tag; uint16_t classIndex; uint16_t nameAndTypeIndex; };
-	struct nameandtype_const { uint16_t selfIndex; uint16_t nameIndex; uint16_t signatureIndex; };
-	struct string_const { uint16_t selfIndex; uint16_t stringIndex; };
+bool VMClassLoader::dumpArchive(const std::string& path, const std::vector<std::string>& classNames)
+{
+	std::vector<Class*> classes;
+	std::vector<ClassArchive::Source> sources;
 
-	std::vector<class_const> class_consts;
-	std::vector<member_const> member_consts;
-	std::vector<nameandtype_const> nameandtype_consts;
-	std::vector<string_const> string_consts;
+	for (const std::string& className: classNames) {
+		Class* c = loadClass(className.c_str(), true);
+		if (!c) {
+			printf("WARNING: class %s not found, not archiving\n", className.c_str());
+			continue;
+		}
 
-	c->constantPool.resize(constantCount);
-	for (auto& slot: c->constantPool)
-		slot = nullptr;
+		std::string fileName = std::string(c->name()->c_str()) + ".class";
+		ClassPathEntry::FileInfo info;
+		ClassPathEntry* entry = locate(fileName, info);
+		std::shared_ptr<ClassfileBuffer> classfile = entry ? entry->open(fileName, zeroCopy_) : nullptr;
+		if (!classfile) {
+			printf("WARNING: classfile of %s not found, not archiving\n", className.c_str());
+			continue;
+		}
+
+		classes.push_back(c);
+		sources.push_back({info.mtime, info.size, ClassArchive::crc32(classfile->data(), classfile->size())});
+	}
+
+	return ClassArchive::write(path, classes, sources);
+}
+
+Class* VMClassLoader::defineClass(const char* className, const uint8_t* classfile, size_t size)
+{
+	// the caller owns the passed memory, so take one copy of the whole
+	// classfile for the class to view into.
+	return defineClass(className, ClassfileBuffer::copy(classfile, size));
+}
+
+Class* VMClassLoader::defineClass(const char* className, std::shared_ptr<ClassfileBuffer> buffer)
+{
+	ClassfileReader r(buffer->data(), buffer->size());
+	Class* c = nullptr;
+
+	auto fail = [&](ClassfileError error) -> Class* {
+		r.fail(error);
+		printf("WARNING: %s in %s at offset %zu\n", tos(r.error()).c_str(), className, r.errorOffset());
+		delete c;
+		return nullptr;
+	};
+
+	if (!r.require(10))
+		return fail(ClassfileError::Truncated);
+
+	if (r.u4() != 0xcafebabe)
+		return fail(ClassfileError::BadMagic);
+
+	c = new Class();
+	c->classfile_ = buffer;
+
+	c->minor_ = r.u2();
+	c->major_ = r.u2();
+
+	// constant pool
+	uint16_t constantCount = r.u2();
+
+	ConstantPool& pool = c->constantPool;
+	pool.allocate(c->arena_, constantCount);
 
 	for (uint16_t i = 1; i < constantCount; ++i) {
-		ConstantTag tag = (ConstantTag) read8();
+		if (!r.require(3))
+			return fail(ClassfileError::Truncated);
+
+		ConstantTag tag = (ConstantTag) r.u1();
 		switch (tag) {
-			case ConstantTag::Class: {
-				uint16_t nameIndex = read16();
-				class_consts.push_back({i, nameIndex});
+			case ConstantTag::Class:
+			case ConstantTag::String:
+			case ConstantTag::MethodType:
+				pool.setRef(i, tag, r.u2(), 0);
 				break;
-			}
 			case ConstantTag::Fieldref:
 			case ConstantTag::Methodref:
-			case ConstantTag::InterfaceMethodref: {
-				uint16_t classIndex = read16();
-				uint16_t nameAndTypeIndex = read16();
-				member_consts.push_back({i, tag, classIndex, nameAndTypeIndex});
+			case ConstantTag::InterfaceMethodref:
+			case ConstantTag::NameAndType:
+			case ConstantTag::InvokeDynamic: {
+				if (!r.require(4))
+					return fail(ClassfileError::Truncated);
+				uint16_t a = r.u2();
+				uint16_t b = r.u2();
+				pool.setRef(i, tag, a, b);
 				break;
 			}
-			case ConstantTag::String: {
-				uint16_t stringIndex = read16();
-				string_consts.push_back({i, stringIndex});
+			case ConstantTag::MethodHandle: {
+				uint8_t kind = r.u1();
+				uint16_t index = r.u2();
+				pool.setRef(i, tag, kind, index);
 				break;
 			}
-			case ConstantTag::Integer: {
-				uint32_t value = read32();
-				c->constantPool[i] = new ConstantInteger(value);
+			case ConstantTag::Integer:
+			case ConstantTag::Float:
+				if (!r.require(4))
+					return fail(ClassfileError::Truncated);
+				if (tag == ConstantTag::Integer)
+					pool.setInteger(i, (int32_t) r.u4());
+				else
+					pool.setFloat(i, r.u4());
 				break;
-			}
-			case ConstantTag::Float: { // TODO
-				read32();
-				break;
-			}
-			case ConstantTag::Long: {
-				uint64_t value = read32();
-				value <<= 32;
-				value |= read32();
-				c->constantPool[i] = new ConstantLong(value);
+			case ConstantTag::Long:
+			case ConstantTag::Double:
+				if (!r.require(8))
+					return fail(ClassfileError::Truncated);
+				if (i + 1 >= constantCount)
+					return fail(ClassfileError::BadConstantPool); // takes two slots
+				if (tag == ConstantTag::Long)
+					pool.setLong(i, (int64_t) r.u8());
+				else
+					pool.setDouble(i, r.u8());
 				++i;
 				break;
-			}
-			case ConstantTag::Double: { // TODO
-				read32();
-				read32();
-				++i;
-				break;
-			}
-			case ConstantTag::NameAndType: {
-				uint16_t nameIndex = read16();
-				uint16_t signatureIndex = read16();
-				nameandtype_consts.push_back({i, nameIndex, signatureIndex});
-				break;
-			}
 			case ConstantTag::Utf8: {
-				uint16_t length = read16();
-				uint8_t* buf = new uint8_t[length + 1];
-				readn(buf, length);
-				buf[length] = '\0';
-				c->constantPool[i] = new ConstantUtf8(length, buf);
-				break;
-			}
-			case ConstantTag::MethodHandle: { // TODO
-				/*uint8_t kind =*/ read8(); // reference kind
-				/*uint16_t index =*/ read16(); // reference index
-				break;
-			}
-			case ConstantTag::MethodType: { // TODO
-				read16(); // descriptor index
-				break;
-			}
-			case ConstantTag::InvokeDynamic: { // TODO
-				/*uint16_t bootstrapMethodAttrIndex =*/ read16();
-				/*uint16_t nameAndTypeIndex =*/ read16();
-				break;
-			}
-			default: {
-				assert(!"FIXME");
-				abort();
+				uint16_t length = r.u2();
+				bool standard;
+				const uint8_t* data = r.utf8(length, &standard);
+				if (!data)
+					return fail(r.error());
+				pool.setUtf8(i, new (c->arena_.allocate(sizeof(ConstantUtf8), alignof(ConstantUtf8)))
+					ConstantUtf8(length, data, standard));
 				break;
 			}
+			default:
+				return fail(ClassfileError::BadConstantTag);
 		}
 	}
 
-	for (const auto& rec: string_consts) {
-		ConstantUtf8* string = c->constantPool.get<ConstantUtf8>(rec.stringIndex);
-		c->constantPool[rec.selfIndex] = new ConstantString(rec.stringIndex, string);
-	}
-
-	for (const auto& rec: nameandtype_consts) {
-		ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(rec.nameIndex);
-		ConstantUtf8* sig = c->constantPool.get<ConstantUtf8>(rec.signatureIndex);
-		c->constantPool[rec.selfIndex] = new ConstantNameAndType(name, sig);
-	}
+	if (!pool.verify())
+		return fail(ClassfileError::BadConstantPool);
 
-	for (const auto& rec: class_consts) {
-		ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(rec.nameIndex);
-		c->constantPool[rec.selfIndex] = new ConstantClass(rec.nameIndex, name);
-	}
+	// attributes are dispatched by symbol, i.e. by pointer compare
+	auto symbolAt = [&](uint16_t id) -> const Symbol* {
+		ConstantUtf8* utf8 = pool.utf8(id);
+		return utf8 ? utf8->symbol() : nullptr;
+	};
 
-	for (const auto& rec: member_consts) {
-		ConstantClass* classRef = (ConstantClass*) c->constantPool[rec.classIndex];
-		ConstantNameAndType* nametypeRef = (ConstantNameAndType*) c->constantPool[rec.nameAndTypeIndex];
-		c->constantPool[rec.selfIndex] = new ConstantMember(rec.tag, classRef, nametypeRef);
-	}
+	if (!r.require(8))
+		return fail(ClassfileError::Truncated);
 
-	c->flags_ = (ClassFlags) read16();
+	c->flags_ = (ClassFlags) r.u2();
 
 	// this class
-	uint16_t thisClassId = read16();
-	c->thisClass_ = c->constantPool.get<ConstantClass>(thisClassId);
-	c->thisClassName_ = c->thisClass_->name->c_str();
+	c->thisClassId_ = r.u2();
+	ConstantUtf8* thisClassName = pool.className(c->thisClassId_);
+	if (!thisClassName)
+		return fail(ClassfileError::BadIndex);
+	c->name_ = thisClassName->symbol();
 
 	// super class
-	uint16_t superClassId = read16();
+	uint16_t superClassId = r.u2();
 	if (superClassId != 0) {
-		c->superClassName_ = c->constantPool.get<ConstantClass>(superClassId)->name->c_str();
+		ConstantUtf8* superClassName = pool.className(superClassId);
+		if (!superClassName)
+			return fail(ClassfileError::BadIndex);
+		c->superClassName_ = superClassName->symbol();
 		c->superClass_ = nullptr;
 	}
 
 	// super interfaces
-	uint16_t interfaceCount = read16();
+	uint16_t interfaceCount = r.u2();
+	if (!r.require(interfaceCount * 2 + 2))
+		return fail(ClassfileError::Truncated);
+
 	c->interfaceIds_.resize(interfaceCount);
 	c->interfaces_.resize(c->interfaceIds_.size());
 	for (size_t i = 0; i < interfaceCount; ++i) {
-		uint16_t id = read16();
+		uint16_t id = r.u2();
+		if (!pool.is(ConstantTag::Class, id))
+			return fail(ClassfileError::BadIndex);
 		c->interfaceIds_[i] = id;
 		c->interfaces_[i] = nullptr;
 	}
 
 	// class fields
-	uint16_t fieldCount = read16();
+	uint16_t fieldCount = r.u2();
 	c->fields_.resize(fieldCount);
 	for (int i = 0; i < fieldCount; ++i) {
-		FieldFlags flags = (FieldFlags) read16();
-		uint16_t nameIndex = read16();
-		uint16_t descriptorIndex = read16();
-		uint16_t attributeCount = read16();
+		if (!r.require(8))
+			return fail(ClassfileError::Truncated);
 
-		ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(nameIndex);
-		ConstantUtf8* desc = c->constantPool.get<ConstantUtf8>(descriptorIndex);
+		FieldFlags flags = (FieldFlags) r.u2();
+		ConstantUtf8* name = pool.utf8(r.u2());
+		ConstantUtf8* desc = pool.utf8(r.u2());
+		uint16_t attributeCount = r.u2();
+		if (!name || !desc)
+			return fail(ClassfileError::BadIndex);
 
-		Field* field = new Field(c, name, desc, flags);
+		Field* field = c->arena_.construct<Field>(c, name->symbol(), desc->symbol(), flags);
 		c->fields_[i] = field;
 
 		// attribute_info
+		const Attribute** attributes = c->arena_.allocateArray<const Attribute*>(attributeCount);
+		field->attributes_ = ArrayView<const Attribute*>(attributes, attributeCount);
+
 		for (int u = 0; u < attributeCount; ++u) {
-			uint16_t nameIndex = read16();
-			uint32_t length = read32();
+			attributes[u] = (const Attribute*) r.position();
+
+			if (!r.require(6))
+				return fail(ClassfileError::Truncated);
 
-			consume(length); // TODO evaluate instead of consuming
+			uint16_t nameIndex = r.u2();
+			uint32_t length = r.u4();
 
-			ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(nameIndex);
+			if (!r.skip(length)) // TODO evaluate instead of skipping
+				return fail(ClassfileError::Truncated);
+
+			ConstantUtf8* name = pool.utf8(nameIndex);
+			if (!name)
+				return fail(ClassfileError::BadIndex);
 			printf("Class field attribute: #%u %s length: %d\n", nameIndex, name->c_str(), length);
 		}
 	}
 
 	// class methods
-	uint16_t methodCount = read16();
+	uint16_t methodCount = r.readU2();
+	c->methods_.reserve(methodCount);
 	for (int i = 0; i < methodCount; ++i) {
-		MethodFlags flags = (MethodFlags) read16();
-		ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(read16());
-		ConstantUtf8* desc = c->constantPool.get<ConstantUtf8>(read16());
-		uint16_t attributeCount = read16();
+		if (!r.require(8))
+			return fail(ClassfileError::Truncated);
+
+		MethodFlags flags = (MethodFlags) r.u2();
+		ConstantUtf8* name = pool.utf8(r.u2());
+		ConstantUtf8* desc = pool.utf8(r.u2());
+		uint16_t attributeCount = r.u2();
+		if (!name || !desc)
+			return fail(ClassfileError::BadIndex);
 
-		Method* method = new Method(name, desc, flags);
+		Method* method = c->arena_.construct<Method>(c, name->symbol(), desc->symbol(), flags);
 		c->methods_.push_back(method);
 
 		// attribute_info
 		for (int u = 0; u < attributeCount; ++u) {
-			uint16_t nameIndex = read16();
-			ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(nameIndex);
-			uint32_t length = read32();
+			if (!r.require(6))
+				return fail(ClassfileError::Truncated);
+
+			uint16_t nameIndex = r.u2();
+			uint32_t length = r.u4();
+			const Symbol* name = symbolAt(nameIndex);
 
-			if (equals(name, "Deprecated")) {
+			const uint8_t* payload = r.view(length);
+			if (!payload)
+				return fail(ClassfileError::Truncated);
+
+			if (name == Symbols::Deprecated) {
 				method->isDeprecated_ = true;
-			} else if (equals(name, "Signature")) {
-				uint16_t signatureId = read16();
-				ConstantUtf8* signatureStr = c->constantPool.get<ConstantUtf8>(signatureId);
+			} else if (name == Symbols::Signature) {
+				ConstantUtf8* signatureStr = length == 2 ? pool.utf8((payload[0] << 8) | payload[1]) : nullptr;
+				if (!signatureStr)
+					return fail(ClassfileError::BadAttribute);
 				printf("Method %s has signature attribute %s\n",
 					method->to_s().c_str(),
 					signatureStr->c_str()
 				);
-			} else if (equals(name, "Code")) {
-				method->maxStack_ = read16();
-				method->maxLocals_ = read16();
-
-				uint32_t codeLength = read32();
-				method->code_.resize(codeLength);
-				readn(&method->code_[0], codeLength);
-
-				uint16_t exceptionTableLength = read16();
-				for (uint16_t i = 0; i < exceptionTableLength; ++i) {
-					uint16_t start = read16();
-					uint16_t end = read16();
-					uint16_t handler = read16();
-					uint16_t type = read16();
-					method->exceptionTable_.push_back({start, end, handler, type});
-				}
-				uint16_t attributeCount = read16();
-				for (int i = 0; i < attributeCount; ++i) {
-					uint16_t nameId = read16();
-					uint32_t length = read32();
-					ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(nameId);
-
-					if (equals(name, "LineNumberTable")) {
-						uint16_t count = read16();
-						method->lineNumberTable_.resize(count);
-						for (uint16_t i = 0; i < count; ++i) {
-							uint16_t start = read16();
-							uint16_t line = read16();
-							method->lineNumberTable_[i] = {start, line};
-						}
-					} else if (equals(name, "LocalVariableTable")) {
-						// TODO implement when we add debugging support
-						consume(length);
-					} else if (equals(name, "LocalVariableTypeTable")) {
-						// TODO implement when we add debugging support
-						consume(length);
-					} else if (equals(name, "StackMapTable")) {
-						// TODO needed for operand-stack type-checking (optional feature since classfile version 51.0)
-						consume(length);
-					} else {
-						printf("WARNING: Unhandled method-code attribute %s for method %s\n", name->c_str(), method->to_s().c_str());
-						// consume unhandled attribute payload
-						consume(length);
-					}
-				}
+			} else if (name == Symbols::Code) {
+				// only remember where the body is, unless decoding eagerly
+				method->setCodeAttribute(payload, length);
+				if (!lazyMethods_ && method->codeError() != ClassfileError::None)
+					return fail(method->codeError());
 			} else {
-				printf("WARNING: Unhandled method attribute %s for method %s\n", name->c_str(), method->to_s().c_str());
-				// consume unhandled attribute payload
-				consume(length);
+				printf("WARNING: Unhandled method attribute %s for method %s\n", name ? name->c_str() : "?", method->to_s().c_str());
 			}
 		}
 	}
 
 	// class attributes
-	uint16_t attributeCount = read16();
+	uint16_t attributeCount = r.readU2();
 	for (int i = 0; i < attributeCount; ++i) {
-		uint16_t nameId = read16();
-		uint32_t length = read32();
+		if (!r.require(6))
+			return fail(ClassfileError::Truncated);
+
+		uint16_t nameId = r.u2();
+		uint32_t length = r.u4();
+		const Symbol* name = symbolAt(nameId);
 
-		ConstantUtf8* name = c->constantPool.get<ConstantUtf8>(nameId);
+		const uint8_t* payload = r.view(length);
+		if (!payload)
+			return fail(ClassfileError::Truncated);
 
-		if (equals(name, "SourceFile")) {
-			uint16_t value = read16();
-			ConstantUtf8* sourceFile = c->constantPool.get<ConstantUtf8>(value);
+		if (name == Symbols::SourceFile) {
+			ConstantUtf8* sourceFile = length == 2 ? pool.utf8((payload[0] << 8) | payload[1]) : nullptr;
+			if (!sourceFile)
+				return fail(ClassfileError::BadAttribute);
 			c->sourceFile_ = sourceFile->c_str();
 		} else {
 			printf("WARNING: Unhandled classfile attribute #%d: name #%d (length: %d)\n", i, nameId, length);
-			consume(length);
 		}
 	}
 
-	return c;
+	if (!r.ok())
+		return fail(r.error());
+
+	Class* defined = classes_.insert(SymbolTable::global().intern(className), c);
+	if (defined != c) {
+		printf("WARNING: class %s already defined\n", className);
+		delete c;
+	}
+
+	return defined;
 }
 
 void VMClassLoader::resolveClass(Class* c)
 {
 	// link class c, resolving any unresolved symbols
 
+	if (c->isLinked())
+		return;
+
+	// classes currently being resolved by this thread, to detect cyclic hierarchies
+	static thread_local std::vector<Class*> resolving;
+	if (std::find(resolving.begin(), resolving.end(), c) != resolving.end()) {
+		printf("WARNING: class circularity in %s\n", c->name()->c_str());
+		return;
+	}
+
+	// superclass first, followed by all interfaces, unless already known
+	std::vector<const Symbol*> names(1 + c->interfaceIds_.size(), nullptr);
+	std::vector<Class*> resolved(names.size(), nullptr);
+	{
+		std::lock_guard<std::mutex> _l(c->linkLock_);
+		resolved[0] = c->superClass_;
+		std::copy(c->interfaces_.begin(), c->interfaces_.end(), resolved.begin() + 1);
+	}
+
+	if (!resolved[0])
+		names[0] = c->superClassName_;
+
 	for (size_t i = 0; i < c->interfaceIds_.size(); ++i) {
-		if (c->interfaces_[i])
+		uint16_t id = c->interfaceIds_[i];
+		if (resolved[1 + i])
 			continue;
 
-		uint16_t id = c->interfaceIds_[i];
-		if (ConstantClass* interface = c->constantPool.get<ConstantClass>(id)) {
-			printf("linking interface #%zu: #%d %s\n", i, id, interface->name->c_str());
-			c->interfaces_[i] = findClass(interface->name->c_str());
+		if (ConstantUtf8* interface = c->constantPool.className(id)) {
+			printf("linking interface #%zu: #%d %s\n", i, id, interface->c_str());
+			names[1 + i] = interface->symbol();
 		}
 	}
 
-	if (!c->superClass_) {
-		c->superClass_ = findClass(c->superClassName_.c_str());
+	if (workers_ && names.size() > 1) {
+		std::vector<ThreadPool::Task> tasks;
+		for (size_t i = 0; i < names.size(); ++i)
+			if (names[i])
+				tasks.push_back([&, i]() { resolved[i] = findClass(names[i]); });
+
+		workers_->run(tasks);
+	} else {
+		for (size_t i = 0; i < names.size(); ++i)
+			if (names[i])
+				resolved[i] = findClass(names[i]);
+	}
+
+	// supertypes get laid out before their subtypes
+	resolving.push_back(c);
+	for (Class* super: resolved)
+		if (super)
+			resolveClass(super);
+	resolving.pop_back();
+
+	std::lock_guard<std::mutex> _l(c->linkLock_);
+
+	bool complete = true;
+
+	if (!c->superClass_)
+		c->superClass_ = resolved[0];
+
+	if (!c->superClass_ && c->superClassName_) {
+		printf("WARNING: superclass %s of %s not found\n", c->superClassName_->c_str(), c->name()->c_str());
+		complete = false;
 	}
 
+	for (size_t i = 0; i < c->interfaces_.size(); ++i) {
+		if (!c->interfaces_[i] && resolved[1 + i]) {
+			c->interfaces_[i] = resolved[1 + i];
+			c->constantPool.setResolved(c->interfaceIds_[i], (uintptr_t) resolved[1 + i]);
+		}
+
+		if (!c->interfaces_[i])
+			complete = false;
+	}
+
+	// a class whose superclass is missing still gets laid out, as a root
+	if (!c->isLaidOut())
+		layoutClass(c);
+
 	// TODO
 	// field/method signature types ...
+
+	if (complete)
+		c->linked_.store(true, std::memory_order_release);
+}
+
+void VMClassLoader::layoutClass(Class* c)
+{
+	Class* super = c->superClass_;
+	if (super && !super->isLaidOut())
+		super = nullptr; // cyclic hierarchy
+
+	c->fieldTable_.build(c->arena_, c->fields_);
+	c->methodTable_.build(c->arena_, c->methods_);
+
+	// field offsets, placing larger fields first so that all of them are
+	// naturally aligned without padding in between.
+	uint32_t instanceSize = super ? super->instanceSize_ : 0;
+	uint32_t staticSize = 0;
+	for (size_t size = 8; size != 0; size /= 2) {
+		for (Field* field: c->fields_) {
+			if (field->size() != size)
+				continue;
+
+			uint32_t& end = field->isStatic() ? staticSize : instanceSize;
+			end = (end + size - 1) & ~(uint32_t) (size - 1);
+			field->offset_ = end;
+			end += size;
+		}
+	}
+	c->instanceSize_ = instanceSize;
+	c->staticSize_ = staticSize;
+
+	if (staticSize) {
+		c->staticData_ = (uint8_t*) c->arena_.allocate(staticSize, alignof(uint64_t));
+		memset(c->staticData_, 0, staticSize);
+	}
+
+	// vtable, starting with the inherited one. Overriding methods take over
+	// the slot of the method they override, any other one gets a new slot.
+	std::vector<Method*> vtable;
+	if (super)
+		vtable.assign(super->vtable_.begin(), super->vtable_.end());
+
+	for (Method* method: c->methods_) {
+		if (!method->isVirtual())
+			continue;
+
+		Method* overridden = super ? super->findMethod(method->name_, method->signature_) : nullptr;
+		if (overridden && overridden->vtableIndex_ != Method::NoVtableIndex) {
+			method->vtableIndex_ = overridden->vtableIndex_;
+			vtable[method->vtableIndex_] = method;
+		} else {
+			method->vtableIndex_ = vtable.size();
+			vtable.push_back(method);
+		}
+	}
+
+	Method** table = c->arena_.allocateArray<Method*>(vtable.size());
+	std::copy(vtable.begin(), vtable.end(), table);
+	c->vtable_ = ArrayView<Method*>(table, vtable.size());
+
+	// itables: interfaces number their methods, and classes get a table of
+	// implementations per interface they implement, directly or inherited
+	std::vector<Class*> interfaces;
+	std::function<void(Class*)> collect = [&](Class* interface) {
+		if (!interface || !interface->isLaidOut())
+			return;
+		if (std::find(interfaces.begin(), interfaces.end(), interface) != interfaces.end())
+			return;
+		interfaces.push_back(interface);
+		for (Class* super: interface->interfaces_)
+			collect(super);
+	};
+
+	if (c->isInterface()) {
+		uint16_t index = 0;
+		for (Method* method: c->methods_)
+			if (!method->isStatic() && !(method->flags_ & MethodFlags::Private) && method->name_ != Symbols::clinit)
+				method->itableIndex_ = index++;
+	} else {
+		for (Class* interface: c->interfaces_)
+			collect(interface);
+		if (super)
+			for (const Class::Itable& itable: super->itables_)
+				collect(itable.interface);
+	}
+
+	if (!interfaces.empty()) {
+		Class::Itable* itables = c->arena_.allocateArray<Class::Itable>(interfaces.size());
+		for (size_t i = 0; i < interfaces.size(); ++i) {
+			Class* interface = interfaces[i];
+			Method** methods = c->arena_.allocateArray<Method*>(interface->methods_.size());
+			for (Method* method: interface->methods_) {
+				if (method->itableIndex_ == Method::NoItableIndex)
+					continue;
+				Method* implementation = c->findMethod(method->name_, method->signature_);
+				methods[method->itableIndex_] = implementation ? implementation : method;
+			}
+			itables[i].interface = interface;
+			itables[i].methods = methods;
+		}
+		c->itables_ = ArrayView<Class::Itable>(itables, interfaces.size());
+	}
+
+	c->laidOut_.store(true, std::memory_order_release);
+
+	// before any instance of it exists to reach code assuming it absent
+	hierarchy_.add(c);
+	dependencies_.classLoaded(c);
+}
+
+bool VMClassLoader::addDependency(const Dependency& dependency, CompiledMethod* compiled)
+{
+	// a class added to the hierarchy meanwhile is checked by classLoaded() afterwards
+	return dependencies_.add(dependency, compiled, [this](const Dependency& d) { return hierarchy_.holds(d); });
 }
 
 Class* VMClassLoader::loadClass(const char* className, bool resolve)
@@ -5,25 +5,171 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "ClassTable.h"
+#include "ClassPath.h"
+#include "ClassHierarchy.h"
+#include "CodeCache.h"
+#include "Dependencies.h"
 
 class Class;
+class Symbol;
+class ClassfileBuffer;
+class ClassPathIndex;
+class ClassArchive;
+class ThreadPool;
 
 class VMClassLoader
 {
 private:
-	std::unordered_map<std::string, Class*> classes_;
-	std::vector<std::string> classpaths_;
+	//! a class currently being loaded by some thread
+	struct LoadRecord {
+		bool done;
+		Class* result;
+
+		LoadRecord() : done(false), result(nullptr) {}
+	};
+
+	ClassTable classes_;
+	std::vector<ClassPathEntry*> classpaths_;
+	ClassPathIndex* index_;
+	bool zeroCopy_;
+	bool lazyMethods_;
+
+	std::mutex loadLock_;
+	std::condition_variable loadDone_;
+	std::unordered_map<const Symbol*, std::shared_ptr<LoadRecord>> loading_;
+
+	ThreadPool* workers_;
+	ClassArchive* archive_;
+
+	CodeCache codeCache_;
+	ClassHierarchy hierarchy_;
+	DependencyTable dependencies_;
 
 public:
 	VMClassLoader();
 	~VMClassLoader();
 
-	void addClassPath(const std::string& path);
+	/**
+	 * Appends a directory or a .jar/.zip archive to the classpath.
+	 *
+	 * @return whether \p path could be opened.
+	 */
+	bool addClassPath(const std::string& path);
+
+	/**
+	 * Enables or disables zero-copy class loading (enabled by default).
+	 *
+	 * When enabled, classfiles are mmap'd and kept mapped for the lifetime of
+	 * their Class, with constants and bytecode viewing into the mapping.
+	 * Otherwise each classfile is read into a single heap buffer instead,
+	 * which avoids holding one mapping per loaded class.
+	 */
+	void setZeroCopy(bool enabled) { zeroCopy_ = enabled; }
+	bool isZeroCopy() const { return zeroCopy_; }
+
+	/**
+	 * Enables or disables lazy method bodies (disabled by default).
+	 *
+	 * When enabled, defineClass() only records where each method's Code
+	 * attribute is, and its bytecode, exception table and line numbers get
+	 * decoded on first access. This saves load time and metadata for the
+	 * many methods that never run.
+	 *
+	 * A malformed Code attribute fails defineClass() when disabled, and
+	 * the first invocation of its method, with a ClassFormatError, when
+	 * enabled.
+	 */
+	void setLazyMethodBodies(bool enabled) { lazyMethods_ = enabled; }
+	bool isLazyMethodBodies() const { return lazyMethods_; }
+
+	/**
+	 * Enables the classpath index.
+	 *
+	 * All classpath elements get scanned once up front, and classes are
+	 * then resolved by a single index probe rather than probing every
+	 * classpath element. Classes created later on are only found when
+	 * \p watch is enabled.
+	 *
+	 * @param watch watch classpath directories for new classfiles via inotify.
+	 */
+	void enableClassPathIndex(bool watch);
+
+	//! Classpath index with its hit/miss counters, or \p nullptr if disabled.
+	const ClassPathIndex* classPathIndex() const { return index_; }
+
+	/**
+	 * Sets the number of worker threads resolveClass() uses to load a class'
+	 * superclass and interfaces in parallel (0 to load them sequentially).
+	 *
+	 * Must not be called while classes are being loaded.
+	 */
+	void setWorkerThreads(size_t count);
+
+	//! Number of metadata bytes allocated by all classes of this loader.
+	size_t metadataBytes() const;
 
+	//! Number of methods whose body has not been decoded (yet).
+	size_t unmaterializedMethodCount() const;
+
+	/**
+	 * Loads, resolves and writes the given classes into a class-data-sharing archive.
+	 *
+	 * @param path archive file to create.
+	 * @param classNames binary names of the classes to archive.
+	 */
+	bool dumpArchive(const std::string& path, const std::vector<std::string>& classNames);
+
+	/**
+	 * Maps a class-data-sharing archive to instantiate classes from.
+	 *
+	 * Archived classes whose classfile changed since the archive was
+	 * written are loaded from their classfile instead.
+	 */
+	bool mapArchive(const std::string& path);
+
+	//! Mapped class-data-sharing archive, or \p nullptr.
+	const ClassArchive* archive() const { return archive_; }
+
+	//! Native code compiled for methods of this loader's classes.
+	CodeCache& codeCache() { return codeCache_; }
+
+	//! Hierarchy of the classes laid out so far.
+	const ClassHierarchy& hierarchy() const { return hierarchy_; }
+
+	/**
+	 * Records that \p compiled relies on \p dependency, to get invalidated
+	 * once a class breaking it is laid out.
+	 *
+	 * @return false if a class laid out already breaks it.
+	 */
+	bool addDependency(const Dependency& dependency, CompiledMethod* compiled);
+
+	const DependencyTable& dependencies() const { return dependencies_; }
+
+	Class* findLoadedClass(const Symbol* name);
 	Class* findLoadedClass(const char* name);
+	Class* findClass(const Symbol* name);
 	Class* findClass(const char* name);
 	Class* defineClass(const char* name, const uint8_t* classfile, size_t size);
+	Class* defineClass(const char* name, std::shared_ptr<ClassfileBuffer> classfile);
 	void resolveClass(Class* c);
 
 	Class* loadClass(const char* name, bool resolve);
+
+private:
+	//! Path of the classfile of \p className within class path entries, without the .class suffix.
+	static std::string fileNameOf(const char* className);
+
+	//! Whether the archive or a class path entry has the classfile at \p fileName (without .class).
+	bool onClassPath(const std::string& fileName);
+
+	Class* loadFromClassPath(const Symbol* name);
+	void layoutClass(Class* c);
+	Class* loadFromArchive(const Symbol* name, const std::string& fileName, uint32_t index);
+	ClassPathEntry* locate(const std::string& fileName, ClassPathEntry::FileInfo& info);
 };
@@ -0,0 +1,182 @@
+#include "X86Assembler.h"
+
+#include <string.h>
+
+static bool isInt8(int32_t v)
+{
+	return v >= -128 && v <= 127;
+}
+
+const std::vector<uint8_t>& X86Assembler::finish()
+{
+	for (const Fixup& fixup: fixups_) {
+		size_t origin = fixup.base == SIZE_MAX ? fixup.at + 4 : labels_[fixup.base];
+		int32_t rel = (int32_t) (labels_[fixup.label] - origin);
+		memcpy(&code_[fixup.at], &rel, 4);
+	}
+	fixups_.clear();
+	return code_;
+}
+
+void X86Assembler::imm32(int32_t v)
+{
+	uint8_t bytes[4];
+	memcpy(bytes, &v, 4);
+	code_.insert(code_.end(), bytes, bytes + 4);
+}
+
+void X86Assembler::rex(bool wide, unsigned reg, unsigned index, unsigned base, bool byteRegs)
+{
+	uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+
+	// spl, bpl, sil and dil need a REX prefix, or they'd mean ah, ch, dh and bh
+	if (prefix != 0x40 || (byteRegs && (reg >= 4 || base >= 4)))
+		byte(prefix);
+}
+
+void X86Assembler::opcode(unsigned op)
+{
+	if (op > 0xff)
+		byte(op >> 8);
+	byte(op & 0xff);
+}
+
+void X86Assembler::rr(bool wide, unsigned op, Reg reg, Reg rm, bool byteRegs)
+{
+	rex(wide, (unsigned) reg, 0, (unsigned) rm, byteRegs);
+	opcode(op);
+	byte(0xc0 | (((unsigned) reg & 7) << 3) | ((unsigned) rm & 7));
+}
+
+void X86Assembler::rm(bool wide, unsigned op, Reg reg, const Mem& m, bool byteRegs)
+{
+	unsigned r = (unsigned) reg;
+	unsigned b = (unsigned) m.base;
+	unsigned x = m.scale ? (unsigned) m.index : 0;
+
+	rex(wide, r, x, b, byteRegs);
+	opcode(op);
+
+	// rbp and r13 have no displacement-less form, that encoding means rip-relative
+	unsigned mod = m.disp == 0 && (b & 7) != 5 ? 0 : isInt8(m.disp) ? 1 : 2;
+
+	// rsp and r12 as base always need a SIB byte
+	if (!m.scale && (b & 7) != 4) {
+		byte((mod << 6) | ((r & 7) << 3) | (b & 7));
+	} else {
+		unsigned ss = m.scale == 8 ? 3 : m.scale == 4 ? 2 : m.scale == 2 ? 1 : 0;
+		unsigned index = m.scale ? (x & 7) : 4; // 4: no index
+		byte((mod << 6) | ((r & 7) << 3) | 4);
+		byte((ss << 6) | (index << 3) | (b & 7));
+	}
+
+	if (mod == 1)
+		byte((uint8_t) m.disp);
+	else if (mod == 2)
+		imm32(m.disp);
+}
+
+void X86Assembler::ri(bool wide, unsigned ext, Reg r, int32_t imm)
+{
+	if (isInt8(imm)) {
+		rr(wide, 0x83, ext, r);
+		byte((uint8_t) imm);
+	} else {
+		rr(wide, 0x81, ext, r);
+		imm32(imm);
+	}
+}
+
+void X86Assembler::mi(bool wide, unsigned ext, const Mem& m, int32_t imm)
+{
+	if (isInt8(imm)) {
+		rm(wide, 0x83, ext, m);
+		byte((uint8_t) imm);
+	} else {
+		rm(wide, 0x81, ext, m);
+		imm32(imm);
+	}
+}
+
+void X86Assembler::mov(Reg dst, int64_t imm)
+{
+	unsigned r = (unsigned) dst;
+
+	if (imm >= 0 && imm <= UINT32_MAX) {
+		// zero-extending mov r32, imm32
+		rex(false, 0, 0, r, false);
+		byte(0xb8 | (r & 7));
+		imm32((int32_t) (uint32_t) imm);
+	} else if (imm >= INT32_MIN && imm <= INT32_MAX) {
+		// sign-extending mov r/m64, imm32
+		rr(true, 0xc7, 0, dst);
+		imm32((int32_t) imm);
+	} else {
+		rex(true, 0, 0, r, false);
+		byte(0xb8 | (r & 7));
+		uint8_t bytes[8];
+		memcpy(bytes, &imm, 8);
+		code_.insert(code_.end(), bytes, bytes + 8);
+	}
+}
+
+void X86Assembler::store8(const Mem& dst, Reg src)
+{
+	rm(false, 0x88, src, dst, true);
+}
+
+void X86Assembler::store16(const Mem& dst, Reg src)
+{
+	byte(0x66);
+	rm(false, 0x89, src, dst);
+}
+
+void X86Assembler::imul(bool wide, Reg dst, Reg src, int32_t imm)
+{
+	if (isInt8(imm)) {
+		rr(wide, 0x6b, dst, src);
+		byte((uint8_t) imm);
+	} else {
+		rr(wide, 0x69, dst, src);
+		imm32(imm);
+	}
+}
+
+void X86Assembler::jmp(size_t label)
+{
+	byte(0xe9);
+	fixups_.push_back({code_.size(), label, SIZE_MAX});
+	imm32(0);
+}
+
+void X86Assembler::jcc(Cond cc, size_t label)
+{
+	byte(0x0f);
+	byte(0x80 | (uint8_t) cc);
+	fixups_.push_back({code_.size(), label, SIZE_MAX});
+	imm32(0);
+}
+
+void X86Assembler::lea(Reg dst, size_t label)
+{
+	// mod 00 with r/m 101 is [rip + disp32]
+	rex(true, (unsigned) dst, 0, 0, false);
+	byte(0x8d);
+	byte((((unsigned) dst & 7) << 3) | 5);
+	fixups_.push_back({code_.size(), label, SIZE_MAX});
+	imm32(0);
+}
+
+void X86Assembler::push(Reg r)
+{
+	if ((unsigned) r >= 8)
+		byte(0x41);
+	byte(0x50 | ((unsigned) r & 7));
+}
+
+void X86Assembler::pop(Reg r)
+{
+	if ((unsigned) r >= 8)
+		byte(0x41);
+	byte(0x58 | ((unsigned) r & 7));
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+//! x86-64 general purpose registers, by encoding.
+enum class Reg : uint8_t {
+	rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+	r8, r9, r10, r11, r12, r13, r14, r15,
+};
+
+//! Condition codes, by encoding.
+enum class Cond : uint8_t {
+	o, no, b, ae, e, ne, be, a, s, ns, p, np, l, ge, le, g,
+};
+
+//! Inverse of condition \p cc.
+inline Cond negate(Cond cc) { return (Cond) ((uint8_t) cc ^ 1); }
+
+//! Memory operand: [base + index * scale + disp].
+struct Mem {
+	Reg base;
+	Reg index;
+	uint8_t scale;     //!< 1, 2, 4 or 8, or 0 without index
+	int32_t disp;
+};
+
+inline Mem mem(Reg base, int32_t disp = 0) { return {base, Reg::rax, 0, disp}; }
+inline Mem mem(Reg base, Reg index, uint8_t scale, int32_t disp = 0) { return {base, index, scale, disp}; }
+
+/**
+ * Emits x86-64 machine code into a buffer, with forward and backward jumps
+ * to labels.
+ *
+ * Covers what the compilers need and no more. Operand size is 32 bits
+ * unless an instruction's \p wide flag asks for 64; 32-bit writes zero
+ * the upper half of a register, as usual.
+ */
+class X86Assembler {
+private:
+	struct Fixup {
+		size_t at;       //!< offset of the 32-bit value
+		size_t label;
+		size_t base;     //!< label it is relative to, or SIZE_MAX for a rel32
+	};
+
+	std::vector<uint8_t> code_;
+	std::vector<size_t> labels_;
+	std::vector<Fixup> fixups_;
+
+public:
+	X86Assembler() : code_(), labels_(), fixups_() {}
+
+	size_t size() const { return code_.size(); }
+
+	//! Code with all jumps resolved; every label jumped to must have been bound.
+	const std::vector<uint8_t>& finish();
+
+	// {{{ labels
+	size_t label() { labels_.push_back(SIZE_MAX); return labels_.size() - 1; }
+	void bind(size_t label) { labels_[label] = code_.size(); }
+	bool isBound(size_t label) const { return labels_[label] != SIZE_MAX; }
+	size_t offset(size_t label) const { return labels_[label]; }
+	// }}}
+
+	// {{{ moves
+	void mov(bool wide, Reg dst, Reg src) { rr(wide, 0x89, src, dst); }
+	void mov(bool wide, Reg dst, const Mem& src) { rm(wide, 0x8b, dst, src); }
+	void mov(bool wide, const Mem& dst, Reg src) { rm(wide, 0x89, src, dst); }
+	void mov(bool wide, const Mem& dst, int32_t imm) { rm(wide, 0xc7, 0, dst); imm32(imm); }
+	void mov(Reg dst, int64_t imm);
+	void store8(const Mem& dst, Reg src);
+	void store16(const Mem& dst, Reg src);
+	void movsx8(Reg dst, const Mem& src) { rm(false, 0x0fbe, dst, src); }
+	void movzx8(Reg dst, const Mem& src) { rm(false, 0x0fb6, dst, src); }
+	void movsx16(Reg dst, const Mem& src) { rm(false, 0x0fbf, dst, src); }
+	void movzx16(Reg dst, const Mem& src) { rm(false, 0x0fb7, dst, src); }
+	void movsx8(Reg dst, Reg src) { rr(false, 0x0fbe, dst, src, true); }
+	void movzx8(Reg dst, Reg src) { rr(false, 0x0fb6, dst, src, true); }
+	void movsx16(Reg dst, Reg src) { rr(false, 0x0fbf, dst, src); }
+	void movzx16(Reg dst, Reg src) { rr(false, 0x0fb7, dst, src); }
+	void movsxd(Reg dst, const Mem& src) { rm(true, 0x63, dst, src); }
+	void movsxd(Reg dst, Reg src) { rr(true, 0x63, dst, src); }
+	void lea(Reg dst, const Mem& src) { rm(true, 0x8d, dst, src); }
+	void lea(bool wide, Reg dst, const Mem& src) { rm(wide, 0x8d, dst, src); }
+	void lea(Reg dst, size_t label);   //!< rip-relative
+	void cmov(bool wide, Cond cc, Reg dst, Reg src) { rr(wide, 0x0f40 | (uint8_t) cc, dst, src); }
+	// }}}
+
+	// {{{ arithmetic
+	void add(bool wide, Reg dst, Reg src) { rr(wide, 0x01, src, dst); }
+	void add(bool wide, Reg dst, const Mem& src) { rm(wide, 0x03, dst, src); }
+	void add(bool wide, Reg dst, int32_t imm) { ri(wide, 0, dst, imm); }
+	void add(bool wide, const Mem& dst, int32_t imm) { mi(wide, 0, dst, imm); }
+	void sub(bool wide, Reg dst, Reg src) { rr(wide, 0x29, src, dst); }
+	void sub(bool wide, Reg dst, const Mem& src) { rm(wide, 0x2b, dst, src); }
+	void sub(bool wide, Reg dst, int32_t imm) { ri(wide, 5, dst, imm); }
+	void and_(bool wide, Reg dst, Reg src) { rr(wide, 0x21, src, dst); }
+	void and_(bool wide, Reg dst, const Mem& src) { rm(wide, 0x23, dst, src); }
+	void and_(bool wide, Reg dst, int32_t imm) { ri(wide, 4, dst, imm); }
+	void or_(bool wide, Reg dst, Reg src) { rr(wide, 0x09, src, dst); }
+	void or_(bool wide, Reg dst, const Mem& src) { rm(wide, 0x0b, dst, src); }
+	void or_(bool wide, Reg dst, int32_t imm) { ri(wide, 1, dst, imm); }
+	void xor_(bool wide, Reg dst, Reg src) { rr(wide, 0x31, src, dst); }
+	void xor_(bool wide, Reg dst, const Mem& src) { rm(wide, 0x33, dst, src); }
+	void xor_(bool wide, Reg dst, int32_t imm) { ri(wide, 6, dst, imm); }
+	void cmp(bool wide, Reg a, Reg b) { rr(wide, 0x39, b, a); }
+	void cmp(bool wide, Reg a, const Mem& b) { rm(wide, 0x3b, a, b); }
+	void cmp(bool wide, Reg a, int32_t imm) { ri(wide, 7, a, imm); }
+	void cmp(bool wide, const Mem& a, int32_t imm) { mi(wide, 7, a, imm); }
+	void test(bool wide, Reg a, Reg b) { rr(wide, 0x85, b, a); }
+	void imul(bool wide, Reg dst, Reg src) { rr(wide, 0x0faf, dst, src); }
+	void imul(bool wide, Reg dst, const Mem& src) { rm(wide, 0x0faf, dst, src); }
+	void imul(bool wide, Reg dst, Reg src, int32_t imm);
+	void neg(bool wide, Reg r) { rr(wide, 0xf7, (Reg) 3, r); }
+	void not_(bool wide, Reg r) { rr(wide, 0xf7, (Reg) 2, r); }
+	void shl(bool wide, Reg r) { rr(wide, 0xd3, (Reg) 4, r); }   //!< by cl
+	void shr(bool wide, Reg r) { rr(wide, 0xd3, (Reg) 5, r); }   //!< by cl
+	void sar(bool wide, Reg r) { rr(wide, 0xd3, (Reg) 7, r); }   //!< by cl
+	void shl(bool wide, Reg r, uint8_t count) { rr(wide, 0xc1, (Reg) 4, r); byte(count); }
+	void shr(bool wide, Reg r, uint8_t count) { rr(wide, 0xc1, (Reg) 5, r); byte(count); }
+	void sar(bool wide, Reg r, uint8_t count) { rr(wide, 0xc1, (Reg) 7, r); byte(count); }
+	void cdq(bool wide) { if (wide) byte(0x48); byte(0x99); }   //!< sign extends eax/rax into edx/rdx
+	void idiv(bool wide, Reg r) { rr(wide, 0xf7, (Reg) 7, r); }
+	void setcc(Cond cc, Reg r) { rr(false, 0x0f90 | (uint8_t) cc, (Reg) 0, r, true); }
+	// }}}
+
+	// {{{ control flow
+	void jmp(size_t label);
+	void jcc(Cond cc, size_t label);
+	void jmp(Reg target) { rr(false, 0xff, (Reg) 4, target); }
+	void jmp(const Mem& target) { rm(false, 0xff, 4u, target); }
+	void call(Reg target) { rr(false, 0xff, (Reg) 2, target); }
+	void push(Reg r);
+	void pop(Reg r);
+	void ret() { byte(0xc3); }
+	void int3() { byte(0xcc); }
+	// }}}
+
+	void byte(uint8_t b) { code_.push_back(b); }
+	void imm32(int32_t v);
+
+	//! Offset of \p label from \p base as 32-bit data, i.e. a jump table entry.
+	void offset32(size_t label, size_t base) { fixups_.push_back({code_.size(), label, base}); imm32(0); }
+
+private:
+	void rex(bool wide, unsigned reg, unsigned index, unsigned base, bool byteRegs);
+	void opcode(unsigned op);
+
+	//! op reg, r/m register
+	void rr(bool wide, unsigned op, Reg reg, Reg rm, bool byteRegs = false);
+	void rr(bool wide, unsigned op, unsigned ext, Reg rm) { rr(wide, op, (Reg) ext, rm); }
+
+	//! op reg, r/m memory
+	void rm(bool wide, unsigned op, Reg reg, const Mem& m, bool byteRegs = false);
+	void rm(bool wide, unsigned op, unsigned ext, const Mem& m) { rm(wide, op, (Reg) ext, m); }
+
+	//! group 1 op (by extension) with an immediate
+	void ri(bool wide, unsigned ext, Reg r, int32_t imm);
+	void mi(bool wide, unsigned ext, const Mem& m, int32_t imm);
+};
@@ -0,0 +1,499 @@
+#include "X86Templates.h"
+#include "JObject.h"
+#include "QuickCode.h"
+#include "Symbol.h"
+
+#include <string.h>
+
+// {{{ memory accesses
+//! Memory access by size and signedness, named after the quick field variants.
+enum class Access { z, b, c, s, i, j };
+
+static void load(X86Assembler& as, Access access, Reg dst, const Mem& src)
+{
+	switch (access) {
+		case Access::z: as.movzx8(dst, src); break;
+		case Access::b: as.movsx8(dst, src); break;
+		case Access::c: as.movzx16(dst, src); break;
+		case Access::s: as.movsx16(dst, src); break;
+		case Access::i: as.mov(false, dst, src); break;
+		case Access::j: as.mov(true, dst, src); break;
+	}
+}
+
+static void store(X86Assembler& as, Access access, const Mem& dst, Reg src)
+{
+	switch (access) {
+		case Access::z:
+		case Access::b: as.store8(dst, src); break;
+		case Access::c:
+		case Access::s: as.store16(dst, src); break;
+		case Access::i: as.mov(false, dst, src); break;
+		case Access::j: as.mov(true, dst, src); break;
+	}
+}
+
+static uint8_t scaleOf(Access access)
+{
+	switch (access) {
+		case Access::z:
+		case Access::b: return 1;
+		case Access::c:
+		case Access::s: return 2;
+		case Access::i: return 4;
+		default: return 8;
+	}
+}
+
+static Cond conditionOf(Opcode op)
+{
+	switch (op) {
+		case Opcode::ifeq: case Opcode::if_icmpeq: case Opcode::if_acmpeq: case Opcode::ifnull: return Cond::e;
+		case Opcode::ifne: case Opcode::if_icmpne: case Opcode::if_acmpne: case Opcode::ifnonnull: return Cond::ne;
+		case Opcode::iflt: case Opcode::if_icmplt: return Cond::l;
+		case Opcode::ifge: case Opcode::if_icmpge: return Cond::ge;
+		case Opcode::ifgt: case Opcode::if_icmpgt: return Cond::g;
+		default: return Cond::le;
+	}
+}
+// }}}
+
+void X86Templates::prologue()
+{
+	// five pushes after the return address keep the stack 16-byte aligned for calls
+	as_.push(Reg::rbx);
+	as_.push(Reg::r12);
+	as_.push(Reg::r13);
+	as_.push(Reg::r14);
+	as_.push(Reg::r15);
+	as_.mov(true, Locals, Reg::rdi);
+	as_.mov(true, Stack, Reg::rsi);
+	as_.mov(true, Self, Reg::rdx);
+	as_.mov(true, FrameRecord, Reg::rcx);
+}
+
+void X86Templates::epilogue()
+{
+	as_.pop(Reg::r15);
+	as_.pop(Reg::r14);
+	as_.pop(Reg::r13);
+	as_.pop(Reg::r12);
+	as_.pop(Reg::rbx);
+	as_.ret();
+}
+
+void X86Templates::push(int index, int64_t value)
+{
+	if (value >= INT32_MIN && value <= INT32_MAX) {
+		as_.mov(true, slot(index), (int32_t) value);
+	} else {
+		as_.mov(Reg::rax, value);
+		as_.mov(true, slot(index), Reg::rax);
+	}
+}
+
+void X86Templates::arithmetic(Opcode op, bool wide, int a, int b)
+{
+	as_.mov(wide, Reg::rax, slot(a));
+	switch (op) {
+		case Opcode::iadd: case Opcode::ladd: as_.add(wide, Reg::rax, slot(b)); break;
+		case Opcode::isub: case Opcode::lsub: as_.sub(wide, Reg::rax, slot(b)); break;
+		case Opcode::imul: case Opcode::lmul: as_.imul(wide, Reg::rax, slot(b)); break;
+		case Opcode::iand: case Opcode::land: as_.and_(wide, Reg::rax, slot(b)); break;
+		case Opcode::ior: case Opcode::lor: as_.or_(wide, Reg::rax, slot(b)); break;
+		default: as_.xor_(wide, Reg::rax, slot(b)); break;
+	}
+	as_.mov(wide, slot(a), Reg::rax);
+}
+
+void X86Templates::divide(const Exit& exit, bool wide, bool remainder, int a, int b)
+{
+	size_t minusOne = as_.label();
+	size_t done = as_.label();
+
+	// the interpreter throws the ArithmeticException
+	as_.mov(wide, Reg::rcx, slot(b));
+	as_.test(wide, Reg::rcx, Reg::rcx);
+	as_.jcc(Cond::e, exit());
+	as_.mov(wide, Reg::rax, slot(a));
+
+	// MIN_VALUE / -1 overflows in Java, but traps on x86
+	as_.cmp(wide, Reg::rcx, -1);
+	as_.jcc(Cond::e, minusOne);
+	as_.cdq(wide);
+	as_.idiv(wide, Reg::rcx);
+	as_.mov(wide, slot(a), remainder ? Reg::rdx : Reg::rax);
+	as_.jmp(done);
+
+	as_.bind(minusOne);
+	if (remainder) {
+		as_.mov(wide, slot(a), 0);
+	} else {
+		as_.neg(wide, Reg::rax);
+		as_.mov(wide, slot(a), Reg::rax);
+	}
+	as_.bind(done);
+}
+
+void X86Templates::shift(Opcode op, bool wide, int a, int b)
+{
+	// x86 masks the count to 5 or 6 bits, just like Java
+	as_.mov(false, Reg::rcx, slot(b));
+	as_.mov(wide, Reg::rax, slot(a));
+	switch (op) {
+		case Opcode::ishl: case Opcode::lshl: as_.shl(wide, Reg::rax); break;
+		case Opcode::ishr: case Opcode::lshr: as_.sar(wide, Reg::rax); break;
+		default: as_.shr(wide, Reg::rax); break;
+	}
+	as_.mov(wide, slot(a), Reg::rax);
+}
+
+void X86Templates::arrayCheck(const Exit& exit, int array, int index)
+{
+	// array into rax, index into rcx
+	as_.mov(true, Reg::rax, slot(array));
+	nullCheck(Reg::rax, exit);
+	as_.mov(false, Reg::rcx, slot(index));
+	as_.cmp(false, Reg::rcx, mem(Reg::rax, JArray::lengthOffset()));
+	as_.jcc(Cond::ae, exit());
+}
+
+void X86Templates::step(const Instruction& insn, int depth)
+{
+	as_.mov(true, Reg::rdi, Self);
+	as_.mov(true, Reg::rsi, FrameRecord);
+	as_.mov(Reg::rdx, (int64_t) (uintptr_t) &insn);
+	as_.lea(Reg::rcx, slot(depth));
+	as_.mov(Reg::rax, (int64_t) runtime_.step);
+	as_.call(Reg::rax);
+}
+
+void X86Templates::invoke(const Instruction& insn, int depth, Method* callee)
+{
+	as_.mov(true, Reg::rdi, Self);
+	as_.mov(true, Reg::rsi, FrameRecord);
+	as_.mov(Reg::rdx, (int64_t) (uintptr_t) &insn);
+	as_.lea(Reg::rcx, slot(depth));
+	as_.mov(Reg::r8, (int64_t) (uintptr_t) callee);
+	as_.mov(Reg::rax, (int64_t) runtime_.invoke);
+	as_.call(Reg::rax);
+}
+
+void X86Templates::trap(uint32_t safepoint)
+{
+	// no registers nor spill slots to pass
+	as_.mov(true, Reg::rdi, Self);
+	as_.mov(true, Reg::rsi, FrameRecord);
+	as_.mov(Reg::rdx, (int64_t) safepoint);
+	as_.xor_(false, Reg::rcx, Reg::rcx);
+	as_.xor_(false, Reg::r8, Reg::r8);
+	as_.mov(Reg::rax, (int64_t) runtime_.trap);
+	as_.call(Reg::rax);
+}
+
+Cond X86Templates::compare(Opcode op, int d)
+{
+	switch (op) {
+		case Opcode::ifeq: case Opcode::ifne: case Opcode::iflt: case Opcode::ifge: case Opcode::ifgt: case Opcode::ifle:
+			as_.cmp(false, slot(d - 1), 0);
+			break;
+		case Opcode::ifnull: case Opcode::ifnonnull:
+			as_.cmp(true, slot(d - 1), 0);
+			break;
+		case Opcode::if_acmpeq: case Opcode::if_acmpne:
+			as_.mov(true, Reg::rax, slot(d - 2));
+			as_.cmp(true, Reg::rax, slot(d - 1));
+			break;
+		default:
+			as_.mov(false, Reg::rax, slot(d - 2));
+			as_.cmp(false, Reg::rax, slot(d - 1));
+			break;
+	}
+	return conditionOf(op);
+}
+
+bool X86Templates::emit(const Instruction& insn, Opcode op, int d, const Exit& exit)
+{
+	switch (op) {
+		// {{{ constants
+		case Opcode::nop:
+			break;
+		case Opcode::aconst_null:
+			push(d, 0);
+			break;
+		case Opcode::iconst_m1: case Opcode::iconst_0: case Opcode::iconst_1: case Opcode::iconst_2:
+		case Opcode::iconst_3: case Opcode::iconst_4: case Opcode::iconst_5:
+			push(d, (int) op - (int) Opcode::iconst_0);
+			break;
+		case Opcode::lconst_0: case Opcode::lconst_1:
+			push(d, (int) op - (int) Opcode::lconst_0);
+			break;
+		case Opcode::fconst_0: case Opcode::fconst_1: case Opcode::fconst_2: {
+			float value = (float) ((int) op - (int) Opcode::fconst_0);
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			push(d, bits);
+			break;
+		}
+		case Opcode::dconst_0: case Opcode::dconst_1: {
+			double value = (double) ((int) op - (int) Opcode::dconst_0);
+			int64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			push(d, bits);
+			break;
+		}
+		case Opcode::bipush: case Opcode::sipush: case Opcode::ldc_int:
+			push(d, insn.operand);
+			break;
+		case Opcode::ldc2_w:
+			push(d, insn.resolved.bits);
+			break;
+		case Opcode::ldc_quick:
+			push(d, (int64_t) (uintptr_t) insn.resolved.object);
+			break;
+		// }}}
+
+		// {{{ locals, copied by whole slots
+		case Opcode::iload: case Opcode::lload: case Opcode::fload: case Opcode::dload: case Opcode::aload:
+			as_.mov(true, Reg::rax, local(insn.index));
+			as_.mov(true, slot(d), Reg::rax);
+			break;
+		case Opcode::iload_0: case Opcode::iload_1: case Opcode::iload_2: case Opcode::iload_3:
+		case Opcode::lload_0: case Opcode::lload_1: case Opcode::lload_2: case Opcode::lload_3:
+		case Opcode::fload_0: case Opcode::fload_1: case Opcode::fload_2: case Opcode::fload_3:
+		case Opcode::dload_0: case Opcode::dload_1: case Opcode::dload_2: case Opcode::dload_3:
+		case Opcode::aload_0: case Opcode::aload_1: case Opcode::aload_2: case Opcode::aload_3:
+			as_.mov(true, Reg::rax, local(((int) op - (int) Opcode::iload_0) % 4));
+			as_.mov(true, slot(d), Reg::rax);
+			break;
+		case Opcode::istore: case Opcode::fstore: case Opcode::astore:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, local(insn.index), Reg::rax);
+			break;
+		case Opcode::lstore: case Opcode::dstore:
+			as_.mov(true, Reg::rax, slot(d - 2));
+			as_.mov(true, local(insn.index), Reg::rax);
+			break;
+		case Opcode::istore_0: case Opcode::istore_1: case Opcode::istore_2: case Opcode::istore_3:
+		case Opcode::fstore_0: case Opcode::fstore_1: case Opcode::fstore_2: case Opcode::fstore_3:
+		case Opcode::astore_0: case Opcode::astore_1: case Opcode::astore_2: case Opcode::astore_3:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, local(((int) op - (int) Opcode::istore_0) % 4), Reg::rax);
+			break;
+		case Opcode::lstore_0: case Opcode::lstore_1: case Opcode::lstore_2: case Opcode::lstore_3:
+		case Opcode::dstore_0: case Opcode::dstore_1: case Opcode::dstore_2: case Opcode::dstore_3:
+			as_.mov(true, Reg::rax, slot(d - 2));
+			as_.mov(true, local(((int) op - (int) Opcode::istore_0) % 4), Reg::rax);
+			break;
+		case Opcode::iinc:
+			as_.add(false, local(insn.index), insn.operand);
+			break;
+		// }}}
+
+		// {{{ stack
+		case Opcode::pop:
+		case Opcode::pop2:
+			break;
+		case Opcode::dup:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, slot(d), Reg::rax);
+			break;
+		case Opcode::dup_x1:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, Reg::rcx, slot(d - 2));
+			as_.mov(true, slot(d - 2), Reg::rax);
+			as_.mov(true, slot(d - 1), Reg::rcx);
+			as_.mov(true, slot(d), Reg::rax);
+			break;
+		case Opcode::dup_x2:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, Reg::rcx, slot(d - 2));
+			as_.mov(true, Reg::rdx, slot(d - 3));
+			as_.mov(true, slot(d - 3), Reg::rax);
+			as_.mov(true, slot(d - 2), Reg::rdx);
+			as_.mov(true, slot(d - 1), Reg::rcx);
+			as_.mov(true, slot(d), Reg::rax);
+			break;
+		case Opcode::dup2:
+			as_.mov(true, Reg::rax, slot(d - 2));
+			as_.mov(true, Reg::rcx, slot(d - 1));
+			as_.mov(true, slot(d), Reg::rax);
+			as_.mov(true, slot(d + 1), Reg::rcx);
+			break;
+		case Opcode::dup2_x1:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, Reg::rcx, slot(d - 2));
+			as_.mov(true, Reg::rdx, slot(d - 3));
+			as_.mov(true, slot(d - 3), Reg::rcx);
+			as_.mov(true, slot(d - 2), Reg::rax);
+			as_.mov(true, slot(d - 1), Reg::rdx);
+			as_.mov(true, slot(d), Reg::rcx);
+			as_.mov(true, slot(d + 1), Reg::rax);
+			break;
+		case Opcode::dup2_x2:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, Reg::rcx, slot(d - 2));
+			as_.mov(true, Reg::rdx, slot(d - 3));
+			as_.mov(true, Reg::rsi, slot(d - 4));
+			as_.mov(true, slot(d - 4), Reg::rcx);
+			as_.mov(true, slot(d - 3), Reg::rax);
+			as_.mov(true, slot(d - 2), Reg::rsi);
+			as_.mov(true, slot(d - 1), Reg::rdx);
+			as_.mov(true, slot(d), Reg::rcx);
+			as_.mov(true, slot(d + 1), Reg::rax);
+			break;
+		case Opcode::swap:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			as_.mov(true, Reg::rcx, slot(d - 2));
+			as_.mov(true, slot(d - 1), Reg::rcx);
+			as_.mov(true, slot(d - 2), Reg::rax);
+			break;
+		// }}}
+
+		// {{{ int and long arithmetic
+		case Opcode::iadd: case Opcode::isub: case Opcode::imul: case Opcode::iand: case Opcode::ior: case Opcode::ixor:
+			arithmetic(op, false, d - 2, d - 1);
+			break;
+		case Opcode::ladd: case Opcode::lsub: case Opcode::lmul: case Opcode::land: case Opcode::lor: case Opcode::lxor:
+			arithmetic(op, true, d - 4, d - 2);
+			break;
+		case Opcode::idiv: case Opcode::irem:
+			divide(exit, false, op == Opcode::irem, d - 2, d - 1);
+			break;
+		case Opcode::ldiv: case Opcode::lrem:
+			divide(exit, true, op == Opcode::lrem, d - 4, d - 2);
+			break;
+		case Opcode::ishl: case Opcode::ishr: case Opcode::iushr:
+			shift(op, false, d - 2, d - 1);
+			break;
+		case Opcode::lshl: case Opcode::lshr: case Opcode::lushr:
+			shift(op, true, d - 3, d - 1);
+			break;
+		case Opcode::ineg: case Opcode::lneg: {
+			bool wide = op == Opcode::lneg;
+			int a = wide ? d - 2 : d - 1;
+			as_.mov(wide, Reg::rax, slot(a));
+			as_.neg(wide, Reg::rax);
+			as_.mov(wide, slot(a), Reg::rax);
+			break;
+		}
+		case Opcode::i2l:
+			as_.movsxd(Reg::rax, slot(d - 1));
+			as_.mov(true, slot(d - 1), Reg::rax);
+			break;
+		case Opcode::l2i:
+			// the low half of the long is the int
+			break;
+		case Opcode::i2b:
+			as_.movsx8(Reg::rax, slot(d - 1));
+			as_.mov(false, slot(d - 1), Reg::rax);
+			break;
+		case Opcode::i2c:
+			as_.movzx16(Reg::rax, slot(d - 1));
+			as_.mov(false, slot(d - 1), Reg::rax);
+			break;
+		case Opcode::i2s:
+			as_.movsx16(Reg::rax, slot(d - 1));
+			as_.mov(false, slot(d - 1), Reg::rax);
+			break;
+		case Opcode::lcmp:
+			as_.mov(true, Reg::rdx, slot(d - 4));
+			as_.xor_(false, Reg::rax, Reg::rax);
+			as_.xor_(false, Reg::rcx, Reg::rcx);
+			as_.cmp(true, Reg::rdx, slot(d - 2));
+			as_.setcc(Cond::g, Reg::rax);
+			as_.setcc(Cond::l, Reg::rcx);
+			as_.sub(false, Reg::rax, Reg::rcx);
+			as_.mov(false, slot(d - 4), Reg::rax);
+			break;
+		// }}}
+
+		// {{{ fields
+		case Opcode::getfield_z: case Opcode::getfield_b: case Opcode::getfield_c: case Opcode::getfield_s:
+		case Opcode::getfield_i: case Opcode::getfield_j: case Opcode::getfield_a: {
+			Access access = op == Opcode::getfield_a ? Access::j : (Access) ((int) op - (int) Opcode::getfield_z);
+			as_.mov(true, Reg::rax, slot(d - 1));
+			nullCheck(Reg::rax, exit);
+			load(as_, access, Reg::rcx, mem(Reg::rax, JObject::dataOffset() + insn.resolved.offset));
+			as_.mov(true, slot(d - 1), Reg::rcx);
+			break;
+		}
+		case Opcode::putfield_z: case Opcode::putfield_b: case Opcode::putfield_s:
+		case Opcode::putfield_i: case Opcode::putfield_j: case Opcode::putfield_a: {
+			static const Access accesses[] = {Access::z, Access::b, Access::s, Access::i, Access::j, Access::j};
+			Access access = accesses[(int) op - (int) Opcode::putfield_z];
+			int value = d - (op == Opcode::putfield_j ? 2 : 1);
+			as_.mov(true, Reg::rax, slot(value - 1));
+			nullCheck(Reg::rax, exit);
+			as_.mov(true, Reg::rcx, slot(value));
+			if (op == Opcode::putfield_z)
+				as_.and_(false, Reg::rcx, 1);
+			store(as_, access, mem(Reg::rax, JObject::dataOffset() + insn.resolved.offset), Reg::rcx);
+			break;
+		}
+		case Opcode::getstatic_z: case Opcode::getstatic_b: case Opcode::getstatic_c: case Opcode::getstatic_s:
+		case Opcode::getstatic_i: case Opcode::getstatic_j: case Opcode::getstatic_a: {
+			Access access = op == Opcode::getstatic_a ? Access::j : (Access) ((int) op - (int) Opcode::getstatic_z);
+			as_.mov(Reg::rax, (int64_t) (uintptr_t) insn.resolved.address);
+			load(as_, access, Reg::rcx, mem(Reg::rax));
+			as_.mov(true, slot(d), Reg::rcx);
+			break;
+		}
+		case Opcode::putstatic_z: case Opcode::putstatic_b: case Opcode::putstatic_s:
+		case Opcode::putstatic_i: case Opcode::putstatic_j: case Opcode::putstatic_a: {
+			static const Access accesses[] = {Access::z, Access::b, Access::s, Access::i, Access::j, Access::j};
+			Access access = accesses[(int) op - (int) Opcode::putstatic_z];
+			as_.mov(Reg::rax, (int64_t) (uintptr_t) insn.resolved.address);
+			as_.mov(true, Reg::rcx, slot(d - (op == Opcode::putstatic_j ? 2 : 1)));
+			if (op == Opcode::putstatic_z)
+				as_.and_(false, Reg::rcx, 1);
+			store(as_, access, mem(Reg::rax), Reg::rcx);
+			break;
+		}
+		// }}}
+
+		// {{{ arrays
+		case Opcode::arraylength:
+			as_.mov(true, Reg::rax, slot(d - 1));
+			nullCheck(Reg::rax, exit);
+			as_.mov(false, Reg::rcx, mem(Reg::rax, JArray::lengthOffset()));
+			as_.mov(true, slot(d - 1), Reg::rcx);
+			break;
+		case Opcode::iaload: case Opcode::laload: case Opcode::faload: case Opcode::daload:
+		case Opcode::aaload: case Opcode::baload: case Opcode::caload: case Opcode::saload: {
+			static const Access accesses[] = {
+				Access::i, Access::j, Access::i, Access::j, Access::j, Access::b, Access::c, Access::s
+			};
+			Access access = accesses[(int) op - (int) Opcode::iaload];
+			arrayCheck(exit, d - 2, d - 1);
+			load(as_, access, Reg::rdx, mem(Reg::rax, Reg::rcx, scaleOf(access), JArray::elementsOffset()));
+			as_.mov(true, slot(d - 2), Reg::rdx);
+			break;
+		}
+		case Opcode::iastore: case Opcode::lastore: case Opcode::fastore: case Opcode::dastore:
+		case Opcode::bastore: case Opcode::castore: case Opcode::sastore: {
+			static const Access accesses[] = {Access::i, Access::j, Access::i, Access::j, Access::j, Access::b, Access::c, Access::s};
+			Access access = accesses[(int) op - (int) Opcode::iastore];
+			int value = d - (op == Opcode::lastore || op == Opcode::dastore ? 2 : 1);
+			arrayCheck(exit, value - 2, value - 1);
+			as_.mov(true, Reg::rdx, slot(value));
+			if (op == Opcode::bastore) {
+				// boolean[] shares the instruction with byte[], and stores 0 or 1 only
+				size_t bytes = as_.label();
+				as_.mov(Reg::rsi, (int64_t) (uintptr_t) intern("[Z"));
+				as_.cmp(true, Reg::rsi, mem(Reg::rax, JArray::descriptorOffset()));
+				as_.jcc(Cond::ne, bytes);
+				as_.and_(false, Reg::rdx, 1);
+				as_.bind(bytes);
+			}
+			store(as_, access, mem(Reg::rax, Reg::rcx, scaleOf(access), JArray::elementsOffset()), Reg::rdx);
+			break;
+		}
+		// }}}
+
+		default:
+			return false;
+	}
+
+	return true;
+}
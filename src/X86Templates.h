@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Opcodes.h"
+#include "X86Assembler.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+struct Instruction;
+class Method;
+
+/**
+ * x86-64 machine code templates of quickened instructions, shared by the
+ * JIT compilers (see BaselineCompiler and TraceCompiler).
+ *
+ * Compiled code runs on the interpreter frame: the frame's locals, operand
+ * stack bottom, interpreter and frame record stay in callee-saved registers,
+ * and every value lives in the frame's slots. A template covers a single
+ * instruction that falls through to the next one, at an operand stack
+ * depth known at compile time. Control flow, calls and exits are up to the
+ * compiler.
+ */
+class X86Templates {
+public:
+	// registers holding the arguments of the entry point throughout
+	static const Reg Locals = Reg::rbx;
+	static const Reg Stack = Reg::r12;
+	static const Reg Self = Reg::r13;
+	static const Reg FrameRecord = Reg::r14;
+
+	//! What compiled code needs to know of the interpreter.
+	struct Runtime {
+		int32_t pcOffset;      //!< of Interpreter::Frame::pc
+		int32_t codeOffset;    //!< of Interpreter::Frame::code
+		uintptr_t step;        //!< Interpreter::jitStep()
+		uintptr_t trap;        //!< Interpreter::jitTrap()
+		uintptr_t invoke;      //!< Interpreter::jitInvoke()
+	};
+
+	static Mem local(int index) { return mem(Locals, 8 * index); }
+	static Mem slot(int index) { return mem(Stack, 8 * index); }
+
+private:
+	X86Assembler& as_;
+	Runtime runtime_;
+
+public:
+	X86Templates(X86Assembler& as, const Runtime& runtime) : as_(as), runtime_(runtime) {}
+
+	const Runtime& runtime() const { return runtime_; }
+
+	/**
+	 * Saves the callee-saved registers and moves the entry point's
+	 * arguments into them.
+	 */
+	void prologue();
+
+	//! Restores the callee-saved registers and returns rax.
+	void epilogue();
+
+	//! Label of the exit to take, created on demand.
+	typedef std::function<size_t()> Exit;
+
+	/**
+	 * Emits the template of \p insn, executing as \p op at operand stack
+	 * depth \p depth, that jumps to \p exit if a null, bounds or division
+	 * check fails.
+	 *
+	 * @return false, emitting nothing, if \p op has no template.
+	 */
+	bool emit(const Instruction& insn, Opcode op, int depth, const Exit& exit);
+
+	/**
+	 * Compares the operands of conditional branch \p op at \p depth.
+	 *
+	 * @return the condition under which the branch is taken.
+	 */
+	Cond compare(Opcode op, int depth);
+
+	//! Calls Interpreter::jitStep() for \p insn, leaving its result in eax.
+	void step(const Instruction& insn, int depth);
+
+	//! Calls Interpreter::jitInvoke() for \p insn and \p callee, leaving its result in eax.
+	void invoke(const Instruction& insn, int depth, Method* callee);
+
+	/**
+	 * Calls Interpreter::jitTrap() for the uncommon trap of \p safepoint,
+	 * whose values all are in the frame's slots, leaving
+	 * CompiledMethod::Deoptimized in eax.
+	 */
+	void trap(uint32_t safepoint);
+
+	static bool isConditionalBranch(Opcode op) {
+		return (op >= Opcode::ifeq && op <= Opcode::if_acmpne) || op == Opcode::ifnull || op == Opcode::ifnonnull;
+	}
+
+	//! Operand slots conditional branch \p op pops.
+	static int branchOperands(Opcode op) {
+		return (op >= Opcode::if_icmpeq && op <= Opcode::if_acmpne) ? 2 : 1;
+	}
+
+private:
+	void nullCheck(Reg r, const Exit& exit) {
+		as_.test(true, r, r);
+		as_.jcc(Cond::e, exit());
+	}
+
+	void push(int index, int64_t value);
+	void arithmetic(Opcode op, bool wide, int a, int b);
+	void divide(const Exit& exit, bool wide, bool remainder, int a, int b);
+	void shift(Opcode op, bool wide, int a, int b);
+	void arrayCheck(const Exit& exit, int array, int index);
+};
@@ -0,0 +1,715 @@
+/**
+ * Class loading benchmark.
+ *
+ * Measures defineClass(), loadClass() and resolveClass() throughput and
+ * per-class latency over the checked-in test classes, synthesized
+ * classfiles (huge constant pools, thousands of methods, deep hierarchies)
+ * and optionally a user supplied directory or .jar.
+ *
+ * With a class-data-sharing archive, the suites' classes get archived into
+ * it if it does not exist yet, and every suite additionally loads its
+ * classes through the mapped archive, so the two load phases give the
+ * startup delta.
+ *
+ * usage: bench [-n iterations] [-s suite,...] [-o report.json] [-z] [-L] [-A archive] [classpath]
+ */
+#include "VMClassLoader.h"
+#include "ClassPath.h"
+#include "ClassfileBuffer.h"
+#include "Class.h"
+#include "ClassWriter.h"
+#include "ClassArchive.h"
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#if !defined(BENCH_TESTS_DIR)
+#define BENCH_TESTS_DIR "tests"
+#endif
+
+// {{{ allocation counting
+static std::atomic<size_t> allocationCount(0);
+
+void* operator new(size_t size)
+{
+	allocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+	free(p);
+}
+// }}}
+
+// {{{ suites
+struct ClassInput {
+	std::string name;
+	std::shared_ptr<ClassfileBuffer> classfile;
+};
+
+struct Suite {
+	std::string name;
+	std::vector<std::string> classpath;
+	std::vector<ClassInput> classes;
+
+	size_t bytes() const {
+		size_t n = 0;
+		for (const ClassInput& c: classes)
+			n += c.classfile->size();
+		return n;
+	}
+};
+
+enum : uint16_t {
+	ACC_PUBLIC = 0x0001,
+	ACC_STATIC = 0x0008,
+};
+
+static std::shared_ptr<ClassfileBuffer> toBuffer(const std::vector<uint8_t>& bytes)
+{
+	return ClassfileBuffer::copy(bytes.data(), bytes.size());
+}
+
+//! Stand-in java/lang/Object, so that synthesized and test classes resolve.
+static ClassInput generateObject()
+{
+	ClassWriter w("java/lang/Object", "");
+	w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, {0xb1});
+	w.addMethod(ACC_PUBLIC, "hashCode", "()I", 1, 1, {0x03, 0xac});
+	w.addMethod(ACC_PUBLIC, "equals", "(Ljava/lang/Object;)Z", 1, 2, {0x03, 0xac});
+	w.addMethod(ACC_PUBLIC, "toString", "()Ljava/lang/String;", 1, 1, {0x01, 0xb0});
+	return {"java/lang/Object", toBuffer(w.finish())};
+}
+
+//! Classes with constant pools close to the 64k limit.
+static std::vector<ClassInput> generatePoolClasses(size_t count)
+{
+	std::vector<ClassInput> classes;
+	for (size_t i = 0; i < count; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "bench/pool/Pool%03zu", i);
+		ClassWriter w(name, "java/lang/Object");
+
+		char s[128];
+		for (int k = 0; w.constantCount() < 65000 - 8; ++k) {
+			snprintf(s, sizeof(s), "field%05d", k);
+			w.fieldRef(w.thisClass(), s, "I");
+			snprintf(s, sizeof(s), "constant string value #%d of %s", k, name);
+			w.string(s);
+			w.integer(k * 7919);
+			w.longConstant((int64_t) k << 33);
+		}
+		w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, {0xb1});
+
+		classes.push_back({name, toBuffer(w.finish())});
+	}
+	return classes;
+}
+
+//! Classes with thousands of small static methods.
+static std::vector<ClassInput> generateMethodClasses(size_t count, size_t methods)
+{
+	std::vector<ClassInput> classes;
+	for (size_t i = 0; i < count; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "bench/methods/Methods%03zu", i);
+		ClassWriter w(name, "java/lang/Object");
+
+		char s[64];
+		for (size_t k = 0; k < methods; ++k) {
+			snprintf(s, sizeof(s), "method%05zu", k);
+			// iload_0, iload_1, iadd, ireturn
+			w.addMethod(ACC_PUBLIC | ACC_STATIC, s, "(II)I", 2, 2, {0x1a, 0x1b, 0x60, 0xac});
+		}
+		w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, {0xb1});
+
+		classes.push_back({name, toBuffer(w.finish())});
+	}
+	return classes;
+}
+
+/**
+ * A single inheritance chain of \p depth classes, each overriding the
+ * virtual methods of its parent and adding fields of its own.
+ */
+static std::vector<ClassInput> generateHierarchy(size_t depth)
+{
+	std::vector<ClassInput> classes;
+	std::string parent = "java/lang/Object";
+	for (size_t i = 0; i < depth; ++i) {
+		char name[64];
+		snprintf(name, sizeof(name), "bench/deep/Level%03zu", i);
+		ClassWriter w(name, parent);
+
+		char s[64];
+		static const char* types[] = {"I", "J", "B", "Ljava/lang/Object;", "S", "D"};
+		for (size_t k = 0; k < 6; ++k) {
+			snprintf(s, sizeof(s), "f%zu_%zu", i, k);
+			w.addField(ACC_PUBLIC, s, types[k]);
+		}
+		for (size_t k = 0; k < 8; ++k) {
+			snprintf(s, sizeof(s), "virtual%zu", k);
+			w.addMethod(ACC_PUBLIC, s, "()V", 0, 1, {0xb1});
+		}
+		snprintf(s, sizeof(s), "own%zu", i);
+		w.addMethod(ACC_PUBLIC, s, "()V", 0, 1, {0xb1});
+		w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, {0xb1});
+
+		classes.push_back({name, toBuffer(w.finish())});
+		parent = name;
+	}
+	return classes;
+}
+
+//! Reads all classes of a classpath directory or .jar.
+static bool readClassPath(const std::string& path, std::vector<ClassInput>& classes)
+{
+	std::unique_ptr<ClassPathEntry> entry(ClassPathEntry::create(path));
+	if (!entry)
+		return false;
+
+	std::vector<std::string> names;
+	entry->list(names);
+	std::sort(names.begin(), names.end());
+
+	for (const std::string& name: names) {
+		std::shared_ptr<ClassfileBuffer> classfile = entry->open(name + ".class", false);
+		if (classfile)
+			classes.push_back({name, classfile});
+	}
+	return true;
+}
+
+static bool makeDirectories(const std::string& path)
+{
+	for (size_t i = path.find('/', 1); ; i = path.find('/', i + 1)) {
+		std::string dir = path.substr(0, i);
+		if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+			return false;
+		if (i == std::string::npos)
+			return true;
+	}
+}
+
+static bool writeClass(const std::string& root, const ClassInput& c)
+{
+	std::string path = root + "/" + c.name + ".class";
+	if (!makeDirectories(path.substr(0, path.rfind('/'))))
+		return false;
+
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	bool ok = fwrite(c.classfile->data(), 1, c.classfile->size(), fp) == c.classfile->size();
+	return fclose(fp) == 0 && ok;
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+
+static bool removeDirectory(const std::string& path)
+{
+	return nftw(path.c_str(), &removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+// }}}
+
+// {{{ measurement
+struct Phase {
+	std::string name;
+	size_t classes;
+	size_t failures;
+	size_t bytes;
+	double seconds;
+	size_t allocations;
+	std::vector<double> latencies; // nanoseconds per class
+
+	explicit Phase(const std::string& n) :
+		name(n), classes(0), failures(0), bytes(0), seconds(0), allocations(0), latencies() {}
+
+	double classesPerSecond() const { return seconds > 0 ? classes / seconds : 0; }
+	double megabytesPerSecond() const { return seconds > 0 ? bytes / seconds / (1024.0 * 1024.0) : 0; }
+	double allocationsPerClass() const { return classes ? (double) allocations / classes : 0; }
+
+	//! Nearest-rank percentile of the per-class latency in microseconds.
+	double percentile(double p) {
+		if (latencies.empty())
+			return 0;
+
+		std::sort(latencies.begin(), latencies.end());
+		size_t rank = (size_t) (p / 100.0 * latencies.size() + 0.5);
+		rank = std::max<size_t>(1, std::min(rank, latencies.size()));
+		return latencies[rank - 1] / 1000.0;
+	}
+};
+
+struct SuiteResult {
+	std::string name;
+	size_t classes;
+	size_t bytes;
+	size_t metadataBytes;
+	size_t unmaterializedMethods;
+	long peakRssKiB;
+	size_t staleClasses; // archived classes loaded from their classfile instead
+	std::vector<Phase> phases;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double nanosSince(Clock::time_point start)
+{
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+static long peakRssKiB()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+struct Options {
+	size_t iterations;
+	bool zeroCopy;
+	bool lazyMethods;
+	std::string archive;
+};
+
+/**
+ * Runs all phases of a suite \p iterations times, each time on a fresh
+ * class loader.
+ *
+ * define:  defineClass() from memory, i.e. parsing only
+ * load:    loadClass() through the classpath, including classfile I/O
+ * resolve: resolveClass() of the loaded classes, in load order
+ * archived: mapArchive() and loadClass() through the archive, if given
+ */
+static SuiteResult runSuite(const Suite& suite, const Options& options)
+{
+	SuiteResult result;
+	result.name = suite.name;
+	result.classes = suite.classes.size();
+	result.bytes = suite.bytes();
+	result.metadataBytes = 0;
+	result.unmaterializedMethods = 0;
+	result.staleClasses = 0;
+
+	Phase define("define");
+	Phase load("load");
+	Phase resolve("resolve");
+	Phase archived("archived");
+
+	for (size_t iteration = 0; iteration < options.iterations; ++iteration) {
+		{
+			std::unique_ptr<VMClassLoader> loader(new VMClassLoader());
+			loader->setLazyMethodBodies(options.lazyMethods);
+
+			size_t allocations = allocationCount.load();
+			Clock::time_point begin = Clock::now();
+			for (const ClassInput& input: suite.classes) {
+				Clock::time_point start = Clock::now();
+				Class* c = loader->defineClass(input.name.c_str(), input.classfile);
+				define.latencies.push_back(nanosSince(start));
+				if (c) {
+					++define.classes;
+					define.bytes += input.classfile->size();
+				} else {
+					++define.failures;
+				}
+			}
+			define.seconds += nanosSince(begin) / 1e9;
+			define.allocations += allocationCount.load() - allocations;
+		}
+
+		std::unique_ptr<VMClassLoader> loader(new VMClassLoader());
+		loader->setZeroCopy(options.zeroCopy);
+		loader->setLazyMethodBodies(options.lazyMethods);
+		for (const std::string& path: suite.classpath)
+			loader->addClassPath(path);
+
+		std::vector<Class*> loaded;
+		size_t allocations = allocationCount.load();
+		Clock::time_point begin = Clock::now();
+		for (const ClassInput& input: suite.classes) {
+			Clock::time_point start = Clock::now();
+			Class* c = loader->loadClass(input.name.c_str(), false);
+			load.latencies.push_back(nanosSince(start));
+			if (c) {
+				++load.classes;
+				load.bytes += input.classfile->size();
+				loaded.push_back(c);
+			} else {
+				++load.failures;
+			}
+		}
+		load.seconds += nanosSince(begin) / 1e9;
+		load.allocations += allocationCount.load() - allocations;
+
+		allocations = allocationCount.load();
+		begin = Clock::now();
+		for (size_t i = 0; i < loaded.size(); ++i) {
+			Clock::time_point start = Clock::now();
+			loader->resolveClass(loaded[i]);
+			resolve.latencies.push_back(nanosSince(start));
+			++resolve.classes;
+			resolve.bytes += loaded[i]->classfile()->size();
+		}
+		resolve.seconds += nanosSince(begin) / 1e9;
+		resolve.allocations += allocationCount.load() - allocations;
+
+		result.metadataBytes = loader->metadataBytes();
+		result.unmaterializedMethods = loader->unmaterializedMethodCount();
+
+		if (options.archive.empty())
+			continue;
+
+		loader.reset(new VMClassLoader());
+		loader->setZeroCopy(options.zeroCopy);
+		loader->setLazyMethodBodies(options.lazyMethods);
+		for (const std::string& path: suite.classpath)
+			loader->addClassPath(path);
+
+		allocations = allocationCount.load();
+		begin = Clock::now();
+		if (!loader->mapArchive(options.archive)) {
+			archived.failures += suite.classes.size();
+			continue;
+		}
+		for (const ClassInput& input: suite.classes) {
+			Clock::time_point start = Clock::now();
+			Class* c = loader->loadClass(input.name.c_str(), false);
+			archived.latencies.push_back(nanosSince(start));
+			if (c) {
+				++archived.classes;
+				archived.bytes += input.classfile->size();
+			} else {
+				++archived.failures;
+			}
+		}
+		archived.seconds += nanosSince(begin) / 1e9;
+		archived.allocations += allocationCount.load() - allocations;
+		result.staleClasses = loader->archive()->staleCount();
+	}
+
+	result.phases.push_back(define);
+	result.phases.push_back(load);
+	result.phases.push_back(resolve);
+	if (!options.archive.empty())
+		result.phases.push_back(archived);
+	result.peakRssKiB = peakRssKiB();
+
+	return result;
+}
+// }}}
+
+// {{{ reporting
+static void printReport(FILE* out, std::vector<SuiteResult>& results)
+{
+	fprintf(out, "%-10s %-8s %7s %12s %9s %9s %9s %9s %9s %10s\n",
+		"suite", "phase", "classes", "classes/s", "MB/s", "p50 us", "p90 us", "p99 us", "max us", "allocs/cls");
+
+	for (SuiteResult& suite: results) {
+		for (Phase& phase: suite.phases) {
+			fprintf(out, "%-10s %-8s %7zu %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f %10.1f\n",
+				suite.name.c_str(), phase.name.c_str(), phase.classes,
+				phase.classesPerSecond(), phase.megabytesPerSecond(),
+				phase.percentile(50), phase.percentile(90), phase.percentile(99), phase.percentile(100),
+				phase.allocationsPerClass());
+		}
+	}
+
+	for (const SuiteResult& suite: results) {
+		if (suite.phases.size() < 4)
+			continue;
+
+		const Phase& load = suite.phases[1];
+		const Phase& archived = suite.phases[3];
+		fprintf(out, "%-10s startup %.2f ms, %.2f ms archived (%.2fx), %zu stale\n",
+			suite.name.c_str(), load.seconds * 1e3, archived.seconds * 1e3,
+			archived.seconds > 0 ? load.seconds / archived.seconds : 0, suite.staleClasses);
+	}
+
+	fprintf(out, "peak RSS: %ld KiB\n", peakRssKiB());
+}
+
+static std::string jsonString(const std::string& s)
+{
+	std::string out = "\"";
+	for (char ch: s) {
+		if (ch == '"' || ch == '\\') {
+			out += '\\';
+			out += ch;
+		} else if ((unsigned char) ch < 0x20) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", ch);
+			out += buf;
+		} else {
+			out += ch;
+		}
+	}
+	return out + "\"";
+}
+
+static void writeJson(FILE* out, std::vector<SuiteResult>& results, const Options& options)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"iterations\": %zu,\n", options.iterations);
+	fprintf(out, "  \"zeroCopy\": %s,\n", options.zeroCopy ? "true" : "false");
+	fprintf(out, "  \"lazyMethodBodies\": %s,\n", options.lazyMethods ? "true" : "false");
+	if (!options.archive.empty())
+		fprintf(out, "  \"archive\": %s,\n", jsonString(options.archive).c_str());
+	fprintf(out, "  \"peakRssKiB\": %ld,\n", peakRssKiB());
+	fprintf(out, "  \"suites\": [");
+
+	for (size_t i = 0; i < results.size(); ++i) {
+		SuiteResult& suite = results[i];
+		fprintf(out, "%s\n    {\n", i ? "," : "");
+		fprintf(out, "      \"name\": %s,\n", jsonString(suite.name).c_str());
+		fprintf(out, "      \"classes\": %zu,\n", suite.classes);
+		fprintf(out, "      \"bytes\": %zu,\n", suite.bytes);
+		fprintf(out, "      \"metadataBytes\": %zu,\n", suite.metadataBytes);
+		fprintf(out, "      \"unmaterializedMethods\": %zu,\n", suite.unmaterializedMethods);
+		fprintf(out, "      \"peakRssKiB\": %ld,\n", suite.peakRssKiB);
+		if (!options.archive.empty())
+			fprintf(out, "      \"staleClasses\": %zu,\n", suite.staleClasses);
+		fprintf(out, "      \"phases\": {");
+
+		for (size_t k = 0; k < suite.phases.size(); ++k) {
+			Phase& phase = suite.phases[k];
+			fprintf(out, "%s\n        %s: {", k ? "," : "", jsonString(phase.name).c_str());
+			fprintf(out, "\"classes\": %zu, ", phase.classes);
+			fprintf(out, "\"failures\": %zu, ", phase.failures);
+			fprintf(out, "\"seconds\": %.6f, ", phase.seconds);
+			fprintf(out, "\"classesPerSecond\": %.1f, ", phase.classesPerSecond());
+			fprintf(out, "\"megabytesPerSecond\": %.3f, ", phase.megabytesPerSecond());
+			fprintf(out, "\"allocationsPerClass\": %.2f, ", phase.allocationsPerClass());
+			fprintf(out, "\"latencyMicros\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}}",
+				phase.percentile(50), phase.percentile(90), phase.percentile(99), phase.percentile(100));
+		}
+
+		fprintf(out, "\n      }\n    }");
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+}
+// }}}
+
+static void usage(const char* program)
+{
+	fprintf(stderr,
+		"usage: %s [-n iterations] [-s suite,...] [-o report.json] [-z] [-L] [-A archive] [classpath]\n"
+		"\n"
+		"  -n N       run each suite N times (default: 5)\n"
+		"  -s LIST    comma separated suites: tests, pool, methods, hierarchy, user\n"
+		"             (default: all, user only if a classpath is given)\n"
+		"  -o FILE    write a JSON report to FILE, - for stdout\n"
+		"  -z         load through mmap'd classfiles (zero-copy)\n"
+		"  -L         decode method bodies lazily\n"
+		"  -A FILE    also load through class-data-sharing archive FILE, which\n"
+		"             gets written first if it does not exist\n"
+		"  classpath  directory or .jar whose classes make up the user suite\n",
+		program);
+}
+
+int main(int argc, char* argv[])
+{
+	Options options = {5, false, false, ""};
+	std::string suiteList;
+	std::string jsonPath;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:o:zLA:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				options.iterations = std::max(1, atoi(optarg));
+				break;
+			case 's':
+				suiteList = optarg;
+				break;
+			case 'o':
+				jsonPath = optarg;
+				break;
+			case 'z':
+				options.zeroCopy = true;
+				break;
+			case 'L':
+				options.lazyMethods = true;
+				break;
+			case 'A':
+				options.archive = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	std::string userPath = optind < argc ? argv[optind] : "";
+	if (suiteList.empty())
+		suiteList = userPath.empty() ? "tests,pool,methods,hierarchy" : "tests,pool,methods,hierarchy,user";
+
+	auto enabled = [&](const char* name) -> bool {
+		return ("," + suiteList + ",").find(std::string(",") + name + ",") != std::string::npos;
+	};
+
+	// synthesized classes get written into a scratch classpath directory
+	char scratch[] = "/tmp/jvm-bench-XXXXXX";
+	if (!mkdtemp(scratch)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	ClassInput object = generateObject();
+	writeClass(scratch, object);
+
+	std::vector<Suite> suites;
+
+	if (enabled("tests")) {
+		Suite suite;
+		suite.name = "tests";
+		suite.classpath = {BENCH_TESTS_DIR, scratch};
+		suite.classes.push_back(object);
+		readClassPath(BENCH_TESTS_DIR, suite.classes);
+		suites.push_back(suite);
+	}
+
+	if (enabled("pool")) {
+		Suite suite;
+		suite.name = "pool";
+		suite.classpath = {scratch};
+		suite.classes.push_back(object);
+		for (const ClassInput& c: generatePoolClasses(16))
+			suite.classes.push_back(c);
+		suites.push_back(suite);
+	}
+
+	if (enabled("methods")) {
+		Suite suite;
+		suite.name = "methods";
+		suite.classpath = {scratch};
+		suite.classes.push_back(object);
+		for (const ClassInput& c: generateMethodClasses(16, 4000))
+			suite.classes.push_back(c);
+		suites.push_back(suite);
+	}
+
+	if (enabled("hierarchy")) {
+		Suite suite;
+		suite.name = "hierarchy";
+		suite.classpath = {scratch};
+		suite.classes.push_back(object);
+		for (const ClassInput& c: generateHierarchy(256))
+			suite.classes.push_back(c);
+		suites.push_back(suite);
+	}
+
+	if (enabled("user")) {
+		Suite suite;
+		suite.name = "user";
+		suite.classpath = {userPath, scratch};
+		if (userPath.empty() || !readClassPath(userPath, suite.classes)) {
+			fprintf(stderr, "Could not open classpath '%s'.\n", userPath.c_str());
+			removeDirectory(scratch);
+			return 1;
+		}
+		suites.push_back(suite);
+	}
+
+	for (const Suite& suite: suites)
+		for (const ClassInput& c: suite.classes)
+			if (suite.name != "tests" && suite.name != "user")
+				writeClass(scratch, c);
+
+	if (!options.archive.empty() && access(options.archive.c_str(), F_OK) != 0) {
+		// one archive of all suites' classes, as they share their classpaths
+		VMClassLoader loader;
+		std::vector<std::string> classpath;
+		std::vector<std::string> names;
+		for (const Suite& suite: suites) {
+			for (const std::string& path: suite.classpath)
+				if (std::find(classpath.begin(), classpath.end(), path) == classpath.end())
+					classpath.push_back(path);
+			for (const ClassInput& c: suite.classes)
+				if (std::find(names.begin(), names.end(), c.name) == names.end())
+					names.push_back(c.name);
+		}
+		for (const std::string& path: classpath)
+			loader.addClassPath(path);
+
+		if (!loader.dumpArchive(options.archive, names)) {
+			fprintf(stderr, "Could not write archive '%s'.\n", options.archive.c_str());
+			removeDirectory(scratch);
+			return 1;
+		}
+		std::unique_ptr<ClassArchive> written(ClassArchive::open(options.archive));
+		fprintf(stderr, "archived %zu of %zu classes into %s\n",
+			written ? written->size() : 0, names.size(), options.archive.c_str());
+	}
+
+	std::vector<SuiteResult> results;
+	for (const Suite& suite: suites) {
+		fprintf(stderr, "running %s: %zu classes, %zu bytes\n", suite.name.c_str(), suite.classes.size(), suite.bytes());
+		results.push_back(runSuite(suite, options));
+	}
+
+	printReport(stderr, results);
+
+	int rc = 0;
+	if (jsonPath == "-") {
+		writeJson(stdout, results, options);
+	} else if (!jsonPath.empty()) {
+		FILE* fp = fopen(jsonPath.c_str(), "w");
+		if (fp) {
+			writeJson(fp, results, options);
+			fclose(fp);
+		} else {
+			perror(jsonPath.c_str());
+			rc = 1;
+		}
+	}
+
+	if (!removeDirectory(scratch))
+		fprintf(stderr, "WARNING: could not remove %s\n", scratch);
+
+	return rc;
+}
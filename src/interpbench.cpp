@@ -0,0 +1,680 @@
+/**
+ * Interpreter dispatch benchmark.
+ *
+ * Runs synthesized bytecode kernels under each available dispatch loop
+ * (switch and, if built in, computed-goto direct threading, without and
+ * with top-of-stack caching) and checks their results against the same
+ * computation in C++. If the JIT is built in, a "jit" row runs the fastest
+ * dispatch loop with hot methods compiled by the baseline compiler, an
+ * "opt" row with the optimizing compiler, and a last "trace" row with
+ * loops of hot methods traced instead; every other row runs with all of
+ * them disabled. Compiled code is entered on invocation and, by on-stack
+ * replacement, at the next back edge once the running kernel turned hot,
+ * and traces at loop headers once recorded, so first runs already spend
+ * most of their time in native code.
+ *
+ * primes-long  Test.testfunc's nested loop without the println: long
+ *              arithmetic, lrem and lcmp
+ * primes-int   the same loop on ints
+ * fib          naive recursive fib via invokestatic
+ * sieve        sieve of Eratosthenes on a boolean[]
+ * calls        invokevirtual of a setter-style method, getfield/putfield
+ * poly         invokevirtual on receivers of 3 classes in turn
+ * iface        invokeinterface on receivers of 3 classes in turn
+ * mega         invokeinterface on receivers of 6 classes in turn
+ *
+ * usage: interpbench [-n iterations] [-k kernel,...] [-s scale] [-p] [-o report.json]
+ */
+#include "Interpreter.h"
+#include "VMClassLoader.h"
+#include "ClassfileBuffer.h"
+#include "ClassWriter.h"
+#include "Class.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum : uint16_t {
+	ACC_PUBLIC    = 0x0001,
+	ACC_STATIC    = 0x0008,
+	ACC_INTERFACE = 0x0200,
+	ACC_ABSTRACT  = 0x0400,
+};
+
+enum : uint8_t {
+	T_BOOLEAN = 4,
+};
+
+static const char* const KernelsClass = "bench/interp/Kernels";
+static const char* const CounterClass = "bench/interp/Counter";
+static const char* const ValuedClass = "bench/interp/Valued";
+static const char* const ShapeClass = "bench/interp/Shape";
+
+//! Number of Shape subclasses, Shape0 to Shape5.
+static const int ShapeCount = 6;
+
+static std::string shapeClass(int k)
+{
+	return std::string(ShapeClass) + std::to_string(k);
+}
+
+// {{{ classes
+//! Stand-in java/lang/Object, as no class library is on the classpath.
+static std::vector<uint8_t> generateObject()
+{
+	ClassWriter w("java/lang/Object", "");
+	w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, {0xb1});
+	return w.finish();
+}
+
+//! A counter with a virtual increment, for the calls kernel.
+static std::vector<uint8_t> generateCounter()
+{
+	ClassWriter w(CounterClass, "java/lang/Object");
+	uint16_t value = w.fieldRef(w.thisClass(), "value", "I");
+	uint16_t super = w.methodRef(w.classRef("java/lang/Object"), "<init>", "()V");
+	w.addField(ACC_PUBLIC, "value", "I");
+
+	CodeBuilder init;
+	init.op(Opcode::aload_0).op2(Opcode::invokespecial, super).op(Opcode::return_);
+	w.addMethod(ACC_PUBLIC, "<init>", "()V", 1, 1, init.finish());
+
+	// value += delta
+	CodeBuilder add;
+	add.op(Opcode::aload_0).op(Opcode::dup).op2(Opcode::getfield, value)
+	   .op(Opcode::iload_1).op(Opcode::iadd).op2(Opcode::putfield, value)
+	   .op(Opcode::return_);
+	w.addMethod(ACC_PUBLIC, "add", "(I)V", 3, 2, add.finish());
+
+	CodeBuilder get;
+	get.op(Opcode::aload_0).op2(Opcode::getfield, value).op(Opcode::ireturn);
+	w.addMethod(ACC_PUBLIC, "get", "()I", 1, 1, get.finish());
+
+	return w.finish();
+}
+
+//! interface Valued { int value(); }
+static std::vector<uint8_t> generateValued()
+{
+	ClassWriter w(ValuedClass, "java/lang/Object");
+	w.setFlags(ACC_PUBLIC | ACC_INTERFACE | ACC_ABSTRACT);
+	w.addAbstractMethod(ACC_PUBLIC | ACC_ABSTRACT, "value", "()I");
+	return w.finish();
+}
+
+/**
+ * class Shape implements Valued { public int value() { return 0; } }
+ * class ShapeK extends Shape { public int value() { return K + 1; } }
+ *
+ * with \p k of -1 for Shape.
+ */
+static std::vector<uint8_t> generateShape(int k)
+{
+	ClassWriter w(k < 0 ? ShapeClass : shapeClass(k), k < 0 ? "java/lang/Object" : ShapeClass);
+	uint16_t super = w.methodRef(w.classRef(k < 0 ? "java/lang/Object" : ShapeClass), "<init>", "()V");
+	if (k < 0)
+		w.addInterface(ValuedClass);
+
+	CodeBuilder init;
+	init.op(Opcode::aload_0).op2(Opcode::invokespecial, super).op(Opcode::return_);
+	w.addMethod(ACC_PUBLIC, "<init>", "()V", 1, 1, init.finish());
+
+	CodeBuilder value;
+	value.op(Opcode::bipush, k + 1).op(Opcode::ireturn);
+	w.addMethod(ACC_PUBLIC, "value", "()I", 1, 1, value.finish());
+
+	return w.finish();
+}
+
+/**
+ * long primesLong(long max) {
+ *     long y = -1;
+ *     for (long i = 0; i < max; i++)
+ *         for (long k = 2; k < i; ++k)
+ *             if ((i % k) == 0) { y += i; break; }
+ *     return y;
+ * }
+ */
+static std::vector<uint8_t> primesLong(ClassWriter& w)
+{
+	uint16_t minusOne = w.longConstant(-1);
+	uint16_t two = w.longConstant(2);
+
+	CodeBuilder b;
+	size_t outer = b.label(), inner = b.label(), found = b.label();
+	size_t next = b.label(), nextOuter = b.label(), done = b.label();
+
+	b.op2(Opcode::ldc2_w, minusOne).op(Opcode::lstore_2);
+	b.op(Opcode::lconst_0).op(Opcode::lstore, 4);
+	b.bind(outer);
+	b.op(Opcode::lload, 4).op(Opcode::lload_0).op(Opcode::lcmp).branch(Opcode::ifge, done);
+	b.op2(Opcode::ldc2_w, two).op(Opcode::lstore, 6);
+	b.bind(inner);
+	b.op(Opcode::lload, 6).op(Opcode::lload, 4).op(Opcode::lcmp).branch(Opcode::ifge, nextOuter);
+	b.op(Opcode::lload, 4).op(Opcode::lload, 6).op(Opcode::lrem).op(Opcode::lconst_0).op(Opcode::lcmp)
+	 .branch(Opcode::ifne, next);
+	b.bind(found);
+	b.op(Opcode::lload_2).op(Opcode::lload, 4).op(Opcode::ladd).op(Opcode::lstore_2).branch(Opcode::goto_, nextOuter);
+	b.bind(next);
+	b.op(Opcode::lload, 6).op(Opcode::lconst_1).op(Opcode::ladd).op(Opcode::lstore, 6).branch(Opcode::goto_, inner);
+	b.bind(nextOuter);
+	b.op(Opcode::lload, 4).op(Opcode::lconst_1).op(Opcode::ladd).op(Opcode::lstore, 4).branch(Opcode::goto_, outer);
+	b.bind(done);
+	b.op(Opcode::lload_2).op(Opcode::lreturn);
+
+	return b.finish();
+}
+
+//! primesLong() on ints.
+static std::vector<uint8_t> primesInt()
+{
+	CodeBuilder b;
+	size_t outer = b.label(), inner = b.label(), next = b.label();
+	size_t nextOuter = b.label(), done = b.label();
+
+	b.op(Opcode::iconst_m1).op(Opcode::istore_1);
+	b.op(Opcode::iconst_0).op(Opcode::istore_2);
+	b.bind(outer);
+	b.op(Opcode::iload_2).op(Opcode::iload_0).branch(Opcode::if_icmpge, done);
+	b.op(Opcode::iconst_2).op(Opcode::istore_3);
+	b.bind(inner);
+	b.op(Opcode::iload_3).op(Opcode::iload_2).branch(Opcode::if_icmpge, nextOuter);
+	b.op(Opcode::iload_2).op(Opcode::iload_3).op(Opcode::irem).branch(Opcode::ifne, next);
+	b.op(Opcode::iload_1).op(Opcode::iload_2).op(Opcode::iadd).op(Opcode::istore_1).branch(Opcode::goto_, nextOuter);
+	b.bind(next);
+	b.op(Opcode::iinc).u1(3).u1(1).branch(Opcode::goto_, inner);
+	b.bind(nextOuter);
+	b.op(Opcode::iinc).u1(2).u1(1).branch(Opcode::goto_, outer);
+	b.bind(done);
+	b.op(Opcode::iload_1).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+//! int fib(int n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+static std::vector<uint8_t> fib(ClassWriter& w)
+{
+	uint16_t self = w.methodRef(w.thisClass(), "fib", "(I)I");
+
+	CodeBuilder b;
+	size_t recurse = b.label();
+	b.op(Opcode::iload_0).op(Opcode::iconst_2).branch(Opcode::if_icmpge, recurse);
+	b.op(Opcode::iload_0).op(Opcode::ireturn);
+	b.bind(recurse);
+	b.op(Opcode::iload_0).op(Opcode::iconst_1).op(Opcode::isub).op2(Opcode::invokestatic, self);
+	b.op(Opcode::iload_0).op(Opcode::iconst_2).op(Opcode::isub).op2(Opcode::invokestatic, self);
+	b.op(Opcode::iadd).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+/**
+ * int sieve(int n) {
+ *     boolean[] composite = new boolean[n + 1];
+ *     int count = 0;
+ *     for (int i = 2; i <= n; i++) {
+ *         if (composite[i]) continue;
+ *         count++;
+ *         for (int j = i + i; j <= n; j += i) composite[j] = true;
+ *     }
+ *     return count;
+ * }
+ */
+static std::vector<uint8_t> sieve()
+{
+	CodeBuilder b;
+	size_t outer = b.label(), inner = b.label(), next = b.label(), done = b.label();
+
+	b.op(Opcode::iload_0).op(Opcode::iconst_1).op(Opcode::iadd).op(Opcode::newarray, T_BOOLEAN).op(Opcode::astore_1);
+	b.op(Opcode::iconst_0).op(Opcode::istore_2);
+	b.op(Opcode::iconst_2).op(Opcode::istore_3);
+	b.bind(outer);
+	b.op(Opcode::iload_3).op(Opcode::iload_0).branch(Opcode::if_icmpgt, done);
+	b.op(Opcode::aload_1).op(Opcode::iload_3).op(Opcode::baload).branch(Opcode::ifne, next);
+	b.op(Opcode::iinc).u1(2).u1(1);
+	b.op(Opcode::iload_3).op(Opcode::iload_3).op(Opcode::iadd).op(Opcode::istore, 4);
+	b.bind(inner);
+	b.op(Opcode::iload, 4).op(Opcode::iload_0).branch(Opcode::if_icmpgt, next);
+	b.op(Opcode::aload_1).op(Opcode::iload, 4).op(Opcode::iconst_1).op(Opcode::bastore);
+	b.op(Opcode::iload, 4).op(Opcode::iload_3).op(Opcode::iadd).op(Opcode::istore, 4).branch(Opcode::goto_, inner);
+	b.bind(next);
+	b.op(Opcode::iinc).u1(3).u1(1).branch(Opcode::goto_, outer);
+	b.bind(done);
+	b.op(Opcode::iload_2).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+/**
+ * int calls(int n) {
+ *     Counter c = new Counter();
+ *     for (int i = 0; i < n; i++) c.add(i);
+ *     return c.get();
+ * }
+ */
+static std::vector<uint8_t> calls(ClassWriter& w)
+{
+	uint16_t counter = w.classRef(CounterClass);
+	uint16_t init = w.methodRef(counter, "<init>", "()V");
+	uint16_t add = w.methodRef(counter, "add", "(I)V");
+	uint16_t get = w.methodRef(counter, "get", "()I");
+
+	CodeBuilder b;
+	size_t loop = b.label(), done = b.label();
+
+	b.op2(Opcode::new_, counter).op(Opcode::dup).op2(Opcode::invokespecial, init).op(Opcode::astore_1);
+	b.op(Opcode::iconst_0).op(Opcode::istore_2);
+	b.bind(loop);
+	b.op(Opcode::iload_2).op(Opcode::iload_0).branch(Opcode::if_icmpge, done);
+	b.op(Opcode::aload_1).op(Opcode::iload_2).op2(Opcode::invokevirtual, add);
+	b.op(Opcode::iinc).u1(2).u1(1).branch(Opcode::goto_, loop);
+	b.bind(done);
+	b.op(Opcode::aload_1).op2(Opcode::invokevirtual, get).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+/**
+ * int poly(int n) {
+ *     Shape[] shapes = { new Shape0(), ..., new ShapeK-1() };
+ *     int sum = 0;
+ *     for (int i = 0; i < n; i++) sum += shapes[i % K].value();
+ *     return sum;
+ * }
+ *
+ * calling value() through Valued if \p viaInterface.
+ */
+static std::vector<uint8_t> dispatchLoop(ClassWriter& w, int classes, bool viaInterface)
+{
+	uint16_t shape = w.classRef(ShapeClass);
+	uint16_t value = viaInterface
+		? w.interfaceMethodRef(w.classRef(ValuedClass), "value", "()I")
+		: w.methodRef(shape, "value", "()I");
+
+	CodeBuilder b;
+	size_t loop = b.label(), done = b.label();
+
+	b.op(Opcode::bipush, classes).op2(Opcode::anewarray, shape).op(Opcode::astore_1);
+	for (int k = 0; k < classes; ++k) {
+		uint16_t type = w.classRef(shapeClass(k));
+		b.op(Opcode::aload_1).op(Opcode::bipush, k).op2(Opcode::new_, type).op(Opcode::dup)
+		 .op2(Opcode::invokespecial, w.methodRef(type, "<init>", "()V")).op(Opcode::aastore);
+	}
+	b.op(Opcode::iconst_0).op(Opcode::istore_2);
+	b.op(Opcode::iconst_0).op(Opcode::istore_3);
+	b.bind(loop);
+	b.op(Opcode::iload_3).op(Opcode::iload_0).branch(Opcode::if_icmpge, done);
+	b.op(Opcode::iload_2).op(Opcode::aload_1).op(Opcode::iload_3).op(Opcode::bipush, classes).op(Opcode::irem)
+	 .op(Opcode::aaload);
+	if (viaInterface)
+		b.op2(Opcode::invokeinterface, value).u1(1).u1(0);
+	else
+		b.op2(Opcode::invokevirtual, value);
+	b.op(Opcode::iadd).op(Opcode::istore_2);
+	b.op(Opcode::iinc).u1(3).u1(1).branch(Opcode::goto_, loop);
+	b.bind(done);
+	b.op(Opcode::iload_2).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+static std::vector<uint8_t> generateKernels()
+{
+	ClassWriter w(KernelsClass, "java/lang/Object");
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "primesLong", "(J)J", 4, 8, primesLong(w));
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "primesInt", "(I)I", 2, 4, primesInt());
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "fib", "(I)I", 3, 1, fib(w));
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "sieve", "(I)I", 3, 5, sieve());
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "calls", "(I)I", 2, 3, calls(w));
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "poly", "(I)I", 6, 4, dispatchLoop(w, 3, false));
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "iface", "(I)I", 6, 4, dispatchLoop(w, 3, true));
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "mega", "(I)I", 6, 4, dispatchLoop(w, ShapeCount, true));
+	return w.finish();
+}
+// }}}
+
+// {{{ reference implementations
+static int64_t primesLongRef(int64_t max)
+{
+	int64_t y = -1;
+	for (int64_t i = 0; i < max; i++) {
+		for (int64_t k = 2; k < i; ++k) {
+			if (i % k == 0) {
+				y += i;
+				break;
+			}
+		}
+	}
+	return y;
+}
+
+static int64_t fibRef(int64_t n)
+{
+	return n < 2 ? n : fibRef(n - 1) + fibRef(n - 2);
+}
+
+static int64_t sieveRef(int64_t n)
+{
+	std::vector<bool> composite(n + 1);
+	int64_t count = 0;
+	for (int64_t i = 2; i <= n; i++) {
+		if (composite[i])
+			continue;
+		count++;
+		for (int64_t j = i + i; j <= n; j += i)
+			composite[j] = true;
+	}
+	return count;
+}
+
+static int64_t callsRef(int64_t n)
+{
+	uint32_t sum = 0;
+	for (int64_t i = 0; i < n; i++)
+		sum += (uint32_t) i;
+	return (int32_t) sum;
+}
+
+static int64_t dispatchLoopRef(int64_t n, int classes)
+{
+	int32_t sum = 0;
+	for (int64_t i = 0; i < n; i++)
+		sum += (int32_t) (i % classes) + 1;
+	return sum;
+}
+
+static int64_t polyRef(int64_t n) { return dispatchLoopRef(n, 3); }
+static int64_t megaRef(int64_t n) { return dispatchLoopRef(n, ShapeCount); }
+// }}}
+
+// {{{ measurement
+struct Kernel {
+	const char* name;
+	const char* method;
+	bool isLong;                //!< takes and returns long
+	int64_t argument;           //!< at scale 1
+	int64_t (*reference)(int64_t);
+};
+
+static const Kernel kernels[] = {
+	{"primes-long", "primesLong", true,  10000,   &primesLongRef},
+	{"primes-int",  "primesInt",  false, 10000,   &primesLongRef},
+	{"fib",         "fib",        false, 27,      &fibRef},
+	{"sieve",       "sieve",      false, 4000000, &sieveRef},
+	{"calls",       "calls",      false, 5000000, &callsRef},
+	{"poly",        "poly",       false, 5000000, &polyRef},
+	{"iface",       "iface",      false, 5000000, &polyRef},
+	{"mega",        "mega",       false, 5000000, &megaRef},
+};
+
+//! A generated class by name.
+struct Classfile {
+	std::string name;
+	std::shared_ptr<ClassfileBuffer> buffer;
+};
+
+//! Native code that a run uses.
+enum class Jit {
+	Off,
+	Methods,   //!< hot methods compiled by the baseline compiler
+	Optimized, //!< hot methods compiled by the optimizing compiler
+	Traces,    //!< loops of hot methods traced
+};
+
+struct Run {
+	const Kernel* kernel;
+	Interpreter::Dispatch dispatch;
+	Jit jit;
+	int64_t argument;
+	std::vector<double> seconds;
+	bool ok;
+
+	double best() const { return *std::min_element(seconds.begin(), seconds.end()); }
+	double median() const {
+		std::vector<double> s = seconds;
+		std::sort(s.begin(), s.end());
+		return s[s.size() / 2];
+	}
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static const char* dispatchName(Interpreter::Dispatch dispatch)
+{
+	switch (dispatch) {
+		case Interpreter::Dispatch::Threaded: return "threaded";
+		case Interpreter::Dispatch::Cached: return "cached";
+		default: return "switch";
+	}
+}
+
+static const char* runName(const Run& run)
+{
+	switch (run.jit) {
+		case Jit::Methods: return "jit";
+		case Jit::Optimized: return "opt";
+		case Jit::Traces: return "trace";
+		default: return dispatchName(run.dispatch);
+	}
+}
+
+/**
+ * Runs \p kernel \p iterations times on a fresh class loader and interpreter.
+ *
+ * @param dumpProfiles whether to print the method profiles of the kernels
+ *                     class afterwards.
+ */
+static Run runKernel(const Kernel& kernel, Interpreter::Dispatch dispatch, Jit jit, int64_t argument,
+                     size_t iterations, const std::vector<Classfile>& classes, bool dumpProfiles)
+{
+	Run run = {&kernel, dispatch, jit, argument, {}, false};
+
+	VMClassLoader loader;
+	for (const Classfile& classfile: classes)
+		loader.defineClass(classfile.name.c_str(), classfile.buffer);
+
+	Class* c = loader.loadClass(KernelsClass, true);
+	Method* method = c ? c->findMethod(kernel.method) : nullptr;
+	if (!method) {
+		fprintf(stderr, "WARNING: could not load %s.%s\n", KernelsClass, kernel.method);
+		return run;
+	}
+
+	Interpreter interpreter(&loader);
+	interpreter.setDispatch(dispatch);
+	interpreter.setJitEnabled(jit == Jit::Methods || jit == Jit::Optimized);
+	interpreter.setOptimizingEnabled(jit == Jit::Optimized);
+	interpreter.setTraceEnabled(jit == Jit::Traces);
+
+	int64_t expected = kernel.reference(argument);
+	run.ok = true;
+
+	for (size_t i = 0; i < iterations; ++i) {
+		Slot args[2];
+		Slot result;
+		if (kernel.isLong)
+			args[0].j = argument;
+		else
+			args[0].i = (int32_t) argument;
+
+		Clock::time_point start = Clock::now();
+		bool completed = interpreter.invoke(method, args, &result);
+		run.seconds.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+
+		if (!completed) {
+			fprintf(stderr, "WARNING: %s (%s) failed: %s\n", kernel.name, runName(run),
+			        interpreter.describeException().c_str());
+			run.ok = false;
+			break;
+		}
+
+		int64_t actual = kernel.isLong ? result.j : result.i;
+		if (actual != expected) {
+			fprintf(stderr, "WARNING: %s (%s) returned %lld, expected %lld\n", kernel.name, runName(run),
+			        (long long) actual, (long long) expected);
+			run.ok = false;
+			break;
+		}
+	}
+
+	if (dumpProfiles)
+		c->dumpProfiles();
+
+	return run;
+}
+
+static void writeJson(FILE* out, const std::vector<Run>& runs, size_t iterations)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"iterations\": %zu,\n", iterations);
+	fprintf(out, "  \"runs\": [");
+
+	for (size_t i = 0; i < runs.size(); ++i) {
+		const Run& run = runs[i];
+		fprintf(out, "%s\n    {", i ? "," : "");
+		fprintf(out, "\"kernel\": \"%s\", ", run.kernel->name);
+		fprintf(out, "\"dispatch\": \"%s\", ", runName(run));
+		fprintf(out, "\"argument\": %lld, ", (long long) run.argument);
+		fprintf(out, "\"ok\": %s", run.ok ? "true" : "false");
+		if (run.ok)
+			fprintf(out, ", \"bestSeconds\": %.6f, \"medianSeconds\": %.6f", run.best(), run.median());
+		fprintf(out, "}");
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+}
+// }}}
+
+static void usage(const char* program)
+{
+	fprintf(stderr,
+		"usage: %s [-n iterations] [-k kernel,...] [-s scale] [-p] [-o report.json]\n"
+		"\n"
+		"  -n N       run each kernel N times per dispatch loop and with the JIT (default: 5)\n"
+		"  -k LIST    comma separated kernels: primes-long, primes-int, fib, sieve, calls,\n"
+		"             poly, iface, mega\n"
+		"             (default: all)\n"
+		"  -s SCALE   multiply the problem sizes (except fib's) by SCALE (default: 1)\n"
+		"  -p         print the kernels' method profiles after their switch dispatch runs\n"
+		"  -o FILE    write a JSON report to FILE, - for stdout\n",
+		program);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t iterations = 5;
+	double scale = 1;
+	std::string kernelList;
+	std::string jsonPath;
+	bool dumpProfiles = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:k:s:po:h")) != -1) {
+		switch (opt) {
+			case 'n':
+				iterations = std::max(1, atoi(optarg));
+				break;
+			case 'k':
+				kernelList = optarg;
+				break;
+			case 's':
+				scale = std::max(0.001, atof(optarg));
+				break;
+			case 'p':
+				dumpProfiles = true;
+				break;
+			case 'o':
+				jsonPath = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	auto enabled = [&](const char* name) -> bool {
+		return kernelList.empty() || ("," + kernelList + ",").find(std::string(",") + name + ",") != std::string::npos;
+	};
+
+	std::vector<Classfile> classes;
+	auto add = [&](const std::string& name, const std::vector<uint8_t>& data) {
+		classes.push_back({name, ClassfileBuffer::copy(data.data(), data.size())});
+	};
+	add("java/lang/Object", generateObject());
+	add(CounterClass, generateCounter());
+	add(ValuedClass, generateValued());
+	add(ShapeClass, generateShape(-1));
+	for (int k = 0; k < ShapeCount; ++k)
+		add(shapeClass(k), generateShape(k));
+	add(KernelsClass, generateKernels());
+
+	std::vector<Interpreter::Dispatch> dispatches = {Interpreter::Dispatch::Switch};
+	if (Interpreter::hasThreadedDispatch()) {
+		dispatches.push_back(Interpreter::Dispatch::Threaded);
+		dispatches.push_back(Interpreter::Dispatch::Cached);
+	} else
+		fprintf(stderr, "WARNING: built without computed-goto dispatch, only measuring switch dispatch\n");
+
+	// (dispatch, jit) per row
+	std::vector<std::pair<Interpreter::Dispatch, Jit>> modes;
+	for (Interpreter::Dispatch dispatch: dispatches)
+		modes.push_back({dispatch, Jit::Off});
+	if (Interpreter::hasJit()) {
+		modes.push_back({dispatches.back(), Jit::Methods});
+		modes.push_back({dispatches.back(), Jit::Optimized});
+		modes.push_back({dispatches.back(), Jit::Traces});
+	}
+
+	std::vector<Run> runs;
+	int rc = 0;
+
+	fprintf(stderr, "%-12s %10s %12s %12s %12s %9s\n", "kernel", "argument", "dispatch", "best ms", "median ms", "speedup");
+	for (const Kernel& kernel: kernels) {
+		if (!enabled(kernel.name))
+			continue;
+
+		int64_t argument = kernel.reference == &fibRef
+			? kernel.argument
+			: std::max<int64_t>(1, (int64_t) (kernel.argument * scale));
+
+		double baseline = 0;
+		for (const auto& mode: modes) {
+			Interpreter::Dispatch dispatch = mode.first;
+			Jit jit = mode.second;
+			Run run = runKernel(kernel, dispatch, jit, argument, iterations, classes,
+			                    dumpProfiles && dispatch == Interpreter::Dispatch::Switch && jit == Jit::Off);
+			if (!run.ok) {
+				rc = 1;
+			} else {
+				if (dispatch == Interpreter::Dispatch::Switch && jit == Jit::Off)
+					baseline = run.best();
+				fprintf(stderr, "%-12s %10lld %12s %12.3f %12.3f %8.2fx\n", kernel.name, (long long) argument,
+				        runName(run), run.best() * 1e3, run.median() * 1e3,
+				        baseline > 0 ? baseline / run.best() : 0.0);
+			}
+			runs.push_back(run);
+		}
+	}
+
+	if (jsonPath == "-") {
+		writeJson(stdout, runs, iterations);
+	} else if (!jsonPath.empty()) {
+		FILE* fp = fopen(jsonPath.c_str(), "w");
+		if (fp) {
+			writeJson(fp, runs, iterations);
+			fclose(fp);
+		} else {
+			perror(jsonPath.c_str());
+			rc = 1;
+		}
+	}
+
+	return rc;
+}
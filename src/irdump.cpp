@@ -0,0 +1,130 @@
+#include "JvmEnv.h"
+#include "Class.h"
+#include "Ir.h"
+#include "IrPasses.h"
+#include "OptimizingCompiler.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: irdump [-n | -m] [-p passes] [-t] [-v] [-c classpath] class [method]\n"
+		"  -n           dump the IR as built, without optimizing it\n"
+		"  -m           dump the machine code of the optimizing compiler instead,\n"
+		"               lowered from the optimized IR and register-allocated\n"
+		"  -p passes    comma-separated passes to run instead of the standard pipeline:\n"
+		"               fold, dbe, copyprop, gvn, licm, dce\n"
+		"  -t           dump the IR after each pass that changed it\n"
+		"  -v           verify the IR after building and after each pass\n"
+		"  -c classpath adds a class path entry (default: . and ./tests)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	bool optimize = true;
+	bool machine = false;
+	bool trace = false;
+	bool verify = false;
+	const char* passes = nullptr;
+	std::vector<std::string> classPath;
+
+	for (int opt; (opt = getopt(argc, argv, "nmp:tvc:h")) != -1; ) {
+		switch (opt) {
+			case 'n': optimize = false; break;
+			case 'm': machine = true; break;
+			case 'p': passes = optarg; break;
+			case 't': trace = true; break;
+			case 'v': verify = true; break;
+			case 'c': classPath.push_back(optarg); break;
+			default: usage(); return 1;
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		return 1;
+	}
+
+	IrPassManager pipeline;
+	pipeline.setVerify(verify);
+	pipeline.setTrace(trace);
+	if (passes) {
+		for (const char* p = passes; *p; ) {
+			const char* end = strchr(p, ',');
+			std::string name(p, end ? end - p : strlen(p));
+			if (!pipeline.add(name)) {
+				fprintf(stderr, "Unknown pass '%s'.\n", name.c_str());
+				return 1;
+			}
+			p = end ? end + 1 : p + name.size();
+		}
+	} else {
+		pipeline.addStandardPipeline();
+	}
+
+	JvmEnv jenv;
+	if (classPath.empty()) {
+		classPath.push_back(".");
+		classPath.push_back("./tests");
+	}
+	for (const std::string& path: classPath)
+		jenv.addClassPath(path);
+
+	Class* c = jenv.getClass(argv[optind]);
+	if (!c) {
+		fprintf(stderr, "Could not find class '%s'.\n", argv[optind]);
+		return 1;
+	}
+	const char* methodName = optind + 1 < argc ? argv[optind + 1] : nullptr;
+
+	int errors = 0;
+	for (Method* method: c->methods()) {
+		if (methodName && strcmp(method->name()->c_str(), methodName) != 0)
+			continue;
+		if (method->code().empty())
+			continue;
+
+		if (machine) {
+			std::string error;
+			std::string code = OptimizingCompiler::dump(method, error);
+			if (code.empty()) {
+				fprintf(stderr, "WARNING: not optimizing %s.%s%s: %s\n", c->name()->c_str(),
+					method->name()->c_str(), method->descriptor()->c_str(), error.c_str());
+				++errors;
+			}
+			printf("%s\n", code.c_str());
+			continue;
+		}
+
+		std::unique_ptr<IrGraph> graph = IrGraph::build(method);
+		if (!graph) {
+			++errors;
+			continue;
+		}
+
+		if (verify) {
+			std::string problems = graph->verify();
+			if (!problems.empty()) {
+				printf("WARNING: invalid IR of method %s.%s%s as built:\n%s", c->name()->c_str(),
+					method->name()->c_str(), method->descriptor()->c_str(), problems.c_str());
+				++errors;
+				continue;
+			}
+		}
+
+		if (optimize && trace)
+			graph->dump();
+		if (optimize && !pipeline.run(*graph)) {
+			++errors;
+			continue;
+		}
+
+		if (!trace || !optimize)
+			graph->dump();
+		printf("\n");
+	}
+
+	return errors ? 1 : 0;
+}
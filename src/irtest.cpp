@@ -0,0 +1,241 @@
+/**
+ * IR regression tests.
+ *
+ * Builds the graphs of synthesized methods, runs the optimization passes
+ * over them with verification after each pass, and checks the result. If
+ * the JIT is built in, also runs the methods until they turn hot and get
+ * compiled by the optimizing compiler, checking their results on the way.
+ *
+ * diamond   a phi merging the same constant over a diamond, ahead of a
+ *           phi merging different values, followed by another merge
+ * folded    the same, but one arm of the diamond is dead behind a
+ *           branch on a constant, leaving the merge a single predecessor
+ * scaled    floating-point arithmetic, which the optimizing compiler
+ *           leaves to the baseline compiler
+ *
+ * usage: irtest
+ */
+#include "Ir.h"
+#include "IrPasses.h"
+#include "Interpreter.h"
+#include "VMClassLoader.h"
+#include "ClassWriter.h"
+#include "Class.h"
+#include "CompiledMethod.h"
+#include "QuickCode.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum : uint16_t {
+	ACC_PUBLIC = 0x0001,
+	ACC_STATIC = 0x0008,
+};
+
+static const char* const TestClass = "test/ir/Phis";
+
+// {{{ classes
+//! Stand-in java/lang/Object, as no class library is on the classpath.
+static std::vector<uint8_t> generateObject()
+{
+	ClassWriter w("java/lang/Object", "");
+	w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, CodeBuilder().op(Opcode::return_).finish());
+	return w.finish();
+}
+
+/**
+ * int diamond(int a) {
+ *     int x, y;
+ *     if (a > 0) { x = 5; y = a; } else { x = 5; y = -a; }
+ *     if (y > 9) y = 9;
+ *     return x + y;
+ * }
+ */
+static std::vector<uint8_t> diamond()
+{
+	CodeBuilder b;
+	size_t otherwise = b.label(), merge = b.label(), clamped = b.label();
+
+	b.op(Opcode::iload_0).branch(Opcode::ifle, otherwise);
+	b.op(Opcode::iconst_5).op(Opcode::istore_1).op(Opcode::iload_0).op(Opcode::istore_2).branch(Opcode::goto_, merge);
+	b.bind(otherwise);
+	b.op(Opcode::iconst_5).op(Opcode::istore_1).op(Opcode::iload_0).op(Opcode::ineg).op(Opcode::istore_2);
+	b.bind(merge);
+	b.op(Opcode::iload_2).op(Opcode::bipush, 9).branch(Opcode::if_icmple, clamped);
+	b.op(Opcode::bipush, 9).op(Opcode::istore_2);
+	b.bind(clamped);
+	b.op(Opcode::iload_1).op(Opcode::iload_2).op(Opcode::iadd).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+/**
+ * int folded(int a) {
+ *     int x, y;
+ *     if (0 == 0) { x = 5; y = a; } else { x = 5; y = -a; }
+ *     if (y > 9) y = 9;
+ *     return x + y;
+ * }
+ */
+static std::vector<uint8_t> folded()
+{
+	CodeBuilder b;
+	size_t otherwise = b.label(), merge = b.label(), clamped = b.label();
+
+	b.op(Opcode::iconst_0).branch(Opcode::ifne, otherwise);
+	b.op(Opcode::iconst_5).op(Opcode::istore_1).op(Opcode::iload_0).op(Opcode::istore_2).branch(Opcode::goto_, merge);
+	b.bind(otherwise);
+	b.op(Opcode::iconst_5).op(Opcode::istore_1).op(Opcode::iload_0).op(Opcode::ineg).op(Opcode::istore_2);
+	b.bind(merge);
+	b.op(Opcode::iload_2).op(Opcode::bipush, 9).branch(Opcode::if_icmple, clamped);
+	b.op(Opcode::bipush, 9).op(Opcode::istore_2);
+	b.bind(clamped);
+	b.op(Opcode::iload_1).op(Opcode::iload_2).op(Opcode::iadd).op(Opcode::ireturn);
+
+	return b.finish();
+}
+
+//! int scaled(int a) { return (int) (a * 2.0f); }
+static std::vector<uint8_t> scaled()
+{
+	CodeBuilder b;
+	b.op(Opcode::iload_0).op(Opcode::i2f).op(Opcode::fconst_2).op(Opcode::fmul).op(Opcode::f2i).op(Opcode::ireturn);
+	return b.finish();
+}
+
+static std::vector<uint8_t> generateTests()
+{
+	ClassWriter w(TestClass, "java/lang/Object");
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "diamond", "(I)I", 2, 3, diamond());
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "folded", "(I)I", 2, 3, folded());
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "scaled", "(I)I", 2, 1, scaled());
+	return w.finish();
+}
+// }}}
+
+// {{{ tests
+static int failures = 0;
+
+static void check(bool ok, const char* test, const char* what)
+{
+	printf("%s: %s: %s\n", ok ? "ok" : "FAIL", test, what);
+	if (!ok)
+		++failures;
+}
+
+//! Runs \p passes over the graph of \p name, verifying it after each one.
+static void testPasses(Class* c, const char* name, const std::vector<const char*>& passes)
+{
+	Method* method = c->findMethod(name);
+	std::unique_ptr<IrGraph> graph = method ? IrGraph::build(method) : nullptr;
+	check(graph != nullptr, name, "builds");
+	if (!graph)
+		return;
+	check(graph->verify().empty(), name, "valid as built");
+
+	IrPassManager pipeline;
+	if (passes.empty()) {
+		pipeline.addStandardPipeline();
+	} else {
+		for (const char* pass: passes)
+			pipeline.add(pass);
+	}
+	pipeline.setVerify(true);
+
+	std::string what = "valid after";
+	for (const char* pass: passes)
+		what = what + " " + pass;
+	if (passes.empty())
+		what += " the standard pipeline";
+	check(pipeline.run(*graph), name, what.c_str());
+
+	bool merged = false;
+	for (const IrBlock* block: graph->blocks()) {
+		for (const IrValue* value: block->values) {
+			if (value->op != IrOp::Phi)
+				continue;
+			bool same = true;
+			for (const IrValue* operand: value->operands)
+				same = same && operand->isConst() && operand->imm == value->operands[0]->imm;
+			merged |= same;
+		}
+	}
+	check(!merged, name, "no phi left merging one constant");
+}
+
+static int32_t diamondRef(int32_t a)
+{
+	int32_t y = a > 0 ? a : -a;
+	return 5 + (y > 9 ? 9 : y);
+}
+
+static int32_t foldedRef(int32_t a)
+{
+	return 5 + (a > 9 ? 9 : a);
+}
+
+static int32_t scaledRef(int32_t a)
+{
+	return a * 2;
+}
+
+/**
+ * Runs \p name until it turns hot and past, checking its results against
+ * \p reference, and that it got compiled by the compiler of \p tier.
+ */
+static void testCompiled(VMClassLoader& loader, Class* c, const char* name, int32_t (*reference)(int32_t),
+                         CompiledMethod::Tier tier)
+{
+	Method* method = c->findMethod(name);
+	if (!method)
+		return check(false, name, "found");
+
+	Interpreter interpreter(&loader);
+	interpreter.setHotThreshold(100);
+
+	bool ok = true;
+	for (int32_t a = -200; a < 200 && ok; ++a) {
+		Slot args[1];
+		Slot result;
+		args[0].i = a;
+		ok = interpreter.invoke(method, args, &result) && result.i == reference(a);
+	}
+	check(ok, name, "same results compiled as interpreted");
+
+	CompiledMethod* compiled = method->quickCode() ? method->quickCode()->compiled() : nullptr;
+	check(compiled && compiled->tier() == tier, name, tier == CompiledMethod::Tier::Optimized
+		? "compiled by the optimizing compiler" : "compiled by the baseline compiler");
+}
+// }}}
+
+int main(int argc, char** argv)
+{
+	std::vector<uint8_t> object = generateObject();
+	std::vector<uint8_t> tests = generateTests();
+
+	VMClassLoader loader;
+	loader.defineClass("java/lang/Object", object.data(), object.size());
+	loader.defineClass(TestClass, tests.data(), tests.size());
+
+	Class* c = loader.loadClass(TestClass, true);
+	if (!c) {
+		fprintf(stderr, "WARNING: could not load %s\n", TestClass);
+		return 1;
+	}
+
+	for (const char* name: {"diamond", "folded"}) {
+		testPasses(c, name, {"fold"});
+		testPasses(c, name, {"fold", "dbe"});
+		testPasses(c, name, {});
+	}
+	if (Interpreter::hasJit()) {
+		testCompiled(loader, c, "diamond", &diamondRef, CompiledMethod::Tier::Optimized);
+		testCompiled(loader, c, "folded", &foldedRef, CompiledMethod::Tier::Optimized);
+		testCompiled(loader, c, "scaled", &scaledRef, CompiledMethod::Tier::Baseline);
+	}
+
+	printf("%d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,375 @@
+/**
+ * Class loading regression tests.
+ *
+ * Defines synthesized classes and checks what the loader and interpreter
+ * make of them.
+ *
+ * nul       string literals that differ only after an embedded NUL
+ *           (encoded as 0xC0 0x80) stay different symbols and objects
+ * utf8      Utf8 constants with overlong forms other than C0 80 fail
+ *           defining the class, short ones and long ones alike
+ * code      a Code attribute whose code runs past its end fails defining
+ *           the class, or with lazy method bodies the first invocation
+ * archive   classes dumped into a class-data-sharing archive get loaded
+ *           from it, unless their classfile changed since, and files that
+ *           are no archive do not map
+ * index     classes created while the classpath index watches it take
+ *           precedence over those of later classpath elements only
+ *
+ * usage: loadertest
+ */
+#include "Interpreter.h"
+#include "VMClassLoader.h"
+#include "ClassWriter.h"
+#include "Class.h"
+#include "ConstantPool.h"
+#include "Symbol.h"
+#include "ClassArchive.h"
+#include "ClassPathIndex.h"
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+enum : uint16_t {
+	ACC_PUBLIC = 0x0001,
+	ACC_STATIC = 0x0008,
+};
+
+static const char* const NulClass = "test/loader/Nul";
+static const char* const CodeClass = "test/loader/Code";
+static const char* const Utf8Class = "test/loader/Utf8";
+static const char* const ArchivedClass = "test/loader/Archived";
+static const char* const EarlierClass = "test/loader/Earlier";
+static const char* const LaterClass = "test/loader/Later";
+
+// {{{ classes
+//! Stand-in java/lang/Object, as no class library is on the classpath.
+static std::vector<uint8_t> generateObject()
+{
+	ClassWriter w("java/lang/Object", "");
+	w.addMethod(ACC_PUBLIC, "<init>", "()V", 0, 1, CodeBuilder().op(Opcode::return_).finish());
+	return w.finish();
+}
+
+//! Stand-in java/lang/String, backed by a char[].
+static std::vector<uint8_t> generateString()
+{
+	ClassWriter w("java/lang/String", "java/lang/Object");
+	w.addField(0, "value", "[C");
+	return w.finish();
+}
+
+/**
+ * static boolean differ() { return "a\0b" != "a\0c"; }
+ * static boolean same() { return "a\0b" == "a\0b"; }
+ */
+static std::vector<uint8_t> generateNul()
+{
+	ClassWriter w(NulClass, "java/lang/Object");
+	uint16_t ab = w.string(std::string("a\xC0\x80" "b"));
+	uint16_t ac = w.string(std::string("a\xC0\x80" "c"));
+	uint16_t again = w.string(std::string("a\xC0\x80" "b"));
+
+	for (int k = 0; k < 2; ++k) {
+		CodeBuilder b;
+		size_t equal = b.label();
+		b.op(Opcode::ldc, ab).op(Opcode::ldc, k ? again : ac).branch(Opcode::if_acmpeq, equal);
+		b.op(k ? Opcode::iconst_0 : Opcode::iconst_1).op(Opcode::ireturn);
+		b.bind(equal);
+		b.op(k ? Opcode::iconst_1 : Opcode::iconst_0).op(Opcode::ireturn);
+		w.addMethod(ACC_PUBLIC | ACC_STATIC, k ? "same" : "differ", "()Z", 2, 0, b.finish());
+	}
+	return w.finish();
+}
+
+//! A class with one more Utf8 constant, of \p bytes.
+static std::vector<uint8_t> generateUtf8(const std::string& bytes)
+{
+	ClassWriter w(Utf8Class, "java/lang/Object");
+	w.utf8(bytes);
+	return w.finish();
+}
+
+/**
+ * static int fine() { return 1; }
+ * static int broken() { return 2; }
+ *
+ * with the code length of broken() beyond its Code attribute.
+ */
+static std::vector<uint8_t> generateCode()
+{
+	ClassWriter w(CodeClass, "java/lang/Object");
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "fine", "()I", 1, 0, CodeBuilder().op(Opcode::iconst_1).op(Opcode::ireturn).finish());
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "broken", "()I", 1, 0, CodeBuilder().op(Opcode::iconst_2).op(Opcode::ireturn).finish());
+	std::vector<uint8_t> classfile = w.finish();
+
+	// max_locals, code_length and the code itself
+	const uint8_t body[] = { 0, 0, 0, 0, 0, 2, (uint8_t) Opcode::iconst_2, (uint8_t) Opcode::ireturn };
+	for (size_t k = 0; k + sizeof(body) <= classfile.size(); ++k) {
+		if (memcmp(&classfile[k], body, sizeof(body)) == 0) {
+			classfile[k + 4] = 0x10;
+			break;
+		}
+	}
+	return classfile;
+}
+
+//! static int value() { return <value>; }
+static std::vector<uint8_t> generateValue(const char* className, int value)
+{
+	ClassWriter w(className, "java/lang/Object");
+	w.addMethod(ACC_PUBLIC | ACC_STATIC, "value", "()I", 1, 0,
+		CodeBuilder().op(value == 1 ? Opcode::iconst_1 : Opcode::iconst_2).op(Opcode::ireturn).finish());
+	return w.finish();
+}
+// }}}
+
+// {{{ files
+static bool writeFile(const std::string& path, const std::vector<uint8_t>& bytes)
+{
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp)
+		return false;
+
+	bool ok = fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+	return fclose(fp) == 0 && ok;
+}
+
+//! Writes \p classfile of \p className below classpath directory \p root.
+static bool writeClass(const std::string& root, const char* className, const std::vector<uint8_t>& classfile)
+{
+	std::string path = root + "/" + className + ".class";
+	for (size_t i = path.find('/', root.size() + 1); i != std::string::npos; i = path.find('/', i + 1))
+		mkdir(path.substr(0, i).c_str(), 0755);
+	return writeFile(path, classfile);
+}
+
+static int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+	return remove(path);
+}
+// }}}
+
+// {{{ tests
+static int failures = 0;
+
+static void check(bool ok, const char* test, const char* what)
+{
+	printf("%s: %s: %s\n", ok ? "ok" : "FAIL", test, what);
+	if (!ok)
+		++failures;
+}
+
+//! Runs static method \p name of \p c, which takes no arguments and returns a boolean.
+static bool returnsTrue(Interpreter& interpreter, Class* c, const char* name)
+{
+	Method* method = c->findMethod(name);
+	if (!method)
+		return false;
+
+	Slot result;
+	return interpreter.invoke(method, nullptr, &result) && result.i == 1;
+}
+
+static void testNul(VMClassLoader& loader)
+{
+	std::vector<uint8_t> nul = generateNul();
+	Class* c = loader.defineClass(NulClass, nul.data(), nul.size());
+	check(c != nullptr, "nul", "defines");
+	if (!c)
+		return;
+
+	std::vector<const Symbol*> symbols;
+	for (size_t k = 1; k < c->constantPool.size(); ++k)
+		if (ConstantUtf8* utf8 = c->constantPool.string(k))
+			symbols.push_back(utf8->symbol());
+	check(symbols.size() == 3 && symbols[0]->size() == 3 && symbols[1]->size() == 3,
+		"nul", "symbols keep what follows the NUL");
+	check(symbols.size() == 3 && symbols[0] != symbols[1] && symbols[0] == symbols[2],
+		"nul", "symbols differ after the NUL only");
+
+	// string literals resolve into the constant pool, for the objects of one interpreter
+	Interpreter interpreter(&loader);
+	check(returnsTrue(interpreter, c, "differ"), "nul", "literals differing after the NUL are different objects");
+	check(returnsTrue(interpreter, c, "same"), "nul", "equal literals are the same object");
+}
+
+static void testUtf8()
+{
+	// past 16 bytes, the vectorized validators take over
+	const std::string padding = "0123456789abcdef0123456789abcdef";
+	for (const std::string& prefix: {std::string("a"), padding}) {
+		std::string what = prefix.size() > 1 ? " in a long constant" : "";
+
+		VMClassLoader loader;
+		std::vector<uint8_t> nul = generateUtf8(prefix + "\xC0\x80" + padding);
+		Class* c = loader.defineClass(Utf8Class, nul.data(), nul.size());
+		check(c != nullptr, "utf8", ("accepts C0 80" + what).c_str());
+
+		bool standard = true;
+		for (size_t k = 1; c && k < c->constantPool.size(); ++k)
+			if (ConstantUtf8* utf8 = c->constantPool.utf8(k))
+				standard = standard && utf8->standard;
+		check(c && !standard, "utf8", ("flags C0 80 as non-standard" + what).c_str());
+
+		for (const char* overlong: {"\xC0\x81", "\xC0\xBF", "\xC1\x80", "\xC1\xBF"}) {
+			VMClassLoader other;
+			std::vector<uint8_t> classfile = generateUtf8(prefix + overlong + padding);
+			char buf[64];
+			snprintf(buf, sizeof(buf), "rejects %02X %02X%s", (uint8_t) overlong[0], (uint8_t) overlong[1], what.c_str());
+			check(!other.defineClass(Utf8Class, classfile.data(), classfile.size()), "utf8", buf);
+		}
+	}
+}
+
+static void testCode(VMClassLoader& loader, VMClassLoader& lazy)
+{
+	std::vector<uint8_t> code = generateCode();
+	check(!loader.defineClass(CodeClass, code.data(), code.size()), "code", "fails defining the class");
+
+	Class* c = lazy.defineClass(CodeClass, code.data(), code.size());
+	check(c != nullptr, "code", "defines with lazy method bodies");
+	if (!c)
+		return;
+
+	Interpreter interpreter(&lazy);
+	Slot result;
+	Method* fine = c->findMethod("fine");
+	check(fine && interpreter.invoke(fine, nullptr, &result) && result.i == 1, "code", "runs the other method");
+
+	Method* broken = c->findMethod("broken");
+	check(broken && !interpreter.invoke(broken, nullptr, &result)
+		&& interpreter.describeException().find("ClassFormatError: malformed Code attribute") != std::string::npos,
+		"code", "fails the first invocation with a ClassFormatError");
+}
+
+//! Loads \p className and returns what its value() returns, 0 if it cannot.
+static int valueOf(VMClassLoader& loader, const char* className)
+{
+	Class* c = loader.loadClass(className, true);
+	Method* method = c ? c->findMethod("value") : nullptr;
+
+	Interpreter interpreter(&loader);
+	Slot result;
+	return method && interpreter.invoke(method, nullptr, &result) ? result.i : 0;
+}
+
+//! Loads \p ArchivedClass through \p root with \p archive mapped, and returns what value() returns.
+static int archivedValue(const std::string& root, const std::string& archive, uint64_t* loaded, uint64_t* stale)
+{
+	VMClassLoader loader;
+	loader.addClassPath(root);
+	if (!loader.mapArchive(archive))
+		return 0;
+
+	int value = valueOf(loader, ArchivedClass);
+	*loaded = loader.archive()->loadedCount();
+	*stale = loader.archive()->staleCount();
+	return value;
+}
+
+static void testArchive(const std::vector<uint8_t>& object, const std::vector<uint8_t>& string)
+{
+	char root[] = "/tmp/jvm-loadertest-XXXXXX";
+	if (!mkdtemp(root))
+		return check(false, "archive", "creates a scratch directory");
+
+	std::string archive = std::string(root) + "/classes.jsa";
+	std::string classfile = std::string(root) + "/" + ArchivedClass + ".class";
+	check(writeClass(root, "java/lang/Object", object) && writeClass(root, "java/lang/String", string)
+		&& writeClass(root, ArchivedClass, generateValue(ArchivedClass, 1)), "archive", "writes the classfiles");
+
+	{
+		VMClassLoader loader;
+		loader.addClassPath(root);
+		check(loader.dumpArchive(archive, {"java/lang/Object", ArchivedClass}), "archive", "dumps");
+	}
+
+	uint64_t loaded = 0, stale = 0;
+	check(archivedValue(root, archive, &loaded, &stale) == 1 && loaded == 2 && stale == 0,
+		"archive", "loads the archived classes from the archive");
+
+	// same size, so only the later modification time and the contents tell
+	struct stat st;
+	stat(classfile.c_str(), &st);
+	check(writeClass(root, ArchivedClass, generateValue(ArchivedClass, 2)), "archive", "rewrites the classfile");
+	struct timespec times[2] = {st.st_atim, st.st_mtim};
+	times[1].tv_sec += 1;
+	utimensat(AT_FDCWD, classfile.c_str(), times, 0);
+
+	check(archivedValue(root, archive, &loaded, &stale) == 2 && loaded == 1 && stale == 1,
+		"archive", "loads a changed class from its classfile");
+
+	std::string other = std::string(root) + "/other.jsa";
+	std::vector<uint8_t> garbage(4096, 0x5A);
+	writeFile(other, garbage);
+	VMClassLoader loader;
+	check(!loader.mapArchive(other) && !loader.archive(), "archive", "does not map what is no archive");
+
+	nftw(root, &removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void testIndex(const std::vector<uint8_t>& object, const std::vector<uint8_t>& string)
+{
+	char root[] = "/tmp/jvm-loadertest-XXXXXX";
+	if (!mkdtemp(root))
+		return check(false, "index", "creates a scratch directory");
+
+	std::string first = std::string(root) + "/first";
+	std::string second = std::string(root) + "/second";
+	mkdir(first.c_str(), 0755);
+	mkdir(second.c_str(), 0755);
+	check(writeClass(second, "java/lang/Object", object) && writeClass(second, "java/lang/String", string)
+		&& writeClass(first, EarlierClass, generateValue(EarlierClass, 1))
+		&& writeClass(second, LaterClass, generateValue(LaterClass, 2)), "index", "writes the classfiles");
+
+	VMClassLoader loader;
+	loader.addClassPath(first);
+	loader.addClassPath(second);
+	loader.enableClassPathIndex(true);
+	if (!loader.classPathIndex()->isWatching()) {
+		nftw(root, &removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+		return check(true, "index", "skipped, cannot watch");
+	}
+
+	check(writeClass(second, EarlierClass, generateValue(EarlierClass, 2))
+		&& writeClass(first, LaterClass, generateValue(LaterClass, 1)), "index", "creates the classfiles");
+
+	// the index picks up created classfiles on a miss
+	check(!loader.findClass("test/loader/Missing"), "index", "misses");
+	check(valueOf(loader, EarlierClass) == 1, "index", "a class created in a later element does not shadow");
+	check(valueOf(loader, LaterClass) == 1, "index", "a class created in an earlier element shadows");
+
+	nftw(root, &removeEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+// }}}
+
+int main(int argc, char** argv)
+{
+	std::vector<uint8_t> object = generateObject();
+	std::vector<uint8_t> string = generateString();
+
+	VMClassLoader loader;
+	VMClassLoader lazy;
+	lazy.setLazyMethodBodies(true);
+	for (VMClassLoader* l: {&loader, &lazy}) {
+		l->defineClass("java/lang/Object", object.data(), object.size());
+		l->defineClass("java/lang/String", string.data(), string.size());
+	}
+
+	testNul(loader);
+	testUtf8();
+	testCode(loader, lazy);
+	testArchive(object, string);
+	testIndex(object, string);
+
+	printf("%d failures\n", failures);
+	return failures ? 1 : 0;
+}
@@ -2,6 +2,8 @@
 #include "Class.h"
 #include "ConstantPool.h"
 
+#include <string.h>
+
 int main(int argc, const char* argv[])
 {
 	JvmEnv jenv;
@@ -18,15 +20,15 @@ int main(int argc, const char* argv[])
 
 	c->dump();
 
-	Method* method = c->findMethod("main");
+	Method* method = c->findMethod(Symbols::main);
 	int errors = 0;
 	if (!method) {
-		fprintf(stderr, "Could not find method '%s' in %s.\n", "main", c->name().c_str());
+		fprintf(stderr, "Could not find method '%s' in %s.\n", "main", c->name()->c_str());
 		++errors;
 	} else {
 		if (!(method->flags() & MethodFlags::Public)) { printf("main: must be public\n"); ++errors; }
 		if (!(method->flags() & MethodFlags::Static)) { printf("main: must be static\n"); ++errors; }
-		if (method->signature() != "([Ljava/lang/String;)V") { printf("main: invalid signature\n"); ++errors; }
+		if (method->signature() != Symbols::main_signature) { printf("main: invalid signature\n"); ++errors; }
 	}
 	if (!errors) {
 		printf("entry method found\n");